@@ -0,0 +1,480 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Benchmarks `DiopserEngine::process()`, which does everything
+// `DiopserProcessor::processBlock()` does except for talking to the host,
+// over a grid of stage counts, channel counts, block sizes, spread settings,
+// smoothing intervals and automation patterns. The results are written as
+// JSON so runs from before and after a change can be compared. On Linux the
+// hardware performance counters can also be recorded to see whether a
+// scenario is bound by compute, latency, or memory. Run with `--help` for the
+// available options.
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/utsname.h>
+#endif
+
+#include "core/denormals.h"
+#include "core/engine.h"
+#include "json_writer.h"
+#include "perf_counters.h"
+#include "scenario.h"
+#include "statistics.h"
+
+#ifndef DIOPSER_VERSION
+#define DIOPSER_VERSION "unknown"
+#endif
+
+/**
+ * Incremented whenever the structure of the JSON results changes in a way that
+ * would break `diopser_bench_compare`.
+ */
+constexpr int result_schema_version = 1;
+
+struct Options {
+    /**
+     * Only scenarios with this substring in their name are run.
+     */
+    std::string filter;
+    bool full_grid = false;
+    int repetitions = 5;
+    /**
+     * The minimum amount of wall clock time spent processing per repetition.
+     */
+    double min_time_secs = 0.1;
+    double sample_rate = 48000.0;
+    /**
+     * Where the JSON results should be written to. Printed to STDOUT if empty.
+     */
+    std::string output_path;
+    /**
+     * Record hardware performance counters alongside the timings, if they're
+     * available.
+     */
+    bool perf_counters = false;
+};
+
+struct Result {
+    Scenario scenario;
+    /**
+     * The number of samples (per channel) processed across all repetitions.
+     */
+    size_t total_samples = 0;
+    /**
+     * Wall clock time per sample, across all channels.
+     */
+    Statistics ns_per_sample;
+    /**
+     * The number of events per sample across all measured repetitions, for
+     * every event that could be counted.
+     */
+    std::array<std::optional<double>, num_perf_events> events_per_sample;
+};
+
+static void print_usage(const char* program_name) {
+    std::cerr
+        << "Usage: " << program_name << " [options]\n"
+        << "\n"
+        << "Options:\n"
+        << "  --filter <substring>  Only run scenarios whose name contains "
+           "this substring\n"
+        << "  --full-grid           Run every combination of parameters "
+           "instead of one axis\n"
+        << "                        at a time. This takes a long time.\n"
+        << "  --repetitions <n>     Number of measured repetitions per "
+           "scenario (default: 5)\n"
+        << "  --min-time <secs>     Minimum time per repetition (default: "
+           "0.1)\n"
+        << "  --sample-rate <hz>    Sample rate to process at (default: "
+           "48000)\n"
+        << "  --out <file>          Write the JSON results to this file "
+           "instead of STDOUT\n"
+        << "  --perf-counters       Also record hardware performance counters "
+           "(Linux only)\n"
+        << "  --list                Print the scenario names and exit\n";
+}
+
+/**
+ * Process `scenario` until at least `duration_secs` seconds have passed.
+ * Returns the elapsed time in nanoseconds and the number of samples processed.
+ */
+static std::pair<double, size_t> run_for(
+    DiopserEngine& engine,
+    const Scenario& scenario,
+    const Options& options,
+    const std::vector<std::vector<float>>& input,
+    std::vector<std::vector<float>>& buffers,
+    std::vector<float*>& pointers,
+    size_t& block_idx,
+    double duration_secs) {
+    using clock = std::chrono::steady_clock;
+
+    size_t num_samples = 0;
+    const auto start = clock::now();
+    const auto deadline =
+        start + std::chrono::duration_cast<clock::duration>(
+                    std::chrono::duration<double>(duration_secs));
+    do {
+        // This mimics the host handing us a fresh buffer on every block.
+        // Copying a block is negligible compared to the filters.
+        for (size_t channel = 0; channel < scenario.channels; channel++) {
+            std::copy(input[channel].begin(), input[channel].end(),
+                      buffers[channel].begin());
+        }
+
+        engine.process(
+            pointers.data(), scenario.channels, scenario.block_size,
+            scenario.parameters_for_block(block_idx, options.sample_rate));
+
+        block_idx += 1;
+        num_samples += scenario.block_size;
+    } while (clock::now() < deadline);
+
+    const double elapsed_ns =
+        std::chrono::duration<double, std::nano>(clock::now() - start).count();
+
+    return {elapsed_ns, num_samples};
+}
+
+static Result run_scenario(const Scenario& scenario,
+                           const Options& options,
+                           PerfCounters* counters) {
+    DiopserEngine engine;
+    engine.prepare(options.sample_rate, scenario.block_size, scenario.channels,
+                   scenario.stages, scenario.smoothing_interval);
+
+    // White noise with a fixed seed so every run processes the same signal.
+    // The level depends on whether the limiter should be active.
+    std::mt19937 rng(1337);
+    const float amplitude = scenario.input_amplitude();
+    std::uniform_real_distribution<float> distribution(-amplitude, amplitude);
+    std::vector<std::vector<float>> input(
+        scenario.channels, std::vector<float>(scenario.block_size));
+    for (auto& channel : input) {
+        for (auto& sample : channel) {
+            sample = distribution(rng);
+        }
+    }
+
+    std::vector<std::vector<float>> buffers = input;
+    std::vector<float*> pointers;
+    for (auto& channel : buffers) {
+        pointers.push_back(channel.data());
+    }
+
+    // The warmup also makes sure the filters have been initialized
+    size_t block_idx = 0;
+    run_for(engine, scenario, options, input, buffers, pointers, block_idx,
+            options.min_time_secs / 4.0);
+
+    Result result;
+    result.scenario = scenario;
+    std::vector<double> ns_per_sample;
+    std::array<std::optional<double>, num_perf_events> event_totals;
+    for (int repetition = 0; repetition < options.repetitions; repetition++) {
+        if (counters) {
+            counters->start();
+        }
+        const auto [elapsed_ns, num_samples] =
+            run_for(engine, scenario, options, input, buffers, pointers,
+                    block_idx, options.min_time_secs);
+        if (counters) {
+            counters->stop();
+            for (size_t i = 0; i < num_perf_events; i++) {
+                if (const auto count =
+                        counters->read(static_cast<PerfEvent>(i))) {
+                    event_totals[i] = event_totals[i].value_or(0.0) + *count;
+                }
+            }
+        }
+
+        result.total_samples += num_samples;
+        ns_per_sample.push_back(elapsed_ns / static_cast<double>(num_samples));
+    }
+    result.ns_per_sample = Statistics::from(std::move(ns_per_sample));
+
+    for (size_t i = 0; i < num_perf_events; i++) {
+        if (event_totals[i]) {
+            result.events_per_sample[i] =
+                *event_totals[i] / static_cast<double>(result.total_samples);
+        }
+    }
+
+    return result;
+}
+
+/**
+ * Print how much slower every scenario got with the limiter enabled, both
+ * while it's idle and while it's reducing the gain, compared to the same
+ * scenario with the safe mode disabled.
+ */
+static void print_limiter_costs(const std::vector<Result>& results) {
+    std::map<std::string, std::array<std::optional<double>, 3>> timings;
+    for (const auto& result : results) {
+        Scenario scenario = result.scenario;
+        const auto limiter = static_cast<size_t>(scenario.limiter);
+        scenario.limiter = Limiter::idle;
+        timings[scenario.name()][limiter] = result.ns_per_sample.median;
+    }
+
+    for (const auto& [name, timing] : timings) {
+        const auto& off = timing[static_cast<size_t>(Limiter::off)];
+        if (!off) {
+            continue;
+        }
+
+        std::fprintf(stderr, "Limiter cost for %s:", name.c_str());
+        for (const auto limiter : {Limiter::idle, Limiter::active}) {
+            if (const auto& on = timing[static_cast<size_t>(limiter)]) {
+                std::fprintf(stderr, " %s %+.1f%%", limiter_name(limiter),
+                             ((*on - *off) / *off) * 100.0);
+            }
+        }
+        std::fprintf(stderr, "\n");
+    }
+}
+
+/**
+ * The CPU's model name, so results from different machines can be told apart.
+ * This is only available on Linux.
+ */
+static std::string cpu_model() {
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(cpuinfo, line)) {
+        if (line.starts_with("model name")) {
+            const size_t separator = line.find(':');
+            if (separator != std::string::npos &&
+                separator + 2 <= line.size()) {
+                return line.substr(separator + 2);
+            }
+        }
+    }
+
+    return "unknown";
+}
+
+static std::string operating_system() {
+#if defined(__unix__) || defined(__APPLE__)
+    utsname name;
+    if (uname(&name) == 0) {
+        return std::string(name.sysname) + " " + name.release + " " +
+               name.machine;
+    }
+#elif defined(_WIN32)
+    return "Windows";
+#endif
+
+    return "unknown";
+}
+
+static void write_results(std::ostream& stream,
+                          const Options& options,
+                          const std::vector<Result>& results) {
+    char date[32] = "";
+    const std::time_t now = std::time(nullptr);
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+    JsonWriter json(stream);
+    json.begin_object();
+    json.field("schema_version", result_schema_version);
+
+    json.key("context");
+    json.begin_object();
+    json.field("date", date);
+    json.field("version", DIOPSER_VERSION);
+#if defined(__clang__)
+    json.field("compiler", "clang " __clang_version__);
+#elif defined(__GNUC__)
+    json.field("compiler", "gcc " __VERSION__);
+#elif defined(_MSC_VER)
+    json.field("compiler", "msvc " + std::to_string(_MSC_VER));
+#endif
+#ifdef NDEBUG
+    json.field("assertions", false);
+#else
+    json.field("assertions", true);
+#endif
+    json.field("cpu", cpu_model());
+    json.field("cores",
+               static_cast<size_t>(std::thread::hardware_concurrency()));
+    json.field("os", operating_system());
+    json.field("sample_rate", options.sample_rate);
+    json.field("repetitions", options.repetitions);
+    json.field("min_time_secs", options.min_time_secs);
+    json.end_object();
+
+    json.key("benchmarks");
+    json.begin_array();
+    for (const auto& result : results) {
+        const Scenario& scenario = result.scenario;
+
+        json.begin_object();
+        json.field("name", scenario.name());
+        json.field("automation", automation_name(scenario.automation));
+        json.field("stages", scenario.stages);
+        json.field("channels", scenario.channels);
+        json.field("block_size", scenario.block_size);
+        json.field("spread", static_cast<double>(scenario.spread));
+        json.field("spread_linear", scenario.spread_linear);
+        json.field("smoothing_interval", scenario.smoothing_interval);
+        json.field("limiter", limiter_name(scenario.limiter));
+        json.field("total_samples", result.total_samples);
+        json.field("ns_per_sample_median", result.ns_per_sample.median);
+        json.field("ns_per_sample_mad", result.ns_per_sample.mad);
+        json.field("ns_per_sample_min", result.ns_per_sample.min);
+        json.field("ns_per_sample_max", result.ns_per_sample.max);
+        json.field("samples_per_second",
+                   1.0e9 / result.ns_per_sample.median);
+
+        const auto& events = result.events_per_sample;
+        if (std::any_of(events.begin(), events.end(),
+                        [](const auto& count) { return count.has_value(); })) {
+            json.key("counters");
+            json.begin_object();
+            for (size_t i = 0; i < num_perf_events; i++) {
+                if (events[i]) {
+                    json.field(std::string(perf_event_name(
+                                   static_cast<PerfEvent>(i))) +
+                                   "_per_sample",
+                               *events[i]);
+                }
+            }
+
+            const auto& cycles =
+                events[static_cast<size_t>(PerfEvent::cycles)];
+            const auto& instructions =
+                events[static_cast<size_t>(PerfEvent::instructions)];
+            if (cycles && instructions && *cycles > 0.0) {
+                json.field("ipc", *instructions / *cycles);
+            }
+            json.end_object();
+        }
+
+        json.end_object();
+    }
+    json.end_array();
+
+    json.end_object();
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    bool list_only = false;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (arg == "--filter" && has_value) {
+            options.filter = argv[++i];
+        } else if (arg == "--full-grid") {
+            options.full_grid = true;
+        } else if (arg == "--repetitions" && has_value) {
+            options.repetitions = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--min-time" && has_value) {
+            options.min_time_secs = std::atof(argv[++i]);
+        } else if (arg == "--sample-rate" && has_value) {
+            options.sample_rate = std::atof(argv[++i]);
+        } else if (arg == "--out" && has_value) {
+            options.output_path = argv[++i];
+        } else if (arg == "--perf-counters") {
+            options.perf_counters = true;
+        } else if (arg == "--list") {
+            list_only = true;
+        } else {
+            print_usage(argv[0]);
+            return arg == "--help" || arg == "-h" ? 0 : 1;
+        }
+    }
+
+    std::vector<Scenario> scenarios;
+    for (const auto& scenario : build_scenarios(options.full_grid)) {
+        if (scenario.name().find(options.filter) != std::string::npos) {
+            scenarios.push_back(scenario);
+        }
+    }
+
+    if (list_only) {
+        for (const auto& scenario : scenarios) {
+            std::cout << scenario.name() << '\n';
+        }
+
+        return 0;
+    }
+
+    // This is what `juce::ScopedNoDenormals` does in the plugin
+    const ScopedFlushDenormals flush_denormals;
+
+    // The counters only measure the current thread, and everything runs on the
+    // main thread
+    std::optional<PerfCounters> counters;
+    if (options.perf_counters) {
+        counters.emplace();
+        if (!counters->is_available()) {
+            std::cerr << "Hardware performance counters are not available, "
+                         "only recording timings. Check "
+                         "/proc/sys/kernel/perf_event_paranoid or the "
+                         "container's seccomp policy.\n";
+            counters.reset();
+        }
+    }
+
+    std::vector<Result> results;
+    for (size_t i = 0; i < scenarios.size(); i++) {
+        const Result result = run_scenario(scenarios[i], options,
+                                           counters ? &*counters : nullptr);
+        results.push_back(result);
+
+        std::fprintf(stderr, "[%zu/%zu] %-72s %9.2f ns/sample (+- %.2f)",
+                     i + 1, scenarios.size(), scenarios[i].name().c_str(),
+                     result.ns_per_sample.median, result.ns_per_sample.mad);
+        const auto& cycles =
+            result.events_per_sample[static_cast<size_t>(PerfEvent::cycles)];
+        const auto& instructions = result.events_per_sample[static_cast<size_t>(
+            PerfEvent::instructions)];
+        if (cycles && instructions && *cycles > 0.0) {
+            std::fprintf(stderr, "  %.2f IPC", *instructions / *cycles);
+        }
+        std::fprintf(stderr, "\n");
+    }
+
+    print_limiter_costs(results);
+
+    if (options.output_path.empty()) {
+        write_results(std::cout, options, results);
+    } else {
+        std::ofstream file(options.output_path);
+        if (!file) {
+            std::cerr << "Could not open '" << options.output_path
+                      << "' for writing\n";
+            return 1;
+        }
+
+        write_results(file, options, results);
+    }
+
+    return 0;
+}
@@ -0,0 +1,242 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Compares two sets of `diopser_bench` results and fails when any scenario
+// got slower than the configured threshold. A scenario only counts as a
+// regression when the change is both larger than the threshold and clearly
+// larger than the noise in the two measurements, so a single noisy run
+// doesn't fail the comparison. Run with `--help` for the available options.
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "json_reader.h"
+
+/**
+ * The version of the JSON format written by `diopser_bench` that this tool
+ * understands.
+ */
+constexpr double supported_schema_version = 1;
+
+/**
+ * Converts a median absolute deviation to an estimate of the standard
+ * deviation, assuming normally distributed noise.
+ */
+constexpr double mad_to_standard_deviation = 1.4826;
+
+struct Options {
+    std::string baseline_path;
+    std::string current_path;
+    /**
+     * The relative slowdown at which a scenario counts as a regression.
+     */
+    double threshold = 0.05;
+    /**
+     * How many (estimated) standard deviations a change must exceed before it
+     * counts as significant.
+     */
+    double noise_factor = 3.0;
+    bool fail_on_missing = false;
+};
+
+struct Measurement {
+    double median;
+    double mad;
+};
+
+static void print_usage(const char* program_name) {
+    std::cerr << "Usage: " << program_name
+              << " [options] <baseline.json> <current.json>\n"
+              << "\n"
+              << "Options:\n"
+              << "  --threshold <fraction>  Relative slowdown that counts as a "
+                 "regression (default: 0.05)\n"
+              << "  --noise-factor <n>      Minimum change in standard "
+                 "deviations (default: 3)\n"
+              << "  --fail-on-missing       Also fail when a baseline scenario "
+                 "is missing\n"
+              << "\n"
+              << "Exits with 1 when a regression was found, and with 2 on "
+                 "errors.\n";
+}
+
+static JsonValue read_results(const std::string& path) {
+    std::ifstream file(path);
+    if (!file) {
+        throw std::runtime_error("Could not open '" + path + "'");
+    }
+
+    std::stringstream contents;
+    contents << file.rdbuf();
+    JsonValue results = parse_json(contents.str());
+    if (results["schema_version"].as_number() != supported_schema_version) {
+        throw std::runtime_error("'" + path +
+                                 "' was not written by a compatible version "
+                                 "of diopser_bench");
+    }
+
+    return results;
+}
+
+/**
+ * Index the benchmarks by their scenario names.
+ */
+static std::map<std::string, Measurement> index_measurements(
+    const JsonValue& results) {
+    std::map<std::string, Measurement> measurements;
+    if (const auto* benchmarks = results["benchmarks"].as_array()) {
+        for (const auto& benchmark : *benchmarks) {
+            const auto name = benchmark["name"].as_string();
+            const auto median = benchmark["ns_per_sample_median"].as_number();
+            const auto mad = benchmark["ns_per_sample_mad"].as_number();
+            if (name && median && mad) {
+                measurements.emplace(std::string(*name),
+                                     Measurement{*median, *mad});
+            }
+        }
+    }
+
+    return measurements;
+}
+
+/**
+ * Print a warning when the two runs were done under different conditions,
+ * since the comparison won't mean much then.
+ */
+static void compare_contexts(const JsonValue& baseline,
+                             const JsonValue& current) {
+    for (const char* key :
+         {"cpu", "cores", "compiler", "assertions", "sample_rate"}) {
+        const JsonValue& baseline_value = baseline["context"][key];
+        const JsonValue& current_value = current["context"][key];
+        if (baseline_value.as_string() != current_value.as_string() ||
+            baseline_value.as_number() != current_value.as_number() ||
+            baseline_value.as_bool() != current_value.as_bool()) {
+            std::cerr << "Warning: the '" << key
+                      << "' differs between the baseline and the current "
+                         "results\n";
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (arg == "--threshold" && has_value) {
+            options.threshold = std::atof(argv[++i]);
+        } else if (arg == "--noise-factor" && has_value) {
+            options.noise_factor = std::atof(argv[++i]);
+        } else if (arg == "--fail-on-missing") {
+            options.fail_on_missing = true;
+        } else if (arg == "--help" || arg == "-h") {
+            print_usage(argv[0]);
+            return 0;
+        } else if (!arg.starts_with("--")) {
+            paths.push_back(arg);
+        } else {
+            print_usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (paths.size() != 2) {
+        print_usage(argv[0]);
+        return 2;
+    }
+    options.baseline_path = paths[0];
+    options.current_path = paths[1];
+
+    JsonValue baseline;
+    JsonValue current;
+    try {
+        baseline = read_results(options.baseline_path);
+        current = read_results(options.current_path);
+    } catch (const std::exception& error) {
+        std::cerr << "Error: " << error.what() << '\n';
+        return 2;
+    }
+
+    compare_contexts(baseline, current);
+    const auto baseline_measurements = index_measurements(baseline);
+    const auto current_measurements = index_measurements(current);
+
+    size_t num_regressions = 0;
+    size_t num_improvements = 0;
+    size_t num_missing = 0;
+    std::printf("%-72s %12s %12s %9s\n", "scenario", "baseline", "current",
+                "change");
+    for (const auto& [name, before] : baseline_measurements) {
+        const auto after_it = current_measurements.find(name);
+        if (after_it == current_measurements.end()) {
+            std::printf("%-72s %12.2f %12s %9s  MISSING\n", name.c_str(),
+                        before.median, "-", "-");
+            num_missing += 1;
+            continue;
+        }
+
+        const Measurement& after = after_it->second;
+        const double difference = after.median - before.median;
+        const double relative_change = difference / before.median;
+        const double noise =
+            mad_to_standard_deviation *
+            std::sqrt((before.mad * before.mad) + (after.mad * after.mad));
+        const bool is_significant =
+            std::abs(difference) > options.noise_factor * noise;
+
+        const char* verdict = "";
+        if (is_significant && relative_change > options.threshold) {
+            verdict = "  REGRESSION";
+            num_regressions += 1;
+        } else if (is_significant && relative_change < -options.threshold) {
+            verdict = "  improvement";
+            num_improvements += 1;
+        } else if (std::abs(relative_change) > options.threshold) {
+            verdict = "  (within noise)";
+        }
+
+        std::printf("%-72s %12.2f %12.2f %+8.1f%%%s\n", name.c_str(),
+                    before.median, after.median, relative_change * 100.0,
+                    verdict);
+    }
+
+    for (const auto& [name, after] : current_measurements) {
+        if (!baseline_measurements.contains(name)) {
+            std::printf("%-72s %12s %12.2f %9s  NEW\n", name.c_str(), "-",
+                        after.median, "-");
+        }
+    }
+
+    std::printf(
+        "\n%zu regression(s), %zu improvement(s), %zu missing scenario(s) "
+        "(threshold %.1f%%, times in ns/sample)\n",
+        num_regressions, num_improvements, num_missing,
+        options.threshold * 100.0);
+
+    const bool failed =
+        num_regressions > 0 || (options.fail_on_missing && num_missing > 0);
+    return failed ? 1 : 0;
+}
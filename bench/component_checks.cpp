@@ -0,0 +1,938 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "component_checks.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <numbers>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "core/all_pass_filter.h"
+#include "core/coefficients.h"
+#include "core/engine.h"
+#include "core/group_delay_designer.h"
+#include "core/phase_rotator.h"
+#include "core/reblocker.h"
+#include "core/response.h"
+
+namespace {
+
+constexpr double sample_rate = 48000.0;
+
+/**
+ * A cascade with stages spread over the spectrum. The group delay designer
+ * should be able to find this cascade again from its group delay curve, and
+ * the design mode uses it with an extra stage above the Nyquist frequency.
+ */
+const std::vector<DesignedStage> known_design = {{80.0f, 0.7f},
+                                                 {250.0f, 1.5f},
+                                                 {700.0f, 0.5f},
+                                                 {2000.0f, 2.0f},
+                                                 {5000.0f, 3.0f}};
+
+using Channels = std::vector<std::vector<float>>;
+
+Channels white_noise(size_t num_channels, size_t length, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> noise(-0.5f, 0.5f);
+
+    Channels channels(num_channels, std::vector<float>(length));
+    for (auto& channel : channels) {
+        for (float& sample : channel) {
+            sample = noise(rng);
+        }
+    }
+
+    return channels;
+}
+
+std::vector<float*> channel_pointers(Channels& channels, size_t offset) {
+    std::vector<float*> pointers;
+    for (auto& channel : channels) {
+        pointers.push_back(channel.data() + offset);
+    }
+
+    return pointers;
+}
+
+/**
+ * The index of the first sample where `expected` and `actual` differ, if any.
+ */
+std::optional<std::pair<size_t, size_t>> first_mismatch(
+    const Channels& expected,
+    const Channels& actual) {
+    for (size_t channel = 0; channel < expected.size(); channel++) {
+        for (size_t sample_idx = 0; sample_idx < expected[channel].size();
+             sample_idx++) {
+            if (std::bit_cast<uint32_t>(expected[channel][sample_idx]) !=
+                std::bit_cast<uint32_t>(actual[channel][sample_idx])) {
+                return std::pair(channel, sample_idx);
+            }
+        }
+    }
+
+    return std::nullopt;
+}
+
+template <typename... Args>
+std::string format(const char* format_string, Args... args) {
+    char buffer[256];
+    std::snprintf(buffer, sizeof(buffer), format_string, args...);
+    return buffer;
+}
+
+/**
+ * Runs noise through a `Reblocker` using irregular host blocks, including
+ * empty blocks, single samples and blocks larger than the block size, while
+ * the block size keeps changing. The output is then compared bit for bit
+ * against what `process_block` produces when it's called directly with the
+ * same fixed-size blocks, delayed by exactly the block size. After every
+ * block size change the output must start with a block of silence, and the
+ * partially collected block from before the change gets dropped.
+ *
+ * @param make_process_block Returns a fresh function that processes a
+ *   block in place. The re-blocked and the direct path each get their own
+ *   instance. This lets the check run both with an engine and with the empty
+ *   callback the plugin uses for delay compensation while it's bypassed.
+ */
+template <typename F>
+CheckResult check_reblocker(F make_process_block) {
+    constexpr size_t num_channels = 2;
+    constexpr size_t length = 192000;
+    constexpr size_t block_sizes[] = {0, 1, 7, 64, 256, 1000, 4096};
+
+    const Channels input = white_noise(num_channels, length, 7331);
+
+    struct Segment {
+        size_t start;
+        size_t block_size;
+    };
+    struct HostBlock {
+        size_t segment_idx;
+        size_t start;
+        size_t num_samples;
+    };
+    std::vector<Segment> segments{{.start = 0, .block_size = 64}};
+    std::vector<HostBlock> host_blocks;
+
+    Reblocker reblocker;
+    reblocker.set_block_size(segments.back().block_size);
+    reblocker.prepare(num_channels);
+
+    auto process_block = make_process_block();
+    Channels actual = input;
+    std::mt19937 rng(1337);
+    const auto chance = [&](double probability) {
+        return std::uniform_real_distribution<double>(0.0, 1.0)(rng) <
+               probability;
+    };
+    for (size_t position = 0; position < length;) {
+        if (chance(0.08)) {
+            const size_t block_size =
+                block_sizes[std::uniform_int_distribution<size_t>(
+                    0, std::size(block_sizes) - 1)(rng)];
+            reblocker.set_block_size(block_size);
+            if (block_size != segments.back().block_size) {
+                segments.push_back(
+                    {.start = position, .block_size = block_size});
+            }
+        }
+
+        const size_t block_size =
+            std::max<size_t>(segments.back().block_size, 1);
+        size_t num_samples = 0;
+        if (chance(0.15)) {
+            num_samples = 0;
+        } else if (chance(0.15)) {
+            num_samples = 1;
+        } else if (chance(0.5)) {
+            num_samples =
+                std::uniform_int_distribution<size_t>(2, (block_size * 2) + 1)(
+                    rng);
+        } else {
+            num_samples = std::uniform_int_distribution<size_t>(2, 2048)(rng);
+        }
+        num_samples = std::min(num_samples, length - position);
+
+        if (reblocker.latency() != segments.back().block_size) {
+            return {.passed = false,
+                    .details = format("latency() returned %zu instead of %zu",
+                                      reblocker.latency(),
+                                      segments.back().block_size)};
+        }
+
+        host_blocks.push_back({.segment_idx = segments.size() - 1,
+                               .start = position,
+                               .num_samples = num_samples});
+        reblocker.process(channel_pointers(actual, position).data(),
+                          num_channels, num_samples, process_block);
+        position += num_samples;
+    }
+
+    // Without re-blocking the host's blocks are processed as is, and with
+    // re-blocking every full block collected before the next block size
+    // change gets processed, even if only part of its output was emitted
+    auto direct_process_block = make_process_block();
+    Channels expected(num_channels, std::vector<float>(length, 0.0f));
+    for (size_t segment_idx = 0; segment_idx < segments.size();
+         segment_idx++) {
+        const auto [start, block_size] = segments[segment_idx];
+        const size_t end = segment_idx + 1 < segments.size()
+                               ? segments[segment_idx + 1].start
+                               : length;
+
+        if (block_size == 0) {
+            for (const auto& host_block : host_blocks) {
+                if (host_block.segment_idx != segment_idx) {
+                    continue;
+                }
+
+                Channels block(num_channels);
+                for (size_t channel = 0; channel < num_channels; channel++) {
+                    const auto begin =
+                        input[channel].begin() +
+                        static_cast<ptrdiff_t>(host_block.start);
+                    block[channel].assign(
+                        begin, begin + static_cast<ptrdiff_t>(
+                                           host_block.num_samples));
+                }
+
+                direct_process_block(channel_pointers(block, 0).data(),
+                                     num_channels, host_block.num_samples);
+                for (size_t channel = 0; channel < num_channels; channel++) {
+                    std::copy(block[channel].begin(), block[channel].end(),
+                              expected[channel].begin() +
+                                  static_cast<ptrdiff_t>(host_block.start));
+                }
+            }
+
+            continue;
+        }
+
+        for (size_t block_start = start; block_start + block_size <= end;
+             block_start += block_size) {
+            Channels block(num_channels);
+            for (size_t channel = 0; channel < num_channels; channel++) {
+                const auto begin = input[channel].begin() +
+                                   static_cast<ptrdiff_t>(block_start);
+                block[channel].assign(
+                    begin, begin + static_cast<ptrdiff_t>(block_size));
+            }
+
+            direct_process_block(channel_pointers(block, 0).data(),
+                                 num_channels, block_size);
+            const size_t output_start = block_start + block_size;
+            const size_t output_length =
+                std::min(block_size, end - std::min(end, output_start));
+            for (size_t channel = 0; channel < num_channels; channel++) {
+                std::copy_n(block[channel].begin(), output_length,
+                            expected[channel].begin() +
+                                static_cast<ptrdiff_t>(output_start));
+            }
+        }
+    }
+
+    if (const auto mismatch = first_mismatch(expected, actual)) {
+        return {.passed = false,
+                .details = format("first mismatch at channel %zu, sample %zu",
+                                  mismatch->first, mismatch->second)};
+    }
+
+    return {.details = format("%zu block size changes, %zu host blocks",
+                              segments.size() - 1, host_blocks.size())};
+}
+
+CheckResult check_reblocker_engine() {
+    return check_reblocker([]() {
+        DiopserEngine::Parameters parameters{
+            .frequency = 500.0f, .resonance = 1.5f, .spread = 200.0f};
+        auto engine = std::make_shared<DiopserEngine>();
+        engine->prepare(sample_rate, Reblocker::max_block_size, 2, 32,
+                        parameters.smoothing_interval);
+
+        return [engine, parameters](float* const* samples, size_t num_channels,
+                                    size_t num_samples) {
+            engine->process(samples, num_channels, num_samples, parameters);
+        };
+    });
+}
+
+CheckResult check_reblocker_bypassed() {
+    return check_reblocker([]() {
+        return [](float* const*, size_t, size_t) {};
+    });
+}
+
+/**
+ * Runs noise through one `PhaseRotator` using the SSE2 path and one using the
+ * scalar path, with odd host block sizes so pairs get split across blocks and
+ * with the angle jumping around and being smoothed. Both the planar and the
+ * interleaved layouts must produce the same output bit for bit.
+ */
+CheckResult check_rotator_simd() {
+    if (!PhaseRotator::simd_available()) {
+        return {.details = "the SSE2 path is not available"};
+    }
+
+    constexpr size_t num_channels = 3;
+    constexpr size_t length = 48000;
+
+    for (const bool interleaved : {false, true}) {
+        const Channels input = white_noise(num_channels, length, 4242);
+
+        Channels outputs[2] = {input, input};
+        std::vector<float> interleaved_outputs[2];
+        for (auto& output : interleaved_outputs) {
+            output.resize(num_channels * length);
+            for (size_t channel = 0; channel < num_channels; channel++) {
+                for (size_t i = 0; i < length; i++) {
+                    output[(i * num_channels) + channel] = input[channel][i];
+                }
+            }
+        }
+
+        PhaseRotator rotators[2];
+        for (auto& rotator : rotators) {
+            rotator.prepare(sample_rate, num_channels);
+        }
+        rotators[1].set_simd_enabled(false);
+
+        std::mt19937 rng(99);
+        float angle = 0.0f;
+        for (size_t position = 0; position < length;) {
+            if (rng() % 8 == 0) {
+                angle = std::uniform_real_distribution<float>(-180.0f,
+                                                              180.0f)(rng);
+            }
+
+            const size_t num_samples =
+                std::min<size_t>(rng() % 200, length - position);
+            for (size_t path = 0; path < 2; path++) {
+                if (interleaved) {
+                    rotators[path].process(
+                        InterleavedSamples{
+                            interleaved_outputs[path].data() +
+                                (position * num_channels),
+                            num_channels},
+                        num_channels, num_samples, angle);
+                } else {
+                    rotators[path].process(
+                        PlanarSamples{
+                            channel_pointers(outputs[path], position).data()},
+                        num_channels, num_samples, angle);
+                }
+            }
+
+            position += num_samples;
+        }
+
+        if (interleaved) {
+            for (size_t path = 0; path < 2; path++) {
+                for (size_t channel = 0; channel < num_channels; channel++) {
+                    for (size_t i = 0; i < length; i++) {
+                        outputs[path][channel][i] =
+                            interleaved_outputs[path]
+                                               [(i * num_channels) + channel];
+                    }
+                }
+            }
+        }
+
+        if (const auto mismatch = first_mismatch(outputs[1], outputs[0])) {
+            return {.passed = false,
+                    .details = format(
+                        "%s: first mismatch at channel %zu, sample %zu",
+                        interleaved ? "interleaved" : "planar",
+                        mismatch->first, mismatch->second)};
+        }
+    }
+
+    return {.details = "planar and interleaved"};
+}
+
+/**
+ * Rotating a sine by an angle and by that angle plus 90 degrees must produce
+ * two signals with the same level that are 90 degrees apart, at every
+ * frequency between `PhaseRotator::min_frequency` and the top of the audible
+ * range. Every frequency is a whole number of cycles per second, so measuring
+ * over exactly one second doesn't add any leakage.
+ */
+CheckResult check_rotator_quadrature() {
+    constexpr double sample_rates[] = {44100.0, 48000.0, 96000.0};
+    constexpr double frequencies[] = {30.0,   100.0,   440.0,  1000.0,
+                                      5000.0, 12000.0, 20000.0};
+    constexpr float angles[] = {-135.0f, 0.0f, 45.0f, 100.0f};
+    /**
+     * The networks need some time to settle at the lowest frequencies, and
+     * the angle is smoothed at the start.
+     */
+    constexpr double settle_secs = 0.5;
+    /**
+     * About a tenth of a degree, and a hundredth of a decibel.
+     */
+    constexpr double max_correlation = 0.002;
+    constexpr double max_level_difference_db = 0.01;
+
+    double worst_correlation = 0.0;
+    double worst_level_difference_db = 0.0;
+    for (const double rate : sample_rates) {
+        const auto settle_samples = static_cast<size_t>(rate * settle_secs);
+        const auto measured_samples = static_cast<size_t>(rate);
+        const size_t length = settle_samples + measured_samples;
+
+        for (const double frequency : frequencies) {
+            Channels sine(1, std::vector<float>(length));
+            for (size_t i = 0; i < length; i++) {
+                sine[0][i] = static_cast<float>(
+                    0.5 * std::sin(2.0 * std::numbers::pi * frequency *
+                                   static_cast<double>(i) / rate));
+            }
+
+            for (const float angle : angles) {
+                Channels outputs[2] = {sine, sine};
+                for (size_t quadrant = 0; quadrant < 2; quadrant++) {
+                    PhaseRotator rotator;
+                    rotator.prepare(rate, 1);
+                    for (size_t position = 0; position < length;
+                         position += 512) {
+                        rotator.process(
+                            PlanarSamples{channel_pointers(outputs[quadrant],
+                                                           position)
+                                              .data()},
+                            1, std::min<size_t>(512, length - position),
+                            angle + (90.0f * static_cast<float>(quadrant)));
+                    }
+                }
+
+                double energies[2] = {0.0, 0.0};
+                double cross = 0.0;
+                for (size_t i = settle_samples; i < length; i++) {
+                    const double a = outputs[0][0][i];
+                    const double b = outputs[1][0][i];
+                    energies[0] += a * a;
+                    energies[1] += b * b;
+                    cross += a * b;
+                }
+
+                const double correlation =
+                    std::abs(cross) / std::sqrt(energies[0] * energies[1]);
+                const double level_difference_db =
+                    std::abs(10.0 * std::log10(energies[0] / energies[1]));
+                worst_correlation = std::max(worst_correlation, correlation);
+                worst_level_difference_db =
+                    std::max(worst_level_difference_db, level_difference_db);
+                if (!(correlation <= max_correlation &&
+                      level_difference_db <= max_level_difference_db)) {
+                    return {.passed = false,
+                            .details = format(
+                                "%.0f Hz at %.0f Hz and %.0f degrees: "
+                                "correlation %.3g, level difference %.3g dB",
+                                frequency, rate, static_cast<double>(angle),
+                                correlation, level_difference_db)};
+                }
+            }
+        }
+    }
+
+    return {.details = format(
+                "worst correlation %.3g, worst level difference %.3g dB",
+                worst_correlation, worst_level_difference_db)};
+}
+
+/**
+ * A call to `fade_to_num_stages()` at a specific point in a `StageFadeRun`.
+ */
+struct FadeRequest {
+    size_t sample_idx;
+    size_t num_stages;
+};
+
+/**
+ * The output of an engine that got the fade requests, and the output of an
+ * engine that got the same stage changes through `set_num_stages()` at the
+ * exact blocks where the first engine swapped in its new filters.
+ */
+struct StageFadeRun {
+    Channels faded;
+    Channels unfaded;
+    /**
+     * The first sample of every block that swapped in new filters, and the
+     * number of stages it swapped in.
+     */
+    std::vector<std::pair<size_t, size_t>> swaps;
+    /**
+     * Where the requests were actually made, at the start of the first block
+     * at or after the requested sample.
+     */
+    std::vector<size_t> requests;
+    size_t final_num_stages = 0;
+};
+
+StageFadeRun run_stage_fades(const std::vector<FadeRequest>& requests,
+                             size_t length) {
+    constexpr size_t num_channels = 2;
+    constexpr size_t initial_stages = 16;
+    constexpr size_t max_host_block_size = 128;
+    // The limiter is disabled so the fade is the only thing changing the gain
+    const DiopserEngine::Parameters parameters{
+        .frequency = 1000.0f, .smoothing_interval = 1, .safe_mode = false};
+
+    Channels input(num_channels, std::vector<float>(length));
+    for (auto& channel : input) {
+        for (size_t i = 0; i < length; i++) {
+            channel[i] = static_cast<float>(
+                0.5 * std::sin(2.0 * std::numbers::pi * 440.0 *
+                               static_cast<double>(i) / sample_rate));
+        }
+    }
+
+    StageFadeRun run;
+    run.faded = input;
+    run.unfaded = input;
+    for (const bool faded : {true, false}) {
+        Channels& output = faded ? run.faded : run.unfaded;
+
+        DiopserEngine engine;
+        engine.prepare(sample_rate, max_host_block_size, num_channels,
+                       initial_stages, parameters.smoothing_interval);
+
+        std::mt19937 rng(512);
+        size_t next_request = 0;
+        size_t next_swap = 0;
+        size_t last_num_stages = initial_stages;
+        for (size_t position = 0; position < length;) {
+            if (faded) {
+                for (; next_request < requests.size() &&
+                       requests[next_request].sample_idx <= position;
+                     next_request++) {
+                    engine.fade_to_num_stages(
+                        requests[next_request].num_stages);
+                    run.requests.push_back(position);
+                }
+            } else if (next_swap < run.swaps.size() &&
+                       run.swaps[next_swap].first == position) {
+                // A zero length block can also swap in the new filters, and
+                // the next block then starts at the same position
+                engine.set_num_stages(run.swaps[next_swap].second);
+                next_swap += 1;
+            }
+
+            const size_t num_samples = std::min<size_t>(
+                rng() % (max_host_block_size + 1), length - position);
+            engine.process(channel_pointers(output, position).data(),
+                           num_channels, num_samples, parameters);
+
+            if (faded && engine.num_stages() != last_num_stages) {
+                last_num_stages = engine.num_stages();
+                run.swaps.emplace_back(position, last_num_stages);
+            }
+            position += num_samples;
+        }
+
+        if (faded) {
+            run.final_num_stages = engine.num_stages();
+        }
+    }
+
+    return run;
+}
+
+/**
+ * Requests stage fades while processing a sine with the limiter disabled.
+ * Dividing the output by that of an engine without fades gives the fade's
+ * gain, which must change gradually, reach zero before every swap, and reach
+ * unity again within two fade times of the last request. Apart from the
+ * fades both outputs must be identical.
+ */
+CheckResult check_stage_fades() {
+    // The fade time documented for `DiopserEngine::fade_to_num_stages()`
+    constexpr double stage_fade_secs = 0.01;
+    constexpr auto fade_samples =
+        static_cast<size_t>(stage_fade_secs * sample_rate);
+    constexpr size_t length = 24000;
+    constexpr size_t request_idx = 9600;
+    /**
+     * The gain can only be recovered for samples that aren't too close to
+     * zero.
+     */
+    constexpr float min_recoverable_level = 0.05f;
+    const float max_gain_step = 1.0f / static_cast<float>(fade_samples);
+
+    const struct {
+        const char* name;
+        std::vector<FadeRequest> requests;
+        size_t expected_swaps;
+    } scenarios[] = {
+        {"single fade", {{request_idx, 128}}, 1},
+        {"second request while fading out",
+         {{request_idx, 128}, {request_idx + (fade_samples / 2), 64}},
+         1},
+        {"second request while fading in",
+         {{request_idx, 128},
+          {request_idx + fade_samples + (fade_samples / 2), 32}},
+         2},
+    };
+
+    size_t longest_fade = 0;
+    for (const auto& scenario : scenarios) {
+        const StageFadeRun run = run_stage_fades(scenario.requests, length);
+        const auto fail = [&](const std::string& details) {
+            return CheckResult{
+                .passed = false,
+                .details = std::string(scenario.name) + ": " + details};
+        };
+
+        if (run.swaps.size() != scenario.expected_swaps) {
+            return fail(format("expected %zu swaps, found %zu",
+                               scenario.expected_swaps, run.swaps.size()));
+        }
+        if (run.final_num_stages != scenario.requests.back().num_stages) {
+            return fail(format("ended up with %zu stages instead of %zu",
+                               run.final_num_stages,
+                               scenario.requests.back().num_stages));
+        }
+
+        // The old filters must keep playing until they've faded out
+        // completely, which takes a fade time plus at most one block for the
+        // swap to happen
+        for (const auto& [swap, num_stages] : run.swaps) {
+            for (const auto& channel : run.faded) {
+                if (channel[swap - 1] != 0.0f) {
+                    return fail(format(
+                        "the output was not silent before swapping to %zu "
+                        "stages at sample %zu",
+                        num_stages, swap));
+                }
+            }
+        }
+        const size_t first_swap = run.swaps.front().first;
+        if (first_swap < run.requests.front() + fade_samples ||
+            first_swap > run.requests.front() + fade_samples + 128) {
+            return fail(format("faded out in %zu samples instead of %zu",
+                               first_swap - run.requests.front(),
+                               fade_samples));
+        }
+
+        size_t full_gain_since = 0;
+        for (size_t channel = 0; channel < run.faded.size(); channel++) {
+            float last_gain = 1.0f;
+            size_t last_gain_idx = 0;
+            for (size_t i = 0; i < length; i++) {
+                const float faded = run.faded[channel][i];
+                const float unfaded = run.unfaded[channel][i];
+                if (faded != unfaded) {
+                    full_gain_since = std::max(full_gain_since, i + 1);
+                }
+                if (std::abs(unfaded) < min_recoverable_level) {
+                    continue;
+                }
+
+                const float gain = faded / unfaded;
+                const float max_change =
+                    (max_gain_step * static_cast<float>(i - last_gain_idx)) +
+                    1e-5f;
+                if (gain < -1e-5f || gain > 1.0f + 1e-5f ||
+                    std::abs(gain - last_gain) > max_change) {
+                    return fail(format(
+                        "the gain jumped from %.4f to %.4f at channel %zu, "
+                        "sample %zu",
+                        static_cast<double>(last_gain),
+                        static_cast<double>(gain), channel, i));
+                }
+
+                last_gain = gain;
+                last_gain_idx = i;
+            }
+        }
+
+        // Faded outputs are never bit-identical to the unfaded ones, so this
+        // is where the last fade in finished
+        if (full_gain_since > run.requests.back() + (2 * fade_samples) + 128) {
+            return fail(format(
+                "the output took %zu samples to return to full level after "
+                "the last request",
+                full_gain_since - run.requests.back()));
+        }
+        longest_fade =
+            std::max(longest_fade, full_gain_since - run.requests.front());
+    }
+
+    return {.details = format("longest fade took %.1f ms",
+                              1000.0 * static_cast<double>(longest_fade) /
+                                  sample_rate)};
+}
+
+/**
+ * Processes noise in design mode using every kernel and odd block sizes, and
+ * compares the output bit for bit against running the designed stages one
+ * filter at a time. Halfway through the engine's state is restored into an
+ * engine prepared with a different number of stages, which must continue
+ * where the first one left off.
+ */
+CheckResult check_design_mode() {
+    constexpr size_t num_channels = 2;
+    constexpr size_t length = 24000;
+    constexpr size_t max_host_block_size = 512;
+    constexpr size_t checkpoint_idx = length / 2;
+
+    std::vector<DesignedStage> design = known_design;
+    design.push_back({.frequency = 30000.0f, .resonance = 1.0f});
+    // The filter parameters are ignored in design mode, and the limiter is
+    // disabled so the cascade is the only thing affecting the output
+    const DiopserEngine::Parameters parameters{.frequency = 3000.0f,
+                                               .spread = 200.0f,
+                                               .safe_mode = false,
+                                               .design_mode = true};
+
+    const Channels input = white_noise(num_channels, length, 2323);
+    Channels expected = input;
+    std::vector<AllPassCoefficients> coefficients;
+    for (const auto& stage : design) {
+        coefficients.push_back(make_all_pass(
+            sample_rate, clamp_filter_frequency(sample_rate, stage.frequency),
+            stage.resonance));
+    }
+    for (auto& channel : expected) {
+        std::vector<AllPassFilter> filters(design.size());
+        for (float& sample : channel) {
+            for (size_t stage = 0; stage < design.size(); stage++) {
+                sample = filters[stage].process_sample(sample,
+                                                       coefficients[stage]);
+            }
+        }
+    }
+
+    for (const auto kernel : {DiopserEngine::Kernel::automatic,
+                              DiopserEngine::Kernel::sample_major,
+                              DiopserEngine::Kernel::pipelined}) {
+        DiopserEngine engines[2];
+        engines[0].prepare(sample_rate, max_host_block_size, num_channels, 16,
+                           parameters.smoothing_interval);
+        engines[1].prepare(sample_rate, max_host_block_size, num_channels, 64,
+                           parameters.smoothing_interval);
+        for (auto& engine : engines) {
+            engine.set_kernel(kernel);
+        }
+        engines[0].set_design(design);
+
+        Channels actual = input;
+        std::mt19937 rng(23);
+        DiopserEngine* engine = &engines[0];
+        for (size_t position = 0; position < length;) {
+            if (engine == &engines[0] && position >= checkpoint_idx) {
+                DiopserEngine::State state;
+                engines[0].save_state(state);
+                if (!engines[1].restore_state(state)) {
+                    return {.passed = false,
+                            .details = "the state could not be restored"};
+                }
+                engine = &engines[1];
+            }
+
+            const size_t num_samples = std::min<size_t>(
+                rng() % (max_host_block_size + 1), length - position);
+            engine->process(channel_pointers(actual, position).data(),
+                            num_channels, num_samples, parameters);
+            position += num_samples;
+        }
+
+        if (const auto mismatch = first_mismatch(expected, actual)) {
+            return {.passed = false,
+                    .details = format(
+                        "kernel %d: first mismatch at channel %zu, sample %zu",
+                        static_cast<int>(kernel), mismatch->first,
+                        mismatch->second)};
+        }
+    }
+
+    return {.details = "all kernels"};
+}
+
+/**
+ * Design settings whose target is the group delay of `known_design`. The
+ * tolerance is tight enough that no smaller cascade meets it.
+ */
+GroupDelayDesigner::Settings known_design_settings() {
+    constexpr size_t num_points = 96;
+
+    AllPassResponseEvaluator evaluator;
+    evaluator.prepare(sample_rate, num_points, 20.0f, 20000.0f);
+    std::vector<AllPassStage> stages;
+    for (const auto& stage : known_design) {
+        const AllPassCoefficients coefficients = make_all_pass(
+            sample_rate, clamp_filter_frequency(sample_rate, stage.frequency),
+            stage.resonance);
+        stages.push_back({.a1 = coefficients.b1, .a2 = coefficients.b0});
+    }
+
+    std::vector<float> phase(num_points);
+    std::vector<float> group_delay(num_points);
+    evaluator.evaluate(stages, phase.data(), group_delay.data());
+
+    GroupDelayDesigner::Settings settings;
+    settings.sample_rate = sample_rate;
+    float peak_ms = 0.0f;
+    for (size_t i = 0; i < num_points; i++) {
+        const auto group_delay_ms = static_cast<float>(
+            group_delay[i] * 1000.0 / sample_rate);
+        settings.target.push_back({.frequency = evaluator.frequencies()[i],
+                                   .group_delay_ms = group_delay_ms});
+        peak_ms = std::max(peak_ms, group_delay_ms);
+    }
+    settings.tolerance_ms = peak_ms * 0.005f;
+
+    return settings;
+}
+
+/**
+ * The designer must meet the tolerance for a target that a known cascade
+ * meets exactly, using as many stages as that cascade.
+ */
+CheckResult check_designer_known_cascade() {
+    const GroupDelayDesigner::Settings settings = known_design_settings();
+    const std::atomic_bool cancelled = false;
+    const GroupDelayDesigner::Result result =
+        GroupDelayDesigner::design(settings, cancelled);
+
+    const std::string summary =
+        format("%zu stages with an error of %.3g ms", result.stages.size(),
+               static_cast<double>(result.error_ms));
+    if (!result.within_tolerance ||
+        result.error_ms > settings.tolerance_ms ||
+        result.stages.size() != known_design.size()) {
+        return {.passed = false,
+                .details = format("expected %zu stages within %.3g ms, found ",
+                                  known_design.size(),
+                                  static_cast<double>(settings.tolerance_ms)) +
+                           summary};
+    }
+
+    return {.details = summary};
+}
+
+/**
+ * The search's candidates don't depend on the number of worker threads, so a
+ * design must come out exactly the same with one thread and with several.
+ */
+CheckResult check_designer_threads() {
+    GroupDelayDesigner::Settings settings = known_design_settings();
+    const std::atomic_bool cancelled = false;
+
+    settings.num_threads = 1;
+    const GroupDelayDesigner::Result single_threaded =
+        GroupDelayDesigner::design(settings, cancelled);
+    settings.num_threads = 4;
+    const GroupDelayDesigner::Result multi_threaded =
+        GroupDelayDesigner::design(settings, cancelled);
+
+    if (single_threaded.stages != multi_threaded.stages ||
+        std::bit_cast<uint32_t>(single_threaded.error_ms) !=
+            std::bit_cast<uint32_t>(multi_threaded.error_ms)) {
+        return {.passed = false,
+                .details = format(
+                    "1 thread found %zu stages with an error of %.6g ms, 4 "
+                    "threads found %zu stages with an error of %.6g ms",
+                    single_threaded.stages.size(),
+                    static_cast<double>(single_threaded.error_ms),
+                    multi_threaded.stages.size(),
+                    static_cast<double>(multi_threaded.error_ms))};
+    }
+
+    return {.details = "1 and 4 threads"};
+}
+
+/**
+ * Cancelling a design that can never meet its tolerance must stop it
+ * promptly, both when it runs on the calling thread and when it was started
+ * in the background. A cancelled background design must not report a result.
+ */
+CheckResult check_designer_cancel() {
+    using clock_type = std::chrono::steady_clock;
+    /**
+     * Cancelling usually takes a couple of milliseconds. This leaves plenty
+     * of room for a busy machine.
+     */
+    constexpr auto max_cancel_time = std::chrono::milliseconds(100);
+    constexpr auto run_time = std::chrono::milliseconds(50);
+
+    GroupDelayDesigner::Settings settings = known_design_settings();
+    settings.tolerance_ms = 0.0f;
+
+    std::atomic_bool cancelled = false;
+    clock_type::time_point finished;
+    std::thread design_thread([&]() {
+        GroupDelayDesigner::design(settings, cancelled);
+        finished = clock_type::now();
+    });
+    std::this_thread::sleep_for(run_time);
+    const auto cancel_start = clock_type::now();
+    cancelled = true;
+    design_thread.join();
+    const auto design_cancel_time = finished - cancel_start;
+
+    GroupDelayDesigner designer;
+    std::atomic_bool reported = false;
+    designer.start(settings,
+                   [&](GroupDelayDesigner::Result) { reported = true; });
+    std::this_thread::sleep_for(run_time);
+    const auto start_cancel_start = clock_type::now();
+    designer.cancel();
+    const auto start_cancel_time = clock_type::now() - start_cancel_start;
+
+    const auto to_ms = [](clock_type::duration duration) {
+        return std::chrono::duration<double, std::milli>(duration).count();
+    };
+    const std::string summary =
+        format("design() stopped after %.1f ms, cancel() took %.1f ms",
+               to_ms(design_cancel_time), to_ms(start_cancel_time));
+    if (design_cancel_time > max_cancel_time ||
+        start_cancel_time > max_cancel_time || reported) {
+        return {.passed = false,
+                .details = summary + (reported ? ", and the cancelled design "
+                                                 "still reported a result"
+                                               : "")};
+    }
+
+    return {.details = summary};
+}
+
+}  // namespace
+
+std::vector<ComponentCheck> component_checks() {
+    return {
+        {"Reblocker (DiopserEngine)", check_reblocker_engine},
+        {"Reblocker (bypassed)", check_reblocker_bypassed},
+        {"DiopserEngine (stage fades)", check_stage_fades},
+        {"PhaseRotator (SSE2 against scalar)", check_rotator_simd},
+        {"PhaseRotator (quadrature)", check_rotator_quadrature},
+        {"DiopserEngine (design mode)", check_design_mode},
+        {"GroupDelayDesigner (known cascade)", check_designer_known_cascade},
+        {"GroupDelayDesigner (thread count)", check_designer_threads},
+        {"GroupDelayDesigner (cancellation)", check_designer_cancel},
+    };
+}
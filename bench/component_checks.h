@@ -0,0 +1,51 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * The outcome of a `ComponentCheck`.
+ */
+struct CheckResult {
+    bool passed = true;
+    /**
+     * What went wrong if the check failed, or a summary of what was measured
+     * otherwise.
+     */
+    std::string details;
+};
+
+/**
+ * A check for a part of the core library that `ReferenceEngine` doesn't
+ * cover, run by `diopser_verify` after the engine comparisons. These check
+ * the components against their own documented behavior instead of against
+ * the reference.
+ */
+struct ComponentCheck {
+    const char* name;
+    std::function<CheckResult()> run;
+};
+
+/**
+ * Every component check, in the order `diopser_verify` runs them. The checks
+ * are deterministic, and they expect denormals to be flushed to zero just
+ * like in the plugin.
+ */
+std::vector<ComponentCheck> component_checks();
@@ -0,0 +1,407 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Loads the built VST3 plugin through JUCE's plugin hosting classes and
+// measures what a host actually sees: how long it takes to instantiate the
+// plugin, the distribution of per-block processing times with and without
+// parameter automation, and how long it takes for a change to the number of
+// stages to become audible. That last one includes the round trip through the
+// message thread. This doesn't open any windows, so it can run without a
+// display. Run with `--help` for the available options.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+
+#include <juce_audio_processors/juce_audio_processors.h>
+#include <juce_events/juce_events.h>
+
+#include "json_writer.h"
+#include "statistics.h"
+
+#ifndef DIOPSER_VST3_PATH
+#define DIOPSER_VST3_PATH ""
+#endif
+
+using clock_type = std::chrono::steady_clock;
+
+struct Options {
+    juce::String plugin_path = DIOPSER_VST3_PATH;
+    double sample_rate = 48000.0;
+    int block_size = 512;
+    int num_stages = 256;
+    double duration_secs = 10.0;
+    int instantiations = 5;
+    int stage_changes = 10;
+    std::string output_path;
+};
+
+/**
+ * The measurements for a single run of audio processing.
+ */
+struct BlockTimings {
+    std::vector<double> block_us;
+    double block_duration_us = 0.0;
+};
+
+static void print_usage(const char* program_name) {
+    std::cerr
+        << "Usage: " << program_name << " [options]\n"
+        << "\n"
+        << "Options:\n"
+        << "  --plugin <path>         The VST3 bundle to load (default: the "
+           "one from this build)\n"
+        << "  --sample-rate <hz>      (default: 48000)\n"
+        << "  --block-size <n>        (default: 512)\n"
+        << "  --stages <n>            Number of filter stages (default: 256)\n"
+        << "  --duration <secs>       Audio processed per scenario (default: "
+           "10)\n"
+        << "  --instantiations <n>    Number of timed instantiations "
+           "(default: 5)\n"
+        << "  --stage-changes <n>     Number of timed stage changes "
+           "(default: 10)\n"
+        << "  --out <file>            Write the JSON results to this file "
+           "instead of STDOUT\n";
+}
+
+static double elapsed_us(clock_type::time_point start) {
+    return std::chrono::duration<double, std::micro>(clock_type::now() - start)
+        .count();
+}
+
+/**
+ * Find one of the plugin's parameters by its display name. The VST3 wrapper
+ * doesn't expose JUCE's string parameter IDs to the host.
+ */
+static juce::AudioProcessorParameter* find_parameter(
+    juce::AudioPluginInstance& plugin,
+    const juce::String& name) {
+    for (auto* parameter : plugin.getParameters()) {
+        if (parameter->getName(128) == name) {
+            return parameter;
+        }
+    }
+
+    return nullptr;
+}
+
+/**
+ * Set a parameter to a plain value, the same way a host would when automating
+ * it.
+ */
+static void set_parameter(juce::AudioProcessorParameter& parameter,
+                          float normalized_value) {
+    parameter.beginChangeGesture();
+    parameter.setValueNotifyingHost(normalized_value);
+    parameter.endChangeGesture();
+}
+
+/**
+ * Give the message thread a chance to run. This is where the plugin resizes
+ * its filters after the number of stages changes.
+ */
+static void pump_messages(int milliseconds) {
+    juce::MessageManager::getInstance()->runDispatchLoopUntil(milliseconds);
+}
+
+static BlockTimings time_processing(juce::AudioPluginInstance& plugin,
+                                    const Options& options,
+                                    juce::AudioProcessorParameter* automated) {
+    const int num_channels = plugin.getTotalNumInputChannels();
+    juce::AudioBuffer<float> buffer(num_channels, options.block_size);
+    juce::MidiBuffer midi;
+
+    std::mt19937 rng(1337);
+    std::uniform_real_distribution<float> noise(-0.25f, 0.25f);
+
+    BlockTimings timings;
+    timings.block_duration_us =
+        1.0e6 * options.block_size / options.sample_rate;
+    const size_t num_blocks = static_cast<size_t>(
+        options.duration_secs * options.sample_rate / options.block_size);
+    timings.block_us.reserve(num_blocks);
+    for (size_t block_idx = 0; block_idx < num_blocks; block_idx++) {
+        for (int channel = 0; channel < num_channels; channel++) {
+            for (int i = 0; i < options.block_size; i++) {
+                buffer.setSample(channel, i, noise(rng));
+            }
+        }
+
+        // A slow sine on the normalized value, changed every block
+        if (automated) {
+            const float phase = static_cast<float>(block_idx) * 0.01f;
+            set_parameter(*automated, 0.5f + (0.4f * std::sin(phase)));
+        }
+
+        const auto start = clock_type::now();
+        plugin.processBlock(buffer, midi);
+        timings.block_us.push_back(elapsed_us(start));
+    }
+
+    return timings;
+}
+
+static double percentile(std::vector<double> values, double fraction) {
+    if (values.empty()) {
+        return 0.0;
+    }
+
+    std::sort(values.begin(), values.end());
+    const size_t index = std::min(
+        values.size() - 1,
+        static_cast<size_t>(fraction * static_cast<double>(values.size())));
+    return values[index];
+}
+
+static void write_block_timings(JsonWriter& json,
+                                const char* name,
+                                const BlockTimings& timings) {
+    const Statistics statistics = Statistics::from(timings.block_us);
+
+    json.key(name);
+    json.begin_object();
+    json.field("num_blocks", timings.block_us.size());
+    json.field("block_us_median", statistics.median);
+    json.field("block_us_mad", statistics.mad);
+    json.field("block_us_p90", percentile(timings.block_us, 0.9));
+    json.field("block_us_p99", percentile(timings.block_us, 0.99));
+    json.field("block_us_p999", percentile(timings.block_us, 0.999));
+    json.field("block_us_max", statistics.max);
+    // The fraction of the real time budget used by the median block
+    json.field("median_load", statistics.median / timings.block_duration_us);
+    json.end_object();
+}
+
+/**
+ * Change the number of stages between zero and `options.num_stages` and
+ * measure how long it takes for the output to reflect the change. With zero
+ * stages the plugin passes the (quiet) input through unchanged, so the change
+ * has taken effect once the output starts or stops being identical to the
+ * input. Returns the times in milliseconds, or an empty vector when the change
+ * never took effect.
+ */
+static std::vector<double> time_stage_changes(
+    juce::AudioPluginInstance& plugin,
+    const Options& options,
+    juce::AudioProcessorParameter& stages_parameter) {
+    const int num_channels = plugin.getTotalNumInputChannels();
+    juce::AudioBuffer<float> input(num_channels, options.block_size);
+    juce::AudioBuffer<float> buffer(num_channels, options.block_size);
+    juce::MidiBuffer midi;
+
+    // Well below the safe mode limiter's threshold
+    std::mt19937 rng(1337);
+    std::uniform_real_distribution<float> noise(-0.1f, 0.1f);
+    for (int channel = 0; channel < num_channels; channel++) {
+        for (int i = 0; i < options.block_size; i++) {
+            input.setSample(channel, i, noise(rng));
+        }
+    }
+
+    const auto output_is_unprocessed = [&]() {
+        for (int channel = 0; channel < num_channels; channel++) {
+            if (std::memcmp(input.getReadPointer(channel),
+                            buffer.getReadPointer(channel),
+                            sizeof(float) *
+                                static_cast<size_t>(options.block_size)) !=
+                0) {
+                return false;
+            }
+        }
+
+        return true;
+    };
+
+    const float zero_stages = stages_parameter.convertTo0to1(0.0f);
+    const float many_stages =
+        stages_parameter.convertTo0to1(static_cast<float>(options.num_stages));
+
+    std::vector<double> times_ms;
+    for (int change = 0; change < options.stage_changes * 2; change++) {
+        const bool enable = change % 2 == 0;
+        set_parameter(stages_parameter, enable ? many_stages : zero_stages);
+
+        // Process blocks in real time until the change can be heard, like a
+        // host would
+        const auto start = clock_type::now();
+        bool took_effect = false;
+        while (elapsed_us(start) < 2.0e6) {
+            buffer.makeCopyOf(input, true);
+            plugin.processBlock(buffer, midi);
+            if (output_is_unprocessed() != enable) {
+                took_effect = true;
+                break;
+            }
+
+            pump_messages(juce::roundToInt(1000.0 * options.block_size /
+                                           options.sample_rate));
+        }
+
+        if (!took_effect) {
+            return {};
+        }
+        times_ms.push_back(elapsed_us(start) / 1000.0);
+    }
+
+    return times_ms;
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (arg == "--plugin" && has_value) {
+            options.plugin_path = argv[++i];
+        } else if (arg == "--sample-rate" && has_value) {
+            options.sample_rate = std::atof(argv[++i]);
+        } else if (arg == "--block-size" && has_value) {
+            options.block_size = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--stages" && has_value) {
+            options.num_stages = std::clamp(std::atoi(argv[++i]), 1, 512);
+        } else if (arg == "--duration" && has_value) {
+            options.duration_secs = std::atof(argv[++i]);
+        } else if (arg == "--instantiations" && has_value) {
+            options.instantiations = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--stage-changes" && has_value) {
+            options.stage_changes = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--out" && has_value) {
+            options.output_path = argv[++i];
+        } else {
+            print_usage(argv[0]);
+            return arg == "--help" || arg == "-h" ? 0 : 1;
+        }
+    }
+
+    // This sets up the message manager without connecting to a display
+    const juce::ScopedJuceInitialiser_GUI juce_initialiser;
+
+    juce::AudioPluginFormatManager format_manager;
+    format_manager.addFormat(new juce::VST3PluginFormat());
+
+    juce::OwnedArray<juce::PluginDescription> descriptions;
+    format_manager.getFormat(0)->findAllTypesForFile(descriptions,
+                                                     options.plugin_path);
+    if (descriptions.isEmpty()) {
+        std::cerr << "Could not load '" << options.plugin_path << "'\n";
+        return 1;
+    }
+
+    // Instantiation includes loading the module the first time, so the first
+    // measurement is reported separately
+    std::vector<double> instantiation_ms;
+    std::unique_ptr<juce::AudioPluginInstance> plugin;
+    for (int i = 0; i < options.instantiations; i++) {
+        plugin.reset();
+
+        juce::String error;
+        const auto start = clock_type::now();
+        plugin = format_manager.createPluginInstance(
+            *descriptions[0], options.sample_rate, options.block_size, error);
+        instantiation_ms.push_back(elapsed_us(start) / 1000.0);
+
+        if (!plugin) {
+            std::cerr << "Could not instantiate the plugin: " << error << '\n';
+            return 1;
+        }
+    }
+
+    const auto start_prepare = clock_type::now();
+    plugin->enableAllBuses();
+    plugin->prepareToPlay(options.sample_rate, options.block_size);
+    const double prepare_ms = elapsed_us(start_prepare) / 1000.0;
+
+    auto* stages_parameter = find_parameter(*plugin, "Filter Stages");
+    auto* frequency_parameter = find_parameter(*plugin, "Filter Frequency");
+    if (!stages_parameter || !frequency_parameter) {
+        std::cerr << "Could not find the plugin's parameters, is this "
+                     "Diopser?\n";
+        return 1;
+    }
+
+    // Changing the number of stages happens asynchronously on the message
+    // thread, so that needs to run before we start measuring
+    set_parameter(*stages_parameter,
+                  stages_parameter->convertTo0to1(
+                      static_cast<float>(options.num_stages)));
+    pump_messages(100);
+
+    std::cerr << "Processing without automation...\n";
+    const BlockTimings static_timings =
+        time_processing(*plugin, options, nullptr);
+    std::cerr << "Processing with frequency automation...\n";
+    const BlockTimings automated_timings =
+        time_processing(*plugin, options, frequency_parameter);
+    std::cerr << "Timing stage changes...\n";
+    const std::vector<double> stage_change_ms =
+        time_stage_changes(*plugin, options, *stages_parameter);
+
+    plugin->releaseResources();
+    plugin.reset();
+
+    std::ofstream file;
+    if (!options.output_path.empty()) {
+        file.open(options.output_path);
+        if (!file) {
+            std::cerr << "Could not open '" << options.output_path
+                      << "' for writing\n";
+            return 1;
+        }
+    }
+
+    JsonWriter json(options.output_path.empty() ? std::cout : file);
+    json.begin_object();
+    json.field("schema_version", 1);
+
+    json.key("context");
+    json.begin_object();
+    json.field("plugin", options.plugin_path.toStdString());
+    json.field("sample_rate", options.sample_rate);
+    json.field("block_size", options.block_size);
+    json.field("stages", options.num_stages);
+    json.end_object();
+
+    json.key("instantiation");
+    json.begin_object();
+    json.field("first_ms", instantiation_ms.front());
+    json.field("median_ms", Statistics::from(instantiation_ms).median);
+    json.field("prepare_ms", prepare_ms);
+    json.end_object();
+
+    write_block_timings(json, "static", static_timings);
+    write_block_timings(json, "automated", automated_timings);
+
+    json.key("stage_change");
+    json.begin_object();
+    if (stage_change_ms.empty()) {
+        // The output never changed, which is a bug in itself
+        json.field("took_effect", false);
+    } else {
+        const Statistics statistics = Statistics::from(stage_change_ms);
+        json.field("took_effect", true);
+        json.field("time_to_effect_ms_median", statistics.median);
+        json.field("time_to_effect_ms_max", statistics.max);
+    }
+    json.end_object();
+
+    json.end_object();
+
+    return 0;
+}
@@ -0,0 +1,269 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "json_reader.h"
+
+#include <charconv>
+#include <cstdlib>
+#include <stdexcept>
+
+static const JsonValue null_value{};
+
+const JsonValue& JsonValue::operator[](std::string_view key) const {
+    if (const auto* object = as_object()) {
+        if (const auto it = object->find(key); it != object->end()) {
+            return it->second;
+        }
+    }
+
+    return null_value;
+}
+
+std::optional<bool> JsonValue::as_bool() const {
+    if (const auto* boolean = std::get_if<bool>(&value)) {
+        return *boolean;
+    }
+
+    return std::nullopt;
+}
+
+std::optional<double> JsonValue::as_number() const {
+    if (const auto* number = std::get_if<double>(&value)) {
+        return *number;
+    }
+
+    return std::nullopt;
+}
+
+std::optional<std::string_view> JsonValue::as_string() const {
+    if (const auto* string = std::get_if<std::string>(&value)) {
+        return *string;
+    }
+
+    return std::nullopt;
+}
+
+const JsonValue::Array* JsonValue::as_array() const {
+    return std::get_if<Array>(&value);
+}
+
+const JsonValue::Object* JsonValue::as_object() const {
+    return std::get_if<Object>(&value);
+}
+
+/**
+ * A recursive descent parser over a string. Only the subset of JSON written by
+ * `JsonWriter` needs to round trip, but this accepts any valid document
+ * except for non-ASCII `\u` escapes.
+ */
+class JsonParser {
+   public:
+    explicit JsonParser(std::string_view json) : json_(json) {}
+
+    JsonValue parse_document() {
+        JsonValue value = parse_value();
+        skip_whitespace();
+        if (pos_ != json_.size()) {
+            fail("Trailing data");
+        }
+
+        return value;
+    }
+
+   private:
+    JsonValue parse_value() {
+        skip_whitespace();
+        if (pos_ >= json_.size()) {
+            fail("Unexpected end of input");
+        }
+
+        switch (json_[pos_]) {
+            case '{':
+                return parse_object();
+            case '[':
+                return parse_array();
+            case '"':
+                return JsonValue{parse_string()};
+            case 't':
+                expect_literal("true");
+                return JsonValue{true};
+            case 'f':
+                expect_literal("false");
+                return JsonValue{false};
+            case 'n':
+                expect_literal("null");
+                return JsonValue{nullptr};
+            default:
+                return JsonValue{parse_number()};
+        }
+    }
+
+    JsonValue parse_object() {
+        JsonValue::Object object;
+        pos_ += 1;
+        skip_whitespace();
+        if (consume('}')) {
+            return JsonValue{std::move(object)};
+        }
+
+        do {
+            skip_whitespace();
+            std::string key = parse_string();
+            skip_whitespace();
+            if (!consume(':')) {
+                fail("Expected ':'");
+            }
+
+            object.insert_or_assign(std::move(key), parse_value());
+            skip_whitespace();
+        } while (consume(','));
+
+        if (!consume('}')) {
+            fail("Expected '}'");
+        }
+
+        return JsonValue{std::move(object)};
+    }
+
+    JsonValue parse_array() {
+        JsonValue::Array array;
+        pos_ += 1;
+        skip_whitespace();
+        if (consume(']')) {
+            return JsonValue{std::move(array)};
+        }
+
+        do {
+            array.push_back(parse_value());
+            skip_whitespace();
+        } while (consume(','));
+
+        if (!consume(']')) {
+            fail("Expected ']'");
+        }
+
+        return JsonValue{std::move(array)};
+    }
+
+    std::string parse_string() {
+        if (!consume('"')) {
+            fail("Expected a string");
+        }
+
+        std::string result;
+        while (pos_ < json_.size() && json_[pos_] != '"') {
+            char c = json_[pos_++];
+            if (c == '\\') {
+                if (pos_ >= json_.size()) {
+                    break;
+                }
+
+                switch (const char escaped = json_[pos_++]) {
+                    case 'n':
+                        c = '\n';
+                        break;
+                    case 't':
+                        c = '\t';
+                        break;
+                    case 'r':
+                        c = '\r';
+                        break;
+                    case 'b':
+                        c = '\b';
+                        break;
+                    case 'f':
+                        c = '\f';
+                        break;
+                    case 'u': {
+                        unsigned int code_point = 0;
+                        if (pos_ + 4 > json_.size() ||
+                            std::from_chars(json_.data() + pos_,
+                                            json_.data() + pos_ + 4,
+                                            code_point, 16)
+                                    .ec != std::errc() ||
+                            code_point > 0x7f) {
+                            fail("Unsupported unicode escape");
+                        }
+
+                        pos_ += 4;
+                        c = static_cast<char>(code_point);
+                    } break;
+                    default:
+                        c = escaped;
+                        break;
+                }
+            }
+
+            result.push_back(c);
+        }
+
+        if (!consume('"')) {
+            fail("Unterminated string");
+        }
+
+        return result;
+    }
+
+    double parse_number() {
+        // `std::from_chars()` for doubles isn't available everywhere yet
+        const std::string number(json_.substr(pos_, 64));
+        char* end = nullptr;
+        const double value = std::strtod(number.c_str(), &end);
+        if (end == number.c_str()) {
+            fail("Expected a value");
+        }
+
+        pos_ += static_cast<size_t>(end - number.c_str());
+        return value;
+    }
+
+    void expect_literal(std::string_view literal) {
+        if (json_.substr(pos_, literal.size()) != literal) {
+            fail("Invalid literal");
+        }
+
+        pos_ += literal.size();
+    }
+
+    bool consume(char c) {
+        if (pos_ < json_.size() && json_[pos_] == c) {
+            pos_ += 1;
+            return true;
+        }
+
+        return false;
+    }
+
+    void skip_whitespace() {
+        while (pos_ < json_.size() &&
+               (json_[pos_] == ' ' || json_[pos_] == '\n' ||
+                json_[pos_] == '\r' || json_[pos_] == '\t')) {
+            pos_ += 1;
+        }
+    }
+
+    [[noreturn]] void fail(const char* message) const {
+        throw std::runtime_error(std::string(message) + " at offset " +
+                                 std::to_string(pos_));
+    }
+
+    std::string_view json_;
+    size_t pos_ = 0;
+};
+
+JsonValue parse_json(std::string_view json) {
+    return JsonParser(json).parse_document();
+}
@@ -0,0 +1,55 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+/**
+ * A parsed JSON value. This is only meant for reading back the benchmark
+ * results, so it's simple rather than fast.
+ */
+struct JsonValue {
+    using Array = std::vector<JsonValue>;
+    using Object = std::map<std::string, JsonValue, std::less<>>;
+
+    std::variant<std::nullptr_t, bool, double, std::string, Array, Object>
+        value = nullptr;
+
+    /**
+     * Look up a key if this is an object. Returns a null value otherwise.
+     */
+    const JsonValue& operator[](std::string_view key) const;
+
+    std::optional<bool> as_bool() const;
+    std::optional<double> as_number() const;
+    std::optional<std::string_view> as_string() const;
+    const Array* as_array() const;
+    const Object* as_object() const;
+};
+
+/**
+ * Parse a JSON document.
+ *
+ * @throw std::runtime_error When the document is malformed.
+ */
+JsonValue parse_json(std::string_view json);
@@ -0,0 +1,161 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cmath>
+#include <cstdio>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+/**
+ * A minimal streaming JSON writer for the benchmark results. Commas and
+ * indentation are handled automatically. Keys must be written using `key()`
+ * before every value inside of an object.
+ */
+class JsonWriter {
+   public:
+    explicit JsonWriter(std::ostream& stream) : stream_(stream) {}
+
+    void begin_object() {
+        begin_value();
+        stream_ << '{';
+        scopes_.push_back(Scope{});
+    }
+
+    void end_object() { end_scope('}'); }
+
+    void begin_array() {
+        begin_value();
+        stream_ << '[';
+        scopes_.push_back(Scope{});
+    }
+
+    void end_array() { end_scope(']'); }
+
+    void key(std::string_view name) {
+        separate();
+        write_string(name);
+        stream_ << ": ";
+        after_key_ = true;
+    }
+
+    void value(std::string_view value) {
+        begin_value();
+        write_string(value);
+    }
+
+    void value(const char* value) { this->value(std::string_view(value)); }
+
+    void value(double value) {
+        begin_value();
+        if (std::isfinite(value)) {
+            char buffer[32];
+            std::snprintf(buffer, sizeof(buffer), "%.17g", value);
+            stream_ << buffer;
+        } else {
+            // JSON has no representation for these
+            stream_ << "null";
+        }
+    }
+
+    void value(bool value) {
+        begin_value();
+        stream_ << (value ? "true" : "false");
+    }
+
+    template <typename T>
+    void field(std::string_view name, T value) {
+        key(name);
+        if constexpr (std::is_integral_v<T> && !std::is_same_v<T, bool>) {
+            this->value(static_cast<double>(value));
+        } else {
+            this->value(value);
+        }
+    }
+
+   private:
+    struct Scope {
+        bool is_empty = true;
+    };
+
+    void separate() {
+        if (!scopes_.empty()) {
+            if (!scopes_.back().is_empty) {
+                stream_ << ',';
+            }
+            scopes_.back().is_empty = false;
+
+            stream_ << '\n' << std::string(scopes_.size() * 2, ' ');
+        }
+    }
+
+    void begin_value() {
+        if (after_key_) {
+            after_key_ = false;
+        } else {
+            separate();
+        }
+    }
+
+    void end_scope(char closing) {
+        const bool was_empty = scopes_.back().is_empty;
+        scopes_.pop_back();
+        if (!was_empty) {
+            stream_ << '\n' << std::string(scopes_.size() * 2, ' ');
+        }
+
+        stream_ << closing;
+        if (scopes_.empty()) {
+            stream_ << '\n';
+        }
+    }
+
+    void write_string(std::string_view string) {
+        stream_ << '"';
+        for (const char c : string) {
+            switch (c) {
+                case '"':
+                    stream_ << "\\\"";
+                    break;
+                case '\\':
+                    stream_ << "\\\\";
+                    break;
+                case '\n':
+                    stream_ << "\\n";
+                    break;
+                default:
+                    if (static_cast<unsigned char>(c) < 0x20) {
+                        char buffer[8];
+                        std::snprintf(buffer, sizeof(buffer), "\\u%04x",
+                                      static_cast<unsigned char>(c));
+                        stream_ << buffer;
+                    } else {
+                        stream_ << c;
+                    }
+                    break;
+            }
+        }
+        stream_ << '"';
+    }
+
+    std::ostream& stream_;
+    std::vector<Scope> scopes_;
+    bool after_key_ = false;
+};
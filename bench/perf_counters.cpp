@@ -0,0 +1,167 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "perf_counters.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+const char* perf_event_name(PerfEvent event) {
+    switch (event) {
+        case PerfEvent::cycles:
+            return "cycles";
+        case PerfEvent::instructions:
+            return "instructions";
+        case PerfEvent::l1d_read_misses:
+            return "l1d_read_misses";
+        case PerfEvent::llc_read_misses:
+            return "llc_read_misses";
+        case PerfEvent::branch_misses:
+            return "branch_misses";
+        case PerfEvent::count:
+        default:
+            return "unknown";
+    }
+}
+
+#ifdef __linux__
+
+/**
+ * The `type` and `config` fields for an event's `perf_event_attr`.
+ */
+static std::pair<uint32_t, uint64_t> event_config(PerfEvent event) {
+    constexpr auto cache_read_miss = [](uint64_t cache) {
+        return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+               (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    };
+
+    switch (event) {
+        case PerfEvent::instructions:
+            return {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS};
+        case PerfEvent::l1d_read_misses:
+            return {PERF_TYPE_HW_CACHE,
+                    cache_read_miss(PERF_COUNT_HW_CACHE_L1D)};
+        case PerfEvent::llc_read_misses:
+            return {PERF_TYPE_HW_CACHE,
+                    cache_read_miss(PERF_COUNT_HW_CACHE_LL)};
+        case PerfEvent::branch_misses:
+            return {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES};
+        case PerfEvent::cycles:
+        case PerfEvent::count:
+        default:
+            return {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES};
+    }
+}
+
+PerfCounters::PerfCounters() {
+    for (size_t i = 0; i < num_perf_events; i++) {
+        const auto [type, config] = event_config(static_cast<PerfEvent>(i));
+
+        perf_event_attr attr{};
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        // Only counting user space events works with the default
+        // `perf_event_paranoid` setting
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format =
+            PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        fds_[i] = static_cast<int>(
+            syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+}
+
+PerfCounters::~PerfCounters() {
+    for (const int fd : fds_) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
+
+bool PerfCounters::is_available() const {
+    for (const int fd : fds_) {
+        if (fd >= 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void PerfCounters::start() {
+    for (const int fd : fds_) {
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+void PerfCounters::stop() {
+    for (const int fd : fds_) {
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+}
+
+std::optional<double> PerfCounters::read(PerfEvent event) const {
+    const int fd = fds_[static_cast<size_t>(event)];
+    if (fd < 0) {
+        return std::nullopt;
+    }
+
+    // The value, the time the event was enabled, and the time it was actually
+    // being counted
+    uint64_t values[3] = {0, 0, 0};
+    if (::read(fd, values, sizeof(values)) != sizeof(values) ||
+        values[2] == 0) {
+        return std::nullopt;
+    }
+
+    return static_cast<double>(values[0]) *
+           (static_cast<double>(values[1]) / static_cast<double>(values[2]));
+}
+
+#else
+
+PerfCounters::PerfCounters() {
+    fds_.fill(-1);
+}
+
+PerfCounters::~PerfCounters() {}
+
+bool PerfCounters::is_available() const {
+    return false;
+}
+
+void PerfCounters::start() {}
+
+void PerfCounters::stop() {}
+
+std::optional<double> PerfCounters::read(PerfEvent /*event*/) const {
+    return std::nullopt;
+}
+
+#endif
@@ -0,0 +1,87 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+
+/**
+ * The hardware events `PerfCounters` measures.
+ */
+enum class PerfEvent : size_t {
+    cycles,
+    instructions,
+    l1d_read_misses,
+    /**
+     * Last level cache misses. The kernel's generic events don't have a
+     * portable L2 miss counter, but on most systems the last level cache is
+     * the one that matters for a cascade whose state no longer fits in L2.
+     */
+    llc_read_misses,
+    branch_misses,
+    count,
+};
+
+constexpr size_t num_perf_events = static_cast<size_t>(PerfEvent::count);
+
+/**
+ * The JSON key for an event.
+ */
+const char* perf_event_name(PerfEvent event);
+
+/**
+ * Hardware performance counters for the calling thread using Linux's
+ * `perf_event_open()`. Every event is opened separately, so a missing event
+ * doesn't prevent the others from being measured. Containers and systems with
+ * a strict `perf_event_paranoid` setting often don't allow any of these, in
+ * which case `is_available()` returns false and the benchmarks only report
+ * timings. Counts are scaled to compensate for multiplexing when more events
+ * are requested than the CPU has counters for. On other platforms this is a
+ * no-op.
+ */
+class PerfCounters {
+   public:
+    PerfCounters();
+    ~PerfCounters();
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    /**
+     * Whether at least one of the events could be opened.
+     */
+    bool is_available() const;
+
+    /**
+     * Reset and start all counters.
+     */
+    void start();
+    /**
+     * Stop all counters. Their values can then be read using `read()`.
+     */
+    void stop();
+
+    /**
+     * Read the (scaled) count for `event` since the last call to `start()`,
+     * if that event is available.
+     */
+    std::optional<double> read(PerfEvent event) const;
+
+   private:
+    std::array<int, num_perf_events> fds_;
+};
@@ -0,0 +1,254 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "reference_engine.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Everything in this file intentionally mirrors what JUCE's
+// `juce::SmoothedValue<float>`,
+// `juce::dsp::IIR::ArrayCoefficients<float>::makeAllPass()` and
+// `juce::dsp::IIR::Filter<float>` do, since that's what Diopser was built on
+// originally.
+
+constexpr float filter_smoothing_secs = 0.1f;
+
+// The safe mode limiter's settings. These are the same as in `limiter.cpp`,
+// but the limiter below processes one sample at a time instead of in chunks.
+constexpr float limiter_threshold_db = -1.0f;
+constexpr float limiter_knee_width_db = 4.0f;
+constexpr float limiter_release_secs = 0.05f;
+
+static const float limiter_knee_start =
+    std::pow(10.0f, (limiter_threshold_db - (limiter_knee_width_db / 2.0f)) /
+                        20.0f);
+static const float limiter_knee_end =
+    std::pow(10.0f, (limiter_threshold_db + (limiter_knee_width_db / 2.0f)) /
+                        20.0f);
+static const float limiter_threshold =
+    std::pow(10.0f, limiter_threshold_db / 20.0f);
+
+void ReferenceEngine::Smoother::reset(double steps_per_second) {
+    steps_to_target = static_cast<int>(std::floor(
+        static_cast<double>(filter_smoothing_secs) * steps_per_second));
+    current = target;
+    countdown = 0;
+}
+
+void ReferenceEngine::Smoother::set_target(float value) {
+    if (value == target) {
+        return;
+    }
+
+    if (steps_to_target <= 0) {
+        current = target = value;
+        countdown = 0;
+        return;
+    }
+
+    target = value;
+    countdown = steps_to_target;
+    step = (target - current) / static_cast<float>(countdown);
+}
+
+float ReferenceEngine::Smoother::next() {
+    if (countdown <= 1) {
+        current = target;
+        countdown = 0;
+        return target;
+    }
+
+    current += step;
+    countdown -= 1;
+    return current;
+}
+
+void ReferenceEngine::prepare(double sample_rate,
+                              size_t /*max_block_size*/,
+                              size_t num_channels,
+                              size_t num_stages,
+                              int smoothing_interval) {
+    sample_rate_ = sample_rate;
+    num_channels_ = num_channels;
+    set_num_stages(num_stages);
+
+    const double compensated_sample_rate = sample_rate / smoothing_interval;
+    frequency_.reset(compensated_sample_rate);
+    resonance_.reset(compensated_sample_rate);
+    spread_.reset(compensated_sample_rate);
+
+    limiter_release_coefficient_ = static_cast<float>(
+        std::exp(-1.0 / (limiter_release_secs * sample_rate)));
+    limiter_envelope_ = 0.0f;
+}
+
+void ReferenceEngine::set_num_stages(size_t num_stages) {
+    stages_.resize(num_stages);
+    for (auto& stage : stages_) {
+        stage.s1.assign(num_channels_, 0.0f);
+        stage.s2.assign(num_channels_, 0.0f);
+    }
+
+    is_initialized_ = false;
+}
+
+void ReferenceEngine::process(float* const* samples,
+                              size_t num_channels,
+                              size_t num_samples,
+                              const DiopserEngine::Parameters& parameters) {
+    frequency_.set_target(parameters.frequency);
+    resonance_.set_target(parameters.resonance);
+    spread_.set_target(parameters.spread);
+
+    // `Parameters::gesture_in_progress` is ignored on purpose, since the
+    // engine's gesture path is an approximation of this
+    const int smoothing_interval = parameters.smoothing_interval;
+    for (size_t sample_idx = 0; sample_idx < num_samples; sample_idx++) {
+        const bool should_apply_smoothing =
+            next_smooth_in_ <= 0 &&
+            (frequency_.countdown > 0 || resonance_.countdown > 0 ||
+             spread_.countdown > 0);
+        const bool should_update_filters =
+            !is_initialized_ ||
+            parameters.spread_linear != old_spread_linear_ ||
+            should_apply_smoothing;
+
+        float frequency = frequency_.current;
+        float resonance = resonance_.current;
+        float spread = spread_.current;
+        if (should_apply_smoothing) {
+            frequency = frequency_.next();
+            resonance = resonance_.next();
+            spread = spread_.next();
+        }
+
+        if (should_update_filters && !stages_.empty()) {
+            // The same spread computation as the original `processBlock()`,
+            // except that the cutoff is also kept below Nyquist when spread
+            // is disabled since the filters are unstable above it
+            const float below_nyquist_frequency =
+                static_cast<float>(sample_rate_) / 2.1f;
+            const float min_filter_frequency =
+                std::clamp(frequency - (spread / 2.0f), 5.0f,
+                           below_nyquist_frequency);
+            const float max_filter_frequency =
+                std::clamp(frequency + (spread / 2.0f), 5.0f,
+                           below_nyquist_frequency);
+            const float filter_frequency_delta =
+                max_filter_frequency - min_filter_frequency;
+            const float log_min_filter_frequency =
+                std::log(min_filter_frequency);
+            const float log_max_filter_frequency =
+                std::log(max_filter_frequency);
+            const float log_filter_frequency_delta =
+                log_max_filter_frequency - log_min_filter_frequency;
+
+            const size_t num_stages = stages_.size();
+            for (size_t stage_idx = 0; stage_idx < num_stages; stage_idx++) {
+                const float frequency_offset_factor =
+                    num_stages == 1 ? 0.5f
+                                    : (static_cast<float>(stage_idx) /
+                                       static_cast<float>(num_stages - 1));
+                float stage_frequency;
+                if (spread == 0.0f) {
+                    stage_frequency =
+                        std::clamp(frequency, 5.0f, below_nyquist_frequency);
+                } else if (parameters.spread_linear) {
+                    stage_frequency =
+                        min_filter_frequency +
+                        (filter_frequency_delta * frequency_offset_factor);
+                } else {
+                    stage_frequency =
+                        std::exp(log_min_filter_frequency +
+                                 (log_filter_frequency_delta *
+                                  frequency_offset_factor));
+                }
+
+                // The all-pass coefficients, exactly like JUCE computes them
+                const float n =
+                    1.0f / std::tan(3.14159265358979323846f * stage_frequency /
+                                    static_cast<float>(sample_rate_));
+                const float n_squared = n * n;
+                const float c1 =
+                    1.0f / (1.0f + 1.0f / resonance * n + n_squared);
+                stages_[stage_idx].b0 =
+                    c1 * (1.0f - n / resonance + n_squared);
+                stages_[stage_idx].b1 = c1 * 2.0f * (1.0f - n_squared);
+            }
+
+            next_smooth_in_ = smoothing_interval;
+        }
+
+        next_smooth_in_ -= 1;
+        is_initialized_ = true;
+        old_spread_linear_ = parameters.spread_linear;
+
+        for (auto& stage : stages_) {
+            for (size_t channel = 0; channel < num_channels; channel++) {
+                // A transposed direct form II biquad with b2 = a0 = 1, a1 = b1
+                // and a2 = b0
+                const float input = samples[channel][sample_idx];
+                float output = (stage.b0 * input) + stage.s1[channel];
+                stage.s1[channel] = (stage.b1 * input) -
+                                    (stage.b1 * output) + stage.s2[channel];
+                stage.s2[channel] = (1.0f * input) - (stage.b0 * output);
+                if (!(output < -1.0e-8f || output > 1.0e-8f)) {
+                    output = 0.0f;
+                }
+
+                samples[channel][sample_idx] = output;
+            }
+        }
+    }
+
+    if (parameters.safe_mode) {
+        if (!old_safe_mode_) {
+            limiter_envelope_ = 0.0f;
+        }
+
+        for (size_t sample_idx = 0; sample_idx < num_samples; sample_idx++) {
+            float peak = 0.0f;
+            for (size_t channel = 0; channel < num_channels; channel++) {
+                peak = std::max(peak, std::abs(samples[channel][sample_idx]));
+            }
+            const float envelope = std::max(
+                peak, limiter_envelope_ * limiter_release_coefficient_);
+            limiter_envelope_ = envelope;
+
+            // A soft knee with an infinite ratio, and a hard ceiling at the
+            // threshold past the knee
+            float gain = 1.0f;
+            if (envelope >= limiter_knee_end) {
+                gain = limiter_threshold / envelope;
+            } else if (envelope > limiter_knee_start) {
+                const float envelope_db = 20.0f * std::log10(envelope);
+                const float knee_offset_db = envelope_db -
+                                             limiter_threshold_db +
+                                             (limiter_knee_width_db / 2.0f);
+                const float output_db =
+                    envelope_db - ((knee_offset_db * knee_offset_db) /
+                                   (2.0f * limiter_knee_width_db));
+                gain = std::pow(10.0f, (output_db - envelope_db) / 20.0f);
+            }
+
+            for (size_t channel = 0; channel < num_channels; channel++) {
+                samples[channel][sample_idx] *= gain;
+            }
+        }
+    }
+    old_safe_mode_ = parameters.safe_mode;
+}
@@ -0,0 +1,102 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "core/engine.h"
+
+/**
+ * The straightforward scalar implementation of Diopser's signal path, kept as
+ * an oracle for `diopser_verify`. This is a copy of the original
+ * `processBlock()` from before any optimizations, with its own copies of the
+ * biquad, the coefficient formula, the frequency spread, the smoother, and
+ * the safe mode limiter so changes to the core library can't silently change
+ * the reference as well. Only `DiopserEngine::Parameters` is shared with the
+ * core library. It should never be optimized.
+ *
+ * The reference only deviates from the original `processBlock()` where the
+ * engine's intended output changed on purpose:
+ *
+ * - The cutoff is clamped below Nyquist when the spread is zero as well. The
+ *   original only clamped the spread's range, and the filters are unstable
+ *   above Nyquist.
+ * - When `Parameters::safe_mode` is enabled the output goes through a copy of
+ *   the safe mode limiter, which didn't exist yet in the original.
+ *
+ * `Parameters::gesture_in_progress` is ignored. The engine's gesture path
+ * deliberately updates the coefficients less often, so `diopser_verify`
+ * compares it against this reference within a tolerance instead of bit for
+ * bit. The rotation and design modes aren't part of the reference either.
+ *
+ * This uses the same interface as `DiopserEngine`, except that changing the
+ * number of stages takes effect immediately.
+ */
+class ReferenceEngine {
+   public:
+    void prepare(double sample_rate,
+                 size_t max_block_size,
+                 size_t num_channels,
+                 size_t num_stages,
+                 int smoothing_interval);
+
+    void set_num_stages(size_t num_stages);
+
+    void process(float* const* samples,
+                 size_t num_channels,
+                 size_t num_samples,
+                 const DiopserEngine::Parameters& parameters);
+
+   private:
+    /**
+     * A linear smoother, see `juce::SmoothedValue<float>`.
+     */
+    struct Smoother {
+        void reset(double steps_per_second);
+        void set_target(float value);
+        float next();
+
+        float current = 0.0f;
+        float target = 0.0f;
+        float step = 0.0f;
+        int countdown = 0;
+        int steps_to_target = 0;
+    };
+
+    struct Stage {
+        float b0 = 0.0f;
+        float b1 = 0.0f;
+        std::vector<float> s1;
+        std::vector<float> s2;
+    };
+
+    double sample_rate_ = 0.0;
+    size_t num_channels_ = 0;
+    std::vector<Stage> stages_;
+    bool is_initialized_ = false;
+
+    int next_smooth_in_ = 0;
+    Smoother frequency_;
+    Smoother resonance_;
+    Smoother spread_;
+    bool old_spread_linear_ = false;
+
+    bool old_safe_mode_ = false;
+    float limiter_release_coefficient_ = 0.0f;
+    float limiter_envelope_ = 0.0f;
+};
@@ -0,0 +1,260 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "scenario.h"
+
+#include <cmath>
+
+constexpr size_t stage_counts[] = {1, 8, 64, 256, 512, 4096};
+constexpr size_t channel_counts[] = {1, 2, 8, 64};
+constexpr size_t block_sizes[] = {16, 64, 512, 2048, 8192};
+constexpr int smoothing_intervals[] = {1, 16, 128, 512};
+constexpr Automation automations[] = {Automation::none, Automation::stepped,
+                                      Automation::sweep};
+constexpr Limiter limiters[] = {Limiter::off, Limiter::idle, Limiter::active};
+
+/**
+ * The number of stages for which the limiter is compared in all three modes.
+ */
+constexpr size_t limiter_stages = 64;
+
+/**
+ * White noise at -12 dBFS stays below the limiter's knee, and white noise
+ * at +6 dBFS keeps it reducing the gain.
+ */
+constexpr float quiet_input_amplitude = 0.25f;
+constexpr float loud_input_amplitude = 2.0f;
+
+/**
+ * The spread used for the 'spread on' scenarios, in Hertz.
+ */
+constexpr float enabled_spread = 2000.0f;
+
+/**
+ * The frequencies the stepped automation cycles through.
+ */
+constexpr float stepped_frequencies[] = {200.0f, 1500.0f, 80.0f, 5000.0f,
+                                         600.0f};
+constexpr double stepped_interval_secs = 0.1;
+
+constexpr float sweep_min_frequency = 50.0f;
+constexpr float sweep_max_frequency = 10000.0f;
+constexpr double sweep_period_secs = 2.0;
+
+/**
+ * In rotation mode, this frequency maps to an angle of zero, and the sweep's
+ * maximum frequency maps to 180 degrees.
+ */
+constexpr float rotation_center_frequency = 200.0f;
+constexpr float rotation_max_frequency = sweep_max_frequency;
+
+const char* automation_name(Automation automation) {
+    switch (automation) {
+        case Automation::stepped:
+            return "stepped";
+        case Automation::sweep:
+            return "sweep";
+        case Automation::none:
+        default:
+            return "static";
+    }
+}
+
+const char* limiter_name(Limiter limiter) {
+    switch (limiter) {
+        case Limiter::off:
+            return "off";
+        case Limiter::active:
+            return "active";
+        case Limiter::idle:
+        default:
+            return "idle";
+    }
+}
+
+std::string Scenario::name() const {
+    std::string spread_name = "off";
+    if (spread != 0.0f) {
+        spread_name = spread_linear ? "linear" : "log";
+    }
+
+    return std::string(automation_name(automation)) +
+           "/stages:" + std::to_string(stages) +
+           "/channels:" + std::to_string(channels) +
+           "/block:" + std::to_string(block_size) + "/spread:" + spread_name +
+           "/interval:" + std::to_string(smoothing_interval) +
+           (rotation_mode ? "/rotation" : "") +
+           // The default is left out so the names still match older results
+           (limiter != Limiter::idle
+                ? std::string("/limiter:") + limiter_name(limiter)
+                : "");
+}
+
+DiopserEngine::Parameters Scenario::parameters_for_block(
+    size_t block_idx,
+    double sample_rate) const {
+    const double time = static_cast<double>(block_idx * block_size) / sample_rate;
+
+    float frequency = 200.0f;
+    switch (automation) {
+        case Automation::stepped: {
+            const size_t step =
+                static_cast<size_t>(time / stepped_interval_secs);
+            frequency = stepped_frequencies[step % std::size(stepped_frequencies)];
+        } break;
+        case Automation::sweep: {
+            // A triangle wave on a logarithmic scale
+            const double phase = std::fmod(time / sweep_period_secs, 1.0);
+            const double position = phase < 0.5 ? phase * 2.0 : 2.0 - (phase * 2.0);
+            frequency = static_cast<float>(
+                sweep_min_frequency *
+                std::pow(sweep_max_frequency / sweep_min_frequency, position));
+        } break;
+        case Automation::none:
+        default:
+            break;
+    }
+
+    // The rotation angle follows the frequency's position on a logarithmic
+    // scale, so it changes in the same way
+    const float rotation_angle =
+        (std::log(frequency / rotation_center_frequency) /
+         std::log(rotation_max_frequency / rotation_center_frequency)) *
+        180.0f;
+
+    return DiopserEngine::Parameters{.frequency = frequency,
+                                     .resonance = 0.5f,
+                                     .spread = spread,
+                                     .spread_linear = spread_linear,
+                                     .smoothing_interval = smoothing_interval,
+                                     .safe_mode = limiter != Limiter::off,
+                                     .gesture_in_progress = false,
+                                     .rotation_mode = rotation_mode,
+                                     .rotation_angle = rotation_angle};
+}
+
+float Scenario::input_amplitude() const {
+    return limiter == Limiter::active ? loud_input_amplitude
+                                      : quiet_input_amplitude;
+}
+
+std::vector<Scenario> build_scenarios(bool full_grid) {
+    std::vector<Scenario> scenarios;
+
+    // Spread off, logarithmic spread, and linear spread
+    const std::pair<float, bool> spreads[] = {
+        {0.0f, false}, {enabled_spread, false}, {enabled_spread, true}};
+
+    if (full_grid) {
+        for (const auto automation : automations) {
+            for (const auto stages : stage_counts) {
+                for (const auto channels : channel_counts) {
+                    for (const auto block_size : block_sizes) {
+                        for (const auto& [spread, spread_linear] : spreads) {
+                            for (const auto interval : smoothing_intervals) {
+                                for (const auto limiter : limiters) {
+                                    if (limiter != Limiter::idle &&
+                                        stages != limiter_stages) {
+                                        continue;
+                                    }
+
+                                    Scenario scenario{
+                                        .stages = stages,
+                                        .channels = channels,
+                                        .block_size = block_size,
+                                        .spread = spread,
+                                        .spread_linear = spread_linear,
+                                        .smoothing_interval = interval,
+                                        .automation = automation};
+                                    scenario.limiter = limiter;
+                                    scenarios.push_back(scenario);
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+
+            Scenario rotation{.automation = automation};
+            rotation.rotation_mode = true;
+            scenarios.push_back(rotation);
+        }
+
+        return scenarios;
+    }
+
+    // Every axis is swept for every kind of automation, with all other values
+    // set to the defaults. Duplicates of the default scenario are skipped.
+    for (const auto automation : automations) {
+        const Scenario base{.automation = automation};
+        scenarios.push_back(base);
+
+        for (const auto stages : stage_counts) {
+            if (stages != base.stages) {
+                Scenario scenario = base;
+                scenario.stages = stages;
+                scenarios.push_back(scenario);
+            }
+        }
+        for (const auto channels : channel_counts) {
+            if (channels != base.channels) {
+                Scenario scenario = base;
+                scenario.channels = channels;
+                scenarios.push_back(scenario);
+            }
+        }
+        for (const auto block_size : block_sizes) {
+            if (block_size != base.block_size) {
+                Scenario scenario = base;
+                scenario.block_size = block_size;
+                scenarios.push_back(scenario);
+            }
+        }
+        for (const auto& [spread, spread_linear] : spreads) {
+            if (spread != base.spread) {
+                Scenario scenario = base;
+                scenario.spread = spread;
+                scenario.spread_linear = spread_linear;
+                scenarios.push_back(scenario);
+            }
+        }
+        for (const auto interval : smoothing_intervals) {
+            if (interval != base.smoothing_interval) {
+                Scenario scenario = base;
+                scenario.smoothing_interval = interval;
+                scenarios.push_back(scenario);
+            }
+        }
+
+        // The default scenario uses 64 stages, so this is the reference point
+        // for the limiter's cost
+        for (const auto limiter : limiters) {
+            if (limiter != base.limiter) {
+                Scenario scenario = base;
+                scenario.limiter = limiter;
+                scenarios.push_back(scenario);
+            }
+        }
+
+        // The rotation mode's cost doesn't depend on the number of stages,
+        // so it's only compared against the default scenario
+        Scenario rotation = base;
+        rotation.rotation_mode = true;
+        scenarios.push_back(rotation);
+    }
+
+    return scenarios;
+}
@@ -0,0 +1,113 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "core/engine.h"
+
+/**
+ * How the parameters change while a benchmark is running.
+ */
+enum class Automation {
+    /**
+     * The parameters never change, so the coefficients are only computed once.
+     */
+    none,
+    /**
+     * The frequency jumps to a new value every 100 milliseconds, like stepped
+     * host automation. The smoothers are busy most of the time.
+     */
+    stepped,
+    /**
+     * The frequency sweeps up and down continuously and gets a new target on
+     * every block, like a user turning a knob.
+     */
+    sweep,
+};
+
+const char* automation_name(Automation automation);
+
+/**
+ * What the safe mode limiter does during a benchmark. Comparing these shows
+ * what the limiter costs on top of the filters.
+ */
+enum class Limiter {
+    /**
+     * The safe mode is disabled.
+     */
+    off,
+    /**
+     * The safe mode is enabled, but the input is quiet enough that the
+     * limiter never reaches its knee. This is the common case.
+     */
+    idle,
+    /**
+     * The safe mode is enabled and the input is loud enough that the limiter
+     * is reducing the gain nearly all of the time.
+     */
+    active,
+};
+
+const char* limiter_name(Limiter limiter);
+
+/**
+ * A single point in the benchmark grid.
+ */
+struct Scenario {
+    size_t stages = 64;
+    size_t channels = 2;
+    size_t block_size = 512;
+    float spread = 0.0f;
+    bool spread_linear = false;
+    int smoothing_interval = 128;
+    Automation automation = Automation::none;
+    /**
+     * Use the engine's rotation mode instead of the filter cascade. The
+     * automation then moves the rotation angle, and the number of stages and
+     * the spread don't matter.
+     */
+    bool rotation_mode = false;
+    Limiter limiter = Limiter::idle;
+
+    /**
+     * A unique, human readable name for this scenario, used to match results
+     * between runs.
+     */
+    std::string name() const;
+
+    /**
+     * The engine's parameters for the block at `block_idx`.
+     */
+    DiopserEngine::Parameters parameters_for_block(size_t block_idx,
+                                                   double sample_rate) const;
+
+    /**
+     * The peak amplitude of the white noise used as the input.
+     */
+    float input_amplitude() const;
+};
+
+/**
+ * Build the benchmark grid. With `full_grid` every combination of the values
+ * below is used. Otherwise a single axis is varied at a time around the
+ * default scenario, which keeps the run time reasonable while still showing
+ * how each dimension scales. The limiter is only varied for the scenarios
+ * with 64 stages, which is the reference point for its cost.
+ */
+std::vector<Scenario> build_scenarios(bool full_grid);
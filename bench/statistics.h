@@ -0,0 +1,64 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+/**
+ * Summary statistics for a set of repeated measurements. The median and the
+ * median absolute deviation are used instead of the mean and the standard
+ * deviation because benchmark timings have long tails from interrupts and
+ * context switches.
+ */
+struct Statistics {
+    double median = 0.0;
+    /**
+     * The median absolute deviation from the median.
+     */
+    double mad = 0.0;
+    double min = 0.0;
+    double max = 0.0;
+
+    static Statistics from(std::vector<double> values) {
+        if (values.empty()) {
+            return Statistics{};
+        }
+
+        Statistics statistics;
+        statistics.median = median_of(values);
+        statistics.min = *std::min_element(values.begin(), values.end());
+        statistics.max = *std::max_element(values.begin(), values.end());
+
+        for (auto& value : values) {
+            value = std::abs(value - statistics.median);
+        }
+        statistics.mad = median_of(values);
+
+        return statistics;
+    }
+
+   private:
+    static double median_of(std::vector<double>& values) {
+        std::sort(values.begin(), values.end());
+        const size_t middle = values.size() / 2;
+        return values.size() % 2 == 1
+                   ? values[middle]
+                   : (values[middle - 1] + values[middle]) / 2.0;
+    }
+};
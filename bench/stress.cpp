@@ -0,0 +1,683 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Drives `DiopserEngine` the way a hostile host would: blocks of varying and
+// zero length, `prepare()` storms with changing sample rates, block sizes
+// and channel counts, fewer channels than were prepared, and parameter
+// changes flooded in from several threads while a simulated message thread
+// keeps resizing the filters. Some of the stage changes are faded, and the
+// rotation mode's angle gets ramped smoothly. Neither of those may click.
+// The output is checked for NaNs, infinities and discontinuities, and
+// whenever the parameter threads are paused the number of active stages is
+// checked against the last requested value to catch dropped stage changes.
+// This is meant to be built with `-DDIOPSER_SANITIZER=thread` or
+// `-DDIOPSER_SANITIZER=address`, which catch the problems that don't show up
+// in the output. Run with `--help` for the available options.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <numbers>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "core/denormals.h"
+#include "core/engine.h"
+
+using clock_type = std::chrono::steady_clock;
+
+constexpr double sample_rates[] = {22050.0, 44100.0, 48000.0,
+                                   96000.0, 192000.0};
+constexpr size_t max_channels = 8;
+constexpr size_t max_stages = 512;
+
+/**
+ * Glitches caused by the way blocks are handled show up as a jump between the
+ * last sample of one block and the first sample of the next one. With high
+ * resonance settings and safe mode disabled the output can legitimately jump
+ * around a lot, so a jump at a block boundary only counts as a discontinuity
+ * if it's this many times larger than the largest jump within the blocks on
+ * either side of it. Resetting the filters after a stage count change and
+ * toggling the boolean parameters are allowed to cause clicks, and so are the
+ * coefficient updates when the smoothing interval is larger than a single
+ * sample, so blocks where that may have happened aren't checked.
+ */
+constexpr float discontinuity_factor = 8.0f;
+/**
+ * Jumps smaller than this never count as discontinuities. The test signal is a
+ * 110 Hz sine at -12 dBFS, which changes by at most 0.025 per sample at the
+ * lowest sample rate.
+ */
+constexpr float min_discontinuity = 0.05f;
+/**
+ * Blocks shorter than this don't say much about how much the signal normally
+ * moves, so boundaries next to them aren't checked.
+ */
+constexpr size_t min_checked_block_size = 16;
+/**
+ * How long `DiopserEngine::fade_to_num_stages()` takes to fade out before it
+ * swaps in the new filters.
+ */
+constexpr double stage_fade_secs = 0.01;
+
+struct Options {
+    double duration_secs = 10.0;
+    uint32_t seed = 1;
+    size_t num_parameter_threads = 3;
+    bool verbose = false;
+};
+
+/**
+ * The plugin's parameters as the parameter threads see them. These are
+ * atomics, just like the values in JUCE's `AudioProcessorValueTreeState`.
+ */
+struct SharedParameters {
+    std::atomic<float> frequency = 200.0f;
+    std::atomic<float> resonance = 0.5f;
+    std::atomic<float> spread = 0.0f;
+    std::atomic_bool spread_linear = false;
+    std::atomic_int smoothing_interval = 128;
+    std::atomic_bool safe_mode = true;
+    std::atomic_bool gesture_in_progress = false;
+    std::atomic_bool rotation_mode = false;
+    std::atomic<float> rotation_angle = 0.0f;
+
+    std::atomic<size_t> num_stages = 16;
+    /**
+     * Set whenever `num_stages` changes, like the plugin's
+     * `LambdaAsyncUpdater`. The message thread clears this and then resizes
+     * the filters.
+     */
+    std::atomic_bool num_stages_changed = false;
+    /**
+     * Set along with `num_stages_changed` when the change should be faded,
+     * like toggling the plugin's extended stage range.
+     */
+    std::atomic_bool fade_stage_change = false;
+
+    DiopserEngine::Parameters load() const {
+        return DiopserEngine::Parameters{
+            .frequency = frequency.load(),
+            .resonance = resonance.load(),
+            .spread = spread.load(),
+            .spread_linear = spread_linear.load(),
+            .smoothing_interval = smoothing_interval.load(),
+            .safe_mode = safe_mode.load(),
+            .gesture_in_progress = gesture_in_progress.load(),
+            .rotation_mode = rotation_mode.load(),
+            .rotation_angle = rotation_angle.load()};
+    }
+};
+
+/**
+ * Used to stop the parameter threads and the message thread so the engine's
+ * state can be checked against the last requested parameter values.
+ */
+struct Pause {
+    std::atomic_bool requested = false;
+    /**
+     * The number of threads that have seen `requested` and stopped touching
+     * anything.
+     */
+    std::atomic<size_t> num_paused = 0;
+
+    /**
+     * Called from the worker threads. Blocks while a pause is requested.
+     */
+    void wait_if_requested() {
+        if (!requested.load()) {
+            return;
+        }
+
+        num_paused += 1;
+        while (requested.load()) {
+            std::this_thread::yield();
+        }
+        num_paused -= 1;
+    }
+};
+
+/**
+ * Everything that went wrong, and the slowest blocks.
+ */
+struct Report {
+    size_t num_blocks = 0;
+    size_t num_samples = 0;
+    size_t num_prepares = 0;
+    size_t num_stage_changes = 0;
+    size_t num_faded_stage_changes = 0;
+    size_t num_checks = 0;
+
+    size_t non_finite_samples = 0;
+    size_t discontinuities = 0;
+    size_t dropped_stage_changes = 0;
+
+    /**
+     * The largest jump at a block boundary relative to the largest jump within
+     * the surrounding blocks, for the checked boundaries.
+     */
+    float max_boundary_jump_ratio = 0.0f;
+    double worst_block_us = 0.0;
+    size_t worst_block_size = 0;
+    double worst_us_per_sample = 0.0;
+
+    bool failed() const {
+        return non_finite_samples > 0 || discontinuities > 0 ||
+               dropped_stage_changes > 0;
+    }
+};
+
+static void print_usage(const char* program_name) {
+    std::cerr << "Usage: " << program_name << " [options]\n"
+              << "\n"
+              << "Options:\n"
+              << "  --duration <secs>       How long to run (default: 10)\n"
+              << "  --seed <n>              (default: 1)\n"
+              << "  --parameter-threads <n> Number of threads flooding "
+                 "parameter changes (default: 3)\n"
+              << "  --verbose               Print every problem as it "
+                 "happens\n";
+}
+
+/**
+ * Randomly changes parameters, including the number of stages. Some changes
+ * come in bursts, like a host sending automation. The threads sleep a little
+ * between changes, since otherwise they would starve the audio thread on
+ * machines with few cores.
+ */
+static void run_parameter_thread(SharedParameters& parameters,
+                                 Pause& pause,
+                                 const std::atomic_bool& done,
+                                 uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    while (!done.load()) {
+        pause.wait_if_requested();
+
+        switch (rng() % 10) {
+            case 0:
+            case 1:
+                parameters.frequency =
+                    5.0f + (19995.0f * std::pow(unit(rng), 5.0f));
+                break;
+            case 2:
+                parameters.resonance =
+                    0.01f + (29.99f * std::pow(unit(rng), 5.0f));
+                break;
+            case 3:
+                parameters.spread =
+                    rng() % 4 == 0 ? 0.0f : (unit(rng) - 0.5f) * 10000.0f;
+                break;
+            case 4:
+                parameters.spread_linear = rng() % 2 == 0;
+                parameters.safe_mode = rng() % 8 != 0;
+                break;
+            case 5:
+                // Discontinuities are only checked with per-sample smoothing
+                parameters.smoothing_interval =
+                    rng() % 3 == 0 ? 1 : 1 + static_cast<int>(rng() % 512);
+                parameters.gesture_in_progress = rng() % 2 == 0;
+                break;
+            case 6:
+                // These are the interesting ones, so they're the most likely
+                // to be changed in a burst
+                for (int i = 0, burst = 1 + static_cast<int>(rng() % 4);
+                     i < burst; i++) {
+                    parameters.num_stages =
+                        rng() % 8 == 0 ? 0 : rng() % (max_stages + 1);
+                    if (rng() % 4 == 0) {
+                        parameters.fade_stage_change = true;
+                    }
+                    parameters.num_stages_changed = true;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                break;
+            case 7:
+                parameters.rotation_mode = rng() % 2 == 0;
+                break;
+            case 8: {
+                // Rotation angle automation is a smooth ramp, and the output
+                // should not click at any point during it
+                const float target = (unit(rng) - 0.5f) * 360.0f;
+                const float start = parameters.rotation_angle.load();
+                for (int step = 1; step <= 32; step++) {
+                    parameters.rotation_angle =
+                        start + ((target - start) *
+                                 (static_cast<float>(step) / 32.0f));
+                    std::this_thread::sleep_for(
+                        std::chrono::microseconds(100));
+                }
+                break;
+            }
+            default:
+                std::this_thread::sleep_for(
+                    std::chrono::microseconds(rng() % 500));
+                break;
+        }
+
+        std::this_thread::sleep_for(std::chrono::microseconds(rng() % 50));
+    }
+}
+
+/**
+ * Resizes the filters whenever the number of stages changes, like
+ * `DiopserProcessor::update_and_swap_filters()` does on the message thread.
+ * Some of those changes are faded.
+ */
+static void run_message_thread(DiopserEngine& engine,
+                               SharedParameters& parameters,
+                               Pause& pause,
+                               const std::atomic_bool& done,
+                               std::atomic<size_t>& num_stage_changes,
+                               std::atomic<size_t>& num_faded_stage_changes) {
+    while (!done.load()) {
+        // All pending changes need to be handled before pausing
+        if (parameters.num_stages_changed.exchange(false)) {
+            const size_t num_stages = parameters.num_stages.load();
+            if (parameters.fade_stage_change.exchange(false)) {
+                engine.fade_to_num_stages(num_stages);
+                num_faded_stage_changes += 1;
+            } else {
+                engine.set_num_stages(num_stages);
+            }
+            num_stage_changes += 1;
+        } else {
+            pause.wait_if_requested();
+            std::this_thread::yield();
+        }
+    }
+}
+
+/**
+ * The simulated host's audio thread. Everything that touches the engine other
+ * than `set_num_stages()` happens here, since hosts also never call
+ * `prepareToPlay()` while processing audio.
+ */
+class AudioThread {
+   public:
+    AudioThread(DiopserEngine& engine,
+                SharedParameters& parameters,
+                const std::atomic<size_t>& num_stage_changes,
+                const Options& options)
+        : engine_(engine),
+          parameters_(parameters),
+          num_stage_changes_(num_stage_changes),
+          options_(options),
+          rng_(options.seed),
+          buffers_(max_channels),
+          last_output_(max_channels, 0.0f),
+          last_max_jump_(max_channels, 0.0f) {}
+
+    /**
+     * Reinitialize the engine with a random configuration, possibly several
+     * times in a row.
+     */
+    void prepare_storm() {
+        const size_t num_prepares = 1 + (rng_() % 4);
+        for (size_t i = 0; i < num_prepares; i++) {
+            if (rng_() % 4 == 0) {
+                engine_.release();
+            }
+
+            sample_rate_ = sample_rates[rng_() % std::size(sample_rates)];
+            max_block_size_ = size_t(1) << (4 + (rng_() % 8));
+            num_channels_ = 1 + (rng_() % max_channels);
+            for (auto& buffer : buffers_) {
+                buffer.resize(max_block_size_);
+            }
+
+            prepared_smoothing_interval_ = parameters_.smoothing_interval;
+            engine_.prepare(sample_rate_, max_block_size_, num_channels_,
+                            parameters_.num_stages.load(),
+                            prepared_smoothing_interval_);
+            report_.num_prepares += 1;
+        }
+
+        filters_may_have_reset_ = true;
+    }
+
+    /**
+     * Process a single block with a random size and channel count.
+     */
+    void process_block() {
+        size_t num_samples;
+        switch (rng_() % 8) {
+            case 0:
+                num_samples = 0;
+                break;
+            case 1:
+                num_samples = 1;
+                break;
+            case 2:
+                num_samples = max_block_size_;
+                break;
+            default:
+                num_samples = rng_() % (max_block_size_ + 1);
+                break;
+        }
+        // Hosts may also process fewer channels than they prepared for
+        const size_t num_channels =
+            rng_() % 8 == 0 ? 1 + (rng_() % num_channels_) : num_channels_;
+
+        process(num_samples, num_channels);
+    }
+
+    /**
+     * Run a couple of blocks after all stage changes have been handled, and
+     * check that the last one actually took effect. A faded change only
+     * takes effect at the start of the first block after the output has
+     * faded out, so this first processes a little more than a fade's worth
+     * of samples.
+     */
+    void check_stages() {
+        const size_t fade_samples =
+            static_cast<size_t>(stage_fade_secs * sample_rate_) + 64;
+        for (size_t processed = 0; processed < fade_samples;) {
+            const size_t block_size =
+                std::min(max_block_size_, fade_samples - processed);
+            process(block_size, num_channels_);
+            processed += block_size;
+        }
+        process(std::min<size_t>(64, max_block_size_), num_channels_);
+        report_.num_checks += 1;
+
+        const size_t expected = parameters_.num_stages.load();
+        const size_t actual = engine_.num_stages();
+        if (actual != expected) {
+            report_.dropped_stage_changes += 1;
+            if (options_.verbose) {
+                std::cerr << "Expected " << expected
+                          << " stages after a pause, found " << actual << '\n';
+            }
+        }
+    }
+
+    Report& report() { return report_; }
+
+   private:
+    void process(size_t num_samples, size_t num_channels) {
+        constexpr double pi = std::numbers::pi;
+        const double phase_delta = 2.0 * pi * 110.0 / sample_rate_;
+
+        float* channel_pointers[max_channels];
+        for (size_t channel = 0; channel < num_channels; channel++) {
+            double phase = phase_;
+            for (size_t i = 0; i < num_samples; i++) {
+                buffers_[channel][i] =
+                    static_cast<float>(0.25 * std::sin(phase));
+                phase += phase_delta;
+            }
+
+            channel_pointers[channel] = buffers_[channel].data();
+        }
+        phase_ = std::fmod(phase_ + (phase_delta * static_cast<double>(
+                                                       num_samples)),
+                           2.0 * pi);
+
+        // A stage change that finished before this point will be swapped in
+        // during this block, which resets the filters
+        const size_t stage_changes_before = num_stage_changes_.load();
+        const DiopserEngine::Parameters parameters = parameters_.load();
+        const bool may_have_reset =
+            filters_may_have_reset_ ||
+            stage_changes_before != last_stage_changes_ ||
+            num_channels != last_num_channels_ ||
+            parameters.spread_linear != last_parameters_.spread_linear ||
+            parameters.safe_mode != last_parameters_.safe_mode ||
+            parameters.rotation_mode != last_parameters_.rotation_mode;
+        // The smoothers' step size depends on the smoothing interval passed to
+        // `prepare()`, so both need to be a single sample for the
+        // coefficients to change gradually. The rotation mode smooths its
+        // angle per sample regardless.
+        const bool coefficients_may_step =
+            !parameters.rotation_mode &&
+            (parameters.smoothing_interval != 1 ||
+             prepared_smoothing_interval_ != 1 ||
+             parameters.gesture_in_progress);
+
+        const auto start = clock_type::now();
+        engine_.process(channel_pointers, num_channels, num_samples,
+                        parameters);
+        const double block_us =
+            std::chrono::duration<double, std::micro>(clock_type::now() -
+                                                      start)
+                .count();
+
+        check_output(channel_pointers, num_channels, num_samples,
+                     may_have_reset || coefficients_may_step);
+
+        report_.num_blocks += 1;
+        report_.num_samples += num_samples;
+        if (block_us > report_.worst_block_us) {
+            report_.worst_block_us = block_us;
+            report_.worst_block_size = num_samples;
+        }
+        if (num_samples > 0) {
+            report_.worst_us_per_sample =
+                std::max(report_.worst_us_per_sample,
+                         block_us / static_cast<double>(num_samples));
+        }
+
+        // Every stage change that finished before the counter was read has
+        // been swapped in by now, but the reset only shows up in the output
+        // once there's a nonzero number of samples to process
+        filters_may_have_reset_ = num_samples == 0 && may_have_reset;
+        last_stage_changes_ = stage_changes_before;
+        last_num_channels_ = num_channels;
+        last_parameters_ = parameters;
+    }
+
+    void check_output(float* const* samples,
+                      size_t num_channels,
+                      size_t num_samples,
+                      bool may_click) {
+        for (size_t channel = 0; channel < num_channels; channel++) {
+            if (num_samples == 0) {
+                continue;
+            }
+
+            float max_jump = 0.0f;
+            for (size_t i = 0; i < num_samples; i++) {
+                const float sample = samples[channel][i];
+                if (!std::isfinite(sample)) {
+                    report_.non_finite_samples += 1;
+                    if (options_.verbose) {
+                        std::cerr << "Non-finite sample in block "
+                                  << report_.num_blocks << '\n';
+                    }
+                } else if (i > 0) {
+                    max_jump = std::max(
+                        max_jump, std::abs(sample - samples[channel][i - 1]));
+                }
+            }
+
+            const float boundary_jump =
+                std::abs(samples[channel][0] - last_output_[channel]);
+            const float reference_jump =
+                std::max(max_jump, last_max_jump_[channel]);
+            if (!may_click && num_samples >= min_checked_block_size &&
+                last_block_size_ >= min_checked_block_size &&
+                std::isfinite(boundary_jump)) {
+                report_.max_boundary_jump_ratio =
+                    std::max(report_.max_boundary_jump_ratio,
+                             boundary_jump / std::max(reference_jump, 1e-6f));
+                if (boundary_jump > min_discontinuity &&
+                    boundary_jump > discontinuity_factor * reference_jump) {
+                    report_.discontinuities += 1;
+                    if (options_.verbose) {
+                        std::cerr << "Jump of " << boundary_jump
+                                  << " at the start of block "
+                                  << report_.num_blocks << " on channel "
+                                  << channel << ", the largest jump around it "
+                                  << "was " << reference_jump << '\n';
+                    }
+                }
+            }
+
+            last_output_[channel] = samples[channel][num_samples - 1];
+            last_max_jump_[channel] = max_jump;
+        }
+
+        if (num_samples > 0) {
+            last_block_size_ = num_samples;
+        }
+    }
+
+    DiopserEngine& engine_;
+    SharedParameters& parameters_;
+    const std::atomic<size_t>& num_stage_changes_;
+    const Options& options_;
+    std::mt19937 rng_;
+
+    double sample_rate_ = 48000.0;
+    int prepared_smoothing_interval_ = 128;
+    size_t max_block_size_ = 512;
+    size_t num_channels_ = 2;
+    std::vector<std::vector<float>> buffers_;
+    double phase_ = 0.0;
+
+    std::vector<float> last_output_;
+    std::vector<float> last_max_jump_;
+    size_t last_block_size_ = 0;
+    size_t last_stage_changes_ = 0;
+    size_t last_num_channels_ = 0;
+    DiopserEngine::Parameters last_parameters_;
+    bool filters_may_have_reset_ = true;
+
+    Report report_;
+};
+
+int main(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (arg == "--duration" && has_value) {
+            options.duration_secs = std::atof(argv[++i]);
+        } else if (arg == "--seed" && has_value) {
+            options.seed = static_cast<uint32_t>(std::stoul(argv[++i]));
+        } else if (arg == "--parameter-threads" && has_value) {
+            options.num_parameter_threads =
+                static_cast<size_t>(std::max(1, std::atoi(argv[++i])));
+        } else if (arg == "--verbose") {
+            options.verbose = true;
+        } else {
+            print_usage(argv[0]);
+            return arg == "--help" || arg == "-h" ? 0 : 1;
+        }
+    }
+
+    DiopserEngine engine;
+    SharedParameters parameters;
+    std::atomic<size_t> num_stage_changes = 0;
+    std::atomic<size_t> num_faded_stage_changes = 0;
+
+    // The parameter threads are paused first, and the message thread is only
+    // paused after it has handled the last stage change
+    Pause parameter_pause;
+    Pause message_pause;
+    std::atomic_bool done = false;
+
+    const ScopedFlushDenormals flush_denormals;
+    AudioThread audio_thread(engine, parameters, num_stage_changes, options);
+    audio_thread.prepare_storm();
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < options.num_parameter_threads; i++) {
+        threads.emplace_back(run_parameter_thread, std::ref(parameters),
+                             std::ref(parameter_pause), std::cref(done),
+                             options.seed + 1 + static_cast<uint32_t>(i));
+    }
+    threads.emplace_back(run_message_thread, std::ref(engine),
+                         std::ref(parameters), std::ref(message_pause),
+                         std::cref(done), std::ref(num_stage_changes),
+                         std::ref(num_faded_stage_changes));
+
+    std::mt19937 rng(options.seed);
+    const auto start = clock_type::now();
+    const auto deadline =
+        start + std::chrono::duration_cast<clock_type::duration>(
+                    std::chrono::duration<double>(options.duration_secs));
+    while (clock_type::now() < deadline) {
+        const size_t num_blocks = 50 + (rng() % 150);
+        for (size_t i = 0; i < num_blocks; i++) {
+            if (rng() % 100 == 0) {
+                audio_thread.prepare_storm();
+            }
+
+            audio_thread.process_block();
+        }
+
+        parameter_pause.requested = true;
+        while (parameter_pause.num_paused.load() <
+               options.num_parameter_threads) {
+            std::this_thread::yield();
+        }
+        message_pause.requested = true;
+        while (message_pause.num_paused.load() < 1) {
+            std::this_thread::yield();
+        }
+
+        audio_thread.check_stages();
+
+        message_pause.requested = false;
+        parameter_pause.requested = false;
+    }
+
+    done = true;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    Report& report = audio_thread.report();
+    report.num_stage_changes = num_stage_changes.load();
+    report.num_faded_stage_changes = num_faded_stage_changes.load();
+
+    std::cout << "Processed " << report.num_blocks << " blocks ("
+              << report.num_samples << " samples) with "
+              << report.num_prepares << " prepares and "
+              << report.num_stage_changes << " stage changes ("
+              << report.num_faded_stage_changes << " faded)\n"
+              << "Worst block: " << report.worst_block_us << " us for "
+              << report.worst_block_size << " samples, worst per sample: "
+              << report.worst_us_per_sample << " us\n"
+              << "Largest relative jump at a block boundary: "
+              << report.max_boundary_jump_ratio << '\n'
+              << "Non-finite samples: " << report.non_finite_samples << '\n'
+              << "Discontinuities: " << report.discontinuities << '\n'
+              << "Dropped stage changes: " << report.dropped_stage_changes
+              << " out of " << report.num_checks << " checks\n";
+
+    // Failing to lock the memory isn't an error, but it does mean the filters
+    // could get swapped out on a system under memory pressure
+    const DiopserEngine::MemoryStats memory = engine.memory_stats();
+    std::cout << "Filter memory: " << memory.allocated_bytes << " bytes, "
+              << memory.locked_bytes << " locked, " << memory.lock_failures
+              << " allocations could not be locked\n";
+
+    if (report.failed()) {
+        std::cout << "FAILED\n";
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,355 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Hammers `AtomicallySwappable` with several writer threads calling
+// `modify_and_swap()` against a simulated audio thread calling `get()` once
+// per block. Every object carries the generation of the modification that
+// wrote it, and the audio thread checks that it never sees an object that's
+// only partially written, that the object doesn't change while it's being
+// used, and that the last modification is always swapped in eventually. It
+// also measures how long `get()` takes, and how long it takes for a finished
+// modification to become visible on the audio thread. This should be run
+// under ThreadSanitizer as well, see `DIOPSER_SANITIZER`. Run with `--help`
+// for the available options.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "core/atomically_swappable.h"
+
+using clock_type = std::chrono::steady_clock;
+
+/**
+ * The number of publication timestamps we keep around. A generation that's
+ * older than this by the time the audio thread sees it doesn't get a latency
+ * measurement.
+ */
+constexpr size_t timestamp_ring_size = 1 << 16;
+
+struct Options {
+    double duration_secs = 10.0;
+    size_t num_writers = 4;
+    /**
+     * Writers sleep for a random duration up to this long between
+     * modifications. With zero they modify back to back.
+     */
+    int max_writer_interval_us = 1000;
+    double sample_rate = 48000.0;
+    size_t block_size = 128;
+    /**
+     * Call `get()` as fast as possible instead of once per block.
+     */
+    bool fast = false;
+};
+
+/**
+ * The object being swapped. Its size depends on the generation so every
+ * modification has to reallocate, just like the filters do when the number
+ * of stages changes.
+ */
+struct Payload {
+    /**
+     * Zero while a modification is in progress.
+     */
+    uint64_t generation = 0;
+    std::vector<uint64_t> values;
+};
+
+static size_t payload_size(uint64_t generation) {
+    return 1 + static_cast<size_t>((generation * 7919) % 4096);
+}
+
+/**
+ * Everything that's shared between the writers and the audio thread, other
+ * than the `AtomicallySwappable` itself.
+ */
+struct Shared {
+    std::atomic<uint64_t> next_generation = 1;
+    /**
+     * The generation written by the modification that ran last. This is only
+     * written from within `modify_and_swap()`, so it's protected by the same
+     * lock as the objects.
+     */
+    uint64_t last_written_generation = 0;
+
+    /**
+     * When each generation's `modify_and_swap()` call returned, in
+     * nanoseconds since `start`, indexed by `generation %
+     * timestamp_ring_size`.
+     */
+    std::unique_ptr<std::atomic<int64_t>[]> published_at =
+        std::make_unique<std::atomic<int64_t>[]>(timestamp_ring_size);
+    clock_type::time_point start = clock_type::now();
+
+    std::atomic<size_t> num_modifications = 0;
+    std::atomic_bool done = false;
+
+    int64_t now_ns() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   clock_type::now() - start)
+            .count();
+    }
+};
+
+struct Report {
+    size_t num_gets = 0;
+    size_t num_swaps_observed = 0;
+
+    /**
+     * Objects with a generation of zero, or whose contents didn't match their
+     * generation.
+     */
+    size_t partial_observations = 0;
+    /**
+     * Objects that changed while the audio thread was using them.
+     */
+    size_t modified_while_active = 0;
+    bool last_modification_lost = false;
+
+    std::vector<double> get_ns;
+    std::vector<double> visible_latency_us;
+
+    bool failed() const {
+        return partial_observations > 0 || modified_while_active > 0 ||
+               last_modification_lost;
+    }
+};
+
+static void print_usage(const char* program_name) {
+    std::cerr << "Usage: " << program_name << " [options]\n"
+              << "\n"
+              << "Options:\n"
+              << "  --duration <secs>        How long to run (default: 10)\n"
+              << "  --writers <n>            Number of writer threads "
+                 "(default: 4)\n"
+              << "  --writer-interval <us>   Maximum sleep between "
+                 "modifications, 0 for none (default: 1000)\n"
+              << "  --sample-rate <hz>       (default: 48000)\n"
+              << "  --block-size <n>         (default: 128)\n"
+              << "  --fast                   Call get() as fast as possible "
+                 "instead of once per block\n";
+}
+
+static void run_writer(AtomicallySwappable<Payload>& swappable,
+                       Shared& shared,
+                       const Options& options,
+                       uint32_t seed) {
+    std::mt19937 rng(seed);
+
+    while (!shared.done.load()) {
+        const uint64_t generation = shared.next_generation.fetch_add(1);
+        swappable.modify_and_swap([&](Payload& payload) {
+            // The generation is only set once everything else has been
+            // written, so a reader that sees a nonzero generation expects a
+            // complete object
+            payload.generation = 0;
+            payload.values.resize(payload_size(generation));
+            for (auto& value : payload.values) {
+                value = generation;
+            }
+            payload.generation = generation;
+
+            shared.last_written_generation = generation;
+        });
+
+        shared.published_at[generation % timestamp_ring_size] =
+            shared.now_ns();
+        shared.num_modifications += 1;
+
+        if (options.max_writer_interval_us > 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(
+                rng() % static_cast<uint32_t>(options.max_writer_interval_us)));
+        }
+    }
+}
+
+/**
+ * Check that an object was written completely by a single modification.
+ */
+static bool is_complete(const Payload& payload) {
+    return payload.generation != 0 &&
+           payload.values.size() == payload_size(payload.generation) &&
+           std::all_of(payload.values.begin(), payload.values.end(),
+                       [&](uint64_t value) {
+                           return value == payload.generation;
+                       });
+}
+
+static double percentile(std::vector<double>& values, double fraction) {
+    if (values.empty()) {
+        return 0.0;
+    }
+
+    std::sort(values.begin(), values.end());
+    const size_t index = std::min(
+        values.size() - 1,
+        static_cast<size_t>(fraction * static_cast<double>(values.size())));
+    return values[index];
+}
+
+static void print_distribution(const char* name,
+                               std::vector<double>& values,
+                               const char* unit) {
+    std::cout << name << " (" << values.size() << " samples): p50 "
+              << percentile(values, 0.5) << ' ' << unit << ", p99 "
+              << percentile(values, 0.99) << ' ' << unit << ", p99.9 "
+              << percentile(values, 0.999) << ' ' << unit << ", max "
+              << percentile(values, 1.0) << ' ' << unit << '\n';
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (arg == "--duration" && has_value) {
+            options.duration_secs = std::atof(argv[++i]);
+        } else if (arg == "--writers" && has_value) {
+            options.num_writers =
+                static_cast<size_t>(std::max(1, std::atoi(argv[++i])));
+        } else if (arg == "--writer-interval" && has_value) {
+            options.max_writer_interval_us = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--sample-rate" && has_value) {
+            options.sample_rate = std::atof(argv[++i]);
+        } else if (arg == "--block-size" && has_value) {
+            options.block_size =
+                static_cast<size_t>(std::max(1, std::atoi(argv[++i])));
+        } else if (arg == "--fast") {
+            options.fast = true;
+        } else {
+            print_usage(argv[0]);
+            return arg == "--help" || arg == "-h" ? 0 : 1;
+        }
+    }
+
+    AtomicallySwappable<Payload> swappable;
+    Shared shared;
+    swappable.modify_both([](Payload& payload) {
+        payload.generation = 0;
+        payload.values.clear();
+    });
+
+    std::vector<std::thread> writers;
+    for (size_t i = 0; i < options.num_writers; i++) {
+        writers.emplace_back(run_writer, std::ref(swappable), std::ref(shared),
+                             std::cref(options), static_cast<uint32_t>(i + 1));
+    }
+
+    Report report;
+    const auto block_period = std::chrono::duration_cast<clock_type::duration>(
+        std::chrono::duration<double>(static_cast<double>(options.block_size) /
+                                      options.sample_rate));
+    const auto deadline =
+        clock_type::now() +
+        std::chrono::duration_cast<clock_type::duration>(
+            std::chrono::duration<double>(options.duration_secs));
+
+    uint64_t last_generation = 0;
+    auto next_block = clock_type::now();
+    while (clock_type::now() < deadline) {
+        const auto get_start = clock_type::now();
+        const Payload& payload = swappable.get();
+        const auto get_end = clock_type::now();
+        report.get_ns.push_back(
+            std::chrono::duration<double, std::nano>(get_end - get_start)
+                .count());
+        report.num_gets += 1;
+
+        // Nothing has been written yet
+        if (payload.generation == 0 && payload.values.empty() &&
+            last_generation == 0) {
+            continue;
+        }
+
+        const uint64_t generation = payload.generation;
+        if (!is_complete(payload)) {
+            report.partial_observations += 1;
+        } else if (generation != last_generation) {
+            report.num_swaps_observed += 1;
+
+            // Generations that are too old have had their timestamp slot
+            // reused, and the timestamp may not have been written yet if the
+            // writer hasn't returned from `modify_and_swap()`
+            const uint64_t newest = shared.next_generation.load();
+            const int64_t published_at =
+                shared.published_at[generation % timestamp_ring_size].load();
+            if (newest - generation < timestamp_ring_size && published_at > 0) {
+                const int64_t latency_ns = shared.now_ns() - published_at;
+                if (latency_ns >= 0) {
+                    report.visible_latency_us.push_back(
+                        static_cast<double>(latency_ns) / 1000.0);
+                }
+            }
+
+            last_generation = generation;
+        }
+
+        // Pretend to process some audio, and then check whether the object
+        // was touched in the meantime
+        if (!options.fast) {
+            next_block += block_period;
+            std::this_thread::sleep_until(next_block - (block_period / 2));
+        }
+        if (payload.generation != generation || !is_complete(payload)) {
+            report.modified_while_active += 1;
+        }
+        if (!options.fast) {
+            std::this_thread::sleep_until(next_block);
+        }
+    }
+
+    shared.done = true;
+    for (auto& writer : writers) {
+        writer.join();
+    }
+
+    // The last modification must become visible even though no more
+    // modifications follow it
+    if (shared.num_modifications.load() > 0 &&
+        swappable.get().generation != shared.last_written_generation) {
+        report.last_modification_lost = true;
+    }
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << shared.num_modifications.load() << " modifications by "
+              << options.num_writers << " writers, " << report.num_gets
+              << " calls to get(), " << report.num_swaps_observed
+              << " swaps observed\n";
+    print_distribution("get()", report.get_ns, "ns");
+    print_distribution("Time until visible", report.visible_latency_us, "us");
+    std::cout << "Partially written objects: " << report.partial_observations
+              << '\n'
+              << "Objects modified while active: "
+              << report.modified_while_active << '\n'
+              << "Last modification lost: "
+              << (report.last_modification_lost ? "yes" : "no") << '\n';
+
+    if (report.failed()) {
+        std::cout << "FAILED\n";
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,815 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Checks every processing engine against `ReferenceEngine`, the scalar
+// implementation Diopser started out with. A fixed set of signals is run
+// through every engine using randomized but reproducible automation scripts,
+// including stage count changes and odd block sizes, and the outputs are
+// compared either bit for bit or within the engine's documented tolerance.
+// Scripts with editor gestures are compared against the reference within
+// `gesture_tolerance`, and every engine must match `DiopserEngine`'s gesture
+// path bit for bit. Parts of the core library the reference doesn't cover are
+// checked against their own documented behavior in `component_checks()`.
+// New engines, for instance ones using SIMD or a different order of
+// operations, should be added to `engines_under_test()` before they're used
+// in the plugin. Run with `--help` for the available options.
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <numbers>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "core/denormals.h"
+#include "component_checks.h"
+#include "core/engine.h"
+#include "reference_engine.h"
+
+constexpr double sample_rate = 48000.0;
+constexpr size_t signal_length = 24000;
+constexpr size_t max_block_size = 1024;
+
+/**
+ * How much an engine's output may deviate from the reference.
+ */
+struct Tolerance {
+    /**
+     * The maximum distance in units in the last place. Zero means that the
+     * output must be bit-identical.
+     */
+    int64_t max_ulps = 0;
+    /**
+     * The maximum absolute error relative to full scale, in decibels. Only
+     * checked when `max_ulps` is nonzero, since reordered arithmetic can
+     * cause large ULP differences for values close to zero.
+     */
+    double max_error_db = -120.0;
+};
+
+/**
+ * A type-erased wrapper around an engine with `DiopserEngine`'s interface.
+ */
+class Engine {
+   public:
+    virtual ~Engine() = default;
+
+    virtual void prepare(size_t num_channels,
+                         size_t num_stages,
+                         int smoothing_interval) = 0;
+    virtual void set_num_stages(size_t num_stages) = 0;
+    virtual void process(float* const* samples,
+                         size_t num_channels,
+                         size_t num_samples,
+                         const DiopserEngine::Parameters& parameters) = 0;
+};
+
+template <typename T>
+class EngineAdapter : public Engine {
+   public:
+    void prepare(size_t num_channels,
+                 size_t num_stages,
+                 int smoothing_interval) override {
+        engine_.prepare(sample_rate, max_block_size, num_channels, num_stages,
+                        smoothing_interval);
+    }
+
+    void set_num_stages(size_t num_stages) override {
+        engine_.set_num_stages(num_stages);
+    }
+
+    void process(float* const* samples,
+                 size_t num_channels,
+                 size_t num_samples,
+                 const DiopserEngine::Parameters& parameters) override {
+        engine_.process(samples, num_channels, num_samples, parameters);
+    }
+
+   private:
+    T engine_;
+};
+
+/**
+ * Runs `DiopserEngine`, but before every block its state is moved to a newly
+ * prepared engine using `save_state()` and `restore_state()`. Offline renders
+ * use these checkpoints to start in the middle of a file, so this has to match
+ * the reference bit for bit.
+ */
+class CheckpointingEngine : public Engine {
+   public:
+    void prepare(size_t num_channels,
+                 size_t num_stages,
+                 int smoothing_interval) override {
+        num_channels_ = num_channels;
+        smoothing_interval_ = smoothing_interval;
+
+        engine_ = std::make_unique<DiopserEngine>();
+        engine_->prepare(sample_rate, max_block_size, num_channels, num_stages,
+                         smoothing_interval);
+    }
+
+    void set_num_stages(size_t num_stages) override {
+        engine_->set_num_stages(num_stages);
+    }
+
+    void process(float* const* samples,
+                 size_t num_channels,
+                 size_t num_samples,
+                 const DiopserEngine::Parameters& parameters) override {
+        engine_->save_state(state_);
+
+        // The number of stages comes from the state
+        auto restored_engine = std::make_unique<DiopserEngine>();
+        restored_engine->prepare(sample_rate, max_block_size, num_channels_, 0,
+                                 smoothing_interval_);
+        if (!restored_engine->restore_state(state_)) {
+            std::cerr
+                << "restore_state() rejected a state from save_state()\n";
+            std::abort();
+        }
+        engine_ = std::move(restored_engine);
+
+        engine_->process(samples, num_channels, num_samples, parameters);
+    }
+
+   private:
+    std::unique_ptr<DiopserEngine> engine_;
+    DiopserEngine::State state_;
+
+    size_t num_channels_ = 0;
+    int smoothing_interval_ = 0;
+};
+
+/**
+ * Runs `DiopserEngine::process_interleaved()` by interleaving every block,
+ * processing it, and then copying it back.
+ */
+class InterleavedEngine : public Engine {
+   public:
+    void prepare(size_t num_channels,
+                 size_t num_stages,
+                 int smoothing_interval) override {
+        engine_.prepare(sample_rate, max_block_size, num_channels, num_stages,
+                        smoothing_interval);
+    }
+
+    void set_num_stages(size_t num_stages) override {
+        engine_.set_num_stages(num_stages);
+    }
+
+    void process(float* const* samples,
+                 size_t num_channels,
+                 size_t num_samples,
+                 const DiopserEngine::Parameters& parameters) override {
+        interleaved_.resize(num_channels * num_samples);
+        for (size_t sample_idx = 0; sample_idx < num_samples; sample_idx++) {
+            for (size_t channel = 0; channel < num_channels; channel++) {
+                interleaved_[(sample_idx * num_channels) + channel] =
+                    samples[channel][sample_idx];
+            }
+        }
+
+        engine_.process_interleaved(interleaved_.data(), num_channels,
+                                    num_samples, parameters);
+
+        for (size_t sample_idx = 0; sample_idx < num_samples; sample_idx++) {
+            for (size_t channel = 0; channel < num_channels; channel++) {
+                samples[channel][sample_idx] =
+                    interleaved_[(sample_idx * num_channels) + channel];
+            }
+        }
+    }
+
+   private:
+    DiopserEngine engine_;
+    std::vector<float> interleaved_;
+};
+
+/**
+ * Runs `DiopserEngine` with a fixed kernel instead of letting it choose one
+ * based on its timings, so both kernels are always covered.
+ */
+class FixedKernelEngine : public Engine {
+   public:
+    explicit FixedKernelEngine(DiopserEngine::Kernel kernel) {
+        engine_.set_kernel(kernel);
+    }
+
+    void prepare(size_t num_channels,
+                 size_t num_stages,
+                 int smoothing_interval) override {
+        engine_.prepare(sample_rate, max_block_size, num_channels, num_stages,
+                        smoothing_interval);
+    }
+
+    void set_num_stages(size_t num_stages) override {
+        engine_.set_num_stages(num_stages);
+    }
+
+    void process(float* const* samples,
+                 size_t num_channels,
+                 size_t num_samples,
+                 const DiopserEngine::Parameters& parameters) override {
+        engine_.process(samples, num_channels, num_samples, parameters);
+    }
+
+   private:
+    DiopserEngine engine_;
+};
+
+/**
+ * How much `DiopserEngine`'s output may deviate from the reference for the
+ * scripts from `generate_gesture_script()`. The gesture path skips ahead to
+ * where the smoothed parameters would be at the end of the block, so the
+ * coefficients lead the reference's by up to one block while a control is
+ * being dragged. With up to 16 stages and the parameters moving by up to one
+ * percent per block, the largest error over 2000 runs was about -22 dB.
+ */
+constexpr Tolerance gesture_tolerance{.max_ulps = 1, .max_error_db = -18.0};
+
+struct EngineUnderTest {
+    const char* name;
+    Tolerance tolerance;
+    std::function<std::unique_ptr<Engine>()> create;
+};
+
+/**
+ * Every engine that should produce the same output as the reference.
+ */
+static std::vector<EngineUnderTest> engines_under_test() {
+    return {
+        EngineUnderTest{
+            .name = "DiopserEngine",
+            .tolerance = Tolerance{.max_ulps = 0},
+            .create =
+                []() { return std::make_unique<EngineAdapter<DiopserEngine>>(); },
+        },
+        EngineUnderTest{
+            .name = "DiopserEngine (checkpointed)",
+            .tolerance = Tolerance{.max_ulps = 0},
+            .create = []() { return std::make_unique<CheckpointingEngine>(); },
+        },
+        EngineUnderTest{
+            .name = "DiopserEngine (interleaved)",
+            .tolerance = Tolerance{.max_ulps = 0},
+            .create = []() { return std::make_unique<InterleavedEngine>(); },
+        },
+        EngineUnderTest{
+            .name = "DiopserEngine (sample-major)",
+            .tolerance = Tolerance{.max_ulps = 0},
+            .create =
+                []() {
+                    return std::make_unique<FixedKernelEngine>(
+                        DiopserEngine::Kernel::sample_major);
+                },
+        },
+        EngineUnderTest{
+            .name = "DiopserEngine (pipelined)",
+            .tolerance = Tolerance{.max_ulps = 0},
+            .create =
+                []() {
+                    return std::make_unique<FixedKernelEngine>(
+                        DiopserEngine::Kernel::pipelined);
+                },
+        },
+    };
+}
+
+/**
+ * The test signals. Every signal is generated per channel, with slight
+ * differences between channels so channel mixups are caught.
+ */
+enum class Signal { impulse, sweep, kick, noise, burst };
+
+constexpr Signal all_signals[] = {Signal::impulse, Signal::sweep, Signal::kick,
+                                  Signal::noise, Signal::burst};
+
+static const char* signal_name(Signal signal) {
+    switch (signal) {
+        case Signal::impulse:
+            return "impulse";
+        case Signal::sweep:
+            return "sweep";
+        case Signal::kick:
+            return "kick";
+        case Signal::noise:
+            return "noise";
+        case Signal::burst:
+        default:
+            return "burst";
+    }
+}
+
+static std::vector<float> generate_signal(Signal signal, size_t channel) {
+    constexpr double pi = std::numbers::pi;
+    const double channel_gain = channel % 2 == 0 ? 1.0 : -0.7;
+
+    std::vector<float> samples(signal_length, 0.0f);
+    std::mt19937 rng(static_cast<uint32_t>(4242 + channel));
+    std::uniform_real_distribution<float> noise(-0.5f, 0.5f);
+    switch (signal) {
+        case Signal::impulse:
+            // A second impulse halfway through checks that the filters'
+            // states are carried over correctly
+            samples[channel] = static_cast<float>(channel_gain);
+            samples[signal_length / 2] = static_cast<float>(channel_gain);
+            break;
+        case Signal::sweep: {
+            // An exponential sine sweep from 20 Hz to 20 kHz
+            const double duration = signal_length / sample_rate;
+            const double rate = std::log(20000.0 / 20.0);
+            for (size_t i = 0; i < signal_length; i++) {
+                const double t = i / sample_rate;
+                const double phase = 2.0 * pi * 20.0 * duration / rate *
+                                     (std::exp(t / duration * rate) - 1.0);
+                samples[i] =
+                    static_cast<float>(0.5 * channel_gain * std::sin(phase));
+            }
+        } break;
+        case Signal::kick: {
+            // A sine with a falling pitch and an exponential decay, repeated
+            // every 100 milliseconds
+            double phase = 0.0;
+            for (size_t i = 0; i < signal_length; i++) {
+                const double t = std::fmod(i / sample_rate, 0.1);
+                if (t < 1.0 / sample_rate) {
+                    phase = 0.0;
+                }
+
+                const double frequency = 45.0 + (105.0 * std::exp(-t / 0.03));
+                phase += 2.0 * pi * frequency / sample_rate;
+                samples[i] = static_cast<float>(0.9 * channel_gain *
+                                                std::exp(-t / 0.15) *
+                                                std::sin(phase));
+            }
+        } break;
+        case Signal::noise:
+            for (auto& sample : samples) {
+                sample = noise(rng);
+            }
+            break;
+        case Signal::burst:
+            // A short burst of noise followed by silence, so the filters decay
+            // into the denormal range
+            for (size_t i = 0; i < signal_length / 10; i++) {
+                samples[i] = noise(rng);
+            }
+            break;
+    }
+
+    return samples;
+}
+
+/**
+ * A block in an automation script, along with the events that happen right
+ * before it gets processed.
+ */
+struct ScriptBlock {
+    size_t num_samples;
+    DiopserEngine::Parameters parameters;
+    /**
+     * If set, the number of stages is changed before processing this block.
+     */
+    std::optional<size_t> new_num_stages;
+};
+
+struct Script {
+    size_t num_channels;
+    size_t initial_num_stages;
+    int initial_smoothing_interval;
+    std::vector<ScriptBlock> blocks;
+};
+
+/**
+ * Generate a random automation script that covers `signal_length` samples.
+ * The same seed always results in the same script. These scripts don't
+ * contain any gestures, since the reference doesn't implement the gesture
+ * path.
+ */
+static Script generate_script(uint32_t seed) {
+    std::mt19937 rng(seed);
+    const auto chance = [&](double probability) {
+        return std::uniform_real_distribution<double>(0.0, 1.0)(rng) <
+               probability;
+    };
+    const auto log_uniform = [&](float min, float max) {
+        return std::exp(std::uniform_real_distribution<float>(
+            std::log(min), std::log(max))(rng));
+    };
+    const auto pick = [&](const auto& options) {
+        return options[std::uniform_int_distribution<size_t>(
+            0, std::size(options) - 1)(rng)];
+    };
+    const auto random_num_stages = [&]() -> size_t {
+        // Mostly small stage counts to keep this fast, but occasionally the
+        // plugin's regular maximum or the extended maximum
+        if (chance(0.1)) {
+            return chance(0.2) ? DiopserEngine::max_stages : 512;
+        }
+
+        return std::uniform_int_distribution<size_t>(0, 48)(rng);
+    };
+
+    constexpr size_t channel_counts[] = {1, 2, 3, 8};
+    constexpr int smoothing_intervals[] = {1, 7, 64, 128, 512};
+
+    Script script{.num_channels = pick(channel_counts),
+                  .initial_num_stages = random_num_stages(),
+                  .initial_smoothing_interval = pick(smoothing_intervals),
+                  .blocks = {}};
+
+    DiopserEngine::Parameters parameters{
+        .frequency = log_uniform(20.0f, 20000.0f),
+        .resonance = 0.5f,
+        .spread = 0.0f,
+        .spread_linear = false,
+        .smoothing_interval = script.initial_smoothing_interval,
+        .safe_mode = chance(0.5),
+        .gesture_in_progress = false};
+
+    size_t num_samples_scripted = 0;
+    while (num_samples_scripted < signal_length) {
+        ScriptBlock block{
+            .num_samples = 0, .parameters = {}, .new_num_stages = {}};
+
+        // Hosts occasionally send empty blocks and blocks with odd sizes
+        block.num_samples =
+            chance(0.05) ? 0
+                         : std::uniform_int_distribution<size_t>(
+                               1, max_block_size)(rng);
+        block.num_samples =
+            std::min(block.num_samples, signal_length - num_samples_scripted);
+
+        if (chance(0.2)) {
+            parameters.frequency = log_uniform(5.0f, 20000.0f);
+        }
+        if (chance(0.1)) {
+            parameters.resonance = log_uniform(0.01f, 30.0f);
+        }
+        if (chance(0.1)) {
+            parameters.spread =
+                chance(0.3) ? 0.0f
+                            : std::uniform_real_distribution<float>(
+                                  -5000.0f, 5000.0f)(rng);
+        }
+        if (chance(0.05)) {
+            parameters.spread_linear = !parameters.spread_linear;
+        }
+        if (chance(0.03)) {
+            parameters.smoothing_interval = pick(smoothing_intervals);
+        }
+        if (chance(0.03)) {
+            parameters.safe_mode = !parameters.safe_mode;
+        }
+        if (chance(0.02)) {
+            block.new_num_stages = random_num_stages();
+        }
+
+        block.parameters = parameters;
+        script.blocks.push_back(block);
+        num_samples_scripted += block.num_samples;
+    }
+
+    return script;
+}
+
+/**
+ * Generate a random script where the user drags the editor's controls every
+ * now and then. While a gesture is in progress the frequency, resonance, and
+ * spread move by up to one percent of the frequency on every block, like they
+ * do when dragging a knob. There is no other automation, so any difference
+ * from the reference comes from the gesture path.
+ */
+static Script generate_gesture_script(uint32_t seed) {
+    std::mt19937 rng(seed);
+    const auto chance = [&](double probability) {
+        return std::uniform_real_distribution<double>(0.0, 1.0)(rng) <
+               probability;
+    };
+    const auto log_uniform = [&](float min, float max) {
+        return std::exp(std::uniform_real_distribution<float>(
+            std::log(min), std::log(max))(rng));
+    };
+    const auto pick = [&](const auto& options) {
+        return options[std::uniform_int_distribution<size_t>(
+            0, std::size(options) - 1)(rng)];
+    };
+
+    constexpr size_t channel_counts[] = {1, 2, 3, 8};
+    constexpr int smoothing_intervals[] = {1, 7, 64, 128, 512};
+
+    Script script{
+        .num_channels = pick(channel_counts),
+        .initial_num_stages =
+            std::uniform_int_distribution<size_t>(1, 16)(rng),
+        .initial_smoothing_interval = pick(smoothing_intervals),
+        .blocks = {}};
+
+    DiopserEngine::Parameters parameters{
+        .frequency = log_uniform(50.0f, 5000.0f),
+        .resonance = log_uniform(0.1f, 2.0f),
+        .spread = 0.0f,
+        .spread_linear = false,
+        .smoothing_interval = script.initial_smoothing_interval,
+        .safe_mode = true,
+        .gesture_in_progress = false};
+
+    // The smoothers start out at zero and take 100 milliseconds to ramp to
+    // the initial parameters. The gesture path would skip through that ramp
+    // just like it does with any other large jump, so gestures only start
+    // once that ramp has finished.
+    const size_t first_gesture_sample =
+        static_cast<size_t>(0.1 * sample_rate) + 1;
+
+    size_t num_samples_scripted = 0;
+    while (num_samples_scripted < signal_length) {
+        ScriptBlock block{
+            .num_samples = 0, .parameters = {}, .new_num_stages = {}};
+        block.num_samples =
+            chance(0.05) ? 0
+                         : std::uniform_int_distribution<size_t>(
+                               1, max_block_size)(rng);
+        block.num_samples =
+            std::min(block.num_samples, signal_length - num_samples_scripted);
+
+        if (chance(0.05) && num_samples_scripted >= first_gesture_sample) {
+            parameters.gesture_in_progress = !parameters.gesture_in_progress;
+        }
+        if (parameters.gesture_in_progress) {
+            parameters.frequency = std::clamp(
+                parameters.frequency * log_uniform(0.99f, 1.01f), 5.0f,
+                20000.0f);
+            parameters.resonance = std::clamp(
+                parameters.resonance * log_uniform(0.99f, 1.01f), 0.01f,
+                30.0f);
+            parameters.spread = std::clamp(
+                parameters.spread +
+                    (parameters.frequency *
+                     std::uniform_real_distribution<float>(-0.01f, 0.01f)(
+                         rng)),
+                -5000.0f, 5000.0f);
+        }
+
+        block.parameters = parameters;
+        script.blocks.push_back(block);
+        num_samples_scripted += block.num_samples;
+    }
+
+    return script;
+}
+
+/**
+ * Run `signal` through `engine` following `script`. Returns the output as
+ * `[channel][sample]`.
+ */
+static std::vector<std::vector<float>> render(Engine& engine,
+                                              const Script& script,
+                                              Signal signal) {
+    std::vector<std::vector<float>> channels;
+    for (size_t channel = 0; channel < script.num_channels; channel++) {
+        channels.push_back(generate_signal(signal, channel));
+    }
+
+    engine.prepare(script.num_channels, script.initial_num_stages,
+                   script.initial_smoothing_interval);
+
+    std::vector<float*> pointers(script.num_channels);
+    size_t offset = 0;
+    for (const auto& block : script.blocks) {
+        if (block.new_num_stages) {
+            engine.set_num_stages(*block.new_num_stages);
+        }
+
+        for (size_t channel = 0; channel < script.num_channels; channel++) {
+            pointers[channel] = channels[channel].data() + offset;
+        }
+        engine.process(pointers.data(), script.num_channels, block.num_samples,
+                       block.parameters);
+
+        offset += block.num_samples;
+    }
+
+    return channels;
+}
+
+/**
+ * The distance between two floats in units in the last place.
+ */
+static int64_t ulp_distance(float a, float b) {
+    const auto to_ordered = [](float value) -> int64_t {
+        const int32_t bits = std::bit_cast<int32_t>(value);
+        return bits < 0 ? static_cast<int64_t>(INT32_MIN) - bits : bits;
+    };
+
+    return std::abs(to_ordered(a) - to_ordered(b));
+}
+
+struct Comparison {
+    bool passed = true;
+    int64_t max_ulps = 0;
+    double max_error = 0.0;
+    size_t first_mismatch_channel = 0;
+    size_t first_mismatch_sample = 0;
+};
+
+static Comparison compare(const std::vector<std::vector<float>>& expected,
+                          const std::vector<std::vector<float>>& actual,
+                          const Tolerance& tolerance) {
+    Comparison result;
+    for (size_t channel = 0; channel < expected.size(); channel++) {
+        for (size_t i = 0; i < expected[channel].size(); i++) {
+            const float expected_sample = expected[channel][i];
+            const float actual_sample = actual[channel][i];
+
+            const int64_t ulps = ulp_distance(expected_sample, actual_sample);
+            const double error =
+                std::abs(static_cast<double>(expected_sample) - actual_sample);
+            result.max_ulps = std::max(result.max_ulps, ulps);
+            result.max_error = std::max(result.max_error, error);
+
+            const bool within_tolerance =
+                std::isfinite(actual_sample) &&
+                (ulps <= tolerance.max_ulps ||
+                 (tolerance.max_ulps > 0 &&
+                  20.0 * std::log10(error) <= tolerance.max_error_db));
+            if (!within_tolerance && result.passed) {
+                result.passed = false;
+                result.first_mismatch_channel = channel;
+                result.first_mismatch_sample = i;
+            }
+        }
+    }
+
+    return result;
+}
+
+/**
+ * Counts the comparisons and prints the failing ones, and optionally also the
+ * passing ones.
+ */
+struct Report {
+    bool verbose = false;
+    size_t num_runs = 0;
+    size_t num_failures = 0;
+
+    void add(const std::string& name,
+             uint32_t seed,
+             Signal signal,
+             const Comparison& result) {
+        num_runs += 1;
+        if (!result.passed) {
+            num_failures += 1;
+            std::printf(
+                "FAIL %s, seed %u, %s: first mismatch at channel %zu, sample "
+                "%zu (max %lld ULP, max error %.3g)\n",
+                name.c_str(), seed, signal_name(signal),
+                result.first_mismatch_channel, result.first_mismatch_sample,
+                static_cast<long long>(result.max_ulps), result.max_error);
+        } else if (verbose) {
+            std::printf("ok   %s, seed %u, %s (max %lld ULP, max error %.3g)\n",
+                        name.c_str(), seed, signal_name(signal),
+                        static_cast<long long>(result.max_ulps),
+                        result.max_error);
+        }
+    }
+
+    void add(const char* name, const CheckResult& result) {
+        num_runs += 1;
+        if (!result.passed) {
+            num_failures += 1;
+            std::printf("FAIL %s: %s\n", name, result.details.c_str());
+        } else if (verbose) {
+            std::printf("ok   %s (%s)\n", name, result.details.c_str());
+        }
+    }
+};
+
+static void print_usage(const char* program_name) {
+    std::cerr << "Usage: " << program_name << " [options]\n"
+              << "\n"
+              << "Options:\n"
+              << "  --seeds <n>      Number of random automation scripts "
+                 "(default: 16)\n"
+              << "  --seed <n>       The first seed to use (default: 1)\n"
+              << "  --engine <name>  Only check this engine, skipping the "
+                 "component checks\n"
+              << "  --check <name>   Only run this component check, skipping "
+                 "the engines\n"
+              << "  --verbose        Also print passing runs\n";
+}
+
+int main(int argc, char* argv[]) {
+    uint32_t num_seeds = 16;
+    uint32_t first_seed = 1;
+    std::string engine_filter;
+    std::string check_filter;
+    bool verbose = false;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (arg == "--seeds" && has_value) {
+            num_seeds = static_cast<uint32_t>(std::atoi(argv[++i]));
+        } else if (arg == "--seed" && has_value) {
+            first_seed = static_cast<uint32_t>(std::atoi(argv[++i]));
+        } else if (arg == "--engine" && has_value) {
+            engine_filter = argv[++i];
+        } else if (arg == "--check" && has_value) {
+            check_filter = argv[++i];
+        } else if (arg == "--verbose") {
+            verbose = true;
+        } else {
+            print_usage(argv[0]);
+            return arg == "--help" || arg == "-h" ? 0 : 1;
+        }
+    }
+
+    // Both the reference and the engines run with denormals flushed, just like
+    // in the plugin
+    const ScopedFlushDenormals flush_denormals;
+
+    Report report{.verbose = verbose};
+    const bool run_engines = check_filter.empty();
+    for (uint32_t seed = first_seed;
+         run_engines && seed < first_seed + num_seeds; seed++) {
+        const Script script = generate_script(seed);
+        const Script gesture_script = generate_gesture_script(seed);
+        for (const Signal signal : all_signals) {
+            EngineAdapter<ReferenceEngine> reference;
+            const auto expected = render(reference, script, signal);
+            EngineAdapter<ReferenceEngine> gesture_reference;
+            const auto gesture_expected =
+                render(gesture_reference, gesture_script, signal);
+
+            // The gesture path only updates the coefficients once per block,
+            // so it can only be compared against the reference within a
+            // tolerance. The other engines should then still match
+            // `DiopserEngine`'s gesture path bit for bit.
+            EngineAdapter<DiopserEngine> gesture_engine;
+            const auto gesture_actual =
+                render(gesture_engine, gesture_script, signal);
+            if (engine_filter.empty() || engine_filter == "DiopserEngine") {
+                report.add("DiopserEngine (gestures)", seed, signal,
+                           compare(gesture_expected, gesture_actual,
+                                   gesture_tolerance));
+            }
+
+            for (const auto& engine_under_test : engines_under_test()) {
+                if (!engine_filter.empty() &&
+                    engine_filter != engine_under_test.name) {
+                    continue;
+                }
+
+                const auto engine = engine_under_test.create();
+                const auto actual = render(*engine, script, signal);
+                report.add(engine_under_test.name, seed, signal,
+                           compare(expected, actual,
+                                   engine_under_test.tolerance));
+
+                const auto gesture_engine_under_test =
+                    engine_under_test.create();
+                const auto gesture_engine_actual =
+                    render(*gesture_engine_under_test, gesture_script, signal);
+                report.add(std::string(engine_under_test.name) +
+                               " (gestures, against DiopserEngine)",
+                           seed, signal,
+                           compare(gesture_actual, gesture_engine_actual,
+                                   engine_under_test.tolerance));
+            }
+        }
+    }
+
+    for (const auto& check : component_checks()) {
+        if ((check_filter.empty() && !engine_filter.empty()) ||
+            (!check_filter.empty() && check_filter != check.name)) {
+            continue;
+        }
+
+        report.add(check.name, check.run());
+    }
+
+    std::printf("%zu of %zu runs passed\n",
+                report.num_runs - report.num_failures, report.num_runs);
+
+    return report.num_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,18 @@
+# Runs `diopser_bench` and compares the results against a baseline with
+# `diopser_bench_compare`. This is used by the `bench_compare` test, since a
+# CTest test can only run a single command. Expects the `BENCH`, `COMPARE`,
+# `BASELINE`, `RESULTS` and `THRESHOLD` variables to be set with `-D`.
+
+execute_process(
+  COMMAND "${BENCH}" --out "${RESULTS}"
+  RESULT_VARIABLE bench_result)
+if(NOT bench_result EQUAL 0)
+  message(FATAL_ERROR "diopser_bench failed: ${bench_result}")
+endif()
+
+execute_process(
+  COMMAND "${COMPARE}" --threshold "${THRESHOLD}" "${BASELINE}" "${RESULTS}"
+  RESULT_VARIABLE compare_result)
+if(NOT compare_result EQUAL 0)
+  message(FATAL_ERROR "The benchmarks regressed compared to '${BASELINE}'")
+endif()
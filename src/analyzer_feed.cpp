@@ -0,0 +1,60 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "analyzer_feed.h"
+
+/**
+ * The ring buffer's capacity in samples. This is enough for a bit over 300
+ * milliseconds of audio at 96 kHz, which is way more than the GUI needs to
+ * catch up between two frames.
+ */
+constexpr size_t analyzer_feed_capacity = 1 << 15;
+
+AnalyzerFeed::AnalyzerFeed() : ring_(analyzer_feed_capacity) {}
+
+void AnalyzerFeed::push(const float* const* samples,
+                        size_t num_channels,
+                        size_t num_samples) {
+    if (num_consumers_.load(std::memory_order_relaxed) == 0 ||
+        num_channels == 0) {
+        return;
+    }
+
+    // The downmix is written straight into the ring buffer, so this costs
+    // about as much as a single `memcpy()`
+    const float* left = samples[0];
+    const float* right = num_channels > 1 ? samples[1] : samples[0];
+    ring_.try_push(num_samples,
+                   [&](float* dest, size_t offset, size_t count) {
+                       for (size_t i = 0; i < count; i++) {
+                           dest[i] =
+                               0.5f * (left[offset + i] + right[offset + i]);
+                       }
+                   });
+}
+
+void AnalyzerFeed::connect() {
+    ring_.discard();
+    num_consumers_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void AnalyzerFeed::disconnect() {
+    num_consumers_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+size_t AnalyzerFeed::pop(float* dest, size_t max_samples) {
+    return ring_.pop(dest, max_samples);
+}
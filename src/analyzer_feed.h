@@ -0,0 +1,62 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "core/spsc_ring_buffer.h"
+
+/**
+ * Sends the processed audio to the editor's spectrum analyzer and oscilloscope.
+ * The audio thread pushes a mono downmix of the output into a preallocated ring
+ * buffer, but only while an analyzer is connected. Otherwise pushing costs a
+ * single relaxed atomic load. The consumer does all of the actual analysis on
+ * the GUI thread, so the audio thread's cost stays constant no matter how slow
+ * the GUI is: when the ring buffer is full, the block is simply dropped.
+ *
+ * JUCE only ever keeps a single editor open per processor, so there's only
+ * ever a single consumer.
+ */
+class AnalyzerFeed {
+   public:
+    AnalyzerFeed();
+
+    /**
+     * Push a block of samples to the ring buffer if an analyzer is connected.
+     * Only the first two channels are used. This is realtime safe and should
+     * only be called from the audio thread.
+     */
+    void push(const float* const* samples,
+              size_t num_channels,
+              size_t num_samples);
+
+    /**
+     * Start receiving samples. Anything that was left in the buffer from a
+     * previous connection is discarded. This and the functions below should
+     * only be called from the consumer's thread.
+     */
+    void connect();
+    void disconnect();
+
+    /**
+     * Read up to `max_samples` samples into `dest`, returning the number of
+     * samples read.
+     */
+    size_t pop(float* dest, size_t max_samples);
+
+   private:
+    std::atomic_int num_consumers_ = 0;
+    SpscRingBuffer ring_;
+};
@@ -0,0 +1,302 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "analyzer_view.h"
+
+constexpr int fft_order = 12;
+constexpr size_t fft_size = 1 << fft_order;
+
+/**
+ * The number of samples shown on the oscilloscope.
+ */
+constexpr size_t scope_length = 2048;
+
+constexpr int analyzer_refresh_rate_hz = 60;
+constexpr float analyzer_min_frequency = 10.0f;
+constexpr float analyzer_max_frequency = 22000.0f;
+constexpr float spectrum_min_db = -100.0f;
+constexpr float spectrum_max_db = 0.0f;
+
+/**
+ * How quickly peaks in the spectrum fall back down, in decibels per frame.
+ */
+constexpr float spectrum_decay_db = 1.5f;
+
+/**
+ * The part of the component's height used for the spectrum. The rest is used
+ * for the oscilloscope.
+ */
+constexpr float spectrum_height_ratio = 0.65f;
+
+AnalyzerView::AnalyzerView(DiopserProcessor& processor)
+    : processor_(processor),
+      fft_(fft_order),
+      window_(fft_size, juce::dsp::WindowingFunction<float>::hann, false),
+      read_buffer_(fft_size),
+      history_(fft_size),
+      fft_data_(fft_size * 2),
+      paint_profiler_("Analyzer") {
+    setOpaque(true);
+
+    processor_.analyzer_feed().connect();
+    startTimerHz(analyzer_refresh_rate_hz);
+}
+
+AnalyzerView::~AnalyzerView() {
+    processor_.analyzer_feed().disconnect();
+}
+
+void AnalyzerView::paint(juce::Graphics& g) {
+    const auto profiler_scope = paint_profiler_.measure();
+
+    background_layer_.draw(
+        g, getLocalBounds(),
+        [&](juce::Graphics& layer) { render_background(layer); });
+
+    // Most repaints only cover the parts of the spectrum and the scope that
+    // actually changed, so we'll skip anything outside of the clip region
+    const auto spectrum_bounds = spectrum_bounds_.toFloat();
+    if (!spectrum_db_.empty() && g.clipRegionIntersects(spectrum_bounds_)) {
+        const auto clip_bounds = g.getClipBounds();
+        const size_t first_column = static_cast<size_t>(
+            std::clamp(clip_bounds.getX() - 1, 0,
+                       static_cast<int>(spectrum_db_.size()) - 1));
+        const size_t last_column = static_cast<size_t>(
+            std::clamp(clip_bounds.getRight() + 1, 0,
+                       static_cast<int>(spectrum_db_.size()) - 1));
+
+        juce::Path spectrum_path;
+        spectrum_path.startNewSubPath(static_cast<float>(first_column),
+                                      spectrum_bounds.getBottom());
+        for (size_t column = first_column; column <= last_column; column++) {
+            spectrum_path.lineTo(static_cast<float>(column),
+                                 spectrum_db_to_y(spectrum_db_[column]));
+        }
+        spectrum_path.lineTo(static_cast<float>(last_column),
+                             spectrum_bounds.getBottom());
+        spectrum_path.closeSubPath();
+
+        g.setColour(juce::Colour(0x6049b6c6));
+        g.fillPath(spectrum_path);
+    }
+
+    if (!scope_min_.empty() && g.clipRegionIntersects(scope_bounds_)) {
+        const auto scope_bounds = scope_bounds_.toFloat();
+        const float center_y = scope_bounds.getCentreY();
+        const float half_height = scope_bounds.getHeight() / 2.0f;
+
+        g.setColour(juce::Colour(0xff49b6c6));
+        for (size_t column = 0; column < scope_min_.size(); column++) {
+            const float top =
+                center_y - (half_height * std::min(scope_max_[column], 1.0f));
+            const float bottom =
+                center_y - (half_height * std::max(scope_min_[column], -1.0f));
+            g.drawVerticalLine(static_cast<int>(column), top,
+                               std::max(bottom, top + 1.0f));
+        }
+    }
+}
+
+void AnalyzerView::resized() {
+    const size_t num_columns = static_cast<size_t>(std::max(getWidth(), 0));
+    spectrum_db_.assign(num_columns, spectrum_min_db);
+    scope_min_.assign(num_columns, 0.0f);
+    scope_max_.assign(num_columns, 0.0f);
+
+    spectrum_bounds_ = getLocalBounds();
+    scope_bounds_ = spectrum_bounds_.removeFromBottom(juce::roundToInt(
+        static_cast<float>(getHeight()) * (1.0f - spectrum_height_ratio)));
+
+    update_column_bins();
+}
+
+void AnalyzerView::timerCallback() {
+    bool received_samples = false;
+    size_t num_samples;
+    while ((num_samples = processor_.analyzer_feed().pop(
+                read_buffer_.data(), read_buffer_.size())) > 0) {
+        for (size_t i = 0; i < num_samples; i++) {
+            history_[history_pos_] = read_buffer_[i];
+            history_pos_ = (history_pos_ + 1) % fft_size;
+        }
+
+        received_samples = true;
+    }
+
+    if (received_samples) {
+        if (processor_.getSampleRate() != column_bins_sample_rate_) {
+            update_column_bins();
+        }
+
+        // Only the regions that actually changed get repainted
+        const auto spectrum_dirty_region = update_spectrum();
+        if (!spectrum_dirty_region.isEmpty()) {
+            repaint(spectrum_dirty_region);
+        }
+        if (update_scope()) {
+            repaint(scope_bounds_);
+        }
+    }
+}
+
+void AnalyzerView::render_background(juce::Graphics& g) {
+    g.fillAll(juce::Colour(0xff16181c));
+
+    // Horizontal lines every 20 dB for the spectrum
+    g.setColour(juce::Colour(0xff22252b));
+    for (float db = spectrum_max_db - 20.0f; db > spectrum_min_db;
+         db -= 20.0f) {
+        g.drawHorizontalLine(juce::roundToInt(spectrum_db_to_y(db)),
+                             static_cast<float>(spectrum_bounds_.getX()),
+                             static_cast<float>(spectrum_bounds_.getRight()));
+    }
+
+    g.setColour(juce::Colour(0xff2c2f36));
+    g.drawHorizontalLine(scope_bounds_.getY(),
+                         static_cast<float>(scope_bounds_.getX()),
+                         static_cast<float>(scope_bounds_.getRight()));
+}
+
+float AnalyzerView::spectrum_db_to_y(float db) const {
+    return juce::jmap(db, spectrum_min_db, spectrum_max_db,
+                      static_cast<float>(spectrum_bounds_.getBottom()),
+                      static_cast<float>(spectrum_bounds_.getY()));
+}
+
+void AnalyzerView::update_column_bins() {
+    column_bins_sample_rate_ = processor_.getSampleRate();
+    const double sample_rate =
+        column_bins_sample_rate_ > 0.0 ? column_bins_sample_rate_ : 44100.0;
+
+    const size_t num_columns = spectrum_db_.size();
+    column_first_bin_.resize(num_columns);
+    column_last_bin_.resize(num_columns);
+
+    const double log_min_frequency = std::log(analyzer_min_frequency);
+    const double log_frequency_delta =
+        std::log(std::min(static_cast<double>(analyzer_max_frequency),
+                          sample_rate * 0.49)) -
+        log_min_frequency;
+    const auto column_to_bin = [&](size_t column) {
+        const double frequency = std::exp(
+            log_min_frequency +
+            (log_frequency_delta * (static_cast<double>(column) /
+                                    static_cast<double>(num_columns))));
+        return frequency * static_cast<double>(fft_size) / sample_rate;
+    };
+
+    // At low frequencies a single bin spans multiple columns, and at high
+    // frequencies a single column spans multiple bins. We'll use the loudest
+    // bin for every column.
+    constexpr int max_bin = static_cast<int>(fft_size / 2) - 1;
+    for (size_t column = 0; column < num_columns; column++) {
+        const int first_bin =
+            std::clamp(static_cast<int>(column_to_bin(column)), 1, max_bin);
+        const int last_bin = std::clamp(
+            static_cast<int>(std::ceil(column_to_bin(column + 1))) - 1,
+            first_bin, max_bin);
+
+        column_first_bin_[column] = first_bin;
+        column_last_bin_[column] = last_bin;
+    }
+}
+
+juce::Rectangle<int> AnalyzerView::update_spectrum() {
+    // `history_` is a circular buffer, so we need to unroll it first
+    const size_t oldest_samples = fft_size - history_pos_;
+    std::copy_n(history_.begin() + static_cast<ptrdiff_t>(history_pos_),
+                oldest_samples, fft_data_.begin());
+    std::copy_n(history_.begin(), history_pos_,
+                fft_data_.begin() + static_cast<ptrdiff_t>(oldest_samples));
+    std::fill(fft_data_.begin() + fft_size, fft_data_.end(), 0.0f);
+
+    window_.multiplyWithWindowingTable(fft_data_.data(), fft_size);
+    fft_.performFrequencyOnlyForwardTransform(fft_data_.data());
+
+    // A full scale sine wave results in a peak magnitude of `fft_size / 4`
+    // with a Hann window
+    const float normalization_factor = 4.0f / static_cast<float>(fft_size);
+    int first_changed_column = -1;
+    int last_changed_column = -1;
+    float max_changed_db = spectrum_min_db;
+    for (size_t column = 0; column < spectrum_db_.size(); column++) {
+        float magnitude = 0.0f;
+        for (int bin = column_first_bin_[column];
+             bin <= column_last_bin_[column]; bin++) {
+            magnitude = std::max(magnitude, fft_data_[static_cast<size_t>(bin)]);
+        }
+
+        const float magnitude_db = juce::Decibels::gainToDecibels(
+            magnitude * normalization_factor, spectrum_min_db);
+        const float old_db = spectrum_db_[column];
+        const float new_db = std::max(
+            magnitude_db, std::max(old_db - spectrum_decay_db, spectrum_min_db));
+        if (new_db != old_db) {
+            if (first_changed_column == -1) {
+                first_changed_column = static_cast<int>(column);
+            }
+            last_changed_column = static_cast<int>(column);
+            max_changed_db = std::max({max_changed_db, old_db, new_db});
+        }
+
+        spectrum_db_[column] = new_db;
+    }
+
+    if (first_changed_column == -1) {
+        return {};
+    }
+
+    // The spectrum is drawn as a filled path, so everything from the highest
+    // changed value down to the bottom of the spectrum needs to be repainted.
+    // The extra pixels account for the path's antialiasing.
+    const int top = static_cast<int>(spectrum_db_to_y(max_changed_db)) - 2;
+    return juce::Rectangle<int>::leftTopRightBottom(
+               first_changed_column - 2, top, last_changed_column + 3,
+               spectrum_bounds_.getBottom())
+        .getIntersection(spectrum_bounds_);
+}
+
+bool AnalyzerView::update_scope() {
+    const size_t num_columns = scope_min_.size();
+    if (num_columns == 0) {
+        return false;
+    }
+
+    // The scope shows the last `scope_length` samples, with every column
+    // covering the minimum and maximum of a range of samples
+    const size_t scope_start = (history_pos_ + fft_size - scope_length);
+    bool changed = false;
+    for (size_t column = 0; column < num_columns; column++) {
+        const size_t first_sample = (column * scope_length) / num_columns;
+        const size_t last_sample = std::max(
+            first_sample + 1, ((column + 1) * scope_length) / num_columns);
+
+        float min_value = std::numeric_limits<float>::max();
+        float max_value = std::numeric_limits<float>::lowest();
+        for (size_t i = first_sample; i < last_sample; i++) {
+            const float sample = history_[(scope_start + i) % fft_size];
+            min_value = std::min(min_value, sample);
+            max_value = std::max(max_value, sample);
+        }
+
+        changed |= min_value != scope_min_[column] ||
+                   max_value != scope_max_[column];
+        scope_min_[column] = min_value;
+        scope_max_[column] = max_value;
+    }
+
+    return changed;
+}
@@ -0,0 +1,106 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <juce_dsp/juce_dsp.h>
+#include <juce_gui_basics/juce_gui_basics.h>
+
+#include "cached_layer.h"
+#include "paint_profiler.h"
+#include "processor.h"
+
+/**
+ * A spectrum analyzer and oscilloscope for the processed audio. This drains
+ * the processor's `AnalyzerFeed` from the GUI thread, so all of the FFT and
+ * decimation work happens here and never on the audio thread. Both views are
+ * decimated to one value per pixel column, and the FFT bin ranges for every
+ * column are only recomputed when the component gets resized or the sample
+ * rate changes. The static background is cached, and only the regions of the
+ * spectrum and the scope that changed since the last frame get repainted.
+ */
+class AnalyzerView : public juce::Component, private juce::Timer {
+   public:
+    explicit AnalyzerView(DiopserProcessor& processor);
+    ~AnalyzerView() override;
+
+    void paint(juce::Graphics& g) override;
+    void resized() override;
+
+   private:
+    void timerCallback() override;
+
+    /**
+     * Recompute `column_first_bin_` and `column_last_bin_` for the current
+     * width and sample rate.
+     */
+    void update_column_bins();
+    /**
+     * Compute a new spectrum from `history_`, returning the region that needs
+     * to be repainted.
+     */
+    juce::Rectangle<int> update_spectrum();
+    /**
+     * Decimate the last part of `history_` for the scope, returning whether
+     * anything changed.
+     */
+    bool update_scope();
+
+    void render_background(juce::Graphics& g);
+    float spectrum_db_to_y(float db) const;
+
+    DiopserProcessor& processor_;
+
+    juce::dsp::FFT fft_;
+    juce::dsp::WindowingFunction<float> window_;
+
+    /**
+     * Samples are drained from the feed into this buffer before being copied
+     * to `history_`.
+     */
+    std::vector<float> read_buffer_;
+    /**
+     * The last `fft_size` samples, used as a circular buffer.
+     */
+    std::vector<float> history_;
+    size_t history_pos_ = 0;
+    /**
+     * The FFT's working buffer, which needs to be twice the FFT size.
+     */
+    std::vector<float> fft_data_;
+
+    double column_bins_sample_rate_ = 0.0;
+    std::vector<int> column_first_bin_;
+    std::vector<int> column_last_bin_;
+
+    /**
+     * The decimated spectrum in decibels, with one value per pixel column.
+     */
+    std::vector<float> spectrum_db_;
+    /**
+     * The decimated oscilloscope, with a minimum and a maximum per pixel
+     * column.
+     */
+    std::vector<float> scope_min_;
+    std::vector<float> scope_max_;
+
+    juce::Rectangle<int> spectrum_bounds_;
+    juce::Rectangle<int> scope_bounds_;
+    CachedLayer background_layer_;
+    PaintProfiler paint_profiler_;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(AnalyzerView)
+};
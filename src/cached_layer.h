@@ -0,0 +1,83 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <juce_gui_basics/juce_gui_basics.h>
+
+/**
+ * A layer of a component's drawing that's rendered to an image once and then
+ * composited on every paint until it gets invalidated. The image is rendered
+ * at the display's physical resolution, so compositing it is a plain
+ * unscaled blit even with high DPI scaling. The layer is also redrawn
+ * automatically when its size or the display scale changes.
+ */
+class CachedLayer {
+   public:
+    /**
+     * Force the layer to be redrawn on the next call to `draw()`.
+     */
+    void invalidate() { is_valid_ = false; }
+
+    /**
+     * Composite the layer onto `g` at `bounds`, redrawing it first using
+     * `render_fn` if needed. The graphics context passed to `render_fn` uses
+     * the same logical coordinates as `bounds`, with `(0, 0)` as the layer's
+     * top left corner.
+     *
+     * @tparam F A function with the signature `void(juce::Graphics&)`.
+     */
+    template <typename F>
+    void draw(juce::Graphics& g, juce::Rectangle<int> bounds, F render_fn) {
+        if (bounds.isEmpty()) {
+            return;
+        }
+
+        const float scale =
+            g.getInternalContext().getPhysicalPixelScaleFactor();
+        const int image_width = juce::roundToInt(bounds.getWidth() * scale);
+        const int image_height = juce::roundToInt(bounds.getHeight() * scale);
+        if (!is_valid_ || scale != scale_ ||
+            image_.getWidth() != image_width ||
+            image_.getHeight() != image_height) {
+            if (image_.getWidth() == image_width &&
+                image_.getHeight() == image_height) {
+                image_.clear(image_.getBounds());
+            } else {
+                image_ = juce::Image(juce::Image::ARGB, image_width,
+                                     image_height, true,
+                                     juce::SoftwareImageType());
+            }
+
+            juce::Graphics image_graphics(image_);
+            image_graphics.addTransform(juce::AffineTransform::scale(scale));
+            render_fn(image_graphics);
+
+            scale_ = scale;
+            is_valid_ = true;
+        }
+
+        g.drawImageTransformed(
+            image_, juce::AffineTransform::scale(1.0f / scale).translated(
+                        static_cast<float>(bounds.getX()),
+                        static_cast<float>(bounds.getY())));
+    }
+
+   private:
+    juce::Image image_;
+    float scale_ = 0.0f;
+    bool is_valid_ = false;
+};
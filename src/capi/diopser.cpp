@@ -0,0 +1,594 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "diopser.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include "core/denormals.h"
+#include "core/engine.h"
+
+/**
+ * Identifies `diopser_get_state()`'s output.
+ */
+constexpr uint32_t state_magic = 0x54534344;  // "DCST"
+/**
+ * Increment this whenever the state's layout changes. Older states should
+ * keep loading.
+ */
+constexpr uint32_t state_version = 1;
+
+constexpr uint32_t max_stages = DiopserEngine::max_stages;
+
+struct diopser {
+    DiopserEngine engine;
+
+    // These can be set from any thread, and they're read at the start of
+    // every processing call
+    std::atomic<uint32_t> num_stages = 0;
+    std::atomic<float> frequency = DiopserEngine::Parameters{}.frequency;
+    std::atomic<float> resonance = DiopserEngine::Parameters{}.resonance;
+    std::atomic<float> spread = DiopserEngine::Parameters{}.spread;
+    std::atomic_bool spread_linear = DiopserEngine::Parameters{}.spread_linear;
+    std::atomic<int> smoothing_interval =
+        DiopserEngine::Parameters{}.smoothing_interval;
+    std::atomic_bool safe_mode = DiopserEngine::Parameters{}.safe_mode;
+    std::atomic_bool rotation_mode = DiopserEngine::Parameters{}.rotation_mode;
+    std::atomic<float> rotation_angle =
+        DiopserEngine::Parameters{}.rotation_angle;
+
+    /**
+     * Held while changing `num_stages` together with the engine's stages, and
+     * while preparing the engine with that count. Otherwise two concurrent
+     * stage changes could reach the engine in the opposite order, or a
+     * concurrent `diopser_prepare()` could use a count the engine never gets.
+     */
+    std::mutex stages_mutex;
+
+    bool is_prepared = false;
+    uint32_t num_channels = 0;
+
+    /**
+     * Reused between calls to `diopser_get_state()` and
+     * `diopser_set_state()`.
+     */
+    DiopserEngine::State engine_state;
+    std::vector<uint8_t> state_buffer;
+
+    DiopserEngine::Parameters parameters() const {
+        DiopserEngine::Parameters parameters;
+        parameters.frequency = frequency.load(std::memory_order_relaxed);
+        parameters.resonance = resonance.load(std::memory_order_relaxed);
+        parameters.spread = spread.load(std::memory_order_relaxed);
+        parameters.spread_linear =
+            spread_linear.load(std::memory_order_relaxed);
+        parameters.smoothing_interval =
+            smoothing_interval.load(std::memory_order_relaxed);
+        parameters.safe_mode = safe_mode.load(std::memory_order_relaxed);
+        parameters.rotation_mode =
+            rotation_mode.load(std::memory_order_relaxed);
+        parameters.rotation_angle =
+            rotation_angle.load(std::memory_order_relaxed);
+
+        return parameters;
+    }
+};
+
+/**
+ * Appends little-endian values to a byte buffer.
+ */
+class StateWriter {
+   public:
+    explicit StateWriter(std::vector<uint8_t>& buffer) : buffer_(buffer) {
+        buffer_.clear();
+    }
+
+    void write_u32(uint32_t value) {
+        for (int shift = 0; shift < 32; shift += 8) {
+            buffer_.push_back(static_cast<uint8_t>(value >> shift));
+        }
+    }
+
+    void write_u64(uint64_t value) {
+        write_u32(static_cast<uint32_t>(value));
+        write_u32(static_cast<uint32_t>(value >> 32));
+    }
+
+    void write_bool(bool value) { buffer_.push_back(value ? 1 : 0); }
+    void write_i32(int32_t value) { write_u32(static_cast<uint32_t>(value)); }
+
+    void write_float(float value) {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        write_u32(bits);
+    }
+
+    void write_double(double value) {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        write_u64(bits);
+    }
+
+   private:
+    std::vector<uint8_t>& buffer_;
+};
+
+/**
+ * Reads little-endian values from a byte buffer. Reading past the end sets
+ * `failed()` and returns zeroes.
+ */
+class StateReader {
+   public:
+    StateReader(const uint8_t* data, size_t size) : data_(data), size_(size) {}
+
+    bool failed() const { return failed_; }
+    bool at_end() const { return position_ == size_; }
+
+    /**
+     * Check that at least `count` items of `item_size` bytes remain, so
+     * counts read from the state can't cause huge allocations.
+     */
+    bool has_items(uint64_t count, size_t item_size) {
+        failed_ |= count > (size_ - position_) / item_size;
+        return !failed_;
+    }
+
+    uint32_t read_u32() {
+        if (failed_ || size_ - position_ < 4) {
+            failed_ = true;
+            return 0;
+        }
+
+        uint32_t value = 0;
+        for (int shift = 0; shift < 32; shift += 8) {
+            value |= static_cast<uint32_t>(data_[position_++]) << shift;
+        }
+
+        return value;
+    }
+
+    uint64_t read_u64() {
+        const uint64_t low = read_u32();
+        return low | (static_cast<uint64_t>(read_u32()) << 32);
+    }
+
+    bool read_bool() {
+        if (failed_ || position_ >= size_) {
+            failed_ = true;
+            return false;
+        }
+
+        return data_[position_++] != 0;
+    }
+
+    int32_t read_i32() { return static_cast<int32_t>(read_u32()); }
+
+    float read_float() {
+        const uint32_t bits = read_u32();
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    double read_double() {
+        const uint64_t bits = read_u64();
+        double value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+   private:
+    const uint8_t* data_;
+    size_t size_;
+    size_t position_ = 0;
+    bool failed_ = false;
+};
+
+static void write_smoother(StateWriter& writer,
+                           const LinearSmoother::State& state) {
+    writer.write_float(state.current);
+    writer.write_float(state.target);
+    writer.write_float(state.step);
+    writer.write_i32(state.countdown);
+    writer.write_i32(state.steps_to_target);
+}
+
+static LinearSmoother::State read_smoother(StateReader& reader) {
+    LinearSmoother::State state;
+    state.current = reader.read_float();
+    state.target = reader.read_float();
+    state.step = reader.read_float();
+    state.countdown = reader.read_i32();
+    state.steps_to_target = reader.read_i32();
+
+    return state;
+}
+
+/**
+ * Run `fn`, turning allocation failures into a result code since exceptions
+ * can't cross the C API.
+ */
+template <typename F>
+static diopser_result catch_allocation_failures(F fn) {
+    try {
+        return fn();
+    } catch (const std::bad_alloc&) {
+        return DIOPSER_ERROR_OUT_OF_MEMORY;
+    }
+}
+
+uint32_t diopser_api_version(void) {
+    return DIOPSER_API_VERSION;
+}
+
+diopser_t* diopser_create(void) {
+    return new (std::nothrow) diopser();
+}
+
+void diopser_destroy(diopser_t* diopser) {
+    delete diopser;
+}
+
+diopser_result diopser_prepare(diopser_t* diopser,
+                               double sample_rate,
+                               uint32_t max_block_size,
+                               uint32_t num_channels) {
+    if (!diopser || !(sample_rate > 0.0) || !std::isfinite(sample_rate) ||
+        max_block_size == 0) {
+        return DIOPSER_ERROR_INVALID_ARGUMENT;
+    }
+
+    return catch_allocation_failures([&]() -> diopser_result {
+        const std::lock_guard lock(diopser->stages_mutex);
+        diopser->engine.prepare(sample_rate, max_block_size, num_channels,
+                                diopser->num_stages.load(),
+                                diopser->smoothing_interval.load());
+        diopser->num_channels = num_channels;
+        diopser->is_prepared = true;
+
+        return DIOPSER_OK;
+    });
+}
+
+diopser_result diopser_set_parameter(diopser_t* diopser,
+                                     uint32_t parameter,
+                                     float value) {
+    if (!diopser || std::isnan(value)) {
+        return DIOPSER_ERROR_INVALID_ARGUMENT;
+    }
+
+    switch (parameter) {
+        case DIOPSER_PARAM_STAGES: {
+            const auto num_stages = static_cast<uint32_t>(
+                std::lround(std::clamp(value, 0.0f, float(max_stages))));
+
+            // This is also picked up by the next `diopser_prepare()` call
+            return catch_allocation_failures([&]() -> diopser_result {
+                const std::lock_guard lock(diopser->stages_mutex);
+                if (diopser->num_stages.exchange(num_stages) != num_stages) {
+                    diopser->engine.set_num_stages(num_stages);
+                }
+
+                return DIOPSER_OK;
+            });
+        }
+        case DIOPSER_PARAM_FREQUENCY:
+            diopser->frequency = std::clamp(value, 5.0f, 20000.0f);
+            return DIOPSER_OK;
+        case DIOPSER_PARAM_RESONANCE:
+            diopser->resonance = std::clamp(value, 0.01f, 30.0f);
+            return DIOPSER_OK;
+        case DIOPSER_PARAM_SPREAD:
+            diopser->spread = std::clamp(value, -5000.0f, 5000.0f);
+            return DIOPSER_OK;
+        case DIOPSER_PARAM_SPREAD_LINEAR:
+            diopser->spread_linear = value != 0.0f;
+            return DIOPSER_OK;
+        case DIOPSER_PARAM_SMOOTHING_INTERVAL:
+            diopser->smoothing_interval = static_cast<int>(
+                std::lround(std::clamp(value, 1.0f, 512.0f)));
+            return DIOPSER_OK;
+        case DIOPSER_PARAM_SAFE_MODE:
+            diopser->safe_mode = value != 0.0f;
+            return DIOPSER_OK;
+        case DIOPSER_PARAM_ROTATION_MODE:
+            diopser->rotation_mode = value != 0.0f;
+            return DIOPSER_OK;
+        case DIOPSER_PARAM_ROTATION_ANGLE:
+            diopser->rotation_angle = std::clamp(value, -180.0f, 180.0f);
+            return DIOPSER_OK;
+        default:
+            return DIOPSER_ERROR_INVALID_ARGUMENT;
+    }
+}
+
+diopser_result diopser_get_parameter(const diopser_t* diopser,
+                                     uint32_t parameter,
+                                     float* value) {
+    if (!diopser || !value) {
+        return DIOPSER_ERROR_INVALID_ARGUMENT;
+    }
+
+    switch (parameter) {
+        case DIOPSER_PARAM_STAGES:
+            *value = static_cast<float>(diopser->num_stages.load());
+            return DIOPSER_OK;
+        case DIOPSER_PARAM_FREQUENCY:
+            *value = diopser->frequency;
+            return DIOPSER_OK;
+        case DIOPSER_PARAM_RESONANCE:
+            *value = diopser->resonance;
+            return DIOPSER_OK;
+        case DIOPSER_PARAM_SPREAD:
+            *value = diopser->spread;
+            return DIOPSER_OK;
+        case DIOPSER_PARAM_SPREAD_LINEAR:
+            *value = diopser->spread_linear ? 1.0f : 0.0f;
+            return DIOPSER_OK;
+        case DIOPSER_PARAM_SMOOTHING_INTERVAL:
+            *value = static_cast<float>(diopser->smoothing_interval.load());
+            return DIOPSER_OK;
+        case DIOPSER_PARAM_SAFE_MODE:
+            *value = diopser->safe_mode ? 1.0f : 0.0f;
+            return DIOPSER_OK;
+        case DIOPSER_PARAM_ROTATION_MODE:
+            *value = diopser->rotation_mode ? 1.0f : 0.0f;
+            return DIOPSER_OK;
+        case DIOPSER_PARAM_ROTATION_ANGLE:
+            *value = diopser->rotation_angle;
+            return DIOPSER_OK;
+        default:
+            return DIOPSER_ERROR_INVALID_ARGUMENT;
+    }
+}
+
+diopser_result diopser_process(diopser_t* diopser,
+                               float* const* channels,
+                               uint32_t num_channels,
+                               uint32_t num_frames) {
+    if (!diopser || (!channels && num_channels > 0)) {
+        return DIOPSER_ERROR_INVALID_ARGUMENT;
+    }
+    if (!diopser->is_prepared) {
+        return DIOPSER_ERROR_NOT_PREPARED;
+    }
+    if (num_channels > diopser->num_channels) {
+        return DIOPSER_ERROR_INVALID_ARGUMENT;
+    }
+
+    const ScopedFlushDenormals flush_denormals;
+    diopser->engine.process(channels, num_channels, num_frames,
+                            diopser->parameters());
+
+    return DIOPSER_OK;
+}
+
+diopser_result diopser_process_interleaved(diopser_t* diopser,
+                                           float* samples,
+                                           uint32_t num_channels,
+                                           uint32_t num_frames) {
+    if (!diopser || (!samples && num_channels > 0 && num_frames > 0)) {
+        return DIOPSER_ERROR_INVALID_ARGUMENT;
+    }
+    if (!diopser->is_prepared) {
+        return DIOPSER_ERROR_NOT_PREPARED;
+    }
+    if (num_channels > diopser->num_channels) {
+        return DIOPSER_ERROR_INVALID_ARGUMENT;
+    }
+
+    const ScopedFlushDenormals flush_denormals;
+    diopser->engine.process_interleaved(samples, num_channels, num_frames,
+                                        diopser->parameters());
+
+    return DIOPSER_OK;
+}
+
+diopser_result diopser_get_state(diopser_t* diopser,
+                                 void* data,
+                                 size_t* size) {
+    if (!diopser || !size) {
+        return DIOPSER_ERROR_INVALID_ARGUMENT;
+    }
+
+    return catch_allocation_failures([&]() -> diopser_result {
+        StateWriter writer(diopser->state_buffer);
+        writer.write_u32(state_magic);
+        writer.write_u32(state_version);
+
+        const DiopserEngine::Parameters parameters = diopser->parameters();
+        writer.write_u32(diopser->num_stages.load());
+        writer.write_float(parameters.frequency);
+        writer.write_float(parameters.resonance);
+        writer.write_float(parameters.spread);
+        writer.write_bool(parameters.spread_linear);
+        writer.write_i32(parameters.smoothing_interval);
+        writer.write_bool(parameters.safe_mode);
+        writer.write_bool(parameters.rotation_mode);
+        writer.write_float(parameters.rotation_angle);
+
+        writer.write_bool(diopser->is_prepared);
+        if (diopser->is_prepared) {
+            DiopserEngine::State& state = diopser->engine_state;
+            diopser->engine.save_state(state);
+
+            writer.write_double(state.sample_rate);
+            writer.write_u32(static_cast<uint32_t>(state.num_channels));
+            writer.write_bool(state.filters_initialized);
+            writer.write_u32(static_cast<uint32_t>(state.stages.size()));
+            for (const auto& stage : state.stages) {
+                writer.write_float(stage.coefficients.b0);
+                writer.write_float(stage.coefficients.b1);
+                for (const auto& channel : stage.channels) {
+                    writer.write_float(channel.s1);
+                    writer.write_float(channel.s2);
+                }
+            }
+
+            write_smoother(writer, state.frequency);
+            write_smoother(writer, state.resonance);
+            write_smoother(writer, state.spread);
+            writer.write_i32(state.next_smooth_in);
+            writer.write_bool(state.old_spread_linear);
+            writer.write_bool(state.old_rotation_mode);
+            writer.write_u32(
+                static_cast<uint32_t>(state.rotator.history.size()));
+            for (const float value : state.rotator.history) {
+                writer.write_float(value);
+            }
+            writer.write_bool(state.rotator.odd);
+            write_smoother(writer, state.rotator.angle);
+            writer.write_bool(state.old_safe_mode);
+            writer.write_float(state.limiter.envelope);
+        }
+
+        const size_t available = *size;
+        *size = diopser->state_buffer.size();
+        if (!data) {
+            return DIOPSER_OK;
+        }
+        if (available < diopser->state_buffer.size()) {
+            return DIOPSER_ERROR_BUFFER_TOO_SMALL;
+        }
+
+        std::memcpy(data, diopser->state_buffer.data(),
+                    diopser->state_buffer.size());
+        return DIOPSER_OK;
+    });
+}
+
+diopser_result diopser_set_state(diopser_t* diopser,
+                                 const void* data,
+                                 size_t size) {
+    if (!diopser || (!data && size > 0)) {
+        return DIOPSER_ERROR_INVALID_ARGUMENT;
+    }
+
+    return catch_allocation_failures([&]() -> diopser_result {
+        StateReader reader(static_cast<const uint8_t*>(data), size);
+        if (reader.read_u32() != state_magic) {
+            return DIOPSER_ERROR_INVALID_STATE;
+        }
+        const uint32_t version = reader.read_u32();
+        if (version > state_version) {
+            return DIOPSER_ERROR_INVALID_STATE;
+        }
+
+        // Everything is read before anything gets applied, so a broken state
+        // leaves the instance unchanged
+        const uint32_t num_stages = reader.read_u32();
+        DiopserEngine::Parameters parameters;
+        parameters.frequency = reader.read_float();
+        parameters.resonance = reader.read_float();
+        parameters.spread = reader.read_float();
+        parameters.spread_linear = reader.read_bool();
+        parameters.smoothing_interval = reader.read_i32();
+        parameters.safe_mode = reader.read_bool();
+        parameters.rotation_mode = reader.read_bool();
+        parameters.rotation_angle = reader.read_float();
+
+        const bool has_engine_state = reader.read_bool();
+        DiopserEngine::State& state = diopser->engine_state;
+        if (has_engine_state) {
+            state.sample_rate = reader.read_double();
+            state.num_channels = reader.read_u32();
+            state.filters_initialized = reader.read_bool();
+
+            const uint32_t num_state_stages = reader.read_u32();
+            const size_t stage_size = 8 * (1 + state.num_channels);
+            if (num_state_stages > max_stages ||
+                !reader.has_items(num_state_stages, stage_size)) {
+                return DIOPSER_ERROR_INVALID_STATE;
+            }
+
+            state.stages.resize(num_state_stages);
+            for (auto& stage : state.stages) {
+                stage.coefficients.b0 = reader.read_float();
+                stage.coefficients.b1 = reader.read_float();
+                stage.channels.resize(state.num_channels);
+                for (auto& channel : stage.channels) {
+                    channel.s1 = reader.read_float();
+                    channel.s2 = reader.read_float();
+                }
+            }
+
+            state.frequency = read_smoother(reader);
+            state.resonance = read_smoother(reader);
+            state.spread = read_smoother(reader);
+            state.next_smooth_in = reader.read_i32();
+            state.old_spread_linear = reader.read_bool();
+
+            state.old_rotation_mode = reader.read_bool();
+            const uint32_t history_size = reader.read_u32();
+            if (!reader.has_items(history_size, 4)) {
+                return DIOPSER_ERROR_INVALID_STATE;
+            }
+
+            state.rotator.history.resize(history_size);
+            for (auto& value : state.rotator.history) {
+                value = reader.read_float();
+            }
+            state.rotator.odd = reader.read_bool();
+            state.rotator.angle = read_smoother(reader);
+
+            state.old_safe_mode = reader.read_bool();
+            state.limiter.envelope = reader.read_float();
+        }
+
+        if (reader.failed() || !reader.at_end()) {
+            return DIOPSER_ERROR_INVALID_STATE;
+        }
+
+        // The values are clamped just like when they're set individually
+        diopser_set_parameter(diopser, DIOPSER_PARAM_FREQUENCY,
+                              parameters.frequency);
+        diopser_set_parameter(diopser, DIOPSER_PARAM_RESONANCE,
+                              parameters.resonance);
+        diopser_set_parameter(diopser, DIOPSER_PARAM_SPREAD, parameters.spread);
+        diopser_set_parameter(diopser, DIOPSER_PARAM_SPREAD_LINEAR,
+                              parameters.spread_linear);
+        diopser_set_parameter(
+            diopser, DIOPSER_PARAM_SMOOTHING_INTERVAL,
+            static_cast<float>(parameters.smoothing_interval));
+        diopser_set_parameter(diopser, DIOPSER_PARAM_SAFE_MODE,
+                              parameters.safe_mode);
+        diopser_set_parameter(diopser, DIOPSER_PARAM_ROTATION_MODE,
+                              parameters.rotation_mode);
+        diopser_set_parameter(diopser, DIOPSER_PARAM_ROTATION_ANGLE,
+                              parameters.rotation_angle);
+
+        // Restoring the engine's state also sets its number of stages. If the
+        // engine's configuration doesn't match, only the stage count from the
+        // parameters is used.
+        if (has_engine_state && diopser->is_prepared) {
+            const std::lock_guard lock(diopser->stages_mutex);
+            if (diopser->engine.restore_state(state)) {
+                diopser->num_stages =
+                    static_cast<uint32_t>(state.stages.size());
+                return DIOPSER_OK;
+            }
+        }
+
+        return diopser_set_parameter(diopser, DIOPSER_PARAM_STAGES,
+                                     static_cast<float>(num_stages));
+    });
+}
@@ -0,0 +1,213 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+/**
+ * A C API for Diopser's DSP, for embedding it in hosts and services that
+ * don't want to load a plugin. This wraps `DiopserEngine` from `diopser_core`
+ * and doesn't depend on JUCE. Audio is always processed in place in the
+ * caller's buffers, which can be either planar or interleaved.
+ *
+ * All functions return one of the `DIOPSER_*` result codes unless noted
+ * otherwise. `diopser_set_parameter()` and `diopser_get_parameter()` may be
+ * called from any thread at any time. Setting `DIOPSER_PARAM_STAGES` takes a
+ * lock shared with `diopser_prepare()` and `diopser_set_state()`, so it may
+ * block until those have finished. All other functions taking a handle must
+ * not be called concurrently with each other for the same handle.
+ * `diopser_process()` and `diopser_process_interleaved()` are realtime safe.
+ *
+ * New functions and parameters may be added in later versions, but existing
+ * functions, parameter IDs, and result codes never change meaning.
+ * `DIOPSER_API_VERSION` is only incremented when they do.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#if defined(DIOPSER_BUILDING_LIBRARY)
+#define DIOPSER_API __declspec(dllexport)
+#else
+#define DIOPSER_API __declspec(dllimport)
+#endif
+#else
+#define DIOPSER_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DIOPSER_API_VERSION 1
+
+typedef struct diopser diopser_t;
+typedef int32_t diopser_result;
+
+enum {
+    DIOPSER_OK = 0,
+    DIOPSER_ERROR_INVALID_ARGUMENT = -1,
+    /**
+     * `diopser_prepare()` has not been called yet.
+     */
+    DIOPSER_ERROR_NOT_PREPARED = -2,
+    DIOPSER_ERROR_OUT_OF_MEMORY = -3,
+    /**
+     * The buffer passed to `diopser_get_state()` is too small. The required
+     * size has been written to `size`.
+     */
+    DIOPSER_ERROR_BUFFER_TOO_SMALL = -4,
+    /**
+     * The data passed to `diopser_set_state()` is not a valid state.
+     */
+    DIOPSER_ERROR_INVALID_STATE = -5,
+};
+
+/**
+ * Parameter IDs. Values are plain numbers, the same ones shown in the plugin's
+ * editor, and they're clamped to the plugin's ranges. Booleans are false for
+ * zero and true for everything else.
+ */
+enum {
+    /**
+     * The number of all-pass filter stages, 0-4096. Unlike the plugin's
+     * parameter, this is the actual number of stages. Changing this
+     * allocates, so it is not realtime safe. The change takes effect on the
+     * next call to one of the processing functions.
+     */
+    DIOPSER_PARAM_STAGES = 0,
+    /**
+     * The filters' center frequency, 5-20000 Hz.
+     */
+    DIOPSER_PARAM_FREQUENCY = 1,
+    /**
+     * The filters' resonance, 0.01-30.
+     */
+    DIOPSER_PARAM_RESONANCE = 2,
+    /**
+     * How far the stages' frequencies are spread out around the center
+     * frequency, -5000-5000 Hz.
+     */
+    DIOPSER_PARAM_SPREAD = 3,
+    /**
+     * Whether the spread is linear instead of logarithmic.
+     */
+    DIOPSER_PARAM_SPREAD_LINEAR = 4,
+    /**
+     * The number of samples between coefficient updates while parameters
+     * are being smoothed, 1-512. The length of the smoothing ramps is based on
+     * the value at the time of the last call to `diopser_prepare()`.
+     */
+    DIOPSER_PARAM_SMOOTHING_INTERVAL = 5,
+    /**
+     * Whether the output goes through the safety limiter.
+     */
+    DIOPSER_PARAM_SAFE_MODE = 6,
+    /**
+     * Whether to replace the filter cascade with a constant phase rotation.
+     * The stages, frequency, resonance, and spread parameters are ignored
+     * while this is enabled.
+     */
+    DIOPSER_PARAM_ROTATION_MODE = 7,
+    /**
+     * The rotation mode's angle, -180-180 degrees. Positive angles advance
+     * the phase. Changes are smoothed over a couple of milliseconds.
+     */
+    DIOPSER_PARAM_ROTATION_ANGLE = 8,
+};
+
+/**
+ * The value of `DIOPSER_API_VERSION` the library was built with. This is not
+ * a result code.
+ */
+DIOPSER_API uint32_t diopser_api_version(void);
+
+/**
+ * Create a new instance with default parameters. It needs to be prepared
+ * before it can process audio.
+ *
+ * @return A null pointer if the allocation failed.
+ */
+DIOPSER_API diopser_t* diopser_create(void);
+
+/**
+ * Destroy an instance. Passing a null pointer does nothing.
+ */
+DIOPSER_API void diopser_destroy(diopser_t* diopser);
+
+/**
+ * Allocate everything needed to process up to `num_channels` channels at
+ * `sample_rate`, and reset the filters. Larger blocks than `max_block_size`
+ * can still be processed, but they're slightly less efficient. This is not
+ * realtime safe.
+ */
+DIOPSER_API diopser_result diopser_prepare(diopser_t* diopser,
+                                           double sample_rate,
+                                           uint32_t max_block_size,
+                                           uint32_t num_channels);
+
+DIOPSER_API diopser_result diopser_set_parameter(diopser_t* diopser,
+                                                 uint32_t parameter,
+                                                 float value);
+
+DIOPSER_API diopser_result diopser_get_parameter(const diopser_t* diopser,
+                                                 uint32_t parameter,
+                                                 float* value);
+
+/**
+ * Process `num_channels` planar channels of `num_frames` samples each in
+ * place. `num_channels` may not exceed the number of channels passed to
+ * `diopser_prepare()`.
+ */
+DIOPSER_API diopser_result diopser_process(diopser_t* diopser,
+                                           float* const* channels,
+                                           uint32_t num_channels,
+                                           uint32_t num_frames);
+
+/**
+ * Process `num_frames` frames of interleaved audio containing
+ * `num_channels` channels in place. This produces exactly the same output as
+ * `diopser_process()`.
+ */
+DIOPSER_API diopser_result diopser_process_interleaved(diopser_t* diopser,
+                                                       float* samples,
+                                                       uint32_t num_channels,
+                                                       uint32_t num_frames);
+
+/**
+ * Serialize the parameters and, once prepared, the filters' current state.
+ * Call this with `data` set to a null pointer to query the size. Otherwise
+ * `size` should contain the size of `data`, and it's set to the number of
+ * bytes written.
+ */
+DIOPSER_API diopser_result diopser_get_state(diopser_t* diopser,
+                                             void* data,
+                                             size_t* size);
+
+/**
+ * Restore a state from `diopser_get_state()`. The parameters are always
+ * restored. The filters' state is only restored if this instance has been
+ * prepared with the same sample rate and channel count, in which case
+ * processing continues exactly where the saved instance left off. This is
+ * not realtime safe.
+ */
+DIOPSER_API diopser_result diopser_set_state(diopser_t* diopser,
+                                             const void* data,
+                                             size_t size);
+
+#ifdef __cplusplus
+}
+#endif
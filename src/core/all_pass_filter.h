@@ -0,0 +1,71 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "coefficients.h"
+
+/**
+ * The state for a single channel of a second order all-pass filter, using the
+ * transposed direct form II structure. The coefficients are passed in when
+ * processing so multiple filters can share them. This performs the exact same
+ * computations as `juce::dsp::IIR::Filter<float>` does with all-pass
+ * coefficients, including snapping tiny outputs to zero.
+ */
+class AllPassFilter {
+   public:
+    /**
+     * The filter's internal state, for checkpointing.
+     */
+    struct State {
+        float s1 = 0.0f;
+        float s2 = 0.0f;
+    };
+
+    /**
+     * Clear the filter's state.
+     */
+    void reset() {
+        s1_ = 0.0f;
+        s2_ = 0.0f;
+    }
+
+    State state() const { return {s1_, s2_}; }
+
+    void restore(const State& state) {
+        s1_ = state.s1;
+        s2_ = state.s2;
+    }
+
+    float process_sample(float sample,
+                         const AllPassCoefficients& coefficients) {
+        // The all-pass filter's `b2` and `a0` coefficients are both 1, and
+        // its `a1` and `a2` coefficients are `b1` and `b0`
+        float output = (coefficients.b0 * sample) + s1_;
+        s1_ = (coefficients.b1 * sample) - (coefficients.b1 * output) + s2_;
+        s2_ = sample - (coefficients.b0 * output);
+
+        if (!(output < -1.0e-8f || output > 1.0e-8f)) {
+            output = 0.0f;
+        }
+
+        return output;
+    }
+
+   private:
+    float s1_ = 0.0f;
+    float s2_ = 0.0f;
+};
@@ -0,0 +1,152 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+/**
+ * A wrapper around some `T` that contains an active `T` and an inactive `T`.
+ * When some plugin parameter changes that would require us to resize the
+ * object, we can resize the inactive object and then swap the two objects on
+ * the next time we fetch the object from the audio processing loop. This
+ * prevents locking and memory allocations on the audio thread. Keep in mind
+ * that the active and the inactive objects have no relation to each other, and
+ * might thus contain completely different data.
+ */
+template <typename T>
+class AtomicallySwappable {
+   public:
+    /**
+     * Default initalizes the objects.
+     */
+    AtomicallySwappable() : objects_{T(), T()} {}
+
+    /**
+     * Initialize the objects with some default value.
+     *
+     * @param initial The initial value for the object. This will also be copied
+     *   to the inactive slot.
+     */
+    AtomicallySwappable(T initial) : objects_{initial, initial} {}
+
+    /**
+     * Return a reference to currently active object. This should be done once
+     * at the start of the audio processing function, and the same reference
+     * should be reused for the remainder of the function.
+     */
+    T& get() {
+        // We'll swap the objects on the audio thread so that two resizes in a
+        // row in between audio processing calls don't cause weird behaviour.
+        // The objects are never swapped while another thread is modifying the
+        // inactive object, since that object would then become active halfway
+        // through the modification.
+        uint32_t state = state_.load();
+        if ((state & needs_swap_bit) && !(state & modifying_bit)) {
+            // This can only fail when another thread just started modifying
+            // the inactive object, in which case we'll swap on a later call
+            const uint32_t swapped =
+                (state ^ active_index_bit) & ~needs_swap_bit;
+            if (state_.compare_exchange_strong(state, swapped)) {
+                state = swapped;
+            }
+        }
+
+        return objects_[state & active_index_bit];
+    }
+
+    /**
+     * Return a reference to the currently active object without swapping in
+     * a pending modification. Like `get()`, this should only be called from
+     * the audio thread. This lets the audio thread keep using the current
+     * object for a while after a modification, for instance to fade out
+     * before switching to the new object.
+     */
+    T& active() { return objects_[state_.load() & active_index_bit]; }
+
+    /**
+     * Whether the inactive object has been modified with `modify_and_swap()`
+     * and is waiting to be swapped in by the next call to `get()`.
+     */
+    bool has_pending_swap() const { return state_.load() & needs_swap_bit; }
+
+    /**
+     * Modify the inactive object using the supplied function, and swap the
+     * active and the inactive objects on the next call to `get()`. This may
+     * block and should thus never be called from the audio thread.
+     *
+     * @tparam F A function with the signature `void(T&)`.
+     */
+    template <typename F>
+    void modify_and_swap(F modify_fn) {
+        std::lock_guard lock(modify_mutex_);
+
+        // While the modifying bit is set `get()` won't swap the objects, so
+        // the inactive object stays inactive until we're done with it. The
+        // audio thread also won't touch the state during that time, and the
+        // mutex keeps other writers out, so the state can be updated with a
+        // plain store afterwards.
+        const uint32_t state = state_.fetch_or(modifying_bit);
+        modify_fn(objects_[(state & active_index_bit) ^ 1]);
+
+        state_.store((state | needs_swap_bit) & ~modifying_bit);
+    }
+
+    /**
+     * Modify both objects using the supplied function, for instance to resize
+     * them for a new configuration or to free them. This should only ever be
+     * called while the audio thread is not calling `get()`, like from
+     * `AudioProcessor::prepareToPlay()` and
+     * `AudioProcessor::releaseResources()`.
+     *
+     * @tparam F A function with the signature `void(T&)`.
+     */
+    template <typename F>
+    void modify_both(F modify_fn) {
+        std::lock_guard lock(modify_mutex_);
+
+        modify_fn(objects_[0]);
+        modify_fn(objects_[1]);
+    }
+
+   private:
+    /**
+     * The index of the currently active object in `objects_`.
+     */
+    static constexpr uint32_t active_index_bit = 1 << 0;
+    /**
+     * Set after the inactive object has been modified. The next call to
+     * `get()` will then swap the objects.
+     */
+    static constexpr uint32_t needs_swap_bit = 1 << 1;
+    /**
+     * Set while `modify_and_swap()` is modifying the inactive object. The
+     * objects are never swapped while this is set.
+     */
+    static constexpr uint32_t modifying_bit = 1 << 2;
+
+    /**
+     * In the unlikely situation that two threads are modifying the objects at
+     * the same time, this mutex makes sure those modifications don't happen
+     * at the same time.
+     */
+    std::mutex modify_mutex_;
+    std::atomic<uint32_t> state_ = 0;
+
+    T objects_[2];
+};
@@ -0,0 +1,317 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "cascade.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DIOPSER_CASCADE_SSE2
+#include <emmintrin.h>
+#endif
+
+/**
+ * Filter outputs with a smaller magnitude than this get snapped to zero, just
+ * like in `AllPassFilter::process_sample()`.
+ */
+constexpr float snap_threshold = 1.0e-8f;
+
+#ifdef DIOPSER_CASCADE_SSE2
+
+/**
+ * A pipeline of `num_vectors * 4` stages, with one stage per SIMD lane. The
+ * filters' states and the previous step's outputs are kept in registers while
+ * processing.
+ */
+template <size_t num_vectors>
+class PipelinedGroup {
+   public:
+    static constexpr size_t num_stages = num_vectors * 4;
+
+    PipelinedGroup(const AllPassCoefficients* coefficients,
+                   AllPassFilter* filters,
+                   size_t filters_stride)
+        : filters_(filters), filters_stride_(filters_stride) {
+        alignas(16) float b0[num_stages];
+        alignas(16) float b1[num_stages];
+        alignas(16) float s1[num_stages];
+        alignas(16) float s2[num_stages];
+        for (size_t stage = 0; stage < num_stages; stage++) {
+            const AllPassFilter::State state =
+                filters_[stage * filters_stride_].state();
+            b0[stage] = coefficients[stage].b0;
+            b1[stage] = coefficients[stage].b1;
+            s1[stage] = state.s1;
+            s2[stage] = state.s2;
+        }
+
+        for (size_t v = 0; v < num_vectors; v++) {
+            b0_[v] = _mm_load_ps(b0 + (v * 4));
+            b1_[v] = _mm_load_ps(b1 + (v * 4));
+            s1_[v] = _mm_load_ps(s1 + (v * 4));
+            s2_[v] = _mm_load_ps(s2 + (v * 4));
+            out_[v] = _mm_setzero_ps();
+            lanes_[v] = _mm_setr_epi32(
+                static_cast<int>(v * 4), static_cast<int>((v * 4) + 1),
+                static_cast<int>((v * 4) + 2), static_cast<int>((v * 4) + 3));
+        }
+    }
+
+    /**
+     * Write the filters' states back.
+     */
+    ~PipelinedGroup() {
+        alignas(16) float s1[num_stages];
+        alignas(16) float s2[num_stages];
+        for (size_t v = 0; v < num_vectors; v++) {
+            _mm_store_ps(s1 + (v * 4), s1_[v]);
+            _mm_store_ps(s2 + (v * 4), s2_[v]);
+        }
+
+        for (size_t stage = 0; stage < num_stages; stage++) {
+            filters_[stage * filters_stride_].restore({s1[stage], s2[stage]});
+        }
+    }
+
+    PipelinedGroup(const PipelinedGroup&) = delete;
+    PipelinedGroup& operator=(const PipelinedGroup&) = delete;
+
+    void process(float* samples, size_t stride, size_t num_samples) {
+        // While the pipeline fills and drains some of the stages don't have a
+        // sample to process yet, so their states are masked
+        constexpr size_t fill_steps = num_stages - 1;
+        const size_t num_steps = num_samples + fill_steps;
+        size_t step = 0;
+        for (; step < fill_steps && step < num_steps; step++) {
+            this->step<true>(samples, stride, num_samples, step);
+        }
+        for (; step < num_samples; step++) {
+            this->step<false>(samples, stride, num_samples, step);
+        }
+        for (; step < num_steps; step++) {
+            this->step<true>(samples, stride, num_samples, step);
+        }
+    }
+
+   private:
+    template <bool masked>
+    inline void step(float* samples,
+                     size_t stride,
+                     size_t num_samples,
+                     size_t step) {
+        const float next_sample =
+            step < num_samples ? samples[step * stride] : 0.0f;
+
+        // Every lane takes the previous lane's last output as its input
+        __m128 inputs[num_vectors];
+        inputs[0] = _mm_move_ss(
+            _mm_shuffle_ps(out_[0], out_[0], _MM_SHUFFLE(2, 1, 0, 0)),
+            _mm_set_ss(next_sample));
+        for (size_t v = 1; v < num_vectors; v++) {
+            inputs[v] = _mm_move_ss(
+                _mm_shuffle_ps(out_[v], out_[v], _MM_SHUFFLE(2, 1, 0, 0)),
+                _mm_shuffle_ps(out_[v - 1], out_[v - 1],
+                               _MM_SHUFFLE(3, 3, 3, 3)));
+        }
+
+        // Lane `n` processes sample `step - n`, if that exists
+        __m128i after_first;
+        __m128i after_last;
+        if constexpr (masked) {
+            after_first = _mm_set1_epi32(static_cast<int>(step));
+            after_last =
+                _mm_set1_epi32(static_cast<int>(step) -
+                               static_cast<int>(num_samples));
+        }
+
+        const __m128 lower = _mm_set1_ps(-snap_threshold);
+        const __m128 upper = _mm_set1_ps(snap_threshold);
+        for (size_t v = 0; v < num_vectors; v++) {
+            const __m128 input = inputs[v];
+            __m128 output = _mm_add_ps(_mm_mul_ps(b0_[v], input), s1_[v]);
+            const __m128 s1 = _mm_add_ps(
+                _mm_sub_ps(_mm_mul_ps(b1_[v], input),
+                           _mm_mul_ps(b1_[v], output)),
+                s2_[v]);
+            const __m128 s2 = _mm_sub_ps(input, _mm_mul_ps(b0_[v], output));
+
+            if constexpr (masked) {
+                const __m128 active = _mm_castsi128_ps(_mm_andnot_si128(
+                    _mm_cmpgt_epi32(lanes_[v], after_first),
+                    _mm_cmpgt_epi32(lanes_[v], after_last)));
+                s1_[v] = _mm_or_ps(_mm_and_ps(active, s1),
+                                   _mm_andnot_ps(active, s1_[v]));
+                s2_[v] = _mm_or_ps(_mm_and_ps(active, s2),
+                                   _mm_andnot_ps(active, s2_[v]));
+            } else {
+                s1_[v] = s1;
+                s2_[v] = s2;
+            }
+
+            output = _mm_and_ps(output,
+                                _mm_or_ps(_mm_cmplt_ps(output, lower),
+                                          _mm_cmpgt_ps(output, upper)));
+            out_[v] = output;
+        }
+
+        if (step >= num_stages - 1) {
+            const __m128 last = out_[num_vectors - 1];
+            samples[(step - (num_stages - 1)) * stride] = _mm_cvtss_f32(
+                _mm_shuffle_ps(last, last, _MM_SHUFFLE(3, 3, 3, 3)));
+        }
+    }
+
+    AllPassFilter* filters_;
+    size_t filters_stride_;
+
+    __m128 b0_[num_vectors];
+    __m128 b1_[num_vectors];
+    __m128 s1_[num_vectors];
+    __m128 s2_[num_vectors];
+    /**
+     * The outputs from the last step.
+     */
+    __m128 out_[num_vectors];
+    /**
+     * The index of every lane within the group, used for masking.
+     */
+    __m128i lanes_[num_vectors];
+};
+
+#else
+
+/**
+ * The same pipeline as the SIMD version, but written out per lane. Compilers
+ * can vectorize the per-lane loops on other architectures.
+ */
+template <size_t num_vectors>
+class PipelinedGroup {
+   public:
+    static constexpr size_t num_stages = num_vectors * 4;
+
+    PipelinedGroup(const AllPassCoefficients* coefficients,
+                   AllPassFilter* filters,
+                   size_t filters_stride)
+        : filters_(filters), filters_stride_(filters_stride) {
+        for (size_t stage = 0; stage < num_stages; stage++) {
+            const AllPassFilter::State state =
+                filters_[stage * filters_stride_].state();
+            b0_[stage] = coefficients[stage].b0;
+            b1_[stage] = coefficients[stage].b1;
+            s1_[stage] = state.s1;
+            s2_[stage] = state.s2;
+            out_[stage] = 0.0f;
+        }
+    }
+
+    ~PipelinedGroup() {
+        for (size_t stage = 0; stage < num_stages; stage++) {
+            filters_[stage * filters_stride_].restore(
+                {s1_[stage], s2_[stage]});
+        }
+    }
+
+    PipelinedGroup(const PipelinedGroup&) = delete;
+    PipelinedGroup& operator=(const PipelinedGroup&) = delete;
+
+    void process(float* samples, size_t stride, size_t num_samples) {
+        const size_t num_steps = num_samples + num_stages - 1;
+        for (size_t step = 0; step < num_steps; step++) {
+            float inputs[num_stages];
+            inputs[0] = step < num_samples ? samples[step * stride] : 0.0f;
+            for (size_t stage = 1; stage < num_stages; stage++) {
+                inputs[stage] = out_[stage - 1];
+            }
+
+            for (size_t stage = 0; stage < num_stages; stage++) {
+                const float input = inputs[stage];
+                float output = (b0_[stage] * input) + s1_[stage];
+                const float s1 =
+                    (b1_[stage] * input) - (b1_[stage] * output) + s2_[stage];
+                const float s2 = input - (b0_[stage] * output);
+
+                const bool active =
+                    stage <= step && step - stage < num_samples;
+                s1_[stage] = active ? s1 : s1_[stage];
+                s2_[stage] = active ? s2 : s2_[stage];
+
+                if (!(output < -snap_threshold || output > snap_threshold)) {
+                    output = 0.0f;
+                }
+                out_[stage] = output;
+            }
+
+            if (step >= num_stages - 1) {
+                samples[(step - (num_stages - 1)) * stride] =
+                    out_[num_stages - 1];
+            }
+        }
+    }
+
+   private:
+    AllPassFilter* filters_;
+    size_t filters_stride_;
+
+    float b0_[num_stages];
+    float b1_[num_stages];
+    float s1_[num_stages];
+    float s2_[num_stages];
+    float out_[num_stages];
+};
+
+#endif
+
+template <size_t num_vectors>
+static void process_group(const AllPassCoefficients* coefficients,
+                          AllPassFilter* filters,
+                          size_t filters_stride,
+                          float* samples,
+                          size_t samples_stride,
+                          size_t num_samples) {
+    PipelinedGroup<num_vectors> group(coefficients, filters, filters_stride);
+    group.process(samples, samples_stride, num_samples);
+}
+
+void process_cascade_pipelined(const AllPassCoefficients* coefficients,
+                               AllPassFilter* filters,
+                               size_t filters_stride,
+                               size_t num_stages,
+                               float* samples,
+                               size_t samples_stride,
+                               size_t num_samples) {
+    // Wider groups keep more independent work in flight, but they also take
+    // longer to fill and drain
+    size_t stage_idx = 0;
+    for (; stage_idx + 16 <= num_stages; stage_idx += 16) {
+        process_group<4>(coefficients + stage_idx,
+                         filters + (stage_idx * filters_stride),
+                         filters_stride, samples, samples_stride, num_samples);
+    }
+    for (; stage_idx + 4 <= num_stages; stage_idx += 4) {
+        process_group<1>(coefficients + stage_idx,
+                         filters + (stage_idx * filters_stride),
+                         filters_stride, samples, samples_stride, num_samples);
+    }
+
+    // The last few stages don't fill a SIMD vector
+    for (; stage_idx < num_stages; stage_idx++) {
+        const AllPassCoefficients stage_coefficients = coefficients[stage_idx];
+        AllPassFilter& filter = filters[stage_idx * filters_stride];
+        for (size_t sample_idx = 0; sample_idx < num_samples; sample_idx++) {
+            float& sample = samples[sample_idx * samples_stride];
+            sample = filter.process_sample(sample, stage_coefficients);
+        }
+    }
+}
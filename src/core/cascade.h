@@ -0,0 +1,51 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstddef>
+
+#include "all_pass_filter.h"
+#include "coefficients.h"
+
+/**
+ * Run a single channel through a cascade of all-pass filters in place, one
+ * group of stages at a time. The coefficients must stay the same during the
+ * call. The output is bit for bit the same as calling
+ * `AllPassFilter::process_sample()` for every stage and every sample.
+ *
+ * Every stage depends on the previous stage's output for the same sample, so
+ * running the cascade one sample at a time is limited by the latency of a
+ * single filter step. Instead, the stages within a group form a pipeline, where
+ * at every step stage `n` in the group processes the sample that stage `n - 1`
+ * processed during the previous step. All stages in a group are then
+ * independent of each other and can be processed with SIMD instructions. The
+ * pipeline needs one step per stage in the group to fill and to drain, so this
+ * only pays off for longer runs of samples.
+ *
+ * @param coefficients The coefficients for every stage.
+ * @param filters The filter for the channel's first stage. The filter for the
+ *   next stage is `filters_stride` filters further.
+ * @param samples The channel's first sample. The next sample is
+ *   `samples_stride` samples further.
+ */
+void process_cascade_pipelined(const AllPassCoefficients* coefficients,
+                               AllPassFilter* filters,
+                               size_t filters_stride,
+                               size_t num_stages,
+                               float* samples,
+                               size_t samples_stride,
+                               size_t num_samples);
@@ -0,0 +1,74 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "coefficients.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+
+AllPassCoefficients make_all_pass(double sample_rate,
+                                  float frequency,
+                                  float resonance) {
+    const float n = 1.0f / std::tan(std::numbers::pi_v<float> * frequency /
+                                    static_cast<float>(sample_rate));
+    const float n_squared = n * n;
+    const float c1 = 1.0f / (1.0f + 1.0f / resonance * n + n_squared);
+
+    return AllPassCoefficients{.b0 = c1 * (1.0f - n / resonance + n_squared),
+                               .b1 = c1 * 2.0f * (1.0f - n_squared)};
+}
+
+float clamp_filter_frequency(double sample_rate, float frequency) {
+    const float below_nyquist_frequency =
+        static_cast<float>(sample_rate) / 2.1f;
+
+    return std::clamp(frequency, 5.0f, below_nyquist_frequency);
+}
+
+StageFrequencies::StageFrequencies(double sample_rate,
+                                   float frequency,
+                                   float spread,
+                                   bool spread_linear)
+    : spread_linear_(spread_linear) {
+    min_filter_frequency_ =
+        clamp_filter_frequency(sample_rate, frequency - (spread / 2.0f));
+    const float max_filter_frequency =
+        clamp_filter_frequency(sample_rate, frequency + (spread / 2.0f));
+    filter_frequency_delta_ = max_filter_frequency - min_filter_frequency_;
+
+    log_min_filter_frequency_ = std::log(min_filter_frequency_);
+    const float log_max_filter_frequency = std::log(max_filter_frequency);
+    log_filter_frequency_delta_ =
+        log_max_filter_frequency - log_min_filter_frequency_;
+}
+
+float StageFrequencies::operator()(size_t stage_idx, size_t num_stages) const {
+    // TODO: Maybe add back the option for simple linear skewing. Or use the
+    //       same skew scheme JUCE's parameter range uses and make the skew
+    //       factor configurable.
+    const float frequency_offset_factor =
+        num_stages == 1 ? 0.5f
+                        : (static_cast<float>(stage_idx) /
+                           static_cast<float>(num_stages - 1));
+
+    return spread_linear_
+               ? (min_filter_frequency_ +
+                  (filter_frequency_delta_ * frequency_offset_factor))
+               : std::exp(log_min_filter_frequency_ +
+                          (log_filter_frequency_delta_ *
+                           frequency_offset_factor));
+}
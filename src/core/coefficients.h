@@ -0,0 +1,90 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstddef>
+
+/**
+ * The coefficients for a second order all-pass filter. An all-pass filter's
+ * numerator is its denominator reversed, so after normalizing `a0` to 1 we
+ * only need to store two values. The full transfer function is:
+ *
+ * ```
+ * H(z) = (b0 + b1 z^-1 + z^-2) / (1 + b1 z^-1 + b0 z^-2)
+ * ```
+ */
+struct AllPassCoefficients {
+    float b0 = 0.0f;
+    float b1 = 0.0f;
+
+    bool operator==(const AllPassCoefficients&) const = default;
+};
+
+/**
+ * Compute the coefficients for a second order all-pass filter. This uses the
+ * exact same formula and evaluation order as JUCE's
+ * `juce::dsp::IIR::ArrayCoefficients<float>::makeAllPass()`, so the output
+ * matches older versions of Diopser that used JUCE's filters directly.
+ */
+AllPassCoefficients make_all_pass(double sample_rate,
+                                  float frequency,
+                                  float resonance);
+
+/**
+ * Clamp a cutoff frequency to the range the filters can handle at this sample
+ * rate. Above the Nyquist frequency the all-pass coefficients become unstable,
+ * so the frequency is kept slightly below it. This only matters at low sample
+ * rates, since the frequency parameter itself goes up to 20 kHz.
+ */
+float clamp_filter_frequency(double sample_rate, float frequency);
+
+/**
+ * Distributes the cutoff frequencies of the filter stages around a center
+ * frequency. The spread can be either linear or logarithmic. The logarithmic
+ * version is the default because it sounds a bit more natural. We also need to
+ * make sure the spread range stays in the normal ranges to prevent the filters
+ * from crapping out. This does cause the range to shift slightly with high
+ * spread values and low or high frequency values. Ideally we would want to
+ * prevent this in the GUI.
+ *
+ * This is used both for the actual audio processing and for drawing the
+ * response in the editor, so both always agree with each other.
+ *
+ * TODO: When adding a GUI, prevent spread values that would cause the
+ *       frequency range to be shifted
+ */
+class StageFrequencies {
+   public:
+    StageFrequencies(double sample_rate,
+                     float frequency,
+                     float spread,
+                     bool spread_linear);
+
+    /**
+     * The cutoff frequency for the stage at index `stage_idx` out of
+     * `num_stages` stages.
+     */
+    float operator()(size_t stage_idx, size_t num_stages) const;
+
+   private:
+    bool spread_linear_;
+
+    float min_filter_frequency_;
+    float filter_frequency_delta_;
+    float log_min_filter_frequency_;
+    float log_filter_frequency_delta_;
+};
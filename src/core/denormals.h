@@ -0,0 +1,61 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_IX86)
+#include <xmmintrin.h>
+#endif
+
+/**
+ * Flush denormals to zero for as long as this object is alive, like
+ * `juce::ScopedNoDenormals`. The filters' states decay into denormals when the
+ * input goes silent, and processing those can be orders of magnitude slower.
+ * Anything that calls `DiopserEngine::process()` outside of a plugin host
+ * should use this.
+ */
+class ScopedFlushDenormals {
+   public:
+    ScopedFlushDenormals() {
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_IX86)
+        // Flush-to-zero and denormals-are-zero
+        old_state_ = _mm_getcsr();
+        _mm_setcsr(old_state_ | 0x8040);
+#elif defined(__aarch64__)
+        asm volatile("mrs %0, fpcr" : "=r"(old_state_));
+        // Flush-to-zero
+        asm volatile("msr fpcr, %0" : : "r"(old_state_ | (1 << 24)));
+#endif
+    }
+
+    ~ScopedFlushDenormals() {
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_IX86)
+        _mm_setcsr(old_state_);
+#elif defined(__aarch64__)
+        asm volatile("msr fpcr, %0" : : "r"(old_state_));
+#endif
+    }
+
+    ScopedFlushDenormals(const ScopedFlushDenormals&) = delete;
+    ScopedFlushDenormals& operator=(const ScopedFlushDenormals&) = delete;
+
+   private:
+#if defined(__aarch64__)
+    unsigned long old_state_ = 0;
+#else
+    unsigned int old_state_ = 0;
+#endif
+};
@@ -0,0 +1,678 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "engine.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <memory>
+#include <type_traits>
+
+#include "cascade.h"
+
+/**
+ * When the filter cutoff or resonance parameters change, we'll interpolate
+ * between the old and the new values over the course of this time span to
+ * prevent clicks.
+ */
+constexpr float filter_smoothing_secs = 0.1f;
+
+/**
+ * The length of both the fade out and the fade in around a stage count change
+ * requested with `DiopserEngine::fade_to_num_stages()`.
+ */
+constexpr double stage_fade_secs = 0.01;
+
+/**
+ * The filters start at a cache line boundary so a stage's filters never
+ * straddle two cache lines more often than necessary.
+ */
+constexpr size_t cache_line_size = 64;
+
+/**
+ * With `Kernel::automatic`, the kernel that's not in use is measured again
+ * after this many blocks.
+ */
+constexpr int kernel_probe_interval = 64;
+
+/**
+ * Runs shorter than this are always processed sample by sample, since the
+ * pipelined kernel needs a couple of steps to fill and drain its pipelines.
+ */
+constexpr size_t min_pipelined_length = 16;
+
+// The filters are constructed directly in their `ResidentMemory` block, and
+// they're never destroyed
+static_assert(std::is_trivially_destructible_v<AllPassCoefficients>);
+static_assert(std::is_trivially_destructible_v<AllPassFilter>);
+
+void DiopserEngine::prepare(double sample_rate,
+                            size_t max_block_size,
+                            size_t num_channels,
+                            size_t num_stages,
+                            int smoothing_interval) {
+    sample_rate_ = sample_rate;
+    num_channels_ = num_channels;
+    num_stages_ = num_stages;
+
+    // Both copies of the filters are resized here, so whichever one is active
+    // during the first processing cycle matches the new configuration, even
+    // if another thread is in the middle of changing the number of stages.
+    // Resizing the filters also sets the `is_initialized` flag to `false`, so
+    // the filter coefficients will be initialized during the first processing
+    // cycle.
+    filters_.modify_both([this](Filters& filters) {
+        resize(filters, num_stages_);
+        filters.stage_fade_request = stage_fade_requests_;
+    });
+    // The designed stages' coefficients depend on the sample rate
+    designed_filters_.modify_both([&](Filters& filters) {
+        filters.sample_rate = sample_rate;
+        apply_design(filters);
+    });
+
+    // The filter parameter will be smoothed to prevent clicks during automation
+    const double compensated_sample_rate = sample_rate / smoothing_interval;
+    smoothed_frequency_.reset(compensated_sample_rate, filter_smoothing_secs);
+    smoothed_resonance_.reset(compensated_sample_rate, filter_smoothing_secs);
+    smoothed_spread_.reset(compensated_sample_rate, filter_smoothing_secs);
+
+    rotator_.prepare(sample_rate, num_channels);
+    limiter_.prepare(sample_rate, max_block_size);
+
+    // Both copies of the filters were just resized, so there's nothing left
+    // to fade to
+    stage_fade_ = StageFade::none;
+    stage_fade_gain_ = 1.0f;
+    stage_fade_step_ =
+        static_cast<float>(1.0 / std::max(1.0, stage_fade_secs * sample_rate));
+}
+
+void DiopserEngine::release() {
+    filters_.modify_both([this](Filters& filters) { free_filters(filters); });
+    designed_filters_.modify_both(
+        [this](Filters& filters) { free_filters(filters); });
+}
+
+void DiopserEngine::set_num_stages(size_t num_stages) {
+    num_stages_ = num_stages;
+    filters_.modify_and_swap([this](Filters& filters) {
+        resize(filters, num_stages_);
+        filters.stage_fade_request = stage_fade_requests_;
+    });
+}
+
+void DiopserEngine::fade_to_num_stages(size_t num_stages) {
+    // This has to be incremented before the new filters are published, or the
+    // audio thread could swap them in without fading
+    stage_fade_requests_ += 1;
+    set_num_stages(num_stages);
+}
+
+void DiopserEngine::set_design(const std::vector<DesignedStage>& design) {
+    designed_filters_.modify_and_swap([&](Filters& filters) {
+        filters.design = design;
+        apply_design(filters);
+    });
+}
+
+void DiopserEngine::process(float* const* samples,
+                            size_t num_channels,
+                            size_t num_samples,
+                            const Parameters& parameters) {
+    process_samples(PlanarSamples{samples}, num_channels, num_samples,
+                    parameters);
+}
+
+void DiopserEngine::process_interleaved(float* samples,
+                                        size_t num_channels,
+                                        size_t num_samples,
+                                        const Parameters& parameters) {
+    process_samples(InterleavedSamples{samples, num_channels}, num_channels,
+                    num_samples, parameters);
+}
+
+template <typename Samples>
+void DiopserEngine::process_samples(Samples samples,
+                                    size_t num_channels,
+                                    size_t num_samples,
+                                    const Parameters& parameters) {
+    assert(num_channels <= num_channels_);
+
+    // Our filter structures get updated from a background thread whenever the
+    // number of stages or the design changes
+    Filters& filters =
+        acquire_filters(!parameters.rotation_mode && !parameters.design_mode);
+    Filters& designed_filters = designed_filters_.get();
+
+    // The rotation mode and the designed stages replace the entire filter
+    // cascade. Whichever one gets switched to starts from silence, so it
+    // doesn't play back whatever was still ringing when it was last used.
+    if (parameters.rotation_mode) {
+        if (!old_rotation_mode_) {
+            rotator_.reset();
+        }
+
+        rotator_.process(samples, num_channels, num_samples,
+                         parameters.rotation_angle);
+    } else {
+        Filters& active_filters =
+            parameters.design_mode ? designed_filters : filters;
+        if (old_rotation_mode_ || parameters.design_mode != old_design_mode_) {
+            std::for_each_n(
+                active_filters.channels,
+                active_filters.num_stages * active_filters.num_channels,
+                [](AllPassFilter& filter) { filter.reset(); });
+        }
+
+        process_filters(active_filters, samples, num_channels, num_samples,
+                        parameters);
+    }
+    old_rotation_mode_ = parameters.rotation_mode;
+    old_design_mode_ = parameters.design_mode;
+
+    if (stage_fade_ != StageFade::none) {
+        apply_stage_fade(samples, num_channels, num_samples);
+    }
+
+    // Some combinations of settings can cause extremely loud resonances, so
+    // unless the user explicitly disabled it we'll run the output through a
+    // zero-latency peak limiter
+    if (parameters.safe_mode) {
+        if (!old_safe_mode_) {
+            limiter_.reset();
+        }
+
+        if constexpr (std::is_same_v<Samples, PlanarSamples>) {
+            limiter_.process(samples.channels, num_channels, num_samples);
+        } else {
+            limiter_.process_interleaved(samples.samples, num_channels,
+                                         samples.stride, num_samples);
+        }
+    }
+    old_safe_mode_ = parameters.safe_mode;
+}
+
+DiopserEngine::Filters& DiopserEngine::acquire_filters(bool uses_filters) {
+    if (stage_fade_ == StageFade::fading_out) {
+        // The old filters keep playing until the output is silent. The swap
+        // can fail if another thread is modifying the filters right now, in
+        // which case we stay silent and try again on the next block.
+        if (stage_fade_gain_ > 0.0f) {
+            return filters_.active();
+        }
+
+        Filters& filters = filters_.get();
+        if (!filters_.has_pending_swap()) {
+            stage_fade_ = StageFade::fading_in;
+        }
+
+        return filters;
+    }
+
+    // The new filters can be swapped in right away when they're not being
+    // listened to. Otherwise a fade was requested if the active filters
+    // predate the last request.
+    if (uses_filters && filters_.has_pending_swap() &&
+        filters_.active().stage_fade_request != stage_fade_requests_) {
+        // This also reverses a fade in that's still in progress
+        stage_fade_ = StageFade::fading_out;
+        return filters_.active();
+    }
+
+    return filters_.get();
+}
+
+template <typename Samples>
+void DiopserEngine::apply_stage_fade(Samples samples,
+                                     size_t num_channels,
+                                     size_t num_samples) {
+    const float step = stage_fade_ == StageFade::fading_out
+                           ? -stage_fade_step_
+                           : stage_fade_step_;
+    const size_t stride = samples.stride;
+
+    float gain = stage_fade_gain_;
+    for (size_t sample_idx = 0; sample_idx < num_samples; sample_idx++) {
+        gain = std::clamp(gain + step, 0.0f, 1.0f);
+        for (size_t channel = 0; channel < num_channels; channel++) {
+            samples.channel(channel)[sample_idx * stride] *= gain;
+        }
+    }
+    stage_fade_gain_ = gain;
+
+    if (stage_fade_ == StageFade::fading_in && gain == 1.0f) {
+        stage_fade_ = StageFade::none;
+    }
+}
+
+template <typename Samples>
+void DiopserEngine::process_filters(Filters& filters,
+                                    Samples samples,
+                                    size_t num_channels,
+                                    size_t num_samples,
+                                    const Parameters& parameters) {
+    const Kernel kernel = choose_kernel(filters.num_stages);
+    const bool should_measure = kernel_ == Kernel::automatic &&
+                                filters.num_stages > 0 &&
+                                filters.num_stages <= max_sample_major_stages &&
+                                num_channels > 0 && num_samples > 0;
+    const auto block_start = should_measure
+                                 ? std::chrono::steady_clock::now()
+                                 : std::chrono::steady_clock::time_point{};
+
+    if (filters.fixed_coefficients) {
+        // The designed stages' coefficients never change
+        process_cascade(filters, samples, num_channels, 0, num_samples,
+                        kernel);
+    } else {
+        process_smoothed(filters, samples, num_channels, num_samples,
+                         parameters, kernel);
+    }
+
+    if (should_measure) {
+        const double block_ns =
+            std::chrono::duration<double, std::nano>(
+                std::chrono::steady_clock::now() - block_start)
+                .count();
+        const double cost =
+            block_ns / static_cast<double>(filters.num_stages * num_channels *
+                                           num_samples);
+
+        double& smoothed_cost =
+            kernel_costs_[kernel == Kernel::sample_major ? 0 : 1];
+        smoothed_cost = smoothed_cost == 0.0
+                            ? cost
+                            : smoothed_cost + ((cost - smoothed_cost) * 0.25);
+    }
+    last_kernel_ = kernel;
+}
+
+template <typename Samples>
+void DiopserEngine::process_smoothed(Filters& filters,
+                                     Samples samples,
+                                     size_t num_channels,
+                                     size_t num_samples,
+                                     const Parameters& parameters,
+                                     Kernel kernel) {
+    smoothed_frequency_.set_target(parameters.frequency);
+    smoothed_resonance_.set_target(parameters.resonance);
+    smoothed_spread_.set_target(parameters.spread);
+
+    // While the user is dragging one of the editor's controls the targets
+    // change on every block, and recomputing every stage's coefficients every
+    // `smoothing_interval` samples causes large CPU spikes with high stage
+    // counts. During those gestures we'll update the coefficients at most once
+    // per block instead, and skip ahead multiple smoothing steps at a time so
+    // the ramps still take the same amount of time. Skipping a single step is
+    // identical to `next()`.
+    const int smoothing_interval = parameters.smoothing_interval;
+    const int smoothing_steps =
+        parameters.gesture_in_progress
+            ? std::max(1, static_cast<int>(num_samples) / smoothing_interval)
+            : 1;
+    for (size_t sample_idx = 0; sample_idx < num_samples;) {
+        // Recomputing these IIR coefficients every sample is expensive, so to
+        // save some cycles we only do it once every `smoothing_interval`
+        // samples unless the filters just got reinitialized or some parameter
+        // we can't smooth has
+        const bool should_apply_smoothing =
+            next_smooth_in_ <= 0 && (smoothed_frequency_.is_smoothing() ||
+                                     smoothed_resonance_.is_smoothing() ||
+                                     smoothed_spread_.is_smoothing());
+        const bool should_update_filters =
+            !filters.is_initialized ||
+            parameters.spread_linear != old_spread_linear_ ||
+            should_apply_smoothing;
+
+        const float current_frequency =
+            should_apply_smoothing ? smoothed_frequency_.skip(smoothing_steps)
+                                   : smoothed_frequency_.current();
+        const float current_resonance =
+            should_apply_smoothing ? smoothed_resonance_.skip(smoothing_steps)
+                                   : smoothed_resonance_.current();
+        const float current_spread =
+            should_apply_smoothing ? smoothed_spread_.skip(smoothing_steps)
+                                   : smoothed_spread_.current();
+
+        if (should_update_filters && filters.num_stages > 0) {
+            update_coefficients(filters, current_frequency, current_resonance,
+                                current_spread, parameters.spread_linear);
+
+            next_smooth_in_ = smoothing_interval * smoothing_steps;
+        }
+
+        next_smooth_in_ -= 1;
+        filters.is_initialized = true;
+        old_spread_linear_ = parameters.spread_linear;
+
+        // The coefficients stay the same until the next smoothing cycle, so
+        // all samples up to that point can be processed in one go. This
+        // counts down `next_smooth_in_` exactly like processing those samples
+        // one at a time would.
+        size_t length = num_samples - sample_idx;
+        if (smoothed_frequency_.is_smoothing() ||
+            smoothed_resonance_.is_smoothing() ||
+            smoothed_spread_.is_smoothing()) {
+            length = std::min(
+                length, static_cast<size_t>(std::max(next_smooth_in_, 0)) + 1);
+        }
+        next_smooth_in_ -= static_cast<int>(length - 1);
+
+        process_cascade(filters, samples, num_channels, sample_idx, length,
+                        kernel);
+        sample_idx += length;
+    }
+}
+
+template <typename Samples>
+void DiopserEngine::process_cascade(Filters& filters,
+                                    Samples samples,
+                                    size_t num_channels,
+                                    size_t offset,
+                                    size_t length,
+                                    Kernel kernel) {
+    if (kernel == Kernel::pipelined && length >= min_pipelined_length) {
+        for (size_t channel = 0; channel < num_channels; channel++) {
+            process_cascade_pipelined(
+                filters.coefficients, filters.channels + channel,
+                filters.num_channels, filters.num_stages,
+                samples.channel(channel) + (offset * samples.stride),
+                samples.stride, length);
+        }
+
+        return;
+    }
+
+    for (size_t sample_idx = offset; sample_idx < offset + length;
+         sample_idx++) {
+        for (size_t stage_idx = 0; stage_idx < filters.num_stages;
+             stage_idx++) {
+            // This is a copy so the coefficients can stay in registers, since
+            // writing the samples could otherwise alias them
+            const AllPassCoefficients coefficients =
+                filters.coefficients[stage_idx];
+            AllPassFilter* stage_channels = filters.stage_channels(stage_idx);
+            for (size_t channel = 0; channel < num_channels; channel++) {
+                // TODO: We should add a dry-wet control, could be useful for
+                //       automation
+                float& sample =
+                    samples.channel(channel)[sample_idx * samples.stride];
+                sample = stage_channels[channel].process_sample(sample,
+                                                                coefficients);
+            }
+        }
+    }
+}
+
+DiopserEngine::Kernel DiopserEngine::choose_kernel(size_t num_stages) {
+    const Kernel kernel = kernel_.load(std::memory_order_relaxed);
+    if (kernel != Kernel::automatic) {
+        return kernel;
+    }
+    if (num_stages > max_sample_major_stages) {
+        return Kernel::pipelined;
+    }
+
+    // The costs are measured per stage, but the pipelined kernel's relative
+    // overhead still depends on the number of stages
+    if (num_stages != measured_num_stages_) {
+        kernel_costs_[0] = 0.0;
+        kernel_costs_[1] = 0.0;
+        measured_num_stages_ = num_stages;
+    }
+    if (kernel_costs_[0] == 0.0) {
+        return Kernel::sample_major;
+    }
+    if (kernel_costs_[1] == 0.0) {
+        return Kernel::pipelined;
+    }
+
+    const bool pipelined_is_cheaper = kernel_costs_[1] < kernel_costs_[0];
+    if (blocks_until_probe_ <= 0) {
+        blocks_until_probe_ = kernel_probe_interval;
+        return pipelined_is_cheaper ? Kernel::sample_major : Kernel::pipelined;
+    }
+
+    blocks_until_probe_ -= 1;
+    return pipelined_is_cheaper ? Kernel::pipelined : Kernel::sample_major;
+}
+
+size_t DiopserEngine::num_stages() {
+    return filters_.active().num_stages;
+}
+
+size_t DiopserEngine::requested_num_stages() const {
+    return num_stages_;
+}
+
+void DiopserEngine::save_state(State& state) {
+    Filters& filters = filters_.get();
+    Filters& designed_filters = designed_filters_.get();
+
+    state.sample_rate = sample_rate_;
+    state.num_channels = num_channels_;
+    state.filters_initialized = filters.is_initialized;
+    save_stages(filters, state.stages);
+
+    state.frequency = smoothed_frequency_.state();
+    state.resonance = smoothed_resonance_.state();
+    state.spread = smoothed_spread_.state();
+    state.next_smooth_in = next_smooth_in_;
+    state.old_spread_linear = old_spread_linear_;
+
+    state.old_rotation_mode = old_rotation_mode_;
+    rotator_.save_state(state.rotator);
+
+    state.old_design_mode = old_design_mode_;
+    state.design = designed_filters.design;
+    save_stages(designed_filters, state.designed_stages);
+
+    state.old_safe_mode = old_safe_mode_;
+    state.limiter = limiter_.state();
+}
+
+bool DiopserEngine::restore_state(const State& state) {
+    if (state.sample_rate != sample_rate_ ||
+        state.num_channels != num_channels_) {
+        return false;
+    }
+    for (const auto* stages : {&state.stages, &state.designed_stages}) {
+        for (const auto& stage_state : *stages) {
+            if (stage_state.channels.size() != state.num_channels) {
+                return false;
+            }
+        }
+    }
+    if (state.designed_stages.size() != state.design.size() ||
+        !std::all_of(state.design.begin(), state.design.end(),
+                     [](const DesignedStage& stage) {
+                         return stage.is_valid();
+                     })) {
+        return false;
+    }
+    if (!rotator_.restore_state(state.rotator)) {
+        return false;
+    }
+
+    // Both copies are restored so it doesn't matter which one is active
+    num_stages_ = state.stages.size();
+    filters_.modify_both([&](Filters& filters) {
+        resize(filters, num_stages_);
+        filters.stage_fade_request = stage_fade_requests_;
+
+        filters.is_initialized = state.filters_initialized;
+        restore_stages(filters, state.stages);
+    });
+    designed_filters_.modify_both([&](Filters& filters) {
+        filters.design = state.design;
+        apply_design(filters);
+
+        restore_stages(filters, state.designed_stages);
+    });
+
+    smoothed_frequency_.restore(state.frequency);
+    smoothed_resonance_.restore(state.resonance);
+    smoothed_spread_.restore(state.spread);
+    next_smooth_in_ = state.next_smooth_in;
+    old_spread_linear_ = state.old_spread_linear;
+
+    old_rotation_mode_ = state.old_rotation_mode;
+    old_design_mode_ = state.old_design_mode;
+
+    old_safe_mode_ = state.old_safe_mode;
+    limiter_.restore(state.limiter);
+
+    stage_fade_ = StageFade::none;
+    stage_fade_gain_ = 1.0f;
+
+    return true;
+}
+
+void DiopserEngine::set_kernel(Kernel kernel) {
+    kernel_ = kernel;
+}
+
+DiopserEngine::MemoryStats DiopserEngine::memory_stats() const {
+    return MemoryStats{.allocated_bytes = allocated_bytes_,
+                       .locked_bytes = locked_bytes_,
+                       .lock_failures = lock_failures_};
+}
+
+void DiopserEngine::save_stages(Filters& filters,
+                                std::vector<State::Stage>& stages) {
+    stages.resize(filters.num_stages);
+    for (size_t stage_idx = 0; stage_idx < filters.num_stages; stage_idx++) {
+        const AllPassFilter* stage_channels = filters.stage_channels(stage_idx);
+        State::Stage& stage_state = stages[stage_idx];
+
+        stage_state.coefficients = filters.coefficients[stage_idx];
+        stage_state.channels.resize(filters.num_channels);
+        for (size_t channel = 0; channel < filters.num_channels; channel++) {
+            stage_state.channels[channel] = stage_channels[channel].state();
+        }
+    }
+}
+
+void DiopserEngine::restore_stages(Filters& filters,
+                                   const std::vector<State::Stage>& stages) {
+    assert(stages.size() == filters.num_stages);
+
+    for (size_t stage_idx = 0; stage_idx < filters.num_stages; stage_idx++) {
+        AllPassFilter* stage_channels = filters.stage_channels(stage_idx);
+        const State::Stage& stage_state = stages[stage_idx];
+
+        filters.coefficients[stage_idx] = stage_state.coefficients;
+        for (size_t channel = 0; channel < filters.num_channels; channel++) {
+            stage_channels[channel].restore(stage_state.channels[channel]);
+        }
+    }
+}
+
+void DiopserEngine::resize(Filters& filters, size_t num_stages) {
+    // The actual coefficients for each stage are initialized on the next
+    // processing cycle thanks to `filters.is_initialized`
+    filters.is_initialized = false;
+
+    const size_t num_channels = num_channels_;
+    const size_t coefficients_size =
+        (num_stages * sizeof(AllPassCoefficients) + cache_line_size - 1) /
+        cache_line_size * cache_line_size;
+    const size_t required_size =
+        coefficients_size + (num_stages * num_channels * sizeof(AllPassFilter));
+    if (required_size > filters.memory.size()) {
+        const size_t old_size = filters.memory.size();
+        const bool was_locked = filters.memory.is_locked();
+        filters.memory.allocate(required_size);
+
+        allocated_bytes_ += filters.memory.size() - old_size;
+        if (was_locked) {
+            locked_bytes_ -= old_size;
+        }
+        if (filters.memory.is_locked()) {
+            locked_bytes_ += filters.memory.size();
+        } else {
+            lock_failures_ += 1;
+        }
+    }
+
+    // Value initializing the filters also clears their state
+    char* data = static_cast<char*>(filters.memory.data());
+    filters.num_stages = num_stages;
+    filters.num_channels = num_channels;
+    filters.coefficients = reinterpret_cast<AllPassCoefficients*>(data);
+    filters.channels =
+        reinterpret_cast<AllPassFilter*>(data + coefficients_size);
+    std::uninitialized_value_construct_n(filters.coefficients, num_stages);
+    std::uninitialized_value_construct_n(filters.channels,
+                                         num_stages * num_channels);
+}
+
+void DiopserEngine::free_filters(Filters& filters) {
+    filters.is_initialized = false;
+    filters.num_stages = 0;
+    filters.coefficients = nullptr;
+    filters.channels = nullptr;
+
+    allocated_bytes_ -= filters.memory.size();
+    if (filters.memory.is_locked()) {
+        locked_bytes_ -= filters.memory.size();
+    }
+    filters.memory.free();
+}
+
+void DiopserEngine::apply_design(Filters& filters) {
+    resize(filters, filters.design.size());
+
+    // Unlike the regular filters' coefficients, these are computed right away
+    // since they never change
+    for (size_t stage_idx = 0; stage_idx < filters.num_stages; stage_idx++) {
+        const DesignedStage& stage = filters.design[stage_idx];
+        filters.coefficients[stage_idx] = make_all_pass(
+            filters.sample_rate,
+            clamp_filter_frequency(filters.sample_rate, stage.frequency),
+            stage.resonance);
+    }
+
+    filters.fixed_coefficients = true;
+    filters.is_initialized = true;
+}
+
+void DiopserEngine::update_coefficients(Filters& filters,
+                                        float frequency,
+                                        float resonance,
+                                        float spread,
+                                        bool spread_linear) {
+    // When spread has been disabled every stage uses the same coefficients, so
+    // those only need to be computed once
+    if (spread == 0.0f) {
+        const AllPassCoefficients coefficients = make_all_pass(
+            sample_rate_, clamp_filter_frequency(sample_rate_, frequency),
+            resonance);
+        std::fill_n(filters.coefficients, filters.num_stages, coefficients);
+    } else {
+        const StageFrequencies stage_frequencies(sample_rate_, frequency,
+                                                 spread, spread_linear);
+
+        const size_t num_stages = filters.num_stages;
+        for (size_t stage_idx = 0; stage_idx < num_stages; stage_idx++) {
+            filters.coefficients[stage_idx] = make_all_pass(
+                sample_rate_, stage_frequencies(stage_idx, num_stages),
+                resonance);
+        }
+    }
+}
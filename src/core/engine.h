@@ -0,0 +1,544 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "all_pass_filter.h"
+#include "atomically_swappable.h"
+#include "coefficients.h"
+#include "group_delay_designer.h"
+#include "limiter.h"
+#include "linear_smoother.h"
+#include "phase_rotator.h"
+#include "resident_memory.h"
+#include "sample_layout.h"
+
+/**
+ * Diopser's entire signal path without any of the plugin wrapper: a cascade of
+ * all-pass filters with smoothed parameters or with stages from a
+ * `GroupDelayDesigner` design, followed by the optional safety limiter. This
+ * doesn't depend on JUCE, so it can also be used by benchmarks and offline
+ * tools. `DiopserProcessor` forwards its parameters to this engine and
+ * otherwise only handles the host interaction.
+ *
+ * The caller is responsible for disabling denormals on the processing thread.
+ */
+class DiopserEngine {
+   public:
+    /**
+     * The highest number of stages the plugin and the tools allow. Stage counts
+     * above 512 are only practical with the pipelined kernel, so they always
+     * use that kernel.
+     */
+    static constexpr size_t max_stages = 4096;
+    static constexpr size_t max_sample_major_stages = 512;
+
+    /**
+     * How the filter cascade gets processed. Both kernels produce the exact
+     * same output.
+     */
+    enum class Kernel {
+        /**
+         * Use whichever kernel is cheaper for the current number of stages,
+         * based on measured block times. The kernel that's not in use is
+         * measured again every so often, since the costs also depend on the
+         * block sizes and the system's load.
+         */
+        automatic,
+        /**
+         * Run every sample through all stages before moving on to the next
+         * sample. This has no overhead per block, so it's faster for low
+         * stage counts and very short smoothing intervals.
+         */
+        sample_major,
+        /**
+         * Process groups of stages as a pipeline using SIMD instructions. See
+         * `process_cascade_pipelined()`.
+         */
+        pipelined,
+    };
+
+    /**
+     * The parameters used for a single call to `process()`. The number of
+     * stages is set separately using `set_num_stages()` since changing it
+     * requires allocations.
+     */
+    struct Parameters {
+        float frequency = 200.0f;
+        float resonance = 0.5f;
+        float spread = 0.0f;
+        bool spread_linear = false;
+        /**
+         * The interval in samples between parameter smoothing cycles.
+         * Recomputing the IIR coefficients for every stage on every sample
+         * while smoothing gets a bit expensive.
+         */
+        int smoothing_interval = 128;
+        bool safe_mode = true;
+        /**
+         * Set while the user is dragging one of the editor's controls. The
+         * targets then change on every block, so the coefficients are only
+         * updated once per block to avoid large CPU spikes with high stage
+         * counts.
+         */
+        bool gesture_in_progress = false;
+        /**
+         * Replace the filter cascade with a `PhaseRotator`, which rotates the
+         * phase of every frequency by `rotation_angle` degrees at a fixed
+         * cost. The number of stages and the filter parameters are ignored
+         * while this is enabled.
+         */
+        bool rotation_mode = false;
+        float rotation_angle = 0.0f;
+        /**
+         * Use the stages set with `set_design()` instead of the ones computed
+         * from the filter parameters. The number of stages and the filter
+         * parameters are ignored while this is enabled.
+         */
+        bool design_mode = false;
+    };
+
+    /**
+     * A snapshot of everything that affects the engine's future output apart
+     * from the parameters passed to `process()`: the filters' states and
+     * coefficients, the parameter smoothers, and the limiter. Restoring this on
+     * an engine prepared with the same sample rate and channel count makes it
+     * continue exactly where the original engine left off, so offline renders
+     * can start in the middle of a file without any pre-roll.
+     */
+    struct State {
+        struct Stage {
+            AllPassCoefficients coefficients;
+            std::vector<AllPassFilter::State> channels;
+        };
+
+        double sample_rate = 0.0;
+        size_t num_channels = 0;
+        bool filters_initialized = false;
+        std::vector<Stage> stages;
+
+        LinearSmoother::State frequency;
+        LinearSmoother::State resonance;
+        LinearSmoother::State spread;
+        int next_smooth_in = 0;
+        bool old_spread_linear = false;
+
+        bool old_rotation_mode = false;
+        PhaseRotator::State rotator;
+
+        bool old_design_mode = false;
+        /**
+         * The design set with `set_design()`, along with the designed stages'
+         * coefficients and filter states.
+         */
+        std::vector<DesignedStage> design;
+        std::vector<Stage> designed_stages;
+
+        bool old_safe_mode = false;
+        SafetyLimiter::State limiter;
+    };
+
+    /**
+     * How much memory the filters use, and whether it could be locked into
+     * RAM. See `ResidentMemory`.
+     */
+    struct MemoryStats {
+        size_t allocated_bytes = 0;
+        size_t locked_bytes = 0;
+        /**
+         * The number of allocations that could not be locked since the engine
+         * was created. These still work, but they may be swapped out.
+         */
+        uint64_t lock_failures = 0;
+    };
+
+    /**
+     * Allocate the filters and set up the smoothers. The ramp length of the
+     * smoothers depends on the smoothing interval at this point, just like it
+     * always has. The filters' memory is made resident here, so the first
+     * call to `process()` doesn't cause any page faults. This must not be
+     * called from the audio thread.
+     */
+    void prepare(double sample_rate,
+                 size_t max_block_size,
+                 size_t num_channels,
+                 size_t num_stages,
+                 int smoothing_interval);
+
+    /**
+     * Free the filters. `prepare()` has to be called again before the next
+     * call to `process()`.
+     */
+    void release();
+
+    /**
+     * Change the number of filter stages. This resizes the inactive copy of
+     * the filters, which then gets swapped in at the start of the next call
+     * to `process()`. Any new memory is made resident before it gets swapped
+     * in. This may block and should thus never be called from the audio
+     * thread.
+     */
+    void set_num_stages(size_t num_stages);
+
+    /**
+     * The same as `set_num_stages()`, but the output fades out before the new
+     * filters get swapped in and fades back in afterwards. Resizing the
+     * filters resets their state, which causes a click, and a large change in
+     * the number of stages also changes the sound abruptly. The fades take
+     * `stage_fade_secs` each. Regular changes to the stage count aren't
+     * faded, since automating the stage count would then keep dipping the
+     * output. Fades are not part of the engine's `State`. This may block and
+     * should thus never be called from the audio thread.
+     */
+    void fade_to_num_stages(size_t num_stages);
+
+    /**
+     * Replace the stages used with `Parameters::design_mode`. Like
+     * `set_num_stages()`, this prepares the inactive copy of the designed
+     * stages, which gets swapped in at the start of the next call to
+     * `process()`. The design is kept when the engine gets prepared again.
+     * This may block and should thus never be called from the audio thread.
+     */
+    void set_design(const std::vector<DesignedStage>& design);
+
+    /**
+     * Process `num_channels` channels of audio in place. `num_channels` may
+     * not exceed the number of channels passed to `prepare()`. This is
+     * realtime safe.
+     */
+    void process(float* const* samples,
+                 size_t num_channels,
+                 size_t num_samples,
+                 const Parameters& parameters);
+
+    /**
+     * The same as `process()`, but for an interleaved buffer containing
+     * `num_channels` channels. The buffer is processed in place, and the
+     * output is identical to processing the same audio in planar form.
+     */
+    void process_interleaved(float* samples,
+                             size_t num_channels,
+                             size_t num_samples,
+                             const Parameters& parameters);
+
+    /**
+     * The number of stages the currently active filters have. A call to
+     * `set_num_stages()` is only reflected here after the next call to
+     * `process()`, and a call to `fade_to_num_stages()` only once the output
+     * has faded out. This should only be called from the audio thread.
+     */
+    size_t num_stages();
+
+    /**
+     * The number of stages from the last call to `prepare()`,
+     * `set_num_stages()`, `fade_to_num_stages()`, or `restore_state()`, even
+     * if those filters haven't been swapped in yet. Unlike `num_stages()`,
+     * this can be called from any thread.
+     */
+    size_t requested_num_stages() const;
+
+    /**
+     * Store the engine's current state in `state`, reusing its allocations.
+     * This should only be called in between calls to `process()` from the
+     * thread that calls `process()`, since it reads the active filters. A
+     * pending call to `set_num_stages()` takes effect before the state is
+     * stored.
+     */
+    void save_state(State& state);
+
+    /**
+     * Restore a state stored with `save_state()`. The engine must already be
+     * prepared using the same sample rate and number of channels, and the
+     * number of stages and the design are taken from the state. Like
+     * `prepare()`, this must not be called while another thread is calling
+     * `process()`.
+     *
+     * @return False if the state doesn't match the engine's sample rate or
+     *   channel count or if its design contains invalid stages, in which
+     *   case the engine is left unchanged.
+     */
+    bool restore_state(const State& state);
+
+    /**
+     * Can be called from any thread.
+     */
+    MemoryStats memory_stats() const;
+
+    /**
+     * Force a specific kernel, for benchmarking and testing. This defaults to
+     * `Kernel::automatic`, and it can be called from any thread.
+     */
+    void set_kernel(Kernel kernel);
+
+    /**
+     * The kernel used during the last call to `process()`. This should only be
+     * called from the audio thread.
+     */
+    Kernel last_kernel() const { return last_kernel_; }
+
+   private:
+    template <typename Samples>
+    void process_samples(Samples samples,
+                         size_t num_channels,
+                         size_t num_samples,
+                         const Parameters& parameters);
+
+    /**
+     * This contains an arbitrary number of filter stages, which each contains
+     * some filter coefficients as well as an IIR filter for each channel.
+     * Everything lives in a single `ResidentMemory` block. The coefficients
+     * come first, followed by the filters starting at the next cache line.
+     * The block only grows, so reducing the number of stages and then
+     * increasing it again doesn't allocate.
+     */
+    struct Filters {
+        /**
+         * This should be set to `false` when changing the number of filter
+         * stages. Then we can initialize the filters during the first
+         * processing cycle.
+         */
+        bool is_initialized = false;
+        /**
+         * Set for the designed stages, whose coefficients are computed once
+         * when the design is set and are never smoothed.
+         */
+        bool fixed_coefficients = false;
+        /**
+         * The design the designed stages were built from, so they can be
+         * rebuilt when the sample rate changes.
+         */
+        std::vector<DesignedStage> design;
+        /**
+         * The sample rate the designed stages' coefficients are computed for.
+         * `prepare()` sets this while holding the lock, so `set_design()` can
+         * read it from the designer's thread without racing `sample_rate_`.
+         */
+        double sample_rate = 0.0;
+        /**
+         * The value of `stage_fade_requests_` when these filters were
+         * resized. If the active filters have an older value, then a fade was
+         * requested for the pending filters.
+         */
+        uint64_t stage_fade_request = 0;
+
+        size_t num_stages = 0;
+        size_t num_channels = 0;
+        /**
+         * Indexed by `[stage_idx]`.
+         */
+        AllPassCoefficients* coefficients = nullptr;
+        /**
+         * Indexed by `[stage_idx * num_channels + channel_idx]`.
+         */
+        AllPassFilter* channels = nullptr;
+
+        ResidentMemory memory;
+
+        AllPassFilter* stage_channels(size_t stage_idx) {
+            return channels + (stage_idx * num_channels);
+        }
+    };
+
+    /**
+     * Run the samples through the filter cascade, updating the coefficients
+     * while the parameters are being smoothed unless the filters have fixed
+     * coefficients.
+     */
+    template <typename Samples>
+    void process_filters(Filters& filters,
+                         Samples samples,
+                         size_t num_channels,
+                         size_t num_samples,
+                         const Parameters& parameters);
+
+    /**
+     * The part of `process_filters()` for filters without fixed coefficients.
+     * This recomputes the coefficients once every smoothing interval while the
+     * parameters are being smoothed, and processes everything in between with
+     * `process_cascade()`.
+     */
+    template <typename Samples>
+    void process_smoothed(Filters& filters,
+                          Samples samples,
+                          size_t num_channels,
+                          size_t num_samples,
+                          const Parameters& parameters,
+                          Kernel kernel);
+
+    /**
+     * Run the samples in `[offset, offset + length)` through all stages using
+     * the filters' current coefficients.
+     */
+    template <typename Samples>
+    void process_cascade(Filters& filters,
+                         Samples samples,
+                         size_t num_channels,
+                         size_t offset,
+                         size_t length,
+                         Kernel kernel);
+
+    /**
+     * Copy the filters' coefficients and states to `stages`, and back. When
+     * restoring, the filters must already have the same number of stages as
+     * `stages`.
+     */
+    static void save_stages(Filters& filters,
+                            std::vector<State::Stage>& stages);
+    static void restore_stages(Filters& filters,
+                               const std::vector<State::Stage>& stages);
+
+    /**
+     * Pick the kernel for the next block. See `Kernel::automatic`.
+     */
+    Kernel choose_kernel(size_t num_stages);
+
+    /**
+     * Fetch the regular filters for the next block, swapping in the filters
+     * from the last call to `set_num_stages()` unless a fade requested by
+     * `fade_to_num_stages()` is still fading out. `uses_filters` should be
+     * false when the block won't be processed with these filters, in which
+     * case there is nothing to fade.
+     */
+    Filters& acquire_filters(bool uses_filters);
+
+    /**
+     * Apply the current stage fade's gain ramp to the processed output.
+     */
+    template <typename Samples>
+    void apply_stage_fade(Samples samples,
+                          size_t num_channels,
+                          size_t num_samples);
+
+    /**
+     * Resize and reset the filters for `num_stages` stages and the current
+     * number of channels. This is called while holding `filters_`'s or
+     * `designed_filters_`'s lock with the latest number of stages, so the last
+     * resize always matches the last call to `prepare()`, `set_num_stages()`
+     * or `set_design()` regardless of which thread gets the lock first.
+     */
+    void resize(Filters& filters, size_t num_stages);
+
+    /**
+     * Free the filters' memory.
+     */
+    void free_filters(Filters& filters);
+
+    /**
+     * Resize `filters` for `filters.design` and compute the designed stages'
+     * coefficients at `filters.sample_rate`. This is called while holding
+     * `designed_filters_`'s lock.
+     */
+    void apply_design(Filters& filters);
+
+    /**
+     * Recompute every stage's coefficients for the current smoothed values.
+     */
+    void update_coefficients(Filters& filters,
+                             float frequency,
+                             float resonance,
+                             float spread,
+                             bool spread_linear);
+
+    double sample_rate_ = 0.0;
+    /**
+     * These are set from `prepare()` and `set_num_stages()`, which may be
+     * called from different threads.
+     */
+    std::atomic<size_t> num_channels_ = 0;
+    std::atomic<size_t> num_stages_ = 0;
+
+    /**
+     * Our all-pass filters. Resized from a background thread whenever the
+     * number of stages changes.
+     */
+    AtomicallySwappable<Filters> filters_;
+    /**
+     * The stages used with `Parameters::design_mode`. These live separately
+     * from the regular filters, so switching between the two doesn't require
+     * any allocations.
+     */
+    AtomicallySwappable<Filters> designed_filters_;
+
+    /**
+     * Updated whenever either copy of the filters gets reallocated or freed.
+     */
+    std::atomic<size_t> allocated_bytes_ = 0;
+    std::atomic<size_t> locked_bytes_ = 0;
+    std::atomic<uint64_t> lock_failures_ = 0;
+
+    /**
+     * How many samples we should process before updating and smoothing the
+     * parameters again. We do this only once every `smoothing_interval`
+     * samples because recomputing all of these filter coefficients per-sample
+     * becomes pretty expensive.
+     *
+     * To keep things simple, this value can be negative.
+     */
+    int next_smooth_in_ = 0;
+
+    LinearSmoother smoothed_frequency_;
+    LinearSmoother smoothed_resonance_;
+    LinearSmoother smoothed_spread_;
+    bool old_spread_linear_ = false;
+
+    bool old_rotation_mode_ = false;
+    PhaseRotator rotator_;
+
+    bool old_design_mode_ = false;
+
+    /**
+     * Where we are in a fade started by `fade_to_num_stages()`. While fading
+     * out the audio thread keeps using the old filters, and the new filters
+     * are only swapped in once the output has reached silence.
+     */
+    enum class StageFade { none, fading_out, fading_in };
+
+    /**
+     * Incremented by `fade_to_num_stages()` before it resizes the filters, and
+     * stored in the resized filters. Only the writers modify this, so a fade
+     * requested while another fade is still running can't be lost to the
+     * audio thread clearing a flag.
+     */
+    std::atomic<uint64_t> stage_fade_requests_ = 0;
+    StageFade stage_fade_ = StageFade::none;
+    float stage_fade_gain_ = 1.0f;
+    /**
+     * How much `stage_fade_gain_` changes per sample, set in `prepare()`.
+     */
+    float stage_fade_step_ = 1.0f;
+
+    bool old_safe_mode_ = false;
+    SafetyLimiter limiter_;
+
+    std::atomic<Kernel> kernel_ = Kernel::automatic;
+    Kernel last_kernel_ = Kernel::sample_major;
+    /**
+     * The measured cost of the sample-major and pipelined kernels in
+     * nanoseconds per stage per channel per sample, smoothed over multiple
+     * blocks. These are zero until the kernel has been measured with the
+     * current number of stages.
+     */
+    double kernel_costs_[2] = {0.0, 0.0};
+    size_t measured_num_stages_ = 0;
+    /**
+     * When this reaches zero the kernel that's not in use is measured again.
+     */
+    int blocks_until_probe_ = 0;
+};
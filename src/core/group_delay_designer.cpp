@@ -0,0 +1,542 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "group_delay_designer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numbers>
+#include <optional>
+
+#include "coefficients.h"
+#include "response.h"
+
+/**
+ * The number of logarithmically spaced frequencies the cascade's group delay
+ * is compared to the target at.
+ */
+constexpr size_t design_num_points = 128;
+
+/**
+ * Every stage count is optimized from this many starting points. See
+ * `initial_stages()`.
+ */
+constexpr size_t design_num_starts = 2;
+
+/**
+ * The number of stage counts tried in every round after the first one.
+ */
+constexpr size_t design_counts_per_round = 8;
+
+/**
+ * The pattern search's first and last step sizes, in natural log units of
+ * the frequency and the resonance. The step size is halved whenever a pass
+ * over all stages doesn't find any improvements.
+ */
+constexpr float design_initial_step = 0.5f;
+constexpr float design_final_step = 1.0f / 512.0f;
+/**
+ * An upper bound for the number of passes over all stages per step size, in
+ * case the search keeps finding tiny improvements.
+ */
+constexpr int design_max_passes_per_step = 16;
+
+/**
+ * The same range the plugin's resonance parameter uses, so every design can
+ * also be reached by hand with a single stage.
+ */
+constexpr float design_min_resonance = 0.01f;
+constexpr float design_max_resonance = 30.0f;
+
+/**
+ * Everything the workers share. This isn't modified while the workers run.
+ */
+struct DesignProblem {
+    double sample_rate;
+    AllPassResponseEvaluator evaluator;
+    /**
+     * The target group delay in samples at every point.
+     */
+    std::vector<float> target;
+    /**
+     * The normalized angular frequency at every point, and the boundaries of
+     * the frequency range each point covers. The boundaries lie halfway
+     * between two points on a logarithmic axis.
+     */
+    std::vector<double> omega;
+    std::vector<double> omega_edges;
+
+    float min_log_frequency;
+    float max_log_frequency;
+};
+
+/**
+ * A stage's parameters in the log domain the pattern search works in.
+ */
+struct SearchStage {
+    float log_frequency;
+    float log_resonance;
+};
+
+struct DesignCandidate {
+    std::vector<DesignedStage> stages;
+    /**
+     * The RMS error in samples.
+     */
+    float error = std::numeric_limits<float>::infinity();
+};
+
+static DesignedStage to_designed_stage(const DesignProblem& problem,
+                                       const SearchStage& stage) {
+    return DesignedStage{
+        .frequency = clamp_filter_frequency(problem.sample_rate,
+                                            std::exp(stage.log_frequency)),
+        .resonance = std::exp(stage.log_resonance)};
+}
+
+static void stage_group_delay(const DesignProblem& problem,
+                              const SearchStage& stage,
+                              float* group_delay) {
+    const DesignedStage designed_stage = to_designed_stage(problem, stage);
+    const AllPassCoefficients coefficients =
+        make_all_pass(problem.sample_rate, designed_stage.frequency,
+                      designed_stage.resonance);
+    problem.evaluator.evaluate_group_delay(
+        AllPassStage{.a1 = coefficients.b1, .a2 = coefficients.b0},
+        group_delay);
+}
+
+static float squared_error(const DesignProblem& problem, const float* total) {
+    float error = 0.0f;
+    for (size_t i = 0; i < problem.target.size(); i++) {
+        const float difference = total[i] - problem.target[i];
+        error += difference * difference;
+    }
+
+    return error;
+}
+
+/**
+ * Place `num_stages` stages so every stage covers an equal share of the area
+ * under the target curve. The first starting point sets every stage's
+ * resonance so its own group delay peak roughly spans that share, and the
+ * second one uses the plugin's default resonance for every stage. The latter
+ * works better for targets that pile many stages onto a narrow range.
+ */
+static std::vector<SearchStage> initial_stages(const DesignProblem& problem,
+                                               size_t num_stages,
+                                               size_t start) {
+    const size_t num_points = problem.target.size();
+    std::vector<double> cumulative_area(num_points + 1, 0.0);
+    for (size_t i = 0; i < num_points; i++) {
+        const double width =
+            problem.omega_edges[i + 1] - problem.omega_edges[i];
+        cumulative_area[i + 1] =
+            cumulative_area[i] +
+            (std::max(static_cast<double>(problem.target[i]), 0.0) * width);
+    }
+
+    // Without any group delay the stages are spread evenly instead
+    const bool has_area = cumulative_area.back() > 0.0;
+    if (!has_area) {
+        for (size_t i = 0; i < num_points; i++) {
+            cumulative_area[i + 1] =
+                cumulative_area[i] +
+                (problem.omega_edges[i + 1] - problem.omega_edges[i]);
+        }
+    }
+
+    // The frequency at which the area under the curve reaches `fraction` of
+    // the total, interpolated linearly within a point's range
+    const double total_area = cumulative_area.back();
+    auto omega_at = [&](double fraction) {
+        const double area = std::clamp(fraction, 0.0, 1.0) * total_area;
+        const size_t i = std::min<size_t>(
+            static_cast<size_t>(
+                std::upper_bound(cumulative_area.begin() + 1,
+                                 cumulative_area.end() - 1, area) -
+                (cumulative_area.begin() + 1)),
+            num_points - 1);
+        const double cell_area = cumulative_area[i + 1] - cumulative_area[i];
+        const double t =
+            cell_area > 0.0 ? (area - cumulative_area[i]) / cell_area : 0.5;
+
+        return problem.omega_edges[i] +
+               (t * (problem.omega_edges[i + 1] - problem.omega_edges[i]));
+    };
+
+    std::vector<SearchStage> stages(num_stages);
+    for (size_t stage_idx = 0; stage_idx < num_stages; stage_idx++) {
+        const double n = static_cast<double>(num_stages);
+        const double position = static_cast<double>(stage_idx);
+        const double omega = omega_at((position + 0.5) / n);
+        const double bandwidth = std::max(
+            omega_at((position + 1.0) / n) - omega_at(position / n), 1.0e-6);
+
+        // A stage's group delay peak is about `4 Q / omega` samples high,
+        // and the area under it is always `2 pi`
+        const double resonance =
+            start == 0 ? std::numbers::pi / 2.0 * omega / bandwidth : 0.5;
+        stages[stage_idx] = SearchStage{
+            .log_frequency = std::clamp(
+                static_cast<float>(std::log(omega * problem.sample_rate /
+                                            (2.0 * std::numbers::pi))),
+                problem.min_log_frequency, problem.max_log_frequency),
+            .log_resonance = std::clamp(static_cast<float>(std::log(resonance)),
+                                        std::log(design_min_resonance),
+                                        std::log(design_max_resonance))};
+    }
+
+    return stages;
+}
+
+/**
+ * Refine the stages' frequencies and resonances with a pattern search that
+ * moves one parameter of one stage at a time. Returns the squared error in
+ * samples.
+ */
+static float refine(const DesignProblem& problem,
+                    std::vector<SearchStage>& stages,
+                    const std::atomic_bool& cancelled) {
+    const size_t num_points = problem.target.size();
+    const size_t num_stages = stages.size();
+    std::vector<float> stage_delays(num_stages * num_points);
+    std::vector<float> total(num_points);
+    std::vector<float> trial(num_points);
+
+    auto sum_stages = [&]() {
+        std::fill(total.begin(), total.end(), 0.0f);
+        for (size_t stage_idx = 0; stage_idx < num_stages; stage_idx++) {
+            const float* stage_delay = &stage_delays[stage_idx * num_points];
+            for (size_t i = 0; i < num_points; i++) {
+                total[i] += stage_delay[i];
+            }
+        }
+
+        return squared_error(problem, total.data());
+    };
+
+    for (size_t stage_idx = 0; stage_idx < num_stages; stage_idx++) {
+        stage_group_delay(problem, stages[stage_idx],
+                          &stage_delays[stage_idx * num_points]);
+    }
+    float error = sum_stages();
+
+    const float min_log_resonance = std::log(design_min_resonance);
+    const float max_log_resonance = std::log(design_max_resonance);
+    for (float step = design_initial_step; step >= design_final_step;
+         step /= 2.0f) {
+        for (int pass = 0; pass < design_max_passes_per_step; pass++) {
+            if (cancelled) {
+                return error;
+            }
+
+            bool improved = false;
+            for (size_t stage_idx = 0; stage_idx < num_stages; stage_idx++) {
+                float* stage_delay = &stage_delays[stage_idx * num_points];
+                for (const bool move_frequency : {true, false}) {
+                    for (const float direction : {1.0f, -1.0f}) {
+                        SearchStage moved = stages[stage_idx];
+                        if (move_frequency) {
+                            moved.log_frequency = std::clamp(
+                                moved.log_frequency + (direction * step),
+                                problem.min_log_frequency,
+                                problem.max_log_frequency);
+                        } else {
+                            moved.log_resonance = std::clamp(
+                                moved.log_resonance + (direction * step),
+                                min_log_resonance, max_log_resonance);
+                        }
+
+                        // Only this stage's group delay has to be computed
+                        // again to know the new error
+                        stage_group_delay(problem, moved, trial.data());
+                        float trial_error = 0.0f;
+                        for (size_t i = 0; i < num_points; i++) {
+                            const float difference = total[i] -
+                                                     stage_delay[i] +
+                                                     trial[i] -
+                                                     problem.target[i];
+                            trial_error += difference * difference;
+                        }
+
+                        if (trial_error < error) {
+                            for (size_t i = 0; i < num_points; i++) {
+                                total[i] += trial[i] - stage_delay[i];
+                            }
+                            std::copy(trial.begin(), trial.end(), stage_delay);
+                            stages[stage_idx] = moved;
+                            error = trial_error;
+                            improved = true;
+
+                            break;
+                        }
+                    }
+                }
+            }
+
+            // Updating the total in place slowly accumulates rounding errors
+            error = sum_stages();
+            if (!improved) {
+                break;
+            }
+        }
+    }
+
+    return error;
+}
+
+static DesignCandidate optimize(const DesignProblem& problem,
+                                size_t num_stages,
+                                size_t start,
+                                const std::atomic_bool& cancelled) {
+    std::vector<SearchStage> stages =
+        initial_stages(problem, num_stages, start);
+    const float error = refine(problem, stages, cancelled);
+
+    DesignCandidate candidate;
+    candidate.error =
+        std::sqrt(error / static_cast<float>(problem.target.size()));
+    candidate.stages.reserve(num_stages);
+    for (const auto& stage : stages) {
+        candidate.stages.push_back(to_designed_stage(problem, stage));
+    }
+    std::sort(candidate.stages.begin(), candidate.stages.end(),
+              [](const DesignedStage& a, const DesignedStage& b) {
+                  return a.frequency < b.frequency;
+              });
+
+    return candidate;
+}
+
+/**
+ * Run `task(idx)` for every index in `[0, num_tasks)` on up to `num_threads`
+ * threads, one of which is the calling thread.
+ */
+template <typename F>
+static void run_parallel(size_t num_tasks, size_t num_threads, F task) {
+    std::atomic_size_t next_task = 0;
+    auto work = [&]() {
+        for (size_t task_idx = next_task++; task_idx < num_tasks;
+             task_idx = next_task++) {
+            task(task_idx);
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t worker_idx = 1;
+         worker_idx < std::min(num_threads, num_tasks); worker_idx++) {
+        workers.emplace_back(work);
+    }
+    work();
+
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+GroupDelayDesigner::~GroupDelayDesigner() {
+    cancel();
+}
+
+GroupDelayDesigner::Result GroupDelayDesigner::design(
+    const Settings& settings,
+    const std::atomic_bool& cancelled) {
+    Result result;
+    if (settings.target.empty()) {
+        result.within_tolerance = true;
+        return result;
+    }
+
+    const double sample_rate = settings.sample_rate;
+    const float ms_per_sample = static_cast<float>(1000.0 / sample_rate);
+    const float min_frequency =
+        clamp_filter_frequency(sample_rate, settings.target.front().frequency);
+    const float max_frequency = std::max(
+        min_frequency,
+        clamp_filter_frequency(sample_rate, settings.target.back().frequency));
+
+    DesignProblem problem;
+    problem.sample_rate = sample_rate;
+    problem.evaluator.prepare(sample_rate, design_num_points, min_frequency,
+                              max_frequency);
+    problem.min_log_frequency =
+        std::log(clamp_filter_frequency(sample_rate, 0.0f));
+    problem.max_log_frequency = std::log(
+        clamp_filter_frequency(sample_rate, static_cast<float>(sample_rate)));
+
+    // The target is interpolated on a logarithmic frequency axis, and it's
+    // held constant past its first and last points
+    const std::vector<float>& frequencies = problem.evaluator.frequencies();
+    problem.target.resize(design_num_points);
+    problem.omega.resize(design_num_points);
+    for (size_t i = 0; i < design_num_points; i++) {
+        const float frequency = frequencies[i];
+        const auto next_point = std::upper_bound(
+            settings.target.begin(), settings.target.end(), frequency,
+            [](float value, const TargetPoint& point) {
+                return value < point.frequency;
+            });
+
+        float group_delay_ms;
+        if (next_point == settings.target.begin()) {
+            group_delay_ms = next_point->group_delay_ms;
+        } else if (next_point == settings.target.end()) {
+            group_delay_ms = settings.target.back().group_delay_ms;
+        } else {
+            const TargetPoint& previous_point = *(next_point - 1);
+            const float t = std::log(frequency / previous_point.frequency) /
+                            std::log(next_point->frequency /
+                                     previous_point.frequency);
+            group_delay_ms = previous_point.group_delay_ms +
+                             (t * (next_point->group_delay_ms -
+                                   previous_point.group_delay_ms));
+        }
+
+        problem.target[i] = group_delay_ms / ms_per_sample;
+        problem.omega[i] = 2.0 * std::numbers::pi * frequency / sample_rate;
+    }
+
+    problem.omega_edges.resize(design_num_points + 1);
+    problem.omega_edges.front() = problem.omega.front();
+    problem.omega_edges.back() = problem.omega.back();
+    for (size_t i = 1; i < design_num_points; i++) {
+        problem.omega_edges[i] =
+            std::sqrt(problem.omega[i - 1] * problem.omega[i]);
+    }
+
+    // The best design found for every stage count so far. Zero stages means
+    // zero group delay.
+    std::vector<DesignCandidate> best(settings.max_stages + 1);
+    best[0].error = std::sqrt(
+        squared_error(problem, std::vector<float>(design_num_points).data()) /
+        static_cast<float>(design_num_points));
+    auto meets_tolerance = [&](size_t num_stages) {
+        return best[num_stages].error * ms_per_sample <= settings.tolerance_ms;
+    };
+
+    const size_t num_threads =
+        settings.num_threads > 0
+            ? settings.num_threads
+            : std::max(1u, std::thread::hardware_concurrency());
+    auto run_round = [&](const std::vector<size_t>& counts) {
+        std::vector<DesignCandidate> candidates(counts.size() *
+                                                design_num_starts);
+        run_parallel(candidates.size(), num_threads, [&](size_t task_idx) {
+            candidates[task_idx] =
+                optimize(problem, counts[task_idx / design_num_starts],
+                         task_idx % design_num_starts, cancelled);
+        });
+
+        for (size_t task_idx = 0; task_idx < candidates.size(); task_idx++) {
+            DesignCandidate& candidate = candidates[task_idx];
+            DesignCandidate& best_candidate =
+                best[counts[task_idx / design_num_starts]];
+            if (candidate.error < best_candidate.error) {
+                best_candidate = std::move(candidate);
+            }
+        }
+    };
+
+    // The first round tries powers of two to find the right order of
+    // magnitude. After that the range between the largest count that missed
+    // the tolerance and the smallest count that met it gets narrowed down.
+    // The error doesn't strictly decrease with the number of stages since the
+    // search can get stuck, so only the counts within that range are
+    // considered.
+    size_t low = 0;
+    std::optional<size_t> high;
+    if (meets_tolerance(0)) {
+        high = 0;
+    } else if (settings.max_stages > 0) {
+        std::vector<size_t> counts;
+        for (size_t count = 1; count < settings.max_stages; count *= 2) {
+            counts.push_back(count);
+        }
+        counts.push_back(settings.max_stages);
+
+        while (!cancelled) {
+            run_round(counts);
+
+            for (const size_t count : counts) {
+                if (meets_tolerance(count)) {
+                    high = count;
+                    break;
+                }
+            }
+            if (!high) {
+                break;
+            }
+            for (const size_t count : counts) {
+                if (count < *high && !meets_tolerance(count)) {
+                    low = std::max(low, count);
+                }
+            }
+
+            const size_t gap = *high - low;
+            if (gap <= 1) {
+                break;
+            }
+
+            const size_t num_counts =
+                std::min(gap - 1, design_counts_per_round);
+            counts.clear();
+            for (size_t i = 1; i <= num_counts; i++) {
+                counts.push_back(low + (gap * i / (num_counts + 1)));
+            }
+        }
+    }
+
+    // If no stage count met the tolerance, we'll return the closest design
+    // instead
+    const DesignCandidate& chosen =
+        high ? best[*high]
+             : *std::min_element(best.begin(), best.end(),
+                                 [](const DesignCandidate& a,
+                                    const DesignCandidate& b) {
+                                     return a.error < b.error;
+                                 });
+    result.stages = chosen.stages;
+    result.error_ms = chosen.error * ms_per_sample;
+    result.within_tolerance = result.error_ms <= settings.tolerance_ms;
+
+    return result;
+}
+
+void GroupDelayDesigner::start(Settings settings,
+                               std::function<void(Result)> on_finished) {
+    cancel();
+
+    cancelled_ = false;
+    running_ = true;
+    thread_ = std::thread([this, settings = std::move(settings),
+                           on_finished = std::move(on_finished)]() {
+        Result result = design(settings, cancelled_);
+        if (!cancelled_) {
+            on_finished(std::move(result));
+        }
+
+        running_ = false;
+    });
+}
+
+void GroupDelayDesigner::cancel() {
+    cancelled_ = true;
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
@@ -0,0 +1,153 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <functional>
+#include <thread>
+#include <vector>
+
+/**
+ * The settings for a single stage of a cascade designed by
+ * `GroupDelayDesigner`. The stage's frequency and resonance are stored instead
+ * of its coefficients, so a design works at any sample rate.
+ */
+struct DesignedStage {
+    float frequency = 200.0f;
+    float resonance = 0.5f;
+
+    /**
+     * Whether this stage can be turned into a stable all-pass filter. Stages
+     * that come from saved states or checkpoints must be checked with this
+     * before they're used, since the filters would otherwise produce NaNs.
+     * Frequencies above Nyquist are fine, since those get clamped.
+     */
+    bool is_valid() const {
+        return std::isfinite(frequency) && frequency > 0.0f &&
+               std::isfinite(resonance) && resonance > 0.0f;
+    }
+
+    bool operator==(const DesignedStage&) const = default;
+};
+
+/**
+ * Searches for the smallest cascade of all-pass stages whose group delay
+ * matches a target curve, with every stage getting its own frequency and
+ * resonance. Reaching a specific curve by hand with the frequency, spread and
+ * resonance parameters tends to take far more stages than necessary.
+ *
+ * Every second order all-pass stage adds exactly one full turn of phase over
+ * the entire frequency range, so the area under a cascade's group delay curve
+ * is fixed by its number of stages. The stages are initially placed so they
+ * each cover an equal share of the target's area, and their frequencies and
+ * resonances are then refined with a pattern search. The response is
+ * evaluated using `AllPassResponseEvaluator`, and since only one stage changes
+ * at a time only that stage's group delay has to be computed for every step.
+ *
+ * Finding the smallest number of stages is done as a parallel search over the
+ * stage counts. Every round optimizes a handful of stage counts from a couple
+ * of starting points on a pool of worker threads, and then narrows the range
+ * down to between the largest count that missed the tolerance and the
+ * smallest count that met it. The candidates don't depend on the number of
+ * threads, so the result is the same on every machine.
+ */
+class GroupDelayDesigner {
+   public:
+    /**
+     * A point on the target curve. The curve is interpolated linearly on a
+     * logarithmic frequency axis between these points.
+     */
+    struct TargetPoint {
+        float frequency;
+        float group_delay_ms;
+    };
+
+    struct Settings {
+        double sample_rate = 44100.0;
+        /**
+         * The target curve, sorted by frequency. The cascade's group delay is
+         * only compared to the target between the first and the last point.
+         */
+        std::vector<TargetPoint> target;
+        size_t max_stages = 512;
+        /**
+         * The largest acceptable RMS difference between the cascade's group
+         * delay and the target.
+         */
+        float tolerance_ms = 0.1f;
+        /**
+         * The number of worker threads to use, or zero to use one thread per
+         * core.
+         */
+        size_t num_threads = 0;
+    };
+
+    struct Result {
+        /**
+         * The designed stages, sorted by frequency. When no stage count up to
+         * `max_stages` met the tolerance, this is the closest design that was
+         * found.
+         */
+        std::vector<DesignedStage> stages;
+        /**
+         * The RMS difference between the design's group delay and the target.
+         */
+        float error_ms = 0.0f;
+        bool within_tolerance = false;
+    };
+
+    ~GroupDelayDesigner();
+
+    /**
+     * Run the design on the calling thread, using additional worker threads
+     * for the optimization. This takes anywhere from milliseconds to a couple
+     * of seconds depending on the number of stages needed. When `cancelled`
+     * gets set the design stops as soon as possible and returns whatever it
+     * found so far.
+     */
+    static Result design(const Settings& settings,
+                         const std::atomic_bool& cancelled);
+
+    /**
+     * Start a design on a background thread, cancelling any design that's
+     * still running. `on_finished` is called from that background thread once
+     * the design is done, unless it gets cancelled first. It must not call
+     * `start()` or `cancel()`. This must not be called from the audio
+     * thread.
+     */
+    void start(Settings settings, std::function<void(Result)> on_finished);
+
+    /**
+     * Stop the running design, if any, and wait for its thread to exit. The
+     * design's `on_finished` callback won't be called. This must not be called
+     * from the audio thread.
+     */
+    void cancel();
+
+    /**
+     * Whether a design started with `start()` is still running. This can be
+     * called from any thread.
+     */
+    bool is_running() const { return running_; }
+
+   private:
+    std::thread thread_;
+    std::atomic_bool cancelled_ = false;
+    std::atomic_bool running_ = false;
+};
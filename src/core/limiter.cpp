@@ -0,0 +1,171 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "limiter.h"
+
+#include <algorithm>
+#include <cmath>
+
+/**
+ * The level the limiter's output will never exceed, in decibels.
+ */
+constexpr float limiter_threshold_db = -1.0f;
+
+/**
+ * The width of the soft knee around the threshold, in decibels. Gain reduction
+ * gradually starts at `limiter_threshold_db - (limiter_knee_width_db / 2)`.
+ */
+constexpr float limiter_knee_width_db = 4.0f;
+
+/**
+ * How long it takes for the envelope to decay by a factor `e` after a peak.
+ * The attack is instant, which is what allows this limiter to run without any
+ * latency.
+ */
+constexpr float limiter_release_secs = 0.05f;
+
+/**
+ * Any peak envelope below this linear gain value will not cause any gain
+ * reduction. This is the start of the knee, or -3 dBFS with the settings from
+ * above.
+ */
+static const float limiter_knee_start =
+    std::pow(10.0f, (limiter_threshold_db - (limiter_knee_width_db / 2.0f)) /
+                        20.0f);
+
+/**
+ * Above this linear envelope value the knee is over and the output is held at
+ * exactly the threshold.
+ */
+static const float limiter_knee_end =
+    std::pow(10.0f, (limiter_threshold_db + (limiter_knee_width_db / 2.0f)) /
+                        20.0f);
+static const float limiter_threshold =
+    std::pow(10.0f, limiter_threshold_db / 20.0f);
+
+void SafetyLimiter::prepare(double sample_rate, size_t max_block_size) {
+    release_coefficient_ = static_cast<float>(
+        std::exp(-1.0 / (limiter_release_secs * sample_rate)));
+    gain_.resize(std::max(max_block_size, static_cast<size_t>(1)));
+
+    reset();
+}
+
+void SafetyLimiter::reset() {
+    envelope_ = 0.0f;
+}
+
+template <typename Samples>
+void SafetyLimiter::process_samples(Samples samples,
+                                    size_t num_channels,
+                                    size_t num_samples) {
+    if (num_channels == 0 || gain_.empty()) {
+        return;
+    }
+
+    const size_t chunk_size = gain_.size();
+    for (size_t offset = 0; offset < num_samples; offset += chunk_size) {
+        process_chunk(samples, num_channels, offset,
+                      std::min(chunk_size, num_samples - offset));
+    }
+}
+
+template <typename Samples>
+void SafetyLimiter::process_chunk(Samples samples,
+                                  size_t num_channels,
+                                  size_t offset,
+                                  size_t num_samples) {
+    float* gain = gain_.data();
+    const size_t stride = samples.stride;
+
+    // First we'll find the peak across all channels for every sample. These
+    // loops are trivially vectorizable for planar buffers.
+    const float* first_channel = samples.channel(0) + (offset * stride);
+    for (size_t sample_idx = 0; sample_idx < num_samples; sample_idx++) {
+        gain[sample_idx] = std::abs(first_channel[sample_idx * stride]);
+    }
+    for (size_t channel = 1; channel < num_channels; channel++) {
+        const float* channel_samples =
+            samples.channel(channel) + (offset * stride);
+        for (size_t sample_idx = 0; sample_idx < num_samples; sample_idx++) {
+            gain[sample_idx] =
+                std::max(gain[sample_idx],
+                         std::abs(channel_samples[sample_idx * stride]));
+        }
+    }
+
+    // The envelope follower and gain computer are the only serial parts. In
+    // the common case the signal stays below the knee, and we can skip the
+    // logarithms and the final gain pass entirely.
+    bool needs_gain_reduction = false;
+    float envelope = envelope_;
+    for (size_t sample_idx = 0; sample_idx < num_samples; sample_idx++) {
+        envelope =
+            std::max(gain[sample_idx], envelope * release_coefficient_);
+
+        if (envelope <= limiter_knee_start) {
+            gain[sample_idx] = 1.0f;
+        } else if (envelope >= limiter_knee_end) {
+            // Past the knee the output is pinned to the threshold, which in
+            // the linear domain is a single division. This is the case for
+            // most samples while the limiter is working, so it's worth
+            // skipping the logarithm and the exponent for.
+            gain[sample_idx] = limiter_threshold / envelope;
+            needs_gain_reduction = true;
+        } else {
+            // This is the usual quadratic soft knee with an infinite ratio,
+            // meaning that the output will never exceed the threshold. Since
+            // the attack is instant, `envelope` is always at least as large as
+            // the current sample's peak.
+            const float envelope_db = 20.0f * std::log10(envelope);
+            const float knee_offset_db = envelope_db - limiter_threshold_db +
+                                         (limiter_knee_width_db / 2.0f);
+            const float output_db =
+                envelope_db - ((knee_offset_db * knee_offset_db) /
+                               (2.0f * limiter_knee_width_db));
+
+            gain[sample_idx] =
+                std::pow(10.0f, (output_db - envelope_db) / 20.0f);
+            needs_gain_reduction = true;
+        }
+    }
+    envelope_ = envelope;
+
+    if (needs_gain_reduction) {
+        for (size_t channel = 0; channel < num_channels; channel++) {
+            float* channel_samples =
+                samples.channel(channel) + (offset * stride);
+            for (size_t sample_idx = 0; sample_idx < num_samples;
+                 sample_idx++) {
+                channel_samples[sample_idx * stride] *= gain[sample_idx];
+            }
+        }
+    }
+}
+
+void SafetyLimiter::process(float* const* samples,
+                            size_t num_channels,
+                            size_t num_samples) {
+    process_samples(PlanarSamples{samples}, num_channels, num_samples);
+}
+
+void SafetyLimiter::process_interleaved(float* samples,
+                                        size_t num_channels,
+                                        size_t stride,
+                                        size_t num_samples) {
+    process_samples(InterleavedSamples{samples, stride}, num_channels,
+                    num_samples);
+}
@@ -0,0 +1,114 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "sample_layout.h"
+
+/**
+ * A zero-latency soft-knee peak limiter used as Diopser's 'safe mode'. Large
+ * numbers of stages combined with high resonance values can cause really loud
+ * resonances, and this prevents those from blowing up the user's speakers
+ * without having to insert another limiter plugin after Diopser.
+ *
+ * All channels are linked, so the gain reduction is computed once per sample
+ * from the loudest channel. Processing is done in three passes over the block
+ * so the channel-wide passes operate on contiguous arrays and can be
+ * vectorized by the compiler: computing the peak across all channels,
+ * computing the gain from the peak envelope (which is inherently serial but
+ * only runs once per sample regardless of the number of channels), and then
+ * applying that gain to every channel. The gain buffer is allocated in
+ * `prepare()` so processing never allocates.
+ *
+ * The limiter runs after the cascade instead of being fused into the
+ * cascade's output loop. Every cascade kernel and the rotation mode would
+ * otherwise need their own peak tracking, and the block is still in the
+ * cache when the limiter reads it back. With 64 stages, two channels and 512
+ * sample blocks the idle limiter costs around 3% of the cascade's time, which
+ * `diopser_bench`'s limiter scenarios measure.
+ */
+class SafetyLimiter {
+   public:
+    /**
+     * The envelope follower's state, for checkpointing.
+     */
+    struct State {
+        float envelope = 0.0f;
+    };
+
+    /**
+     * Set the sample rate and allocate the scratch buffer. This also resets
+     * the limiter's envelope. Must not be called from the audio thread.
+     */
+    void prepare(double sample_rate, size_t max_block_size);
+
+    /**
+     * Reset the envelope follower, as if the limiter has only seen silence.
+     */
+    void reset();
+
+    State state() const { return {envelope_}; }
+    void restore(const State& state) { envelope_ = state.envelope; }
+
+    /**
+     * Limit `num_channels` channels of audio in place. Blocks larger than the
+     * maximum block size passed to `prepare()` are processed in multiple
+     * chunks.
+     */
+    void process(float* const* samples,
+                 size_t num_channels,
+                 size_t num_samples);
+
+    /**
+     * Limit interleaved audio in place. The first `num_channels` channels of
+     * a buffer with `stride` channels are processed.
+     */
+    void process_interleaved(float* samples,
+                             size_t num_channels,
+                             size_t stride,
+                             size_t num_samples);
+
+   private:
+    template <typename Samples>
+    void process_samples(Samples samples,
+                         size_t num_channels,
+                         size_t num_samples);
+
+    /**
+     * Process a chunk of at most `gain_.size()` samples.
+     */
+    template <typename Samples>
+    void process_chunk(Samples samples,
+                       size_t num_channels,
+                       size_t offset,
+                       size_t num_samples);
+
+    /**
+     * The peak envelope follower's current value. This instantly follows
+     * peaks, and then decays exponentially using `release_coefficient_`.
+     */
+    float envelope_ = 0.0f;
+    float release_coefficient_ = 0.0f;
+
+    /**
+     * Used to store the per-sample peaks across all channels and then the
+     * per-sample gain. Sized to the maximum block size in `prepare()`.
+     */
+    std::vector<float> gain_;
+};
@@ -0,0 +1,310 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "phase_rotator.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DIOPSER_ROTATOR_SSE2
+#include <emmintrin.h>
+#endif
+
+/**
+ * The time it takes for the angle to reach a new value.
+ */
+constexpr double angle_smoothing_secs = 0.01;
+
+/**
+ * The angle's sine and cosine are computed for this many samples at a time.
+ */
+constexpr size_t gain_chunk_size = 64;
+
+constexpr double pi = 3.14159265358979323846;
+
+/**
+ * Compute the coefficients for a polyphase half-band filter made from two
+ * all-pass networks. This is the elliptic design from Valenzuela and
+ * Constantinides, with the transition bandwidth given as a fraction of the
+ * sample rate. The even and the odd coefficients form the two networks.
+ * Shifting that half-band filter by a quarter of the sample rate turns the
+ * difference between the two networks into a 90 degree phase shift. The
+ * transition bands then end up at the DC and Nyquist ends of the spectrum.
+ */
+static void design_half_band(double* coefficients,
+                             size_t num_coefficients,
+                             double transition) {
+    double k = std::tan((1.0 - (transition * 2.0)) * pi / 4.0);
+    k *= k;
+    const double k_root = std::pow(1.0 - (k * k), 0.25);
+    const double e = 0.5 * (1.0 - k_root) / (1.0 + k_root);
+    const double e4 = e * e * e * e;
+    const double q = e * (1.0 + e4 * (2.0 + e4 * (15.0 + 150.0 * e4)));
+
+    const double order = static_cast<double>((num_coefficients * 2) + 1);
+    for (size_t idx = 0; idx < num_coefficients; idx++) {
+        const double c = static_cast<double>(idx + 1);
+
+        // These two series converge very quickly since `q` is small
+        double numerator = 0.0;
+        for (int i = 0; i < 16; i++) {
+            const double sign = (i % 2 == 0) ? 1.0 : -1.0;
+            numerator += sign * std::pow(q, i * (i + 1)) *
+                         std::sin(((i * 2) + 1) * c * pi / order);
+        }
+        numerator *= std::pow(q, 0.25);
+
+        double denominator = 0.5;
+        for (int i = 1; i < 16; i++) {
+            const double sign = (i % 2 == 0) ? 1.0 : -1.0;
+            denominator += sign * std::pow(q, i * i) *
+                           std::cos(i * 2 * c * pi / order);
+        }
+
+        const double w = numerator / denominator;
+        const double w_squared = w * w;
+        const double x =
+            std::sqrt((1.0 - (w_squared * k)) * (1.0 - (w_squared / k))) /
+            (1.0 + w_squared);
+        coefficients[idx] = (1.0 - x) / (1.0 + x);
+    }
+}
+
+void PhaseRotator::design(double sample_rate,
+                          float (&coefficients_a)[num_sections],
+                          float (&coefficients_b)[num_sections]) {
+    double coefficients[num_sections * 2];
+    design_half_band(coefficients, num_sections * 2,
+                     min_frequency / sample_rate);
+    for (size_t section = 0; section < num_sections; section++) {
+        coefficients_a[section] =
+            static_cast<float>(coefficients[section * 2]);
+        coefficients_b[section] =
+            static_cast<float>(coefficients[(section * 2) + 1]);
+    }
+}
+
+void PhaseRotator::prepare(double sample_rate, size_t num_channels) {
+    float coefficients_a[num_sections];
+    float coefficients_b[num_sections];
+    design(sample_rate, coefficients_a, coefficients_b);
+    for (size_t section = 0; section < num_sections; section++) {
+        float* section_coefficients = coefficients_ + (section * num_chains);
+        section_coefficients[0] = coefficients_a[section];
+        section_coefficients[1] = coefficients_a[section];
+        section_coefficients[2] = coefficients_b[section];
+        section_coefficients[3] = coefficients_b[section];
+    }
+
+    num_channels_ = num_channels;
+    history_.assign(num_channels * channel_history_size, 0.0f);
+    odd_ = false;
+
+    angle_.reset(sample_rate, angle_smoothing_secs);
+}
+
+bool PhaseRotator::simd_available() {
+#ifdef DIOPSER_ROTATOR_SSE2
+    return true;
+#else
+    return false;
+#endif
+}
+
+void PhaseRotator::set_simd_enabled(bool enabled) {
+    simd_enabled_ = enabled;
+}
+
+void PhaseRotator::reset() {
+    std::fill(history_.begin(), history_.end(), 0.0f);
+    odd_ = false;
+}
+
+void PhaseRotator::save_state(State& state) const {
+    state.history = history_;
+    state.odd = odd_;
+    state.angle = angle_.state();
+}
+
+bool PhaseRotator::restore_state(const State& state) {
+    if (state.history.empty()) {
+        reset();
+        return true;
+    }
+    if (state.history.size() != history_.size()) {
+        return false;
+    }
+
+    std::copy(state.history.begin(), state.history.end(), history_.begin());
+    odd_ = state.odd;
+    angle_.restore(state.angle);
+
+    return true;
+}
+
+float PhaseRotator::process_chain(float* history,
+                                  size_t chain,
+                                  float sample) const {
+    for (size_t section = 0; section < num_sections; section++) {
+        float& input_history = history[(section * num_chains) + chain];
+        const float output =
+            (coefficients_[(section * num_chains) + chain] *
+             (sample + history[((section + 1) * num_chains) + chain])) -
+            input_history;
+        input_history = sample;
+        sample = output;
+    }
+    history[(num_sections * num_chains) + chain] = sample;
+
+    return sample;
+}
+
+#ifdef DIOPSER_ROTATOR_SSE2
+void PhaseRotator::process_pairs_sse2(float* history,
+                                      float& delayed_b,
+                                      float* samples,
+                                      size_t stride,
+                                      size_t pairs_start,
+                                      size_t pairs_end,
+                                      const float* cosines,
+                                      const float* sines) const {
+    __m128 chain_history[chain_history_size];
+    __m128 coefficients[num_sections];
+    for (size_t value = 0; value < chain_history_size; value++) {
+        chain_history[value] = _mm_loadu_ps(history + (value * num_chains));
+    }
+    for (size_t section = 0; section < num_sections; section++) {
+        coefficients[section] =
+            _mm_load_ps(coefficients_ + (section * num_chains));
+    }
+
+    for (size_t i = pairs_start; i < pairs_end; i += 2) {
+        float& even_sample = samples[i * stride];
+        float& odd_sample = samples[(i + 1) * stride];
+
+        __m128 x =
+            _mm_setr_ps(even_sample, odd_sample, even_sample, odd_sample);
+        for (size_t section = 0; section < num_sections; section++) {
+            const __m128 y = _mm_sub_ps(
+                _mm_mul_ps(coefficients[section],
+                           _mm_add_ps(x, chain_history[section + 1])),
+                chain_history[section]);
+            chain_history[section] = x;
+            x = y;
+        }
+        chain_history[num_sections] = x;
+
+        alignas(16) float outputs[num_chains];
+        _mm_store_ps(outputs, x);
+        even_sample = (outputs[0] * cosines[i]) - (delayed_b * sines[i]);
+        odd_sample =
+            (outputs[1] * cosines[i + 1]) - (outputs[2] * sines[i + 1]);
+        delayed_b = outputs[3];
+    }
+
+    for (size_t value = 0; value < chain_history_size; value++) {
+        _mm_storeu_ps(history + (value * num_chains), chain_history[value]);
+    }
+}
+#endif
+
+template <typename Samples>
+void PhaseRotator::process(Samples samples,
+                           size_t num_channels,
+                           size_t num_samples,
+                           float angle_degrees) {
+    angle_.set_target(angle_degrees);
+
+    float cosines[gain_chunk_size];
+    float sines[gain_chunk_size];
+    for (size_t offset = 0; offset < num_samples;) {
+        const size_t length = std::min(num_samples - offset, gain_chunk_size);
+        if (angle_.is_smoothing()) {
+            for (size_t i = 0; i < length; i++) {
+                const float angle =
+                    angle_.next() * static_cast<float>(pi / 180.0);
+                cosines[i] = std::cos(angle);
+                sines[i] = std::sin(angle);
+            }
+        } else {
+            const float angle =
+                angle_.current() * static_cast<float>(pi / 180.0);
+            std::fill_n(cosines, length, std::cos(angle));
+            std::fill_n(sines, length, std::sin(angle));
+        }
+
+        // The pairs always start at an even sample, so a leading odd sample
+        // and a trailing even sample go through the chains one at a time
+        const size_t pairs_start = odd_ ? 1 : 0;
+        const size_t pairs_end =
+            pairs_start + ((length - std::min(length, pairs_start)) / 2 * 2);
+
+        for (size_t channel = 0; channel < num_channels; channel++) {
+            float* history = history_.data() + (channel * channel_history_size);
+            float& delayed_b = history[channel_history_size - 1];
+            float* channel_samples =
+                samples.channel(channel) + (offset * samples.stride);
+
+            // The second network lags the first by 90 degrees, so this is
+            // `cos(x + angle)` for an input of `cos(x)`. The second network's
+            // output is delayed by a sample.
+            auto process_single = [&](size_t i, size_t phase) {
+                float& sample = channel_samples[i * samples.stride];
+                const float a = process_chain(history, phase, sample);
+                const float b = delayed_b;
+                delayed_b = process_chain(history, 2 + phase, sample);
+
+                sample = (a * cosines[i]) - (b * sines[i]);
+            };
+
+            if (pairs_start == 1 && length > 0) {
+                process_single(0, 1);
+            }
+
+#ifdef DIOPSER_ROTATOR_SSE2
+            if (simd_enabled_) {
+                process_pairs_sse2(history, delayed_b, channel_samples,
+                                   samples.stride, pairs_start, pairs_end,
+                                   cosines, sines);
+            } else
+#endif
+            {
+                for (size_t i = pairs_start; i < pairs_end; i += 2) {
+                    process_single(i, 0);
+                    process_single(i + 1, 1);
+                }
+            }
+
+            if (pairs_end < length) {
+                process_single(pairs_end, 0);
+            }
+        }
+
+        odd_ = odd_ != ((length % 2) == 1);
+        offset += length;
+    }
+}
+
+template void PhaseRotator::process(PlanarSamples samples,
+                                    size_t num_channels,
+                                    size_t num_samples,
+                                    float angle_degrees);
+template void PhaseRotator::process(InterleavedSamples samples,
+                                    size_t num_channels,
+                                    size_t num_samples,
+                                    float angle_degrees);
@@ -0,0 +1,181 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "linear_smoother.h"
+#include "sample_layout.h"
+
+/**
+ * Rotates the phase of the entire spectrum by a fixed angle. This uses a pair
+ * of all-pass networks whose outputs are 90 degrees apart over the audible
+ * range, so one is the Hilbert transform of the other. Mixing the two outputs
+ * using the cosine and the sine of an angle shifts every frequency by that
+ * angle. Both networks also add the same frequency dependent phase shift, so
+ * an angle of zero is not the same as the dry signal. The relative rotation
+ * between two angles is exact though, and that's what matters for reducing a
+ * signal's crest factor.
+ *
+ * Each network is a cascade of `num_sections` sections of the form
+ * `(c - z^-2) / (1 - c z^-2)`, and one of them is delayed by a sample. The
+ * even and odd samples thus pass through two independent first order
+ * cascades, which is why this is also called a polyphase structure. The cost
+ * per sample is fixed and doesn't depend on the number of filter stages. The
+ * angle is smoothed per sample, and it only needs a sine and a cosine per
+ * sample while it's changing.
+ */
+class PhaseRotator {
+   public:
+    /**
+     * The number of sections in each of the two networks.
+     */
+    static constexpr size_t num_sections = 8;
+    /**
+     * The networks are designed to be 90 degrees apart from this frequency up
+     * to this far below the Nyquist frequency. The error is around a hundredth
+     * of a degree at common sample rates, and a bit more at very high sample
+     * rates.
+     */
+    static constexpr double min_frequency = 20.0;
+
+    /**
+     * The rotator's complete state, for checkpointing.
+     */
+    struct State {
+        /**
+         * The networks' histories for every channel.
+         */
+        std::vector<float> history;
+        /**
+         * Whether the next sample is an odd sample.
+         */
+        bool odd = false;
+        LinearSmoother::State angle;
+    };
+
+    /**
+     * Compute the coefficients for both networks at this sample rate. The
+     * editor uses these to draw the rotation's response.
+     */
+    static void design(double sample_rate,
+                       float (&coefficients_a)[num_sections],
+                       float (&coefficients_b)[num_sections]);
+
+    /**
+     * Design the networks for the sample rate and allocate the histories for
+     * `num_channels` channels. This also resets the rotator. Must not be
+     * called from the audio thread.
+     */
+    void prepare(double sample_rate, size_t num_channels);
+
+    /**
+     * Whether this was compiled with the SSE2 path. The scalar path is used
+     * otherwise.
+     */
+    static bool simd_available();
+
+    /**
+     * Use the scalar path even when the SSE2 path is available, for testing.
+     * Both paths produce the exact same output. This must not be called while
+     * `process()` is running.
+     */
+    void set_simd_enabled(bool enabled);
+
+    /**
+     * Clear the networks' histories. The angle is left alone.
+     */
+    void reset();
+
+    void save_state(State& state) const;
+    /**
+     * Restore a state from `save_state()`. An empty history resets the
+     * networks and keeps the current angle instead, for states saved before
+     * the rotator existed. Returns false, leaving the rotator unchanged, if
+     * the state was saved with a different number of channels.
+     */
+    bool restore_state(const State& state);
+
+    /**
+     * Rotate `num_channels` channels in place. Positive angles advance the
+     * phase. The angle ramps to `angle_degrees` over the course of a couple of
+     * milliseconds.
+     */
+    template <typename Samples>
+    void process(Samples samples,
+                 size_t num_channels,
+                 size_t num_samples,
+                 float angle_degrees);
+
+   private:
+    /**
+     * The networks are processed as four independent chains: the first
+     * network for the even and the odd samples, followed by the second
+     * network for the even and the odd samples. The histories and the
+     * coefficients are stored for all four chains at once, so a pair of
+     * samples can go through all four chains with SIMD instructions.
+     */
+    static constexpr size_t num_chains = 4;
+    /**
+     * Every chain stores its last input followed by the output of every
+     * section, which are the values from two samples ago.
+     */
+    static constexpr size_t chain_history_size = num_sections + 1;
+    /**
+     * The histories for all chains indexed by `[value_idx * num_chains +
+     * chain_idx]`, followed by the second network's one sample delay.
+     */
+    static constexpr size_t channel_history_size =
+        (chain_history_size * num_chains) + 1;
+
+    /**
+     * Run a single sample through one of the chains, updating the chain's
+     * history in `history`. This is used for samples that aren't part of a
+     * pair, and it produces the same results as the SIMD version.
+     */
+    float process_chain(float* history, size_t chain, float sample) const;
+
+    /**
+     * Run the pairs of samples in `[pairs_start, pairs_end)` through all four
+     * chains at once using SSE2, and mix them using the gains for those
+     * samples. Only defined when the SSE2 path is available.
+     */
+    void process_pairs_sse2(float* history,
+                            float& delayed_b,
+                            float* samples,
+                            size_t stride,
+                            size_t pairs_start,
+                            size_t pairs_end,
+                            const float* cosines,
+                            const float* sines) const;
+
+    /**
+     * Indexed by `[section_idx * num_chains + chain_idx]`.
+     */
+    alignas(16) float coefficients_[num_sections * num_chains] = {};
+
+    /**
+     * Indexed by `[channel_idx * channel_history_size + ...]`.
+     */
+    std::vector<float> history_;
+    size_t num_channels_ = 0;
+    bool odd_ = false;
+    bool simd_enabled_ = true;
+
+    LinearSmoother angle_;
+};
@@ -0,0 +1,188 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "reblocker.h"
+
+#include <chrono>
+#include <limits>
+#include <random>
+
+#include "denormals.h"
+#include "engine.h"
+
+/**
+ * The smallest block size `tune()` considers. Anything smaller wouldn't save
+ * enough overhead to be worth the latency.
+ */
+constexpr size_t min_tuned_block_size = 64;
+
+/**
+ * How much work `tune()` does for every block size it measures, in stages
+ * times channels times samples. Every block size is measured for at least
+ * four blocks regardless.
+ */
+constexpr size_t tuning_work = size_t(1) << 21;
+
+/**
+ * Doubling the block size has to make processing at least this much cheaper
+ * for `tune()` to prefer the larger block size.
+ */
+constexpr double tuning_tolerance = 1.05;
+
+/**
+ * Re-blocking has to make processing at least this much cheaper than
+ * processing the host's blocks directly for `tune()` to enable it.
+ */
+constexpr double min_tuning_gain = 0.9;
+
+void Reblocker::prepare(size_t num_channels) {
+    num_channels_ = num_channels;
+    input_.assign(num_channels * max_block_size, 0.0f);
+    output_.assign(num_channels * max_block_size, 0.0f);
+    channel_pointers_.assign(num_channels, nullptr);
+
+    active_block_size_ = block_size_;
+    position_ = 0;
+}
+
+void Reblocker::set_block_size(size_t block_size) {
+    block_size_ = std::min(block_size, max_block_size);
+}
+
+size_t Reblocker::latency() const {
+    return block_size_;
+}
+
+size_t Reblocker::tune(double sample_rate,
+                       size_t host_block_size,
+                       size_t num_channels,
+                       size_t num_stages,
+                       int smoothing_interval,
+                       const std::atomic_bool& cancelled) {
+    if (host_block_size == 0 || host_block_size >= max_block_size ||
+        num_channels == 0 || num_stages == 0) {
+        return 0;
+    }
+
+    ScopedFlushDenormals flush_denormals;
+
+    DiopserEngine engine;
+    engine.prepare(sample_rate, max_block_size, num_channels, num_stages,
+                   smoothing_interval);
+    const DiopserEngine::Parameters parameters{
+        .smoothing_interval = smoothing_interval};
+
+    std::mt19937 rng(0);
+    std::uniform_real_distribution<float> distribution(-0.5f, 0.5f);
+    std::vector<float> buffer(num_channels * max_block_size);
+    std::vector<float*> channels(num_channels);
+    for (size_t channel = 0; channel < num_channels; channel++) {
+        channels[channel] = buffer.data() + (channel * max_block_size);
+    }
+
+    // The cost in nanoseconds per sample of processing blocks of
+    // `block_size` samples, using the fastest of a couple of runs to filter
+    // out some of the noise
+    auto measure = [&](size_t block_size) -> double {
+        const size_t num_blocks =
+            std::max<size_t>(2, tuning_work / (num_stages * num_channels *
+                                               block_size));
+
+        // This first block also makes sure the engine has settled on a
+        // kernel for this block size
+        engine.process(channels.data(), num_channels, block_size, parameters);
+
+        double best_cost = std::numeric_limits<double>::max();
+        for (int run = 0; run < 3 && !cancelled; run++) {
+            for (auto& sample : buffer) {
+                sample = distribution(rng);
+            }
+
+            const auto start = std::chrono::steady_clock::now();
+            for (size_t block_idx = 0; block_idx < num_blocks; block_idx++) {
+                engine.process(channels.data(), num_channels, block_size,
+                               parameters);
+            }
+            const std::chrono::duration<double, std::nano> elapsed =
+                std::chrono::steady_clock::now() - start;
+
+            best_cost = std::min(
+                best_cost, elapsed.count() /
+                               static_cast<double>(num_blocks * block_size));
+        }
+
+        return best_cost;
+    };
+
+    const double direct_cost = measure(host_block_size);
+
+    // The costs level off once the per-block overhead becomes negligible, so
+    // the scan stops as soon as doubling the block size no longer helps. The
+    // larger block sizes are also by far the most expensive ones to measure.
+    size_t best_block_size = 0;
+    double best_cost = std::numeric_limits<double>::max();
+    for (size_t block_size = min_tuned_block_size;
+         block_size <= max_block_size; block_size *= 2) {
+        if (block_size <= host_block_size) {
+            continue;
+        }
+
+        const double cost = measure(block_size);
+        if (cancelled) {
+            return 0;
+        }
+        if (cost * tuning_tolerance >= best_cost) {
+            break;
+        }
+
+        best_block_size = block_size;
+        best_cost = cost;
+    }
+
+    if (best_cost <= direct_cost * min_tuning_gain) {
+        return best_block_size;
+    }
+
+    return 0;
+}
+
+ReblockTuner::~ReblockTuner() {
+    cancel();
+}
+
+void ReblockTuner::start(Settings settings,
+                         std::function<void(size_t block_size)> on_finished) {
+    cancel();
+
+    cancelled_ = false;
+    thread_ = std::thread([this, settings,
+                           on_finished = std::move(on_finished)]() {
+        const size_t block_size = Reblocker::tune(
+            settings.sample_rate, settings.host_block_size,
+            settings.num_channels, settings.num_stages,
+            settings.smoothing_interval, cancelled_);
+        if (!cancelled_) {
+            on_finished(block_size);
+        }
+    });
+}
+
+void ReblockTuner::cancel() {
+    cancelled_ = true;
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
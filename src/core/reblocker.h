@@ -0,0 +1,211 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <thread>
+#include <vector>
+
+/**
+ * Collects the host's blocks into blocks of a fixed size before they're
+ * processed. The engine has some overhead for every block, and the pipelined
+ * kernel needs a couple of samples to fill and drain its pipelines for every
+ * run of samples, so tiny or irregular host blocks make it much slower than
+ * it could be. Re-blocking delays the output by exactly the block size, which
+ * should be reported to the host as latency.
+ *
+ * A block size of zero disables re-blocking. Blocks are then processed
+ * directly without any latency. There's no zero-latency path with re-blocking
+ * enabled: the cascade is recursive, so every output sample depends on the
+ * filters' states after the previous sample, and a block can't be processed
+ * before all of its input has arrived.
+ */
+class Reblocker {
+   public:
+    /**
+     * The largest block size `set_block_size()` accepts.
+     */
+    static constexpr size_t max_block_size = 4096;
+
+    /**
+     * Allocate the buffers for `num_channels` channels and clear them. The
+     * block size is kept. Must not be called from the audio thread.
+     */
+    void prepare(size_t num_channels);
+
+    /**
+     * Change the block size. This takes effect at the start of the next call
+     * to `process()`, which then starts with a block of silence. This can be
+     * called from any thread.
+     *
+     * @param block_size The new block size, or zero to disable re-blocking.
+     *   Clamped to `max_block_size`.
+     */
+    void set_block_size(size_t block_size);
+
+    /**
+     * The latency in samples caused by the last block size passed to
+     * `set_block_size()`. This can be called from any thread.
+     */
+    size_t latency() const;
+
+    /**
+     * Measure the engine's throughput for the given configuration at a range
+     * of block sizes, and return the smallest block size that's close to the
+     * fastest one. If re-blocking isn't noticeably faster than processing the
+     * host's blocks directly this returns zero. This processes a couple of
+     * seconds worth of audio with a separate engine, so it takes up to a
+     * couple hundred milliseconds with very high stage counts. Use
+     * `ReblockTuner` to run this in the background. When `cancelled` gets set
+     * this stops after the current measurement and returns zero. It must not
+     * be called from the audio thread.
+     */
+    static size_t tune(double sample_rate,
+                       size_t host_block_size,
+                       size_t num_channels,
+                       size_t num_stages,
+                       int smoothing_interval,
+                       const std::atomic_bool& cancelled);
+
+    /**
+     * Process `num_channels` channels of audio in place. Whenever a full block
+     * has been collected, `process_block` is called to process that block
+     * in place. With re-blocking disabled `process_block` is called directly
+     * on `samples`. This is realtime safe as long as `process_block` is.
+     *
+     * @tparam F A function with the signature
+     *   `void(float* const* samples, size_t num_channels, size_t num_samples)`.
+     */
+    template <typename F>
+    void process(float* const* samples,
+                 size_t num_channels,
+                 size_t num_samples,
+                 F process_block) {
+        const size_t block_size =
+            block_size_.load(std::memory_order_relaxed);
+        if (block_size != active_block_size_) {
+            active_block_size_ = block_size;
+            position_ = 0;
+
+            // Only the first block's worth of every channel gets emitted
+            // before the buffers are swapped, so that's all that needs to be
+            // silenced
+            for (size_t channel = 0; channel < num_channels_; channel++) {
+                std::fill_n(output_.data() + (channel * max_block_size),
+                            active_block_size_, 0.0f);
+            }
+        }
+
+        if (active_block_size_ == 0) {
+            process_block(samples, num_channels, num_samples);
+            return;
+        }
+
+        num_channels = std::min(num_channels, num_channels_);
+        for (size_t sample_idx = 0; sample_idx < num_samples;) {
+            const size_t length = std::min(num_samples - sample_idx,
+                                           active_block_size_ - position_);
+            for (size_t channel = 0; channel < num_channels; channel++) {
+                float* io = samples[channel] + sample_idx;
+                const size_t offset = (channel * max_block_size) + position_;
+                std::copy(io, io + length, input_.data() + offset);
+                std::copy(output_.data() + offset,
+                          output_.data() + offset + length, io);
+            }
+
+            sample_idx += length;
+            position_ += length;
+            if (position_ == active_block_size_) {
+                // The block that was just collected becomes the next output
+                // block, and the output block that was just emitted gets
+                // reused for collecting the next input
+                std::swap(input_, output_);
+                for (size_t channel = 0; channel < num_channels; channel++) {
+                    channel_pointers_[channel] =
+                        output_.data() + (channel * max_block_size);
+                }
+
+                process_block(channel_pointers_.data(), num_channels,
+                              active_block_size_);
+                position_ = 0;
+            }
+        }
+    }
+
+   private:
+    std::atomic<size_t> block_size_ = 0;
+    /**
+     * The block size `process()` is currently using. Only used on the audio
+     * thread.
+     */
+    size_t active_block_size_ = 0;
+    /**
+     * The position within the current block.
+     */
+    size_t position_ = 0;
+
+    size_t num_channels_ = 0;
+    /**
+     * Indexed by `[channel_idx * max_block_size + sample_idx]`.
+     */
+    std::vector<float> input_;
+    std::vector<float> output_;
+    std::vector<float*> channel_pointers_;
+};
+
+/**
+ * Runs `Reblocker::tune()` on a background thread, so enabling re-blocking or
+ * preparing the plugin doesn't have to wait for the measurements. Like
+ * `GroupDelayDesigner`, starting a new tuning cancels the one that's still
+ * running.
+ */
+class ReblockTuner {
+   public:
+    struct Settings {
+        double sample_rate = 44100.0;
+        size_t host_block_size = 0;
+        size_t num_channels = 0;
+        size_t num_stages = 0;
+        int smoothing_interval = 1;
+    };
+
+    ~ReblockTuner();
+
+    /**
+     * Start tuning on a background thread, cancelling any tuning that's still
+     * running. `on_finished` is called from that background thread with the
+     * tuned block size, unless the tuning gets cancelled first. It must not
+     * call `start()` or `cancel()`. This must not be called from the audio
+     * thread.
+     */
+    void start(Settings settings,
+               std::function<void(size_t block_size)> on_finished);
+
+    /**
+     * Stop the running tuning, if any, and wait for its thread to exit. The
+     * tuning's `on_finished` callback won't be called. This must not be called
+     * from the audio thread.
+     */
+    void cancel();
+
+   private:
+    std::thread thread_;
+    std::atomic_bool cancelled_ = false;
+};
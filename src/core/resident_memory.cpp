@@ -0,0 +1,124 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "resident_memory.h"
+
+#include <new>
+#include <utility>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+ResidentMemory::~ResidentMemory() {
+    free();
+}
+
+ResidentMemory::ResidentMemory(ResidentMemory&& other) noexcept
+    : data_(std::exchange(other.data_, nullptr)),
+      size_(std::exchange(other.size_, 0)),
+      is_locked_(std::exchange(other.is_locked_, false)) {}
+
+ResidentMemory& ResidentMemory::operator=(ResidentMemory&& other) noexcept {
+    if (this != &other) {
+        free();
+        data_ = std::exchange(other.data_, nullptr);
+        size_ = std::exchange(other.size_, 0);
+        is_locked_ = std::exchange(other.is_locked_, false);
+    }
+
+    return *this;
+}
+
+void ResidentMemory::allocate(size_t size) {
+    const size_t page = page_size();
+    size = (size + page - 1) / page * page;
+    if (size == 0) {
+        free();
+        return;
+    }
+
+    // Fresh mappings are already zeroed, but they may all be backed by the
+    // same shared zero page until they're written to. Writing to every page
+    // here makes the OS give us our own pages now instead of on the audio
+    // thread.
+#ifdef _WIN32
+    void* data =
+        VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (!data) {
+        throw std::bad_alloc();
+    }
+#else
+    void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+#endif
+
+    volatile char* bytes = static_cast<char*>(data);
+    for (size_t offset = 0; offset < size; offset += page) {
+        bytes[offset] = 0;
+    }
+
+#ifdef _WIN32
+    const bool is_locked = VirtualLock(data, size) != 0;
+#else
+    const bool is_locked = mlock(data, size) == 0;
+#endif
+
+    free();
+    data_ = data;
+    size_ = size;
+    is_locked_ = is_locked;
+}
+
+void ResidentMemory::free() {
+    if (!data_) {
+        return;
+    }
+
+#ifdef _WIN32
+    if (is_locked_) {
+        VirtualUnlock(data_, size_);
+    }
+    VirtualFree(data_, 0, MEM_RELEASE);
+#else
+    if (is_locked_) {
+        munlock(data_, size_);
+    }
+    munmap(data_, size_);
+#endif
+
+    data_ = nullptr;
+    size_ = 0;
+    is_locked_ = false;
+}
+
+size_t ResidentMemory::page_size() {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwPageSize;
+#else
+    return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
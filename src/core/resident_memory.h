@@ -0,0 +1,72 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstddef>
+
+/**
+ * A page aligned, zeroed block of memory for data the audio thread works on.
+ * Every page is touched when the memory is allocated, so the audio thread
+ * never takes a page fault the first time it reads or writes the memory. The
+ * memory is also locked into RAM when the OS allows it, so it can't be swapped
+ * out on systems under memory pressure. Locking often fails because of
+ * `RLIMIT_MEMLOCK` or the process' working set size. The memory is still
+ * usable then, and `is_locked()` can be used to report the failure.
+ *
+ * This must not be allocated or freed from the audio thread.
+ */
+class ResidentMemory {
+   public:
+    ResidentMemory() = default;
+    ~ResidentMemory();
+
+    ResidentMemory(const ResidentMemory&) = delete;
+    ResidentMemory& operator=(const ResidentMemory&) = delete;
+    ResidentMemory(ResidentMemory&& other) noexcept;
+    ResidentMemory& operator=(ResidentMemory&& other) noexcept;
+
+    /**
+     * Replace the memory with a new zeroed block of at least `size` bytes,
+     * rounded up to whole pages. The old contents are not copied.
+     *
+     * @throw std::bad_alloc When the memory could not be allocated, in which
+     *   case the old block is left untouched.
+     */
+    void allocate(size_t size);
+
+    /**
+     * Free the memory.
+     */
+    void free();
+
+    void* data() const { return data_; }
+    /**
+     * The size of the block in bytes. This is a multiple of the page size.
+     */
+    size_t size() const { return size_; }
+    bool is_locked() const { return is_locked_; }
+
+    /**
+     * The system's page size. Allocations are always aligned to this.
+     */
+    static size_t page_size();
+
+   private:
+    void* data_ = nullptr;
+    size_t size_ = 0;
+    bool is_locked_ = false;
+};
@@ -0,0 +1,206 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "response.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+
+/**
+ * A branchless approximation of `std::atan2()` with a maximum error of about
+ * `2e-6` radians. Unlike `std::atan2()` this can be vectorized, and since we'll
+ * sum the phases of up to 512 filters that error is still way below what can
+ * be seen on the plot.
+ */
+static inline float fast_atan2(float y, float x) {
+    const float abs_x = std::abs(x);
+    const float abs_y = std::abs(y);
+
+    // Everything below is written so GCC can if-convert it: the conditionals
+    // only select between constants, and the minimum and maximum are computed
+    // arithmetically since GCC otherwise turns the division into a branch. The
+    // small constant prevents a division by zero at the origin.
+    const float abs_delta = std::abs(abs_x - abs_y);
+    const float min_value = 0.5f * (abs_x + abs_y - abs_delta);
+    const float max_value = 0.5f * (abs_x + abs_y + abs_delta);
+    const float ratio = min_value / (max_value + 1.0e-30f);
+    const float ratio_squared = ratio * ratio;
+
+    float result =
+        ratio *
+        (0.99997726f +
+         ratio_squared *
+             (-0.33262347f +
+              ratio_squared *
+                  (0.19354346f +
+                   ratio_squared *
+                       (-0.11643287f +
+                        ratio_squared *
+                            (0.05265332f + ratio_squared * -0.01172120f)))));
+
+    // This mirrors the result to the other octants
+    const float y_is_larger = abs_y > abs_x ? 1.0f : 0.0f;
+    result = (y_is_larger * (std::numbers::pi_v<float> / 2.0f)) +
+             ((1.0f - (2.0f * y_is_larger)) * result);
+    const float x_is_negative = x < 0.0f ? 1.0f : 0.0f;
+    result = (x_is_negative * std::numbers::pi_v<float>) +
+             ((1.0f - (2.0f * x_is_negative)) * result);
+
+    return std::copysign(result, y);
+}
+
+void AllPassResponseEvaluator::prepare(double sample_rate,
+                                       size_t num_points,
+                                       float min_frequency,
+                                       float max_frequency) {
+    frequencies_.resize(num_points);
+    omega_.resize(num_points);
+    cos_omega_.resize(num_points);
+    sin_omega_.resize(num_points);
+
+    const double log_min_frequency = std::log(min_frequency);
+    const double log_frequency_delta =
+        std::log(max_frequency) - log_min_frequency;
+    for (size_t i = 0; i < num_points; i++) {
+        const double frequency = std::exp(
+            log_min_frequency +
+            (log_frequency_delta *
+             (num_points == 1 ? 0.5
+                              : static_cast<double>(i) /
+                                    static_cast<double>(num_points - 1))));
+        const double omega =
+            2.0 * std::numbers::pi * frequency / sample_rate;
+
+        frequencies_[i] = static_cast<float>(frequency);
+        omega_[i] = static_cast<float>(omega);
+        cos_omega_[i] = static_cast<float>(std::cos(omega));
+        sin_omega_[i] = static_cast<float>(std::sin(omega));
+    }
+
+    cached_stages_.clear();
+    slot_valid_.clear();
+    stage_phase_.clear();
+    stage_group_delay_.clear();
+}
+
+void AllPassResponseEvaluator::evaluate(const std::vector<AllPassStage>& stages,
+                                        float* phase,
+                                        float* group_delay) {
+    const size_t num_points = frequencies_.size();
+    const size_t num_stages = stages.size();
+    if (cached_stages_.size() < num_stages) {
+        cached_stages_.resize(num_stages);
+        slot_valid_.resize(num_stages, false);
+        stage_phase_.resize(num_stages * num_points);
+        stage_group_delay_.resize(num_stages * num_points);
+    }
+
+    std::fill_n(phase, num_points, 0.0f);
+    std::fill_n(group_delay, num_points, 0.0f);
+
+    // Runs of identical stages are evaluated once and then weighted by the
+    // length of the run. The first stage of every run is used as the cache
+    // slot for that run.
+    size_t run_start = 0;
+    while (run_start < num_stages) {
+        size_t run_end = run_start + 1;
+        while (run_end < num_stages && stages[run_end] == stages[run_start]) {
+            run_end++;
+        }
+
+        if (!slot_valid_[run_start] ||
+            cached_stages_[run_start] != stages[run_start]) {
+            evaluate_stage(stages[run_start], run_start);
+        }
+
+        const float weight = static_cast<float>(run_end - run_start);
+        const float* stage_phase = &stage_phase_[run_start * num_points];
+        const float* stage_group_delay =
+            &stage_group_delay_[run_start * num_points];
+        for (size_t i = 0; i < num_points; i++) {
+            phase[i] += weight * stage_phase[i];
+            group_delay[i] += weight * stage_group_delay[i];
+        }
+
+        run_start = run_end;
+    }
+}
+
+void AllPassResponseEvaluator::evaluate_stage(const AllPassStage& stage,
+                                              size_t slot_idx) {
+    const size_t num_points = frequencies_.size();
+    const float a1 = stage.a1;
+    const float a2 = stage.a2;
+    const float* omega = omega_.data();
+    const float* cos_omega = cos_omega_.data();
+    const float* sin_omega = sin_omega_.data();
+    float* stage_phase = &stage_phase_[slot_idx * num_points];
+    float* stage_group_delay = &stage_group_delay_[slot_idx * num_points];
+
+    // With `D(w) = 1 + a1 e^-jw + a2 e^-2jw` the all-pass filter's response is
+    // `e^-2jw conj(D(w)) / D(w)`. Its phase is thus `-2w - 2 arg(D(w))`, and
+    // since both of `D`'s roots lie within the unit circle `arg(D(w))` stays
+    // within `(-pi, pi)` so the per-stage phase never needs to be unwrapped.
+    // The group delay follows from the derivative: `2 - 2 Re(E(w) / D(w))`
+    // with `E(w) = a1 e^-jw + 2 a2 e^-2jw`. The double angle terms are derived
+    // here instead of being stored, since fewer input arrays means fewer
+    // aliasing checks GCC has to insert before it can vectorize this loop.
+    for (size_t i = 0; i < num_points; i++) {
+        const float cos_2_omega =
+            (2.0f * cos_omega[i] * cos_omega[i]) - 1.0f;
+        const float sin_2_omega = 2.0f * sin_omega[i] * cos_omega[i];
+        const float d_re = 1.0f + (a1 * cos_omega[i]) + (a2 * cos_2_omega);
+        const float d_im = -((a1 * sin_omega[i]) + (a2 * sin_2_omega));
+        const float e_re = (a1 * cos_omega[i]) + (2.0f * a2 * cos_2_omega);
+        const float e_im =
+            -((a1 * sin_omega[i]) + (2.0f * a2 * sin_2_omega));
+
+        stage_phase[i] = (-2.0f * omega[i]) - (2.0f * fast_atan2(d_im, d_re));
+        stage_group_delay[i] =
+            2.0f - (2.0f * ((e_re * d_re) + (e_im * d_im)) /
+                    ((d_re * d_re) + (d_im * d_im)));
+    }
+
+    cached_stages_[slot_idx] = stage;
+    slot_valid_[slot_idx] = true;
+}
+
+void AllPassResponseEvaluator::evaluate_group_delay(const AllPassStage& stage,
+                                                    float* group_delay) const {
+    const size_t num_points = frequencies_.size();
+    const float a1 = stage.a1;
+    const float a2 = stage.a2;
+    const float* cos_omega = cos_omega_.data();
+    const float* sin_omega = sin_omega_.data();
+
+    // This is the group delay half of `evaluate_stage()`, without the
+    // arctangent
+    for (size_t i = 0; i < num_points; i++) {
+        const float cos_2_omega =
+            (2.0f * cos_omega[i] * cos_omega[i]) - 1.0f;
+        const float sin_2_omega = 2.0f * sin_omega[i] * cos_omega[i];
+        const float d_re = 1.0f + (a1 * cos_omega[i]) + (a2 * cos_2_omega);
+        const float d_im = -((a1 * sin_omega[i]) + (a2 * sin_2_omega));
+        const float e_re = (a1 * cos_omega[i]) + (2.0f * a2 * cos_2_omega);
+        const float e_im =
+            -((a1 * sin_omega[i]) + (2.0f * a2 * sin_2_omega));
+
+        group_delay[i] =
+            2.0f - (2.0f * ((e_re * d_re) + (e_im * d_im)) /
+                    ((d_re * d_re) + (d_im * d_im)));
+    }
+}
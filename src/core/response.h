@@ -0,0 +1,108 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * The denominator of a normalized second order all-pass filter. The numerator
+ * of an all-pass filter is the denominator's reverse, so `a1` and `a2` fully
+ * describe the filter: `H(z) = (a2 + a1 z^-1 + z^-2) / (1 + a1 z^-1 + a2
+ * z^-2)`. In JUCE's raw coefficient layout these are the last two values.
+ */
+struct AllPassStage {
+    float a1;
+    float a2;
+
+    bool operator==(const AllPassStage&) const = default;
+};
+
+/**
+ * Computes the phase and group delay of a cascade of second order all-pass
+ * filters at a fixed set of logarithmically spaced frequencies. This is used to
+ * draw the editor's response plot from a background thread, and by
+ * `GroupDelayDesigner` to evaluate candidate designs.
+ *
+ * Every stage is evaluated over all frequencies in a single pass over a
+ * handful of contiguous arrays, which the compiler can vectorize since the
+ * arctangent is computed using a branchless polynomial approximation. The
+ * contributions of every stage are cached, so when only some stages change
+ * only those stages are evaluated again. Consecutive stages with identical
+ * coefficients, like when the filter spread is set to zero, are only evaluated
+ * once.
+ */
+class AllPassResponseEvaluator {
+   public:
+    /**
+     * Set the frequencies the responses are evaluated at. This invalidates all
+     * cached stages.
+     */
+    void prepare(double sample_rate,
+                 size_t num_points,
+                 float min_frequency,
+                 float max_frequency);
+
+    /**
+     * The frequencies in Hertz the response is evaluated at, logarithmically
+     * spaced between the minimum and maximum frequencies.
+     */
+    const std::vector<float>& frequencies() const { return frequencies_; }
+
+    /**
+     * Compute the cascade's unwrapped phase response in radians and its group
+     * delay in samples. Both output arrays should contain
+     * `frequencies().size()` elements.
+     */
+    void evaluate(const std::vector<AllPassStage>& stages,
+                  float* phase,
+                  float* group_delay);
+
+    /**
+     * Compute a single stage's group delay in samples. This doesn't touch the
+     * cache, so unlike `evaluate()` it can be called from multiple threads at
+     * once. `group_delay` should contain `frequencies().size()` elements.
+     */
+    void evaluate_group_delay(const AllPassStage& stage,
+                              float* group_delay) const;
+
+   private:
+    /**
+     * Compute a single stage's phase and group delay and store it in slot
+     * `slot_idx`.
+     */
+    void evaluate_stage(const AllPassStage& stage, size_t slot_idx);
+
+    std::vector<float> frequencies_;
+
+    // These are precomputed for every frequency. `omega_` is the normalized
+    // angular frequency, and the other two are the cosine and sine of that
+    // frequency.
+    std::vector<float> omega_;
+    std::vector<float> cos_omega_;
+    std::vector<float> sin_omega_;
+
+    /**
+     * The stages the cached responses in `stage_phase_` and
+     * `stage_group_delay_` were computed for, indexed by stage. Slots that have
+     * not been computed yet are marked invalid in `slot_valid_`.
+     */
+    std::vector<AllPassStage> cached_stages_;
+    std::vector<bool> slot_valid_;
+    std::vector<float> stage_phase_;
+    std::vector<float> stage_group_delay_;
+};
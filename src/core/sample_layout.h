@@ -0,0 +1,52 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstddef>
+
+// The engine and the limiter are templated on these, so they can process both
+// planar and interleaved buffers in place. Sample `n` of channel `c` is at
+// `samples.channel(c)[n * samples.stride]`. For planar buffers the stride is
+// a compile time constant, so that version compiles to exactly the same code
+// as indexing the channel pointers directly. These should be passed by value.
+// Passing them by reference made the compiler reload the channel pointers in
+// the engine's inner loop, which made low stage counts almost twice as slow.
+
+/**
+ * One pointer per channel.
+ */
+struct PlanarSamples {
+    static constexpr size_t stride = 1;
+
+    float* const* channels;
+
+    float* channel(size_t channel) const { return channels[channel]; }
+};
+
+/**
+ * A single buffer where every frame contains one sample for every channel.
+ */
+struct InterleavedSamples {
+    float* samples;
+    /**
+     * The number of channels in the buffer, which may be larger than the
+     * number of channels being processed.
+     */
+    size_t stride;
+
+    float* channel(size_t channel) const { return samples + channel; }
+};
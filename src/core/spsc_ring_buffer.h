@@ -0,0 +1,112 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <vector>
+
+/**
+ * A single producer single consumer ring buffer for sending samples from the
+ * audio thread to the GUI. Both pushing and popping are wait-free and never
+ * allocate. When the buffer doesn't have enough space for a push, the entire
+ * push gets dropped so a slow consumer can never cause the audio thread to do
+ * any additional work.
+ */
+class SpscRingBuffer {
+   public:
+    /**
+     * Allocate the buffer. The capacity is rounded up to the next power of
+     * two. This should never be called from the audio thread.
+     */
+    explicit SpscRingBuffer(size_t min_capacity)
+        : buffer_(std::bit_ceil(std::max(min_capacity, size_t(1)))),
+          mask_(buffer_.size() - 1) {}
+
+    /**
+     * Write `num_samples` samples to the buffer, or drop them if there's not
+     * enough space. Instead of copying from a source buffer, `write_fn` gets
+     * called with a pointer to the buffer's storage so the caller can write
+     * directly to it. It's called at most twice since the region may wrap
+     * around. This may only be called from the producer thread.
+     *
+     * @tparam F A function with the signature `void(float* dest, size_t
+     *   offset, size_t count)`, where `offset` is the index of `dest[0]` within
+     *   the `num_samples` pushed samples.
+     *
+     * @return Whether the samples were written.
+     */
+    template <typename F>
+    bool try_push(size_t num_samples, F write_fn) {
+        const size_t write_idx = write_idx_.load(std::memory_order_relaxed);
+        const size_t read_idx = read_idx_.load(std::memory_order_acquire);
+        if (buffer_.size() - (write_idx - read_idx) < num_samples) {
+            return false;
+        }
+
+        const size_t start = write_idx & mask_;
+        const size_t first_count =
+            std::min(num_samples, buffer_.size() - start);
+        write_fn(&buffer_[start], 0, first_count);
+        if (first_count < num_samples) {
+            write_fn(&buffer_[0], first_count, num_samples - first_count);
+        }
+
+        write_idx_.store(write_idx + num_samples, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Copy up to `max_samples` samples to `dest`. This may only be called from
+     * the consumer thread.
+     *
+     * @return The number of samples read.
+     */
+    size_t pop(float* dest, size_t max_samples) {
+        const size_t read_idx = read_idx_.load(std::memory_order_relaxed);
+        const size_t write_idx = write_idx_.load(std::memory_order_acquire);
+        const size_t num_samples = std::min(max_samples, write_idx - read_idx);
+
+        const size_t start = read_idx & mask_;
+        const size_t first_count =
+            std::min(num_samples, buffer_.size() - start);
+        std::copy_n(&buffer_[start], first_count, dest);
+        std::copy_n(&buffer_[0], num_samples - first_count, dest + first_count);
+
+        read_idx_.store(read_idx + num_samples, std::memory_order_release);
+        return num_samples;
+    }
+
+    /**
+     * Drop everything that's currently in the buffer. This may only be called
+     * from the consumer thread.
+     */
+    void discard() {
+        read_idx_.store(write_idx_.load(std::memory_order_acquire),
+                        std::memory_order_release);
+    }
+
+   private:
+    std::vector<float> buffer_;
+    const size_t mask_;
+
+    // These indices only ever increase, and they're kept on separate cache
+    // lines so the producer and the consumer don't contend with each other
+    alignas(64) std::atomic_size_t write_idx_ = 0;
+    alignas(64) std::atomic_size_t read_idx_ = 0;
+};
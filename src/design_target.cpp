@@ -0,0 +1,77 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#include "design_target.h"
+
+#include <algorithm>
+
+juce::Result load_design_target(
+    const juce::File& file,
+    std::vector<GroupDelayDesigner::TargetPoint>& target) {
+    if (!file.existsAsFile()) {
+        return juce::Result::fail("Could not read '" + file.getFullPathName() +
+                                  "'");
+    }
+
+    juce::StringArray lines;
+    file.readLines(lines);
+
+    target.clear();
+    for (int line_idx = 0; line_idx < lines.size(); line_idx++) {
+        const juce::String line = lines[line_idx].trim();
+        if (line.isEmpty() || line.startsWithChar('#')) {
+            continue;
+        }
+
+        const juce::StringArray fields =
+            juce::StringArray::fromTokens(line, " \t,", "");
+        juce::StringArray values;
+        for (const auto& field : fields) {
+            if (field.isNotEmpty()) {
+                values.add(field);
+            }
+        }
+
+        // `juce::StringArray` returns empty strings for missing values
+        const float frequency = values[0].getFloatValue();
+        if (values.size() != 2 || frequency <= 0.0f ||
+            !values[0].containsOnly("0123456789.eE+") ||
+            !values[1].containsOnly("0123456789.-eE+")) {
+            return juce::Result::fail(
+                "Expected a frequency and a group delay on line " +
+                juce::String(line_idx + 1) + " of '" +
+                file.getFullPathName() + "'");
+        }
+
+        target.push_back(GroupDelayDesigner::TargetPoint{
+            .frequency = frequency,
+            .group_delay_ms = values[1].getFloatValue()});
+    }
+
+    if (target.empty()) {
+        return juce::Result::fail("'" + file.getFullPathName() +
+                                  "' does not contain a target");
+    }
+
+    std::stable_sort(target.begin(), target.end(),
+                     [](const GroupDelayDesigner::TargetPoint& a,
+                        const GroupDelayDesigner::TargetPoint& b) {
+                         return a.frequency < b.frequency;
+                     });
+
+    return juce::Result::ok();
+}
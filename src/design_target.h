@@ -0,0 +1,35 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <vector>
+
+#include <juce_core/juce_core.h>
+
+#include "core/group_delay_designer.h"
+
+/**
+ * Read a target group delay curve for `GroupDelayDesigner`. Every line
+ * contains a frequency in Hz followed by a group delay in milliseconds,
+ * separated by whitespace or a comma. Empty lines and lines starting with `#`
+ * are ignored. The points are sorted by frequency afterwards, since that's
+ * what the designer expects.
+ */
+juce::Result load_design_target(
+    const juce::File& file,
+    std::vector<GroupDelayDesigner::TargetPoint>& target);
@@ -16,26 +16,384 @@
 
 #include "editor.h"
 
-#include "processor.h"
+#include <algorithm>
+
+#include "design_target.h"
+
+constexpr int controls_height = 110;
+constexpr int toggles_width = 150;
+constexpr int design_panel_width = 130;
+
+/**
+ * The number of points from the response plot's group delay curve that are
+ * used as the designer's target. The curve is smooth, so this doesn't need
+ * anywhere near the plot's resolution.
+ */
+constexpr size_t design_target_num_points = 64;
+constexpr int design_status_refresh_rate_hz = 10;
+
+/**
+ * The part of the space above the controls used for the spectrum analyzer and
+ * oscilloscope. The rest is used for the response plot.
+ */
+constexpr float analyzer_height_ratio = 0.4f;
+
+CoalescingSliderAttachment::CoalescingSliderAttachment(
+    DiopserProcessor& processor,
+    juce::RangedAudioParameter& parameter,
+    juce::Slider& slider)
+    : processor_(processor),
+      slider_(slider),
+      attachment_(parameter, [this](float value) {
+          // Don't let parameter changes overwrite the slider mid-drag
+          if (!is_dragging_) {
+              const juce::ScopedValueSetter<bool> ignore_callbacks(
+                  ignore_callbacks_, true);
+              slider_.setValue(value, juce::sendNotificationSync);
+          }
+      }) {
+    // This is the same setup JUCE's `SliderParameterAttachment` does
+    slider_.valueFromTextFunction = [&parameter](const juce::String& text) {
+        return static_cast<double>(
+            parameter.convertFrom0to1(parameter.getValueForText(text)));
+    };
+    slider_.textFromValueFunction = [&parameter](double value) {
+        return parameter.getText(
+            parameter.convertTo0to1(static_cast<float>(value)), 0);
+    };
+    slider_.setDoubleClickReturnValue(
+        true, parameter.convertFrom0to1(parameter.getDefaultValue()));
+
+    const auto range = parameter.getNormalisableRange();
+    juce::NormalisableRange<double> slider_range(
+        range.start, range.end,
+        [range](double start, double end, double normalized) mutable {
+            range.start = static_cast<float>(start);
+            range.end = static_cast<float>(end);
+            return static_cast<double>(
+                range.convertFrom0to1(static_cast<float>(normalized)));
+        },
+        [range](double start, double end, double value) mutable {
+            range.start = static_cast<float>(start);
+            range.end = static_cast<float>(end);
+            return static_cast<double>(
+                range.convertTo0to1(static_cast<float>(value)));
+        },
+        [range](double start, double end, double value) mutable {
+            range.start = static_cast<float>(start);
+            range.end = static_cast<float>(end);
+            return static_cast<double>(
+                range.snapToLegalValue(static_cast<float>(value)));
+        });
+    slider_range.interval = range.interval;
+    slider_range.skew = range.skew;
+    slider_range.symmetricSkew = range.symmetricSkew;
+    slider_.setNormalisableRange(slider_range);
+
+    attachment_.sendInitialUpdate();
+    slider_.addListener(this);
+}
+
+CoalescingSliderAttachment::~CoalescingSliderAttachment() {
+    slider_.removeListener(this);
+    if (is_dragging_) {
+        flush_pending_value();
+        attachment_.endGesture();
+        processor_.end_gesture();
+    }
+}
+
+void CoalescingSliderAttachment::sliderValueChanged(juce::Slider*) {
+    if (ignore_callbacks_) {
+        return;
+    }
+
+    const float value = static_cast<float>(slider_.getValue());
+    if (is_dragging_) {
+        // This gets sent to the parameter on the next timer tick
+        pending_value_ = value;
+    } else {
+        attachment_.setValueAsCompleteGesture(value);
+    }
+}
+
+void CoalescingSliderAttachment::sliderDragStarted(juce::Slider*) {
+    is_dragging_ = true;
+    processor_.begin_gesture();
+    attachment_.beginGesture();
+
+    // The processor only picks up new parameter values once per block, so
+    // there's no point in sending them any more often than that. This is
+    // clamped to sensible values in case the host uses extreme block sizes.
+    const double sample_rate = processor_.getSampleRate();
+    const int block_size = processor_.getBlockSize();
+    const int interval_ms =
+        sample_rate > 0.0 && block_size > 0
+            ? juce::jlimit(
+                  5, 50, juce::roundToInt(1000.0 * block_size / sample_rate))
+            : 10;
+    startTimer(interval_ms);
+}
+
+void CoalescingSliderAttachment::sliderDragEnded(juce::Slider*) {
+    stopTimer();
+    flush_pending_value();
+
+    attachment_.endGesture();
+    processor_.end_gesture();
+    is_dragging_ = false;
+}
+
+void CoalescingSliderAttachment::timerCallback() {
+    flush_pending_value();
+}
+
+void CoalescingSliderAttachment::flush_pending_value() {
+    if (pending_value_) {
+        attachment_.setValueAsPartOfGesture(*pending_value_);
+        pending_value_.reset();
+    }
+}
+
+ParameterKnob::ParameterKnob(DiopserProcessor& processor,
+                             const juce::String& parameter_id,
+                             const juce::String& label)
+    : slider_(juce::Slider::RotaryHorizontalVerticalDrag,
+              juce::Slider::TextBoxBelow),
+      attachment_(processor,
+                  *processor.parameters().getParameter(parameter_id),
+                  slider_) {
+    label_.setText(label, juce::dontSendNotification);
+    label_.setJustificationType(juce::Justification::centred);
+
+    addAndMakeVisible(slider_);
+    addAndMakeVisible(label_);
+}
+
+void ParameterKnob::resized() {
+    auto bounds = getLocalBounds();
+    label_.setBounds(bounds.removeFromTop(18));
+    slider_.setBounds(bounds);
+}
+
+ParameterToggle::ParameterToggle(juce::AudioProcessorValueTreeState& parameters,
+                                 const juce::String& parameter_id,
+                                 const juce::String& label)
+    : button_(label), attachment_(parameters, parameter_id, button_) {
+    addAndMakeVisible(button_);
+}
+
+void ParameterToggle::resized() {
+    button_.setBounds(getLocalBounds());
+}
+
+DesignPanel::DesignPanel(DiopserProcessor& processor,
+                         ResponsePlot& response_plot)
+    : processor_(processor),
+      response_plot_(response_plot),
+      design_mode_toggle_(processor.parameters(),
+                          design_mode_param_name,
+                          "Use design"),
+      design_button_("Design"),
+      target_button_("Load target...") {
+    design_button_.onClick = [this]() { start_design(); };
+    target_button_.onClick = [this]() { load_or_clear_target(); };
+    status_label_.setJustificationType(juce::Justification::centred);
+    status_label_.setFont(juce::Font(12.0f));
+
+    addAndMakeVisible(design_mode_toggle_);
+    addAndMakeVisible(design_button_);
+    addAndMakeVisible(target_button_);
+    addAndMakeVisible(status_label_);
+
+    timerCallback();
+    startTimerHz(design_status_refresh_rate_hz);
+}
+
+void DesignPanel::resized() {
+    auto bounds = getLocalBounds();
+    const int row_height = bounds.getHeight() / 4;
+    design_mode_toggle_.setBounds(bounds.removeFromTop(row_height));
+    design_button_.setBounds(bounds.removeFromTop(row_height).reduced(0, 2));
+    target_button_.setBounds(bounds.removeFromTop(row_height).reduced(0, 2));
+    status_label_.setBounds(bounds);
+}
+
+void DesignPanel::timerCallback() {
+    const DiopserProcessor::DesignStatus status = processor_.design_status();
+
+    juce::String text;
+    if (status.is_running) {
+        text = "Designing...";
+    } else if (status.num_stages == 0) {
+        text = "No design";
+    } else {
+        text = juce::String(status.num_stages) + " stages";
+        if (status.error_ms) {
+            text += ", " + juce::String(*status.error_ms, 2) + " ms off";
+        }
+    }
+
+    if (text != status_label_.getText()) {
+        status_label_.setText(text, juce::dontSendNotification);
+    }
+}
+
+void DesignPanel::start_design() {
+    if (!loaded_target_.empty()) {
+        processor_.start_design(loaded_target_);
+        timerCallback();
+        return;
+    }
+
+    const ResponseSnapshot& snapshot = response_plot_.snapshot();
+    if (snapshot.version == 0 || snapshot.frequencies.empty()) {
+        return;
+    }
+
+    const size_t num_points = snapshot.frequencies.size();
+    const size_t stride =
+        std::max<size_t>(1, num_points / design_target_num_points);
+    std::vector<GroupDelayDesigner::TargetPoint> target;
+    target.reserve((num_points / stride) + 1);
+    for (size_t i = 0; i < num_points; i += stride) {
+        target.push_back(GroupDelayDesigner::TargetPoint{
+            .frequency = snapshot.frequencies[i],
+            .group_delay_ms = snapshot.group_delay_ms[i]});
+    }
+
+    processor_.start_design(std::move(target));
+    timerCallback();
+}
+
+void DesignPanel::load_or_clear_target() {
+    if (!loaded_target_.empty()) {
+        loaded_target_.clear();
+        response_plot_.set_target({});
+        target_button_.setButtonText("Load target...");
+        return;
+    }
+
+    // The same text files `diopser-render --design` reads
+    target_chooser_ = std::make_unique<juce::FileChooser>(
+        "Load a group delay target", juce::File(), "*.txt;*.csv;*.tsv");
+    target_chooser_->launchAsync(
+        juce::FileBrowserComponent::openMode |
+            juce::FileBrowserComponent::canSelectFiles,
+        [this](const juce::FileChooser& chooser) {
+            const juce::File file = chooser.getResult();
+            if (file == juce::File()) {
+                return;
+            }
+
+            std::vector<GroupDelayDesigner::TargetPoint> target;
+            const juce::Result result = load_design_target(file, target);
+            if (result.failed()) {
+                juce::AlertWindow::showMessageBoxAsync(
+                    juce::MessageBoxIconType::WarningIcon,
+                    "Could not load the target", result.getErrorMessage(),
+                    "OK", this);
+                return;
+            }
+
+            loaded_target_ = std::move(target);
+            response_plot_.set_target(loaded_target_);
+            target_button_.setButtonText("Clear target");
+        });
+}
 
 DiopserEditor::DiopserEditor(DiopserProcessor& p)
-    : AudioProcessorEditor(&p), processor_(p) {
-    setSize(400, 300);
+    : AudioProcessorEditor(&p),
+      processor_(p),
+      response_plot_(p),
+      analyzer_view_(p),
+      filter_stages_knob_(p, filter_stages_param_name, "Stages"),
+      extended_filter_stages_knob_(p,
+                                   extended_filter_stages_param_name,
+                                   "Stages"),
+      filter_frequency_knob_(p, filter_frequency_param_name, "Frequency"),
+      filter_resonance_knob_(p, filter_resonance_param_name, "Resonance"),
+      filter_spread_knob_(p, filter_spread_param_name, "Spread"),
+      smoothing_interval_knob_(p, smoothing_interval_param_name, "Precision"),
+      rotation_angle_knob_(p, rotation_angle_param_name, "Angle"),
+      filter_spread_linear_toggle_(p.parameters(),
+                                   filter_spread_linear_param_name,
+                                   "Linear spread"),
+      extended_stages_toggle_(p.parameters(),
+                              extended_stages_param_name,
+                              "Extended range"),
+      rotation_mode_toggle_(p.parameters(),
+                            rotation_mode_param_name,
+                            "Rotate only"),
+      safe_mode_toggle_(p.parameters(), safe_mode_param_name, "Safe mode"),
+      reblocking_toggle_(p.parameters(), reblocking_param_name, "Re-block"),
+      design_panel_(p, response_plot_),
+      extended_stages_attachment_(
+          *p.parameters().getParameter(extended_stages_param_name),
+          [&](float value) {
+              const bool extended = value >= 0.5f;
+              filter_stages_knob_.setVisible(!extended);
+              extended_filter_stages_knob_.setVisible(extended);
+          }) {
+    addAndMakeVisible(response_plot_);
+    addAndMakeVisible(analyzer_view_);
+    addChildComponent(filter_stages_knob_);
+    addChildComponent(extended_filter_stages_knob_);
+    addAndMakeVisible(filter_frequency_knob_);
+    addAndMakeVisible(filter_resonance_knob_);
+    addAndMakeVisible(filter_spread_knob_);
+    addAndMakeVisible(smoothing_interval_knob_);
+    addAndMakeVisible(rotation_angle_knob_);
+    addAndMakeVisible(filter_spread_linear_toggle_);
+    addAndMakeVisible(extended_stages_toggle_);
+    addAndMakeVisible(rotation_mode_toggle_);
+    addAndMakeVisible(safe_mode_toggle_);
+    addAndMakeVisible(reblocking_toggle_);
+    addAndMakeVisible(design_panel_);
+    extended_stages_attachment_.sendInitialUpdate();
+
+    setResizable(true, true);
+    setResizeLimits(690, 480, 2400, 1600);
+    setSize(850, 580);
 }
 
 DiopserEditor::~DiopserEditor() {}
 
 void DiopserEditor::paint(juce::Graphics& g) {
-    // TODO: Replace with something else. Or drop the GUI.
     g.fillAll(
         getLookAndFeel().findColour(juce::ResizableWindow::backgroundColourId));
-
-    g.setColour(juce::Colours::white);
-    g.setFont(15.0f);
-    g.drawFittedText("Hello World!", getLocalBounds(),
-                     juce::Justification::centred, 1);
 }
 
 void DiopserEditor::resized() {
-    // TODO
+    auto bounds = getLocalBounds().reduced(8);
+
+    auto controls = bounds.removeFromBottom(controls_height);
+    bounds.removeFromBottom(8);
+
+    auto analyzer_bounds = bounds.removeFromBottom(
+        juce::roundToInt(bounds.getHeight() * analyzer_height_ratio));
+    bounds.removeFromBottom(8);
+    analyzer_view_.setBounds(analyzer_bounds);
+    response_plot_.setBounds(bounds);
+
+    auto toggles = controls.removeFromRight(toggles_width);
+    const int toggle_height = toggles.getHeight() / 5;
+    filter_spread_linear_toggle_.setBounds(
+        toggles.removeFromTop(toggle_height));
+    extended_stages_toggle_.setBounds(toggles.removeFromTop(toggle_height));
+    rotation_mode_toggle_.setBounds(toggles.removeFromTop(toggle_height));
+    safe_mode_toggle_.setBounds(toggles.removeFromTop(toggle_height));
+    reblocking_toggle_.setBounds(toggles);
+
+    design_panel_.setBounds(controls.removeFromRight(design_panel_width));
+
+    const int knob_width = controls.getWidth() / 6;
+    const auto stages_bounds = controls.removeFromLeft(knob_width);
+    filter_stages_knob_.setBounds(stages_bounds);
+    extended_filter_stages_knob_.setBounds(stages_bounds);
+    filter_frequency_knob_.setBounds(controls.removeFromLeft(knob_width));
+    filter_resonance_knob_.setBounds(controls.removeFromLeft(knob_width));
+    filter_spread_knob_.setBounds(controls.removeFromLeft(knob_width));
+    rotation_angle_knob_.setBounds(controls.removeFromLeft(knob_width));
+    smoothing_interval_knob_.setBounds(controls);
 }
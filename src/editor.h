@@ -16,7 +16,142 @@
 
 #pragma once
 
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "analyzer_view.h"
 #include "processor.h"
+#include "response_plot.h"
+
+/**
+ * Connects a slider to a parameter like JUCE's `SliderAttachment`, but values
+ * set while dragging the slider are coalesced and sent to the parameter at
+ * most once per audio processing block. Every one of those changes would
+ * otherwise retarget the processor's smoothers. The processor is also told
+ * when a drag starts and ends, so it can switch to a cheaper way to update
+ * the filters while the user is turning a knob.
+ */
+class CoalescingSliderAttachment : private juce::Slider::Listener,
+                                   private juce::Timer {
+   public:
+    CoalescingSliderAttachment(DiopserProcessor& processor,
+                               juce::RangedAudioParameter& parameter,
+                               juce::Slider& slider);
+    ~CoalescingSliderAttachment() override;
+
+   private:
+    void sliderValueChanged(juce::Slider*) override;
+    void sliderDragStarted(juce::Slider*) override;
+    void sliderDragEnded(juce::Slider*) override;
+    void timerCallback() override;
+
+    /**
+     * Send the last value set during the current gesture to the parameter, if
+     * it hasn't been sent yet.
+     */
+    void flush_pending_value();
+
+    DiopserProcessor& processor_;
+    juce::Slider& slider_;
+    juce::ParameterAttachment attachment_;
+
+    bool is_dragging_ = false;
+    std::optional<float> pending_value_;
+    /**
+     * Set while we're updating the slider in response to a parameter change,
+     * so that doesn't get sent back to the parameter.
+     */
+    bool ignore_callbacks_ = false;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(CoalescingSliderAttachment)
+};
+
+/**
+ * A rotary slider with a label underneath it, attached to one of the
+ * processor's parameters.
+ */
+class ParameterKnob : public juce::Component {
+   public:
+    ParameterKnob(DiopserProcessor& processor,
+                  const juce::String& parameter_id,
+                  const juce::String& label);
+
+    void resized() override;
+
+   private:
+    juce::Slider slider_;
+    juce::Label label_;
+    CoalescingSliderAttachment attachment_;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ParameterKnob)
+};
+
+/**
+ * A toggle button attached to one of the processor's boolean parameters.
+ */
+class ParameterToggle : public juce::Component {
+   public:
+    ParameterToggle(juce::AudioProcessorValueTreeState& parameters,
+                    const juce::String& parameter_id,
+                    const juce::String& label);
+
+    void resized() override;
+
+   private:
+    juce::ToggleButton button_;
+    juce::AudioProcessorValueTreeState::ButtonAttachment attachment_;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ParameterToggle)
+};
+
+/**
+ * Controls for the group delay designer. The design button designs the
+ * smallest cascade that matches the group delay currently shown in the
+ * response plot, or the target curve loaded with the target button if there
+ * is one. The toggle switches between the designed cascade and the regular
+ * one.
+ */
+class DesignPanel : public juce::Component, private juce::Timer {
+   public:
+    DesignPanel(DiopserProcessor& processor, ResponsePlot& response_plot);
+
+    void resized() override;
+
+   private:
+    void timerCallback() override;
+
+    /**
+     * Start a new design using the loaded target, or the response plot's
+     * current group delay if no target has been loaded.
+     */
+    void start_design();
+
+    /**
+     * Ask for a target curve file and load it with `load_design_target()`, or
+     * clear the loaded target if there already is one.
+     */
+    void load_or_clear_target();
+
+    DiopserProcessor& processor_;
+    ResponsePlot& response_plot_;
+
+    ParameterToggle design_mode_toggle_;
+    juce::TextButton design_button_;
+    juce::TextButton target_button_;
+    std::unique_ptr<juce::FileChooser> target_chooser_;
+    /**
+     * The target loaded from a file. When this is empty the response plot's
+     * current group delay is used instead.
+     */
+    std::vector<GroupDelayDesigner::TargetPoint> loaded_target_;
+    /**
+     * Shows whether a design is running, and the size of the current design.
+     */
+    juce::Label status_label_;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(DesignPanel)
+};
 
 class DiopserEditor : public juce::AudioProcessorEditor {
    public:
@@ -29,5 +164,40 @@ class DiopserEditor : public juce::AudioProcessorEditor {
    private:
     DiopserProcessor& processor_;
 
+    /**
+     * Shows the cascade's phase and group delay. The response is computed on
+     * a background thread that only lives as long as the editor is open.
+     */
+    ResponsePlot response_plot_;
+    /**
+     * A spectrum analyzer and oscilloscope for the processed audio.
+     */
+    AnalyzerView analyzer_view_;
+
+    ParameterKnob filter_stages_knob_;
+    /**
+     * Takes the place of `filter_stages_knob_` while the extended stage range
+     * is enabled.
+     */
+    ParameterKnob extended_filter_stages_knob_;
+    ParameterKnob filter_frequency_knob_;
+    ParameterKnob filter_resonance_knob_;
+    ParameterKnob filter_spread_knob_;
+    ParameterKnob smoothing_interval_knob_;
+    ParameterKnob rotation_angle_knob_;
+    ParameterToggle filter_spread_linear_toggle_;
+    ParameterToggle extended_stages_toggle_;
+    ParameterToggle rotation_mode_toggle_;
+    ParameterToggle safe_mode_toggle_;
+    ParameterToggle reblocking_toggle_;
+    DesignPanel design_panel_;
+
+    /**
+     * Shows either of the stage knobs depending on whether the extended stage
+     * range is enabled. This is declared after the knobs so it never outlives
+     * them.
+     */
+    juce::ParameterAttachment extended_stages_attachment_;
+
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(DiopserEditor)
 };
@@ -0,0 +1,68 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <juce_core/juce_core.h>
+
+#ifndef DIOPSER_PROFILE_PAINTING
+#define DIOPSER_PROFILE_PAINTING 0
+#endif
+
+/**
+ * Measures how long a component's `paint()` function takes. When building with
+ * the `DIOPSER_PROFILE_PAINTING` CMake option this logs the average paint time
+ * every 120 frames using JUCE's `PerformanceCounter`. Otherwise this does
+ * nothing at all.
+ */
+class PaintProfiler {
+   public:
+    explicit PaintProfiler(const juce::String& name)
+#if DIOPSER_PROFILE_PAINTING
+        : counter_(name + " paint", 120)
+#endif
+    {
+        juce::ignoreUnused(name);
+    }
+
+    /**
+     * Measures the time between its construction and its destruction.
+     */
+    class Scope {
+       public:
+        explicit Scope(PaintProfiler& profiler) : profiler_(profiler) {
+#if DIOPSER_PROFILE_PAINTING
+            profiler_.counter_.start();
+#endif
+        }
+
+        ~Scope() {
+#if DIOPSER_PROFILE_PAINTING
+            profiler_.counter_.stop();
+#endif
+        }
+
+       private:
+        [[maybe_unused]] PaintProfiler& profiler_;
+    };
+
+    [[nodiscard]] Scope measure() { return Scope(*this); }
+
+   private:
+#if DIOPSER_PROFILE_PAINTING
+    juce::PerformanceCounter counter_;
+#endif
+};
@@ -0,0 +1,44 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+// The IDs for the plugin's parameters. These are also used in the saved state,
+// so they should never change. The offline tools use these to read parameters
+// from a state saved by the plugin.
+
+constexpr char filter_settings_group_name[] = "filters";
+constexpr char filter_stages_param_name[] = "filter_stages";
+constexpr char filter_frequency_param_name[] = "filter_freq";
+constexpr char filter_resonance_param_name[] = "filter_res";
+constexpr char filter_spread_param_name[] = "filter_spread";
+constexpr char filter_spread_linear_param_name[] = "filter_spread_linear";
+constexpr char extended_stages_param_name[] = "extended_stages";
+constexpr char extended_filter_stages_param_name[] = "extended_filter_stages";
+constexpr char rotation_mode_param_name[] = "rotation_mode";
+constexpr char rotation_angle_param_name[] = "rotation_angle";
+constexpr char design_mode_param_name[] = "design_mode";
+constexpr char smoothing_interval_param_name[] = "smoothing_interval";
+constexpr char safe_mode_param_name[] = "safe_mode";
+constexpr char reblocking_param_name[] = "reblocking";
+
+/**
+ * The largest number of stages the extended stage range allows. With the
+ * extended range enabled the stage count comes from its own parameter, so
+ * existing automation of the regular filter stages parameter keeps its
+ * meaning.
+ */
+constexpr int max_extended_stages = 4096;
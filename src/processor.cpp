@@ -16,24 +16,11 @@
 
 #include "processor.h"
 
-#include "editor.h"
-
-using juce::uint32;
-
-constexpr char filter_settings_group_name[] = "filters";
-constexpr char filter_stages_param_name[] = "filter_stages";
-constexpr char filter_frequency_param_name[] = "filter_freq";
-constexpr char filter_resonance_param_name[] = "filter_res";
-constexpr char filter_spread_param_name[] = "filter_spread";
-constexpr char filter_spread_linear_param_name[] = "filter_spread_linear";
-constexpr char smoothing_interval_param_name[] = "smoothing_interval";
+#include <algorithm>
+#include <bitset>
 
-/**
- * When the filter cutoff or resonance parameters change, we'll interpolate
- * between the old and the new values over the course of this time span to
- * prevent clicks.
- */
-constexpr float filter_smoothing_secs = 0.1f;
+#include "editor.h"
+#include "state.h"
 
 /**
  * The default filter resonance. This value should minimize the amount of
@@ -44,6 +31,26 @@ constexpr float filter_smoothing_secs = 0.1f;
  */
 constexpr float default_filter_resonance = 0.5f;
 
+/**
+ * An upper bound for the number of parameters, used to keep track of which
+ * parameters were restored in `setStateInformation()` without allocating.
+ */
+constexpr size_t max_state_parameters = 64;
+
+/**
+ * The largest design the designer can produce in the plugin. Restoring a state
+ * reserves this many stages up front, so a design can be collected without
+ * reallocating while the state is being parsed.
+ */
+constexpr size_t max_designed_stages = 512;
+
+/**
+ * The designer stops at the smallest number of stages whose group delay stays
+ * within this fraction of the target's peak group delay, in terms of the RMS
+ * difference.
+ */
+constexpr float design_relative_tolerance = 0.02f;
+
 DiopserProcessor::DiopserProcessor()
     : AudioProcessor(
           BusesProperties()
@@ -114,7 +121,71 @@ DiopserProcessor::DiopserProcessor()
                       [](const juce::String& text) -> bool {
                           const auto& lower_case = text.toLowerCase();
                           return lower_case == "linear" || lower_case == "true";
-                      })),
+                      }),
+                  // Anything above 512 stages is only practical with the
+                  // engine's pipelined kernel, which the engine always uses
+                  // for those stage counts
+                  std::make_unique<juce::AudioParameterBool>(
+                      extended_stages_param_name,
+                      "Extended stage range",
+                      false,
+                      "",
+                      [](float value, int /*max_length*/) -> juce::String {
+                          return (value >= 0.5) ? "enabled" : "disabled";
+                      },
+                      [](const juce::String& text) -> bool {
+                          const auto& lower_case = text.toLowerCase();
+                          return lower_case == "enabled" ||
+                                 lower_case == "true";
+                      }),
+                  // The extended range has its own stage count instead of
+                  // remapping the regular one, so automation of either one
+                  // keeps meaning the same number of stages
+                  std::make_unique<juce::AudioParameterInt>(
+                      extended_filter_stages_param_name,
+                      "Extended Filter Stages",
+                      0,
+                      max_extended_stages,
+                      0)),
+              // Replaces the filter cascade with a constant phase shift. The
+              // other filter parameters don't do anything in this mode.
+              std::make_unique<juce::AudioParameterBool>(
+                  rotation_mode_param_name,
+                  "Rotation mode",
+                  false,
+                  "",
+                  [](float value, int /*max_length*/) -> juce::String {
+                      return (value >= 0.5) ? "enabled" : "disabled";
+                  },
+                  [](const juce::String& text) -> bool {
+                      const auto& lower_case = text.toLowerCase();
+                      return lower_case == "enabled" || lower_case == "true";
+                  }),
+              std::make_unique<juce::AudioParameterFloat>(
+                  rotation_angle_param_name,
+                  "Rotation angle",
+                  juce::NormalisableRange<float>(-180.0f, 180.0f, 0.1f),
+                  0.0f,
+                  juce::String::fromUTF8("\xc2\xb0"),
+                  juce::AudioProcessorParameter::genericParameter,
+                  [](float value, int /*max_length*/) -> juce::String {
+                      return juce::String(value, 1);
+                  }),
+              // Replaces the filter cascade with the stages found by the
+              // group delay designer. The design itself is stored separately
+              // in the plugin's state.
+              std::make_unique<juce::AudioParameterBool>(
+                  design_mode_param_name,
+                  "Design mode",
+                  false,
+                  "",
+                  [](float value, int /*max_length*/) -> juce::String {
+                      return (value >= 0.5) ? "enabled" : "disabled";
+                  },
+                  [](const juce::String& text) -> bool {
+                      const auto& lower_case = text.toLowerCase();
+                      return lower_case == "enabled" || lower_case == "true";
+                  }),
               std::make_unique<juce::AudioParameterInt>(
                   smoothing_interval_param_name,
                   "Automation precision",
@@ -136,6 +207,32 @@ DiopserProcessor::DiopserProcessor()
                       const float percentage = text.getFloatValue();
                       return std::round(512 - ((percentage / 100.0f) * 511.0f));
                   }),
+              std::make_unique<juce::AudioParameterBool>(
+                  safe_mode_param_name,
+                  "Safe mode",
+                  true,
+                  "",
+                  [](float value, int /*max_length*/) -> juce::String {
+                      return (value >= 0.5) ? "enabled" : "disabled";
+                  },
+                  [](const juce::String& text) -> bool {
+                      const auto& lower_case = text.toLowerCase();
+                      return lower_case == "enabled" || lower_case == "true";
+                  }),
+              // Processes the audio in fixed size blocks at the cost of some
+              // latency. See `Reblocker`.
+              std::make_unique<juce::AudioParameterBool>(
+                  reblocking_param_name,
+                  "Re-blocking",
+                  false,
+                  "",
+                  [](float value, int /*max_length*/) -> juce::String {
+                      return (value >= 0.5) ? "enabled" : "disabled";
+                  },
+                  [](const juce::String& text) -> bool {
+                      const auto& lower_case = text.toLowerCase();
+                      return lower_case == "enabled" || lower_case == "true";
+                  }),
               std::make_unique<juce::AudioParameterBool>(
                   "please_ignore",
                   "Don't touch this",
@@ -157,16 +254,70 @@ DiopserProcessor::DiopserProcessor()
           *parameters_.getRawParameterValue(filter_spread_param_name)),
       filter_spread_linear_(*dynamic_cast<juce::AudioParameterBool*>(
           parameters_.getParameter(filter_spread_linear_param_name))),
+      extended_stages_(*dynamic_cast<juce::AudioParameterBool*>(
+          parameters_.getParameter(extended_stages_param_name))),
+      extended_filter_stages_(*dynamic_cast<juce::AudioParameterInt*>(
+          parameters_.getParameter(extended_filter_stages_param_name))),
+      rotation_mode_(*dynamic_cast<juce::AudioParameterBool*>(
+          parameters_.getParameter(rotation_mode_param_name))),
+      rotation_angle_(
+          *parameters_.getRawParameterValue(rotation_angle_param_name)),
+      design_mode_(*dynamic_cast<juce::AudioParameterBool*>(
+          parameters_.getParameter(design_mode_param_name))),
       smoothing_interval_(*dynamic_cast<juce::AudioParameterInt*>(
           parameters_.getParameter(smoothing_interval_param_name))),
+      safe_mode_(*dynamic_cast<juce::AudioParameterBool*>(
+          parameters_.getParameter(safe_mode_param_name))),
+      reblocking_(*dynamic_cast<juce::AudioParameterBool*>(
+          parameters_.getParameter(reblocking_param_name))),
       filter_stages_updater_([&]() { update_and_swap_filters(); }),
       filter_stages_listener_(
-          [&](const juce::String& /*parameter_id*/, float /*new_value*/) {
+          [&](const juce::String& parameter_id, float /*new_value*/) {
+              // Switching between the regular and the extended stage count
+              // can change the number of stages by thousands at once, so that
+              // change gets faded instead of being swapped in directly
+              if (parameter_id == extended_stages_param_name) {
+                  fade_stage_change_ = true;
+              }
+
               // Resize our filter vector from a background thread
               filter_stages_updater_.triggerAsyncUpdate();
-          }) {
+          }),
+      reblocking_updater_([&]() { update_block_size(); }),
+      reblocking_listener_(
+          [&](const juce::String& /*parameter_id*/, float /*new_value*/) {
+              reblocking_updater_.triggerAsyncUpdate();
+          }),
+      tuned_block_size_updater_([&]() { set_block_size(tuned_block_size_); }),
+      design_finished_updater_([&]() { design_mode_ = true; }) {
     parameters_.addParameterListener(filter_stages_param_name,
                                      &filter_stages_listener_);
+    parameters_.addParameterListener(extended_stages_param_name,
+                                     &filter_stages_listener_);
+    parameters_.addParameterListener(extended_filter_stages_param_name,
+                                     &filter_stages_listener_);
+    parameters_.addParameterListener(reblocking_param_name,
+                                     &reblocking_listener_);
+
+    // The parameters never change after this point, so they only need to be
+    // looked up once for restoring states
+    const juce::Array<juce::AudioProcessorParameter*>& all_parameters =
+        getParameters();
+    jassert(all_parameters.size() <= static_cast<int>(max_state_parameters));
+    for (int i = 0; i < all_parameters.size(); i++) {
+        if (auto* parameter = dynamic_cast<juce::RangedAudioParameter*>(
+                all_parameters.getUnchecked(i))) {
+            state_parameters_.push_back(StateParameter{
+                .id = std::string_view(parameter->paramID.toRawUTF8(),
+                                       parameter->paramID.getNumBytesAsUTF8()),
+                .parameter = parameter,
+                .index = static_cast<size_t>(i)});
+        }
+    }
+    std::sort(state_parameters_.begin(), state_parameters_.end(),
+              [](const StateParameter& lhs, const StateParameter& rhs) {
+                  return lhs.id < rhs.id;
+              });
 }
 
 DiopserProcessor::~DiopserProcessor() {}
@@ -224,34 +375,19 @@ void DiopserProcessor::changeProgramName(int /*index*/,
 
 void DiopserProcessor::prepareToPlay(double sampleRate,
                                      int maximumExpectedSamplesPerBlock) {
-    current_spec_ = juce::dsp::ProcessSpec{
-        .sampleRate = sampleRate,
-        .maximumBlockSize = static_cast<uint32>(maximumExpectedSamplesPerBlock),
-        .numChannels = static_cast<uint32>(getMainBusNumInputChannels())};
-
-    // After initializing the filters we make an explicit call to
-    // `filters.get()` to swap the two filters in case we get a parameter change
-    // before the first processing cycle. Updating the filters will also set the
-    // `is_initialized` flag to `false`, so the filter coefficients will be
-    // initialized during the first processing cycle.
-    update_and_swap_filters();
-    filters_.get();
-
-    // The filter parameter will be smoothed to prevent clicks during automation
-    const double compensated_sample_rate = sampleRate / smoothing_interval_;
-    smoothed_filter_frequency_.reset(compensated_sample_rate,
-                                     filter_smoothing_secs);
-    smoothed_filter_resonance_.reset(compensated_sample_rate,
-                                     filter_smoothing_secs);
-    smoothed_filter_spread_.reset(compensated_sample_rate,
-                                  filter_smoothing_secs);
+    engine_.prepare(sampleRate,
+                    static_cast<size_t>(maximumExpectedSamplesPerBlock),
+                    static_cast<size_t>(getMainBusNumOutputChannels()),
+                    static_cast<size_t>(num_stages()),
+                    smoothing_interval_);
+
+    max_block_size_ = static_cast<size_t>(maximumExpectedSamplesPerBlock);
+    reblocker_.prepare(static_cast<size_t>(getMainBusNumOutputChannels()));
+    update_block_size();
 }
 
 void DiopserProcessor::releaseResources() {
-    filters_.clear([](Filters& filters) {
-        filters.stages.clear();
-        filters.stages.shrink_to_fit();
-    });
+    engine_.release();
 }
 
 bool DiopserProcessor::isBusesLayoutSupported(
@@ -264,9 +400,25 @@ bool DiopserProcessor::isBusesLayoutSupported(
 }
 
 void DiopserProcessor::processBlockBypassed(
-    juce::AudioBuffer<float>& /*buffer*/,
+    juce::AudioBuffer<float>& buffer,
     juce::MidiBuffer& /*midiMessages*/) {
-    // TODO: The default should be fine if we don't introduce any latency
+    // With re-blocking enabled the dry signal has to be delayed by the same
+    // amount as the processed signal. The re-blocker does exactly that when
+    // its blocks aren't processed.
+    float** samples = buffer.getArrayOfWritePointers();
+    const size_t input_channels =
+        static_cast<size_t>(getMainBusNumInputChannels());
+    const size_t output_channels =
+        static_cast<size_t>(getMainBusNumOutputChannels());
+    const size_t num_samples = static_cast<size_t>(buffer.getNumSamples());
+
+    for (auto channel = input_channels; channel < output_channels; channel++) {
+        buffer.clear(channel, 0.0f, num_samples);
+    }
+
+    reblocker_.process(samples, input_channels, num_samples,
+                       [](float* const* /*block*/, size_t /*num_channels*/,
+                          size_t /*num_samples*/) {});
 }
 
 void DiopserProcessor::processBlock(juce::AudioBuffer<float>& buffer,
@@ -289,195 +441,274 @@ void DiopserProcessor::processBlock(juce::AudioBuffer<float>& buffer,
         buffer.clear(channel, 0.0f, num_samples);
     }
 
-    // Our filter structure gets updated from a background thread whenever the
-    // `filter_stages` parameter changes
-    Filters& filters = filters_.get();
-
-    smoothed_filter_frequency_.setTargetValue(filter_frequency_);
-    smoothed_filter_resonance_.setTargetValue(filter_resonance_);
-    smoothed_filter_spread_.setTargetValue(filter_spread_);
-    for (size_t sample_idx = 0; sample_idx < num_samples; sample_idx++) {
-        // Recomputing these IIR coefficients every sample is expensive, so to
-        // save some cycles we only do it once every `smoothing_interval`
-        // samples unless the filters just got reinitialized or some parameter
-        // we can't smooth has
-        const bool should_apply_smoothing =
-            next_smooth_in_ <= 0 && (smoothed_filter_frequency_.isSmoothing() ||
-                                     smoothed_filter_resonance_.isSmoothing() ||
-                                     smoothed_filter_spread_.isSmoothing());
-        const bool should_update_filters =
-            !filters.is_initialized ||
-            filter_spread_linear_ != old_filter_spread_linear_ ||
-            should_apply_smoothing;
-
-        const float current_filter_frequency =
-            should_apply_smoothing
-                ? smoothed_filter_frequency_.getNextValue()
-                : smoothed_filter_frequency_.getCurrentValue();
-        const float current_filter_resonance =
-            should_apply_smoothing
-                ? smoothed_filter_resonance_.getNextValue()
-                : smoothed_filter_resonance_.getCurrentValue();
-        const float current_filter_spread =
-            should_apply_smoothing ? smoothed_filter_spread_.getNextValue()
-                                   : smoothed_filter_spread_.getCurrentValue();
-
-        if (should_update_filters && !filters.stages.empty()) {
-            // We can use a single set of coefficients as a cache locality
-            // optimization if spread has been disabled
-            const bool use_single_set_of_coefficients =
-                current_filter_spread == 0.0f;
-            if (use_single_set_of_coefficients) {
-                *filters.stages[0].coefficients =
-                    juce::dsp::IIR::ArrayCoefficients<float>::makeAllPass(
-                        getSampleRate(), current_filter_frequency,
-                        current_filter_resonance);
-            }
+    // With re-blocking enabled, blocks that were collected over multiple
+    // calls are processed with the parameters from the call that completed
+    // them
+    const DiopserEngine::Parameters parameters{
+        .frequency = filter_frequency_,
+        .resonance = filter_resonance_,
+        .spread = filter_spread_,
+        .spread_linear = filter_spread_linear_,
+        .smoothing_interval = smoothing_interval_,
+        .safe_mode = safe_mode_,
+        .gesture_in_progress = gesture_in_progress(),
+        .rotation_mode = rotation_mode_,
+        .rotation_angle = rotation_angle_,
+        .design_mode = design_mode_};
+    reblocker_.process(samples, input_channels, num_samples,
+                       [&](float* const* block, size_t num_channels,
+                           size_t block_size) {
+                           engine_.process(block, num_channels, block_size,
+                                           parameters);
+                       });
+
+    analyzer_feed_.push(samples, input_channels, num_samples);
+}
 
-            // The filter spread can be either linear or logarithmic. The
-            // logarithmic version is the default because it sounds a bit more
-            // natural. We also need to make sure the spread range stays in the
-            // normal ranges to prevent the filters from crapping out. This does
-            // cause the range to shift slightly with high spread values and low
-            // or high frequency values. Ideally we would want to prevent this
-            // in the GUI.
-            // TODO: When adding a GUI, prevent spread values that would cause
-            //       the frequency range to be shifted
-            const float below_nyquist_frequency =
-                static_cast<float>(getSampleRate()) / 2.1f;
-            const float min_filter_frequency = std::clamp(
-                current_filter_frequency - (current_filter_spread / 2.0f), 5.0f,
-                below_nyquist_frequency);
-            const float max_filter_frequency = std::clamp(
-                current_filter_frequency + (current_filter_spread / 2.0f), 5.0f,
-                below_nyquist_frequency);
-            const float filter_frequency_delta =
-                max_filter_frequency - min_filter_frequency;
-            const float log_min_filter_frequency =
-                std::log(min_filter_frequency);
-            const float log_max_filter_frequency =
-                std::log(max_filter_frequency);
-            const float log_filter_frequency_delta =
-                log_max_filter_frequency - log_min_filter_frequency;
-
-            const size_t num_stages = filters.stages.size();
-            for (size_t stage_idx = 0; stage_idx < num_stages; stage_idx++) {
-                auto& stage = filters.stages[stage_idx];
-
-                if (!use_single_set_of_coefficients) {
-                    // TODO: Maybe add back the option for simple linear
-                    //       skewing. Or use the same skew scheme JUCE's
-                    //       parameter range uses and make the skew factor
-                    //       configurable.
-                    const float frequency_offset_factor =
-                        num_stages == 1 ? 0.5f
-                                        : (static_cast<float>(stage_idx) /
-                                           static_cast<float>(num_stages - 1));
-
-                    *stage.coefficients =
-                        juce::dsp::IIR::ArrayCoefficients<float>::makeAllPass(
-                            getSampleRate(),
-                            filter_spread_linear_
-                                ? (min_filter_frequency +
-                                   (filter_frequency_delta *
-                                    frequency_offset_factor))
-                                : std::exp(log_min_filter_frequency +
-                                           (log_filter_frequency_delta *
-                                            frequency_offset_factor)),
-                            current_filter_resonance);
-                }
-
-                const auto& coefficients = use_single_set_of_coefficients
-                                               ? filters.stages[0].coefficients
-                                               : stage.coefficients;
-                for (auto& filter : stage.channels) {
-                    filter.coefficients = coefficients;
-                }
-            }
+bool DiopserProcessor::hasEditor() const {
+    return true;
+}
 
-            next_smooth_in_ = smoothing_interval_;
-        }
+juce::AudioProcessorEditor* DiopserProcessor::createEditor() {
+    return new DiopserEditor(*this);
+}
 
-        next_smooth_in_ -= 1;
-        filters.is_initialized = true;
-        old_filter_spread_linear_ = filter_spread_linear_;
-
-        for (auto& stage : filters.stages) {
-            for (size_t channel = 0; channel < input_channels; channel++) {
-                // TODO: We should add a dry-wet control, could be useful for
-                //       automation
-                // TODO: Oh and we should _definitely_ have some kind of 'safe
-                //       mode' limiter enabled by default
-                samples[channel][sample_idx] =
-                    stage.channels[channel].processSample(
-                        samples[channel][sample_idx]);
-            }
-        }
+juce::AudioProcessorValueTreeState& DiopserProcessor::parameters() {
+    return parameters_;
+}
+
+DiopserProcessor::FilterSettings DiopserProcessor::filter_settings() const {
+    return FilterSettings{.stages = num_stages(),
+                          .frequency = filter_frequency_,
+                          .resonance = filter_resonance_,
+                          .spread = filter_spread_,
+                          .spread_linear = filter_spread_linear_,
+                          .rotation_mode = rotation_mode_,
+                          .rotation_angle = rotation_angle_,
+                          .design_mode = design_mode_,
+                          .design_version = design_version_};
+}
+
+void DiopserProcessor::begin_gesture() {
+    num_active_gestures_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void DiopserProcessor::end_gesture() {
+    num_active_gestures_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+bool DiopserProcessor::gesture_in_progress() const {
+    return num_active_gestures_.load(std::memory_order_relaxed) > 0;
+}
+
+AnalyzerFeed& DiopserProcessor::analyzer_feed() {
+    return analyzer_feed_;
+}
+
+void DiopserProcessor::start_design(
+    std::vector<GroupDelayDesigner::TargetPoint> target) {
+    float peak_group_delay_ms = 0.0f;
+    for (const auto& point : target) {
+        peak_group_delay_ms =
+            std::max(peak_group_delay_ms, point.group_delay_ms);
     }
+
+    // The editor can be opened before the plugin has been prepared
+    const double sample_rate = getSampleRate();
+    GroupDelayDesigner::Settings settings{
+        .sample_rate = sample_rate > 0.0 ? sample_rate : 44100.0,
+        .target = std::move(target),
+        .max_stages = max_designed_stages,
+        .tolerance_ms = peak_group_delay_ms * design_relative_tolerance};
+
+    // Setting the design reallocates the engine's designed stages, so this
+    // happens on the designer's thread
+    designer_.start(std::move(settings),
+                    [this](GroupDelayDesigner::Result result) {
+                        set_design(std::move(result.stages), result.error_ms);
+                        design_finished_updater_.triggerAsyncUpdate();
+                    });
 }
 
-bool DiopserProcessor::hasEditor() const {
-    return true;
+std::vector<DesignedStage> DiopserProcessor::design() const {
+    std::lock_guard lock(design_mutex_);
+    return design_;
 }
 
-juce::AudioProcessorEditor* DiopserProcessor::createEditor() {
-    // TODO: Add an editor at some point
-    // return new DiopserEditor(*this);
-    return new juce::GenericAudioProcessorEditor(*this);
+DiopserProcessor::DesignStatus DiopserProcessor::design_status() const {
+    std::lock_guard lock(design_mutex_);
+    return DesignStatus{.is_running = designer_.is_running(),
+                        .num_stages = design_.size(),
+                        .error_ms = design_error_ms_};
 }
 
 void DiopserProcessor::getStateInformation(juce::MemoryBlock& destData) {
-    const std::unique_ptr<juce::XmlElement> xml =
-        parameters_.copyState().createXml();
-    copyXmlToBinary(*xml, destData);
+    BinaryState::write(destData, getParameters(), design());
 }
 
 void DiopserProcessor::setStateInformation(const void* data, int sizeInBytes) {
+    if (sizeInBytes <= 0) {
+        return;
+    }
+
+    // A design that's still running would otherwise replace the restored
+    // design once it finishes
+    designer_.cancel();
+
+    // Patches saved by older versions of Diopser are stored as XML
+    const size_t size = static_cast<size_t>(sizeInBytes);
+    if (!BinaryState::is_binary_state(data, size)) {
+        set_xml_state(data, sizeInBytes);
+        set_design({}, std::nullopt);
+        return;
+    }
+
+    // Parameters missing from the state are reset to their defaults, just like
+    // `AudioProcessorValueTreeState::replaceState()` would do. The IDs are
+    // looked up in place in the sorted table built in the constructor, so
+    // restoring the parameters doesn't allocate. Only the design's vector is
+    // allocated, once.
+    std::bitset<max_state_parameters> restored;
+    std::vector<DesignedStage> design;
+    design.reserve(max_designed_stages);
+    const bool is_valid = BinaryState::read(
+        data, size,
+        [&](std::string_view id, float value) {
+            const auto entry = std::lower_bound(
+                state_parameters_.begin(), state_parameters_.end(), id,
+                [](const StateParameter& parameter, std::string_view key) {
+                    return parameter.id < key;
+                });
+            if (entry != state_parameters_.end() && entry->id == id) {
+                entry->parameter->setValueNotifyingHost(
+                    entry->parameter->convertTo0to1(value));
+                restored.set(entry->index);
+            }
+        },
+        [&](const DesignedStage& stage) { design.push_back(stage); });
+    if (!is_valid) {
+        return;
+    }
+
+    const bool has_design = !design.empty();
+    set_design(std::move(design), std::nullopt);
+
+    for (const auto& entry : state_parameters_) {
+        if (!restored.test(entry.index)) {
+            entry.parameter->setValueNotifyingHost(
+                entry.parameter->getDefaultValue());
+        }
+    }
+
+    // The design is skipped when it contained invalid stages, and the design
+    // mode would then silence the plugin
+    if (!has_design) {
+        design_mode_ = false;
+    }
+}
+
+void DiopserProcessor::set_xml_state(const void* data, int sizeInBytes) {
     const auto xml = getXmlFromBinary(data, sizeInBytes);
     if (xml && xml->hasTagName(parameters_.state.getType())) {
         parameters_.replaceState(juce::ValueTree::fromXml(*xml));
 
         // When loading patches from before we added the smoothing interval we
         // should default that to 1 instead of the normal default in case the
-        // parameter was being automated
+        // parameter was being automated. Similarly, patches from before we
+        // added the safe mode limiter should keep sounding the same, so we'll
+        // disable the limiter for those.
         bool has_smoothing_interval = false;
+        bool has_safe_mode = false;
         for (const auto* child : xml->getChildWithTagNameIterator("PARAM")) {
             if (child->compareAttribute("id", smoothing_interval_param_name)) {
                 has_smoothing_interval = true;
-                break;
+            } else if (child->compareAttribute("id", safe_mode_param_name)) {
+                has_safe_mode = true;
             }
         }
 
         if (!has_smoothing_interval) {
             smoothing_interval_ = 1;
         }
+        if (!has_safe_mode) {
+            safe_mode_ = false;
+        }
     }
 }
 
+int DiopserProcessor::num_stages() const {
+    return extended_stages_ ? extended_filter_stages_.get()
+                            : filter_stages_.get();
+}
+
 void DiopserProcessor::update_and_swap_filters() {
-    filters_.modify_and_swap([this](Filters& filters) {
-        filters.is_initialized = false;
-        filters.stages.resize(static_cast<size_t>(filter_stages_));
-
-        for (auto& stage : filters.stages) {
-            // The actual coefficients for each stage are initialized on the
-            // next processing cycle thanks to `filters.is_initialized`
-            if (!stage.coefficients) {
-                // The actual values here don't matter and we can just use
-                // any 6 length array
-                stage.coefficients = new juce::dsp::IIR::Coefficients<float>(
-                    FilterStage::Coefficients{});
-            }
+    // Resizing resets every filter, so changing the stage parameter that's
+    // not currently in use should not touch the cascade at all. This also
+    // means that toggling the extended range only fades when the stage count
+    // actually changes.
+    const size_t new_num_stages = static_cast<size_t>(num_stages());
+    const bool fade = fade_stage_change_.exchange(false);
+    if (new_num_stages == engine_.requested_num_stages()) {
+        return;
+    }
 
-            stage.channels.resize(
-                static_cast<size_t>(getMainBusNumOutputChannels()));
-            for (auto& filter : stage.channels) {
-                filter.prepare(current_spec_);
-                filter.coefficients = stage.coefficients;
-                filter.reset();
-            }
-        }
-    });
+    if (fade) {
+        engine_.fade_to_num_stages(new_num_stages);
+    } else {
+        engine_.set_num_stages(new_num_stages);
+    }
+}
+
+void DiopserProcessor::set_design(std::vector<DesignedStage> design,
+                                  std::optional<float> error_ms) {
+    engine_.set_design(design);
+
+    std::lock_guard lock(design_mutex_);
+    design_ = std::move(design);
+    design_error_ms_ = error_ms;
+    design_version_ += 1;
+}
+
+void DiopserProcessor::update_block_size() {
+    // A tuning that's still running was started for the old settings, and its
+    // result may already be waiting to be applied
+    block_size_tuner_.cancel();
+    tuned_block_size_updater_.cancelPendingUpdate();
+
+    if (!reblocking_) {
+        set_block_size(0);
+        return;
+    }
+
+    // Tuning takes up to a couple hundred milliseconds, so it runs in the
+    // background. The current block size is kept until it's done, so the
+    // latency only changes once. The tuning uses the settings from when
+    // re-blocking was enabled or when the plugin was last prepared. Tuning
+    // again whenever the number of stages changes would also change the
+    // latency while the stages are automated.
+    block_size_tuner_.start(
+        ReblockTuner::Settings{
+            .sample_rate = getSampleRate(),
+            .host_block_size = max_block_size_,
+            .num_channels =
+                static_cast<size_t>(getMainBusNumOutputChannels()),
+            .num_stages = static_cast<size_t>(num_stages()),
+            .smoothing_interval = smoothing_interval_},
+        [this](size_t block_size) {
+            tuned_block_size_ = block_size;
+            tuned_block_size_updater_.triggerAsyncUpdate();
+        });
+}
+
+void DiopserProcessor::set_block_size(size_t block_size) {
+    // Changing the block size flushes the re-blocker, so this shouldn't
+    // happen when the tuning ends up at the same block size
+    if (block_size == reblocker_.latency()) {
+        return;
+    }
+
+    reblocker_.set_block_size(block_size);
+    setLatencySamples(static_cast<int>(block_size));
 }
 
 juce::AudioProcessor* JUCE_CALLTYPE createPluginFilter() {
@@ -16,9 +16,18 @@
 
 #pragma once
 
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <vector>
+
 #include <juce_audio_processors/juce_audio_processors.h>
-#include <juce_dsp/juce_dsp.h>
 
+#include "analyzer_feed.h"
+#include "core/engine.h"
+#include "core/group_delay_designer.h"
+#include "core/reblocker.h"
+#include "parameter_ids.h"
 #include "utils.h"
 
 class DiopserProcessor : public juce::AudioProcessor {
@@ -57,83 +66,144 @@ class DiopserProcessor : public juce::AudioProcessor {
     void getStateInformation(juce::MemoryBlock& destData) override;
     void setStateInformation(const void* data, int sizeInBytes) override;
 
-   private:
-    struct FilterStage {
+    /**
+     * The filter parameters' current (unsmoothed) values. Used by the editor
+     * to draw the response curves.
+     */
+    struct FilterSettings {
+        int stages;
+        float frequency;
+        float resonance;
+        float spread;
+        bool spread_linear;
+        bool rotation_mode;
+        float rotation_angle;
+        bool design_mode;
         /**
-         * The type of the IIR coefficient array used, because these
-         * `CoefficientPtr`s are completely opaque.
+         * Incremented whenever the design changes. The design itself can be
+         * fetched using `design()`.
          */
-        using Coefficients = std::array<float, 6>;
+        uint64_t design_version;
 
-        std::vector<juce::dsp::IIR::Filter<float>> channels;
-        /**
-         * The all-pass coefficients for this stage's filters. As explained
-         * below, all filters will actually use the first stage's filter's
-         * coefficients when the spread has been turned down as an optimization.
-         * When adding filter stages in `update_and_swap_filters()`, this should
-         * be initialized with some arbitrary `Coefficients` so it can then be
-         * reinitialized with the correct coefficients in `processBlock()`.
-         */
-        juce::dsp::IIR::Filter<float>::CoefficientsPtr coefficients = nullptr;
+        bool operator==(const FilterSettings&) const = default;
     };
 
     /**
-     * This contains an arbitrary number of filter stages, which each contains
-     * some filter coefficients as well as an IIR filter for each channel.
+     * The state of the group delay designer, for the editor.
      */
-    struct Filters {
+    struct DesignStatus {
+        bool is_running;
+        size_t num_stages;
         /**
-         * This should be set to `false` when changing the number of filter
-         * stages. Then we can initialize the filters during the first
-         * processing cycle.
+         * The RMS difference between the design and its target. This is only
+         * known for designs made since the plugin was loaded.
          */
-        bool is_initialized = false;
-
-        std::vector<FilterStage> stages;
+        std::optional<float> error_ms;
     };
 
     /**
-     * Reinitialize `filters` with `filter_stages` filters on the next audio
-     * processing cycle. The inactive object we're modifying will be swapped
-     * with the active object on the next call to `filters.get()`. This should
-     * not be called from the audio thread.
+     * Used by the editor to attach its controls to the parameters.
+     */
+    juce::AudioProcessorValueTreeState& parameters();
+
+    /**
+     * Read the current values for the filter parameters. This only reads some
+     * atomics and can be called from any thread.
+     */
+    FilterSettings filter_settings() const;
+
+    /**
+     * Called by the editor when the user starts and stops dragging one of the
+     * controls. While a gesture is in progress the parameters are likely to
+     * change on every block, so the processing can use a cheaper update path
+     * for the filter coefficients.
+     */
+    void begin_gesture();
+    void end_gesture();
+    /**
+     * Whether the user is currently dragging one of the editor's controls.
+     * This can be called from any thread.
+     */
+    bool gesture_in_progress() const;
+
+    /**
+     * The processed audio is sent to the editor's analyzer through this feed.
+     */
+    AnalyzerFeed& analyzer_feed();
+
+    /**
+     * Search for the smallest cascade that matches `target` on a background
+     * thread, cancelling the design that's currently running, if any. Once
+     * it's done the new design replaces the current one and the design mode
+     * gets enabled. This should be called from the message thread.
+     */
+    void start_design(std::vector<GroupDelayDesigner::TargetPoint> target);
+
+    /**
+     * A copy of the current design. This can be called from any thread other
+     * than the audio thread.
+     */
+    std::vector<DesignedStage> design() const;
+
+    /**
+     * This can be called from any thread other than the audio thread.
+     */
+    DesignStatus design_status() const;
+
+   private:
+    /**
+     * The actual number of filter stages, taking the extended stage range into
+     * account. This can be called from any thread.
+     */
+    int num_stages() const;
+
+    /**
+     * Reinitialize the engine's filters with `num_stages()` filters on the
+     * next audio processing cycle, if that's different from the engine's
+     * current number of stages. This should not be called from the audio
+     * thread.
      */
     void update_and_swap_filters();
 
     /**
-     * The current processing spec. Needed when adding more filters when the
-     * number of stages changes.
+     * Start tuning the re-blocker's block size in the background if
+     * re-blocking is enabled. The current block size is kept until the tuning
+     * is done. This should not be called from the audio thread.
      */
-    juce::dsp::ProcessSpec current_spec_;
+    void update_block_size();
 
     /**
-     * Our all-pass filters. This is essentially a vector of filters indexed by
-     * `[filter_idx][channel_idx]` along coefficients per filter. The number of
-     * filters and the frequency of the filters is controlled using the
-     * `filter_stages` and `filter_frequency` parameters. Filter coefficients
-     * are stored along with the filter, but if `filter_spread` is disabled then
-     * all filters will use the first filter's coefficients for better cache
-     * locality.
+     * Change the re-blocker's block size and report the resulting latency to
+     * the host, if it's different from the current block size. This should
+     * not be called from the audio thread.
      */
-    AtomicallySwappable<Filters> filters_;
+    void set_block_size(size_t block_size);
 
-    juce::AudioProcessorValueTreeState parameters_;
+    /**
+     * Restore a state saved by a version of Diopser from before we switched to
+     * `BinaryState`. These were stored as XML.
+     */
+    void set_xml_state(const void* data, int sizeInBytes);
 
     /**
-     * How many samples we should process before updating and smoothing the
-     * parameters again. We do this only once every `smoothing_interval` samples
-     * because recomputing all of these filter coefficients per-sample becomes
-     * pretty expensive.
-     *
-     * To keep things simple, this value can be negative.
+     * Replace the design used in the design mode, both here and in the engine.
+     * This must not be called from the audio thread.
      */
-    int next_smooth_in_ = 0;
+    void set_design(std::vector<DesignedStage> design,
+                    std::optional<float> error_ms);
+
+    /**
+     * All of the actual audio processing happens here. The number of filters
+     * and the frequency of the filters is controlled using the `filter_stages`
+     * and `filter_frequency` parameters.
+     */
+    DiopserEngine engine_;
+
+    juce::AudioProcessorValueTreeState parameters_;
 
     juce::AudioParameterInt& filter_stages_;
     std::atomic<float>& filter_frequency_;
-    juce::SmoothedValue<float> smoothed_filter_frequency_;
     std::atomic<float>& filter_resonance_;
-    juce::SmoothedValue<float> smoothed_filter_resonance_;
     /**
      * A cutoff spread between the filter stages. When this value is `0`, the
      * same coefficients are used for every filter. Otherwise, the used
@@ -141,13 +211,32 @@ class DiopserProcessor : public juce::AudioProcessor {
      * (filter_spread / 2)]`.
      */
     std::atomic<float>& filter_spread_;
-    juce::SmoothedValue<float> smoothed_filter_spread_;
     /**
      * The spread can either be logarithmic or linear. The logarithmic version
      * usually sounds more natural, but surely more options is better, right?
      */
     juce::AudioParameterBool& filter_spread_linear_;
-    bool old_filter_spread_linear_;
+    /**
+     * Uses `extended_filter_stages_` instead of `filter_stages_` for the
+     * number of stages.
+     */
+    juce::AudioParameterBool& extended_stages_;
+    /**
+     * The number of filter stages used with the extended stage range, up to
+     * `max_extended_stages`.
+     */
+    juce::AudioParameterInt& extended_filter_stages_;
+    /**
+     * Replaces the filter cascade with the engine's `PhaseRotator`, which
+     * shifts every frequency by `rotation_angle` degrees.
+     */
+    juce::AudioParameterBool& rotation_mode_;
+    std::atomic<float>& rotation_angle_;
+    /**
+     * Replaces the filter cascade with the stages from the group delay
+     * designer. See `start_design()`.
+     */
+    juce::AudioParameterBool& design_mode_;
 
     /**
      * The interval in samples between parameter smoothing cycles. Recomputing
@@ -157,10 +246,95 @@ class DiopserProcessor : public juce::AudioProcessor {
     juce::AudioParameterInt& smoothing_interval_;
 
     /**
-     * Will add or remove filters when the number of filter stages changes.
+     * When enabled, the output is run through a limiter to prevent loud
+     * resonances from clipping. Enabled by default, but disabled when loading
+     * patches from before this option existed.
+     */
+    juce::AudioParameterBool& safe_mode_;
+    /**
+     * When enabled, the audio is processed in fixed size blocks tuned for the
+     * current configuration. This makes processing with small or irregular
+     * host block sizes much cheaper, at the cost of the block size in latency.
+     */
+    juce::AudioParameterBool& reblocking_;
+
+    /**
+     * Collects the host's blocks into fixed size blocks for the engine. This
+     * passes the blocks through directly when re-blocking is disabled.
+     */
+    Reblocker reblocker_;
+    /**
+     * The maximum block size from the last call to `prepareToPlay()`, used
+     * when tuning the re-blocker.
+     */
+    size_t max_block_size_ = 0;
+
+    AnalyzerFeed analyzer_feed_;
+
+    /**
+     * The number of controls the user is currently dragging in the editor.
+     */
+    std::atomic_int num_active_gestures_ = 0;
+
+    /**
+     * Will add or remove filters when the number of filter stages or the
+     * stage range changes.
      */
     LambdaAsyncUpdater filter_stages_updater_;
     LambdaParameterListener filter_stages_listener_;
+    /**
+     * Set when the extended stage range gets toggled, so the next call to
+     * `update_and_swap_filters()` fades to the new number of stages.
+     */
+    std::atomic_bool fade_stage_change_ = false;
+    /**
+     * Tunes the block size again when re-blocking gets enabled or disabled.
+     */
+    LambdaAsyncUpdater reblocking_updater_;
+    LambdaParameterListener reblocking_listener_;
+
+    /**
+     * A parameter that can be restored from a `BinaryState`, along with its
+     * index in `getParameters()`.
+     */
+    struct StateParameter {
+        std::string_view id;
+        juce::RangedAudioParameter* parameter;
+        size_t index;
+    };
+    /**
+     * All of the plugin's parameters sorted by their IDs, so
+     * `setStateInformation()` can look up every stored parameter without
+     * scanning the entire list. The IDs point into the parameters' own
+     * strings.
+     */
+    std::vector<StateParameter> state_parameters_;
+
+    /**
+     * The stages found by the last design, or loaded from the plugin's state.
+     * These are stored in the plugin's state, since the design can't be
+     * recreated from the parameters.
+     */
+    std::vector<DesignedStage> design_;
+    std::optional<float> design_error_ms_;
+    mutable std::mutex design_mutex_;
+    std::atomic<uint64_t> design_version_ = 0;
+    /**
+     * The block size found by `block_size_tuner_`, applied on the message
+     * thread by `tuned_block_size_updater_`.
+     */
+    std::atomic<size_t> tuned_block_size_ = 0;
+    LambdaAsyncUpdater tuned_block_size_updater_;
+    /**
+     * Enables the design mode on the message thread after a design finishes.
+     */
+    LambdaAsyncUpdater design_finished_updater_;
+    /**
+     * These are declared last so their threads get stopped before anything
+     * they touch is destroyed.
+     */
+    ReblockTuner block_size_tuner_;
+    GroupDelayDesigner designer_;
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(DiopserProcessor)
 };
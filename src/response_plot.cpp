@@ -0,0 +1,384 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "response_plot.h"
+
+#include <optional>
+
+#include "core/coefficients.h"
+#include "core/phase_rotator.h"
+
+/**
+ * The number of logarithmically spaced frequencies we'll evaluate the response
+ * at.
+ */
+constexpr size_t response_num_points = 1024;
+constexpr float response_min_frequency = 10.0f;
+constexpr float response_max_frequency = 22000.0f;
+
+/**
+ * How often the analyzer checks for parameter changes, and how often the plot
+ * checks for new snapshots.
+ */
+constexpr int response_refresh_rate_hz = 60;
+
+/**
+ * The frequencies at which we'll draw vertical grid lines.
+ */
+constexpr float grid_frequencies[] = {20.0f,   50.0f,   100.0f,  200.0f,
+                                      500.0f,  1000.0f, 2000.0f, 5000.0f,
+                                      10000.0f, 20000.0f};
+
+/**
+ * Maps frequencies to x-coordinates on a logarithmic axis spanning `bounds`.
+ */
+class FrequencyAxis {
+   public:
+    FrequencyAxis(juce::Rectangle<float> bounds,
+                  float min_frequency,
+                  float max_frequency)
+        : x_(bounds.getX()),
+          width_(bounds.getWidth()),
+          log_min_frequency_(std::log(min_frequency)),
+          log_frequency_delta_(std::log(max_frequency) - log_min_frequency_) {}
+
+    float operator()(float frequency) const {
+        return x_ + (width_ * ((std::log(frequency) - log_min_frequency_) /
+                               log_frequency_delta_));
+    }
+
+   private:
+    float x_;
+    float width_;
+    float log_min_frequency_;
+    float log_frequency_delta_;
+};
+
+/**
+ * Extract the all-pass denominator from the filter's coefficients.
+ */
+static AllPassStage to_all_pass_stage(
+    const AllPassCoefficients& coefficients) {
+    return AllPassStage{.a1 = coefficients.b1, .a2 = coefficients.b0};
+}
+
+ResponseAnalyzer::ResponseAnalyzer(DiopserProcessor& processor)
+    : juce::Thread("Diopser response analyzer"), processor_(processor) {
+    // This should never compete with the audio thread
+    startThread(3);
+}
+
+ResponseAnalyzer::~ResponseAnalyzer() {
+    stopThread(1000);
+}
+
+const ResponseSnapshot& ResponseAnalyzer::snapshot() {
+    return snapshot_.get();
+}
+
+void ResponseAnalyzer::run() {
+    std::optional<DiopserProcessor::FilterSettings> last_settings;
+    double last_sample_rate = 0.0;
+    while (!threadShouldExit()) {
+        // The editor can be opened before the plugin has been prepared
+        double sample_rate = processor_.getSampleRate();
+        if (sample_rate <= 0.0) {
+            sample_rate = 44100.0;
+        }
+
+        if (sample_rate != last_sample_rate) {
+            evaluator_.prepare(
+                sample_rate, response_num_points, response_min_frequency,
+                std::min(response_max_frequency,
+                         static_cast<float>(sample_rate) * 0.49f));
+            phase_.resize(response_num_points);
+            group_delay_.resize(response_num_points);
+
+            last_sample_rate = sample_rate;
+            last_settings.reset();
+        }
+
+        const DiopserProcessor::FilterSettings settings =
+            processor_.filter_settings();
+        if (settings != last_settings) {
+            compute_stages(settings, sample_rate);
+            evaluator_.evaluate(stages_, phase_.data(), group_delay_.data());
+            if (settings.rotation_mode) {
+                const float angle =
+                    settings.rotation_angle * juce::MathConstants<float>::pi /
+                    180.0f;
+                for (auto& phase : phase_) {
+                    phase += angle;
+                }
+            }
+
+            const float ms_per_sample =
+                1000.0f / static_cast<float>(sample_rate);
+            snapshot_.modify_and_swap([&](ResponseSnapshot& snapshot) {
+                // These vectors keep their size after the first snapshot, so
+                // this doesn't allocate
+                snapshot.version = ++current_version_;
+                snapshot.frequencies = evaluator_.frequencies();
+                snapshot.phase = phase_;
+                snapshot.group_delay_ms.resize(group_delay_.size());
+                for (size_t i = 0; i < group_delay_.size(); i++) {
+                    snapshot.group_delay_ms[i] =
+                        group_delay_[i] * ms_per_sample;
+                }
+            });
+
+            last_settings = settings;
+        }
+
+        wait(1000 / response_refresh_rate_hz);
+    }
+}
+
+void ResponseAnalyzer::compute_stages(
+    const DiopserProcessor::FilterSettings& settings,
+    double sample_rate) {
+    // The rotation mode's output is its first network's output shifted by
+    // the rotation angle. That network's sections only use `z^-2`, so they
+    // fit the same second order form with `a1 = 0`. `AllPassStage` has its
+    // phase start at zero at DC while the actual sections start at 180
+    // degrees, but there's an even number of them so that cancels out.
+    if (settings.rotation_mode) {
+        float coefficients_a[PhaseRotator::num_sections];
+        float coefficients_b[PhaseRotator::num_sections];
+        PhaseRotator::design(sample_rate, coefficients_a, coefficients_b);
+
+        stages_.resize(PhaseRotator::num_sections);
+        for (size_t section = 0; section < PhaseRotator::num_sections;
+             section++) {
+            stages_[section] = AllPassStage{.a1 = 0.0f,
+                                            .a2 = -coefficients_a[section]};
+        }
+
+        return;
+    }
+
+    // The designed stages are stored as frequencies and resonances, so they
+    // get converted the same way the engine does. The settings only contain
+    // the design's version, so the design itself is fetched here.
+    if (settings.design_mode) {
+        const std::vector<DesignedStage> design = processor_.design();
+        stages_.resize(design.size());
+        for (size_t stage_idx = 0; stage_idx < design.size(); stage_idx++) {
+            stages_[stage_idx] = to_all_pass_stage(make_all_pass(
+                sample_rate,
+                clamp_filter_frequency(sample_rate,
+                                       design[stage_idx].frequency),
+                design[stage_idx].resonance));
+        }
+
+        return;
+    }
+
+    const size_t num_stages =
+        static_cast<size_t>(std::max(settings.stages, 0));
+    stages_.resize(num_stages);
+
+    if (settings.spread == 0.0f) {
+        std::fill(stages_.begin(), stages_.end(),
+                  to_all_pass_stage(make_all_pass(
+                      sample_rate,
+                      clamp_filter_frequency(sample_rate, settings.frequency),
+                      settings.resonance)));
+    } else {
+        const StageFrequencies stage_frequencies(sample_rate,
+                                                 settings.frequency,
+                                                 settings.spread,
+                                                 settings.spread_linear);
+        for (size_t stage_idx = 0; stage_idx < num_stages; stage_idx++) {
+            stages_[stage_idx] = to_all_pass_stage(make_all_pass(
+                sample_rate, stage_frequencies(stage_idx, num_stages),
+                settings.resonance));
+        }
+    }
+}
+
+ResponsePlot::ResponsePlot(DiopserProcessor& processor)
+    : analyzer_(processor), paint_profiler_("Response plot") {
+    setOpaque(true);
+    startTimerHz(response_refresh_rate_hz);
+}
+
+const ResponseSnapshot& ResponsePlot::snapshot() {
+    return analyzer_.snapshot();
+}
+
+void ResponsePlot::set_target(
+    std::vector<GroupDelayDesigner::TargetPoint> target) {
+    target_ = std::move(target);
+    curve_layer_.invalidate();
+    repaint();
+}
+
+void ResponsePlot::paint(juce::Graphics& g) {
+    const auto profiler_scope = paint_profiler_.measure();
+    const ResponseSnapshot& snapshot = analyzer_.snapshot();
+
+    // The grid only needs to be redrawn when the frequency range changes,
+    // which only happens when the sample rate changes, or when the plot gets
+    // resized. The curves only need to be redrawn when a new snapshot has been
+    // published. The layers take care of resizes themselves.
+    const float min_frequency = snapshot.frequencies.empty()
+                                    ? response_min_frequency
+                                    : snapshot.frequencies.front();
+    const float max_frequency = snapshot.frequencies.empty()
+                                    ? response_max_frequency
+                                    : snapshot.frequencies.back();
+    if (min_frequency != grid_min_frequency_ ||
+        max_frequency != grid_max_frequency_) {
+        grid_min_frequency_ = min_frequency;
+        grid_max_frequency_ = max_frequency;
+        grid_layer_.invalidate();
+        curve_layer_.invalidate();
+    }
+    if (snapshot.version != painted_version_) {
+        painted_version_ = snapshot.version;
+        curve_layer_.invalidate();
+    }
+
+    grid_layer_.draw(g, getLocalBounds(),
+                     [&](juce::Graphics& layer) { render_grid(layer); });
+    if (snapshot.version != 0) {
+        curve_layer_.draw(g, getLocalBounds(), [&](juce::Graphics& layer) {
+            render_curves(layer, snapshot);
+        });
+    }
+}
+
+void ResponsePlot::render_grid(juce::Graphics& g) {
+    const auto bounds = getLocalBounds().toFloat();
+    const FrequencyAxis frequency_to_x(bounds, grid_min_frequency_,
+                                       grid_max_frequency_);
+
+    g.fillAll(juce::Colour(0xff1b1d22));
+
+    g.setFont(12.0f);
+    for (const float frequency : grid_frequencies) {
+        if (frequency < grid_min_frequency_ ||
+            frequency > grid_max_frequency_) {
+            continue;
+        }
+
+        const float x = frequency_to_x(frequency);
+        g.setColour(juce::Colour(0xff2c2f36));
+        g.drawVerticalLine(juce::roundToInt(x), bounds.getY(),
+                           bounds.getBottom());
+        g.setColour(juce::Colour(0xff7a7f8a));
+        g.drawText(frequency >= 1000.0f
+                       ? juce::String(juce::roundToInt(frequency / 1000.0f)) +
+                             "k"
+                       : juce::String(juce::roundToInt(frequency)),
+                   juce::Rectangle<float>(x + 3.0f, bounds.getBottom() - 16.0f,
+                                          40.0f, 14.0f),
+                   juce::Justification::centredLeft);
+    }
+}
+
+void ResponsePlot::render_curves(juce::Graphics& g,
+                                 const ResponseSnapshot& snapshot) {
+    const auto bounds = getLocalBounds().toFloat();
+    const FrequencyAxis frequency_to_x(bounds, grid_min_frequency_,
+                                       grid_max_frequency_);
+
+    // Both curves are scaled to fill the plot. The group delay is drawn
+    // starting from the bottom, and the phase, which is always negative, is
+    // drawn starting from the top.
+    float max_group_delay_ms =
+        std::max(1.0f, *std::max_element(snapshot.group_delay_ms.begin(),
+                                         snapshot.group_delay_ms.end()));
+    for (const auto& point : target_) {
+        max_group_delay_ms = std::max(max_group_delay_ms, point.group_delay_ms);
+    }
+    const float min_phase =
+        std::min(-juce::MathConstants<float>::pi,
+                 *std::min_element(snapshot.phase.begin(),
+                                   snapshot.phase.end()));
+    const float plot_top = bounds.getY() + 20.0f;
+    const float plot_height = bounds.getHeight() - 40.0f;
+
+    juce::Path group_delay_path;
+    juce::Path phase_path;
+    for (size_t i = 0; i < snapshot.frequencies.size(); i++) {
+        const float x = frequency_to_x(snapshot.frequencies[i]);
+        const float group_delay_y =
+            plot_top + plot_height -
+            (plot_height * (snapshot.group_delay_ms[i] / max_group_delay_ms));
+        const float phase_y =
+            plot_top + (plot_height * (snapshot.phase[i] / min_phase));
+
+        if (i == 0) {
+            group_delay_path.startNewSubPath(x, group_delay_y);
+            phase_path.startNewSubPath(x, phase_y);
+        } else {
+            group_delay_path.lineTo(x, group_delay_y);
+            phase_path.lineTo(x, phase_y);
+        }
+    }
+
+    g.setColour(juce::Colour(0xff8a7dff));
+    g.strokePath(phase_path, juce::PathStrokeType(1.5f));
+    g.setColour(juce::Colour(0xffffb347));
+    g.strokePath(group_delay_path, juce::PathStrokeType(2.0f));
+
+    // The target uses the same scale as the group delay, so the two can be
+    // compared directly
+    if (!target_.empty()) {
+        juce::Path target_path;
+        for (size_t i = 0; i < target_.size(); i++) {
+            const float x = frequency_to_x(target_[i].frequency);
+            const float y = plot_top + plot_height -
+                            (plot_height * (target_[i].group_delay_ms /
+                                            max_group_delay_ms));
+            if (i == 0) {
+                target_path.startNewSubPath(x, y);
+            } else {
+                target_path.lineTo(x, y);
+            }
+        }
+
+        g.setColour(juce::Colour(0xff7fd89a));
+        g.strokePath(target_path, juce::PathStrokeType(1.5f));
+    }
+
+    g.setFont(13.0f);
+    g.setColour(juce::Colour(0xffffb347));
+    g.drawText("Group delay (peak " + juce::String(max_group_delay_ms, 1) +
+                   " ms)",
+               bounds.reduced(8.0f, 4.0f).removeFromTop(16.0f),
+               juce::Justification::centredLeft);
+    g.setColour(juce::Colour(0xff8a7dff));
+    g.drawText("Phase (down to " +
+                   juce::String(juce::radiansToDegrees(min_phase), 0) +
+                   juce::String(juce::CharPointer_UTF8("\xc2\xb0")) + ")",
+               bounds.reduced(8.0f, 4.0f).removeFromTop(16.0f),
+               juce::Justification::centredRight);
+    if (!target_.empty()) {
+        g.setColour(juce::Colour(0xff7fd89a));
+        g.drawText("Design target",
+                   bounds.reduced(8.0f, 4.0f).removeFromTop(16.0f),
+                   juce::Justification::centred);
+    }
+}
+
+void ResponsePlot::timerCallback() {
+    if (analyzer_.snapshot().version != painted_version_) {
+        repaint();
+    }
+}
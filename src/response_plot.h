@@ -0,0 +1,146 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <juce_gui_basics/juce_gui_basics.h>
+
+#include "cached_layer.h"
+#include "core/atomically_swappable.h"
+#include "core/group_delay_designer.h"
+#include "core/response.h"
+#include "paint_profiler.h"
+#include "processor.h"
+
+/**
+ * The cascade's response at a set of frequencies, computed by
+ * `ResponseAnalyzer`.
+ */
+struct ResponseSnapshot {
+    /**
+     * Incremented every time a new snapshot is published. Zero means that
+     * nothing has been computed yet.
+     */
+    uint64_t version = 0;
+
+    std::vector<float> frequencies;
+    /**
+     * The unwrapped phase response, in radians.
+     */
+    std::vector<float> phase;
+    /**
+     * The group delay, in milliseconds.
+     */
+    std::vector<float> group_delay_ms;
+};
+
+/**
+ * Computes the cascade's phase and group delay on a background thread whenever
+ * the filter parameters change. This only reads the parameters' atomics, so it
+ * never interacts with the audio thread. The results are published through an
+ * `AtomicallySwappable`, so the GUI thread can fetch the latest snapshot
+ * without ever having to wait for a computation to finish.
+ */
+class ResponseAnalyzer : private juce::Thread {
+   public:
+    explicit ResponseAnalyzer(DiopserProcessor& processor);
+    ~ResponseAnalyzer() override;
+
+    /**
+     * Fetch the latest snapshot. This should only be called from the GUI
+     * thread, and the returned reference is only valid until the next call.
+     */
+    const ResponseSnapshot& snapshot();
+
+   private:
+    void run() override;
+
+    /**
+     * Compute the all-pass coefficients for every stage the same way
+     * `DiopserProcessor::processBlock()` does, and store them in `stages_`.
+     * In the design mode these are the designed stages.
+     */
+    void compute_stages(const DiopserProcessor::FilterSettings& settings,
+                        double sample_rate);
+
+    DiopserProcessor& processor_;
+
+    AllPassResponseEvaluator evaluator_;
+    std::vector<AllPassStage> stages_;
+    std::vector<float> phase_;
+    std::vector<float> group_delay_;
+
+    uint64_t current_version_ = 0;
+    AtomicallySwappable<ResponseSnapshot> snapshot_;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ResponseAnalyzer)
+};
+
+/**
+ * Draws the cascade's group delay and phase response. The plot polls the
+ * analyzer at 60 Hz and only repaints when a new snapshot has been published.
+ * The grid and the curves are drawn to separate cached layers, so a new
+ * snapshot only redraws the curves, and any other repaint, for instance
+ * because another window moved over the editor, only composites the two
+ * existing images.
+ */
+class ResponsePlot : public juce::Component, private juce::Timer {
+   public:
+    explicit ResponsePlot(DiopserProcessor& processor);
+
+    /**
+     * The response that's currently being shown. This is used as the target
+     * for the group delay designer. Like `ResponseAnalyzer::snapshot()`, this
+     * should only be called from the GUI thread.
+     */
+    const ResponseSnapshot& snapshot();
+
+    /**
+     * Draw `target` on top of the group delay curve, or stop drawing a target
+     * if it's empty. This shows the target curve loaded for the group delay
+     * designer.
+     */
+    void set_target(std::vector<GroupDelayDesigner::TargetPoint> target);
+
+    void paint(juce::Graphics& g) override;
+
+   private:
+    void timerCallback() override;
+
+    /**
+     * Draw the background and the frequency grid for the frequency range in
+     * `grid_min_frequency_` and `grid_max_frequency_`.
+     */
+    void render_grid(juce::Graphics& g);
+    /**
+     * Draw the group delay and phase curves along with their legends, and the
+     * designer's target if one has been set.
+     */
+    void render_curves(juce::Graphics& g, const ResponseSnapshot& snapshot);
+
+    ResponseAnalyzer analyzer_;
+    uint64_t painted_version_ = 0;
+    std::vector<GroupDelayDesigner::TargetPoint> target_;
+
+    CachedLayer grid_layer_;
+    float grid_min_frequency_ = 0.0f;
+    float grid_max_frequency_ = 0.0f;
+    CachedLayer curve_layer_;
+
+    PaintProfiler paint_profiler_;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ResponsePlot)
+};
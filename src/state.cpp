@@ -0,0 +1,268 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "state.h"
+
+/**
+ * Build a four character tag the same way it's stored in the state, so it can
+ * be compared to values read with `MemoryInputStream::readInt()`.
+ */
+static constexpr int make_tag(const char (&tag)[5]) {
+    return static_cast<int>(static_cast<uint32_t>(tag[0]) |
+                            (static_cast<uint32_t>(tag[1]) << 8) |
+                            (static_cast<uint32_t>(tag[2]) << 16) |
+                            (static_cast<uint32_t>(tag[3]) << 24));
+}
+
+constexpr int state_magic = make_tag("DIOP");
+constexpr int parameters_section_tag = make_tag("PRMS");
+constexpr int design_section_tag = make_tag("DSGN");
+
+/**
+ * The size of a single stage in the design section.
+ */
+constexpr uint32_t design_stage_size = 2 * sizeof(float);
+
+void BinaryState::write(
+    juce::MemoryBlock& dest,
+    const juce::Array<juce::AudioProcessorParameter*>& parameters,
+    const std::vector<DesignedStage>& design) {
+    // The section's size needs to be known up front
+    uint32_t num_parameters = 0;
+    uint32_t section_size = sizeof(uint32_t);
+    for (const auto* parameter : parameters) {
+        if (const auto* parameter_with_id =
+                dynamic_cast<const juce::RangedAudioParameter*>(parameter)) {
+            const size_t id_length =
+                parameter_with_id->paramID.getNumBytesAsUTF8();
+            jassert(id_length <= 255);
+
+            num_parameters += 1;
+            section_size += static_cast<uint32_t>(
+                sizeof(uint8_t) + id_length + sizeof(float));
+        }
+    }
+
+    const uint32_t design_section_size = static_cast<uint32_t>(
+        sizeof(uint32_t) + (design.size() * design_stage_size));
+
+    dest.reset();
+    juce::MemoryOutputStream stream(dest, false);
+    stream.preallocate(4 * sizeof(uint32_t) + section_size +
+                       (design.empty()
+                            ? 0
+                            : 2 * sizeof(uint32_t) + design_section_size));
+
+    stream.writeInt(state_magic);
+    stream.writeInt(static_cast<int>(version));
+
+    stream.writeInt(parameters_section_tag);
+    stream.writeInt(static_cast<int>(section_size));
+    stream.writeInt(static_cast<int>(num_parameters));
+    for (const auto* parameter : parameters) {
+        if (const auto* parameter_with_id =
+                dynamic_cast<const juce::RangedAudioParameter*>(parameter)) {
+            const auto& id = parameter_with_id->paramID;
+            stream.writeByte(static_cast<char>(id.getNumBytesAsUTF8()));
+            stream.write(id.toRawUTF8(), id.getNumBytesAsUTF8());
+            stream.writeFloat(parameter_with_id->convertFrom0to1(
+                parameter_with_id->getValue()));
+        }
+    }
+
+    if (!design.empty()) {
+        stream.writeInt(design_section_tag);
+        stream.writeInt(static_cast<int>(design_section_size));
+        stream.writeInt(static_cast<int>(design.size()));
+        for (const auto& stage : design) {
+            stream.writeFloat(stage.frequency);
+            stream.writeFloat(stage.resonance);
+        }
+    }
+}
+
+bool BinaryState::is_binary_state(const void* data, size_t size) {
+    if (size < sizeof(uint32_t)) {
+        return false;
+    }
+
+    juce::MemoryInputStream stream(data, size, false);
+    return stream.readInt() == state_magic;
+}
+
+/**
+ * Walk over the parameters section's payload, calling `parameter_fn` for every
+ * parameter if it's set. Returns false if the section is malformed.
+ */
+static bool read_parameters_section(
+    juce::MemoryInputStream& stream,
+    fu2::function_view<void(std::string_view, float)>* parameter_fn) {
+    if (stream.getNumBytesRemaining() <
+        static_cast<juce::int64>(sizeof(uint32_t))) {
+        return false;
+    }
+
+    const auto* data = static_cast<const char*>(stream.getData());
+    const uint32_t num_parameters = static_cast<uint32_t>(stream.readInt());
+    for (uint32_t i = 0; i < num_parameters; i++) {
+        if (stream.getNumBytesRemaining() < 1) {
+            return false;
+        }
+
+        const size_t id_length = static_cast<uint8_t>(stream.readByte());
+        if (stream.getNumBytesRemaining() <
+            static_cast<juce::int64>(id_length + sizeof(float))) {
+            return false;
+        }
+
+        // The ID is read in place so this doesn't need to allocate
+        const std::string_view id(data + stream.getPosition(), id_length);
+        stream.skipNextBytes(static_cast<juce::int64>(id_length));
+        const float value = stream.readFloat();
+
+        if (parameter_fn) {
+            (*parameter_fn)(id, value);
+        }
+    }
+
+    return stream.isExhausted();
+}
+
+/**
+ * Walk over the design section's payload, calling `design_stage_fn` for every
+ * stage if it's set. Returns false if the section is malformed. A design with
+ * invalid stages is skipped entirely, so `design_stage_fn` is not called at
+ * all in that case.
+ */
+static bool read_design_section(
+    juce::MemoryInputStream& stream,
+    fu2::function_view<void(const DesignedStage&)>* design_stage_fn) {
+    if (stream.getNumBytesRemaining() <
+        static_cast<juce::int64>(sizeof(uint32_t))) {
+        return false;
+    }
+
+    const uint32_t num_stages = static_cast<uint32_t>(stream.readInt());
+    if (stream.getNumBytesRemaining() !=
+        static_cast<juce::int64>(num_stages) * design_stage_size) {
+        return false;
+    }
+
+    // The stages are validated before the first callback, so a design is
+    // either restored completely or not at all
+    const juce::int64 stages_position = stream.getPosition();
+    for (uint32_t i = 0; i < num_stages; i++) {
+        DesignedStage stage;
+        stage.frequency = stream.readFloat();
+        stage.resonance = stream.readFloat();
+        if (!stage.is_valid()) {
+            return true;
+        }
+    }
+
+    if (design_stage_fn) {
+        stream.setPosition(stages_position);
+        for (uint32_t i = 0; i < num_stages; i++) {
+            DesignedStage stage;
+            stage.frequency = stream.readFloat();
+            stage.resonance = stream.readFloat();
+
+            (*design_stage_fn)(stage);
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Walk over all sections in a binary state. See `read_parameters_section()`
+ * and `read_design_section()`.
+ */
+static bool read_sections(
+    const void* data,
+    size_t size,
+    fu2::function_view<void(std::string_view, float)>* parameter_fn,
+    fu2::function_view<void(const DesignedStage&)>* design_stage_fn) {
+    juce::MemoryInputStream stream(data, size, false);
+    if (size < 2 * sizeof(uint32_t) || stream.readInt() != state_magic) {
+        return false;
+    }
+
+    // States from newer versions of the plugin may store things differently
+    const uint32_t state_version = static_cast<uint32_t>(stream.readInt());
+    if (state_version == 0 || state_version > BinaryState::version) {
+        return false;
+    }
+
+    while (!stream.isExhausted()) {
+        if (stream.getNumBytesRemaining() <
+            static_cast<juce::int64>(2 * sizeof(uint32_t))) {
+            return false;
+        }
+
+        const int tag = stream.readInt();
+        const uint32_t section_size = static_cast<uint32_t>(stream.readInt());
+        if (stream.getNumBytesRemaining() <
+            static_cast<juce::int64>(section_size)) {
+            return false;
+        }
+
+        const auto* section_data =
+            static_cast<const char*>(data) + stream.getPosition();
+        if (tag == parameters_section_tag) {
+            juce::MemoryInputStream section_stream(section_data, section_size,
+                                                   false);
+            if (!read_parameters_section(section_stream, parameter_fn)) {
+                return false;
+            }
+        } else if (tag == design_section_tag) {
+            juce::MemoryInputStream section_stream(section_data, section_size,
+                                                   false);
+            if (!read_design_section(section_stream, design_stage_fn)) {
+                return false;
+            }
+        }
+
+        stream.skipNextBytes(static_cast<juce::int64>(section_size));
+    }
+
+    return true;
+}
+
+bool BinaryState::read(
+    const void* data,
+    size_t size,
+    fu2::function_view<void(std::string_view id, float value)> parameter_fn) {
+    // The first pass only validates the state so we never partially apply a
+    // malformed state
+    if (!read_sections(data, size, nullptr, nullptr)) {
+        return false;
+    }
+
+    return read_sections(data, size, &parameter_fn, nullptr);
+}
+
+bool BinaryState::read(
+    const void* data,
+    size_t size,
+    fu2::function_view<void(std::string_view id, float value)> parameter_fn,
+    fu2::function_view<void(const DesignedStage& stage)> design_stage_fn) {
+    if (!read_sections(data, size, nullptr, nullptr)) {
+        return false;
+    }
+
+    return read_sections(data, size, &parameter_fn, &design_stage_fn);
+}
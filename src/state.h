@@ -0,0 +1,111 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <string_view>
+
+#include <juce_audio_processors/juce_audio_processors.h>
+#include <function2/function2.hpp>
+
+#include "core/group_delay_designer.h"
+
+/**
+ * Diopser's binary plugin state format. Older versions of the plugin stored
+ * their state as XML, which meant building an `XmlElement` and a `ValueTree`
+ * for every save and every load. Hosts do this for every instance when loading
+ * a session, so this adds up quickly. The binary format can be read straight
+ * from the host's buffer without any allocations.
+ *
+ * All values are stored in little-endian byte order. The state starts with a
+ * magic number that can never occur at the start of JUCE's binary XML format
+ * and a format version, followed by any number of tagged sections:
+ *
+ * ```
+ * u32 magic ("DIOP")
+ * u32 version
+ * { u32 tag, u32 size, u8 payload[size] }*
+ * ```
+ *
+ * The parameter section (tag "PRMS") contains a `u32` count followed by that
+ * many `{ u8 id_length, char id[id_length], f32 value }` entries. Values are
+ * stored in their denormalized form, so changing a parameter's range doesn't
+ * change the meaning of old states. Readers skip sections and parameters they
+ * don't recognize, so new sections can be added without breaking older
+ * versions of the plugin.
+ *
+ * The design section (tag "DSGN") stores the stages found by the group delay
+ * designer as a `u32` count followed by that many `{ f32 frequency, f32
+ * resonance }` entries. It's only written when there is a design. Readers
+ * ignore a design if any of its stages has a non-finite value or a frequency
+ * or resonance that isn't positive, and the rest of the state is still
+ * restored.
+ *
+ * The state only captures the plugin's settings. The filters' internal state
+ * is not stored, so the filters start from silence after a state has been
+ * restored, just like they did with the XML format.
+ */
+class BinaryState {
+   public:
+    /**
+     * The current version of the format. Increment this whenever the meaning
+     * of an existing section changes.
+     */
+    static constexpr uint32_t version = 1;
+
+    /**
+     * Serialize the values of all of `parameters` and the stages in `design`
+     * to `dest`, replacing its contents.
+     */
+    static void write(
+        juce::MemoryBlock& dest,
+        const juce::Array<juce::AudioProcessorParameter*>& parameters,
+        const std::vector<DesignedStage>& design);
+
+    /**
+     * Check whether `data` starts with the binary state's magic number. If
+     * this returns false, then the data should be parsed as an older XML state
+     * instead.
+     */
+    static bool is_binary_state(const void* data, size_t size);
+
+    /**
+     * Parse a binary state and call `parameter_fn` with the ID and the
+     * denormalized value of every stored parameter. The entire state is
+     * validated before the callback is called for the first time, so a
+     * malformed state never gets partially applied. This does not allocate.
+     *
+     * @return Whether the state was valid.
+     */
+    static bool read(
+        const void* data,
+        size_t size,
+        fu2::function_view<void(std::string_view id, float value)>
+            parameter_fn);
+
+    /**
+     * The same as the other overload, but `design_stage_fn` is also called
+     * for every stored designed stage, in order. It's not called at all when
+     * the stored design contains invalid stages, see
+     * `DesignedStage::is_valid()`.
+     */
+    static bool read(
+        const void* data,
+        size_t size,
+        fu2::function_view<void(std::string_view id, float value)>
+            parameter_fn,
+        fu2::function_view<void(const DesignedStage& stage)> design_stage_fn);
+};
@@ -0,0 +1,332 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Sends requests to a running `diopser-daemon` from one or more client
+// threads and reports the round trip time, the time requests spent waiting
+// for a worker, and the processing time. With `--verify` every result is
+// compared against a local engine, which must match bit for bit. Run with
+// `--help` for the available options.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "client.h"
+#include "core/denormals.h"
+#include "core/engine.h"
+#include "futex.h"
+
+struct Options {
+    std::string name = "/diopser-daemon";
+    size_t num_requests = 10000;
+    size_t num_clients = 1;
+    /**
+     * The number of requests each client keeps in flight.
+     */
+    size_t pipeline = 1;
+    uint32_t num_frames = 512;
+    uint32_t num_channels = 2;
+    uint32_t num_stages = 32;
+    double sample_rate = 48000.0;
+    bool verify = false;
+};
+
+struct Report {
+    std::vector<double> round_trip_us;
+    std::vector<double> queue_us;
+    std::vector<double> process_us;
+    size_t num_failed = 0;
+    size_t num_mismatched = 0;
+};
+
+static void print_usage(const char* program_name) {
+    std::cerr << "Usage: " << program_name << " [options]\n"
+              << "\n"
+              << "Options:\n"
+              << "  --name <name>            Shared memory segment name "
+                 "(default: /diopser-daemon)\n"
+              << "  --requests <n>           Requests per client (default: "
+                 "10000)\n"
+              << "  --clients <n>            Number of client threads "
+                 "(default: 1)\n"
+              << "  --pipeline <n>           Requests in flight per client "
+                 "(default: 1)\n"
+              << "  --frames <n>             Samples per request (default: "
+                 "512)\n"
+              << "  --channels <n>           (default: 2)\n"
+              << "  --stages <n>             (default: 32)\n"
+              << "  --sample-rate <hz>       (default: 48000)\n"
+              << "  --verify                 Compare the results against a "
+                 "local engine\n";
+}
+
+static void fill_request(const Options& options, DaemonRequest& request) {
+    request.sample_rate = options.sample_rate;
+    request.num_channels = options.num_channels;
+    request.num_frames = options.num_frames;
+    request.num_stages = options.num_stages;
+    request.frequency = 350.0f;
+    request.resonance = 2.0f;
+    request.spread = 0.0f;
+    request.smoothing_interval = 128;
+    request.flags = daemon_request_safe_mode;
+}
+
+/**
+ * Process the input the same way the daemon should, using a freshly prepared
+ * engine.
+ */
+static std::vector<std::vector<float>> process_locally(
+    const Options& options,
+    const std::vector<std::vector<float>>& input) {
+    DaemonRequest request{};
+    fill_request(options, request);
+
+    DiopserEngine::Parameters parameters;
+    parameters.frequency = request.frequency;
+    parameters.resonance = request.resonance;
+    parameters.spread = request.spread;
+    parameters.smoothing_interval = request.smoothing_interval;
+    parameters.safe_mode = true;
+
+    std::vector<std::vector<float>> output = input;
+    std::vector<float*> channels;
+    for (auto& channel : output) {
+        channels.push_back(channel.data());
+    }
+
+    const ScopedFlushDenormals flush_denormals;
+    DiopserEngine engine;
+    engine.prepare(options.sample_rate, options.num_frames,
+                   options.num_channels, options.num_stages,
+                   request.smoothing_interval);
+    engine.process(channels.data(), channels.size(), options.num_frames,
+                   parameters);
+
+    return output;
+}
+
+static void run_client(const Options& options,
+                       const std::vector<std::vector<float>>& input,
+                       const std::vector<std::vector<float>>& expected,
+                       Report& report,
+                       std::mutex& report_mutex) {
+    DaemonClient client;
+    std::string error;
+    if (!client.connect(options.name, error)) {
+        std::lock_guard lock(report_mutex);
+        std::cerr << error << '\n';
+        report.num_failed += options.num_requests;
+        return;
+    }
+    if (options.num_channels > client.max_channels() ||
+        options.num_frames > client.max_frames()) {
+        std::lock_guard lock(report_mutex);
+        std::cerr << "The daemon supports at most " << client.max_channels()
+                  << " channels and " << client.max_frames()
+                  << " frames per request\n";
+        report.num_failed += options.num_requests;
+        return;
+    }
+
+    const size_t pipeline = std::min<size_t>(
+        std::max<size_t>(1, options.pipeline), client.num_slots());
+    Report local;
+    const auto collect = [&]() {
+        DaemonRequest* request = client.wait();
+        const uint64_t now = monotonic_ns();
+        if (!request || request->status != DaemonStatus::ok) {
+            local.num_failed += 1;
+            return request != nullptr;
+        }
+
+        local.round_trip_us.push_back(
+            static_cast<double>(now - request->submitted_ns) / 1000.0);
+        local.queue_us.push_back(
+            static_cast<double>(request->started_ns - request->submitted_ns) /
+            1000.0);
+        local.process_us.push_back(
+            static_cast<double>(request->finished_ns - request->started_ns) /
+            1000.0);
+
+        if (options.verify) {
+            for (uint32_t channel = 0; channel < options.num_channels;
+                 channel++) {
+                if (std::memcmp(client.channel(*request, channel),
+                                expected[channel].data(),
+                                options.num_frames * sizeof(float)) != 0) {
+                    local.num_mismatched += 1;
+                    break;
+                }
+            }
+        }
+
+        return true;
+    };
+
+    size_t in_flight = 0;
+    for (size_t i = 0; i < options.num_requests; i++) {
+        if (in_flight == pipeline) {
+            if (!collect()) {
+                break;
+            }
+            in_flight -= 1;
+        }
+
+        DaemonRequest* request = client.acquire();
+        if (!request) {
+            local.num_failed += options.num_requests - i;
+            break;
+        }
+
+        fill_request(options, *request);
+        for (uint32_t channel = 0; channel < options.num_channels; channel++) {
+            std::copy(input[channel].begin(), input[channel].end(),
+                      client.channel(*request, channel));
+        }
+        client.submit(*request);
+        in_flight += 1;
+    }
+    while (in_flight > 0 && collect()) {
+        in_flight -= 1;
+    }
+
+    std::lock_guard lock(report_mutex);
+    for (auto [from, to] :
+         {std::pair(&local.round_trip_us, &report.round_trip_us),
+          std::pair(&local.queue_us, &report.queue_us),
+          std::pair(&local.process_us, &report.process_us)}) {
+        to->insert(to->end(), from->begin(), from->end());
+    }
+    report.num_failed += local.num_failed;
+    report.num_mismatched += local.num_mismatched;
+}
+
+static double percentile(std::vector<double>& values, double fraction) {
+    if (values.empty()) {
+        return 0.0;
+    }
+
+    std::sort(values.begin(), values.end());
+    const size_t index = std::min(
+        values.size() - 1,
+        static_cast<size_t>(fraction * static_cast<double>(values.size())));
+    return values[index];
+}
+
+static void print_distribution(const char* name, std::vector<double>& values) {
+    std::cout << name << ": p50 " << percentile(values, 0.5) << " us, p99 "
+              << percentile(values, 0.99) << " us, p99.9 "
+              << percentile(values, 0.999) << " us, max "
+              << percentile(values, 1.0) << " us\n";
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        const auto count = [&]() {
+            return static_cast<uint32_t>(std::max(1, std::atoi(argv[++i])));
+        };
+
+        if (arg == "--name" && has_value) {
+            options.name = argv[++i];
+        } else if (arg == "--requests" && has_value) {
+            options.num_requests = count();
+        } else if (arg == "--clients" && has_value) {
+            options.num_clients = count();
+        } else if (arg == "--pipeline" && has_value) {
+            options.pipeline = count();
+        } else if (arg == "--frames" && has_value) {
+            options.num_frames = count();
+        } else if (arg == "--channels" && has_value) {
+            options.num_channels = count();
+        } else if (arg == "--stages" && has_value) {
+            options.num_stages =
+                static_cast<uint32_t>(std::max(0, std::atoi(argv[++i])));
+        } else if (arg == "--sample-rate" && has_value) {
+            options.sample_rate = std::atof(argv[++i]);
+        } else if (arg == "--verify") {
+            options.verify = true;
+        } else {
+            print_usage(argv[0]);
+            return arg == "--help" || arg == "-h" ? 0 : 1;
+        }
+    }
+
+    // Every request processes the same noise, so the expected output only
+    // has to be computed once
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> noise(-0.5f, 0.5f);
+    std::vector<std::vector<float>> input(options.num_channels);
+    for (auto& channel : input) {
+        channel.resize(options.num_frames);
+        for (auto& sample : channel) {
+            sample = noise(rng);
+        }
+    }
+    const std::vector<std::vector<float>> expected =
+        options.verify ? process_locally(options, input)
+                       : std::vector<std::vector<float>>{};
+
+    Report report;
+    std::mutex report_mutex;
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> clients;
+    for (size_t i = 0; i < options.num_clients; i++) {
+        clients.emplace_back(run_client, std::cref(options), std::cref(input),
+                             std::cref(expected), std::ref(report),
+                             std::ref(report_mutex));
+    }
+    for (auto& client : clients) {
+        client.join();
+    }
+    const double seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+            .count();
+
+    const size_t num_completed = report.round_trip_us.size();
+    std::cout << std::fixed << std::setprecision(2) << num_completed
+              << " requests in " << seconds << " seconds ("
+              << static_cast<double>(num_completed) / seconds
+              << " requests per second, "
+              << static_cast<double>(num_completed) * options.num_frames /
+                     options.sample_rate / seconds
+              << "x realtime)\n";
+    print_distribution("Round trip", report.round_trip_us);
+    print_distribution("Queued", report.queue_us);
+    print_distribution("Processing", report.process_us);
+
+    if (report.num_failed > 0) {
+        std::cout << report.num_failed << " requests failed\n";
+    }
+    if (options.verify) {
+        std::cout << report.num_mismatched
+                  << " results did not match the local engine\n";
+    }
+
+    return report.num_failed > 0 || report.num_mismatched > 0 ? 1 : 0;
+}
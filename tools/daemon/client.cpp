@@ -0,0 +1,212 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "client.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "futex.h"
+
+/**
+ * How often a waiting client spins before going to sleep. Small requests
+ * often finish within this time, and spinning avoids two context switches.
+ */
+constexpr int client_spin_iterations = 4096;
+
+/**
+ * Clients check whether the daemon is still running at this interval while
+ * waiting.
+ */
+constexpr int64_t client_wait_timeout_ns = 100'000'000;
+
+/**
+ * Whether `a` comes after `b`, taking wrapping into account.
+ */
+static bool is_after(uint32_t a, uint32_t b) {
+    return static_cast<int32_t>(a - b) > 0;
+}
+
+static bool process_exists(int32_t pid) {
+    return pid > 0 && (kill(pid, 0) == 0 || errno != ESRCH);
+}
+
+DaemonClient::~DaemonClient() {
+    disconnect();
+}
+
+bool DaemonClient::connect(const std::string& name, std::string& error) {
+    disconnect();
+
+    const int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd == -1) {
+        error = "Could not open '" + name + "', is diopser-daemon running? (" +
+                std::strerror(errno) + ")";
+        return false;
+    }
+
+    struct stat stat_buffer;
+    void* mapping = MAP_FAILED;
+    if (fstat(fd, &stat_buffer) == 0 &&
+        static_cast<size_t>(stat_buffer.st_size) >= sizeof(DaemonHeader)) {
+        // Populating the mapping up front keeps page faults out of the first
+        // requests
+        mapping = mmap(nullptr, static_cast<size_t>(stat_buffer.st_size),
+                       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                       0);
+    }
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        error = "Could not map '" + name + "'";
+        return false;
+    }
+
+    header_ = static_cast<DaemonHeader*>(mapping);
+    mapped_size_ = static_cast<size_t>(stat_buffer.st_size);
+
+    // The rest of the header is only valid once the magic value is set
+    const bool is_daemon =
+        header_->magic.load(std::memory_order_acquire) == daemon_magic &&
+        header_->version == daemon_protocol_version;
+    if (is_daemon) {
+        layout_ = DaemonLayout::compute(
+            header_->num_lanes, header_->slots_per_lane,
+            header_->max_channels, header_->max_frames);
+    }
+    if (!is_daemon || layout_.total_size > mapped_size_ ||
+        header_->num_workers == 0 ||
+        !header_->running.load(std::memory_order_acquire)) {
+        error = "'" + name +
+                "' does not belong to a running diopser-daemon with the same "
+                "version";
+        disconnect();
+        return false;
+    }
+
+    // Free lanes are claimed first. Lanes left behind by clients that
+    // exited without disconnecting are only taken over after that.
+    const int32_t pid = getpid();
+    for (const bool take_over : {false, true}) {
+        for (uint32_t lane_idx = 0; lane_idx < header_->num_lanes;
+             lane_idx++) {
+            DaemonLane* lane = layout_.lane(header_, lane_idx);
+            int32_t owner = lane->owner.load();
+            if ((owner == 0 || (take_over && !process_exists(owner))) &&
+                lane->owner.compare_exchange_strong(owner, pid)) {
+                lane->generation.fetch_add(1);
+
+                lane_ = lane;
+                lane_idx_ = lane_idx;
+                next_request_ = lane->submitted.load();
+                next_wait_ = next_request_;
+
+                return true;
+            }
+        }
+    }
+
+    error = "All of the daemon's " + std::to_string(header_->num_lanes) +
+            " lanes are in use";
+    disconnect();
+    return false;
+}
+
+void DaemonClient::disconnect() {
+    if (lane_) {
+        lane_->owner.store(0);
+        lane_ = nullptr;
+    }
+
+    if (header_) {
+        munmap(header_, mapped_size_);
+        header_ = nullptr;
+        mapped_size_ = 0;
+    }
+}
+
+DaemonRequest* DaemonClient::acquire() {
+    const uint32_t num_slots = header_->slots_per_lane;
+    if (next_request_ - next_wait_ >= num_slots) {
+        return nullptr;
+    }
+
+    // The slot may still be in use by a request from a previous owner of
+    // this lane
+    if (!wait_for_completion(next_request_ - num_slots)) {
+        return nullptr;
+    }
+
+    return layout_.slot(lane_, next_request_ % num_slots);
+}
+
+void DaemonClient::submit(DaemonRequest& request) {
+    request.submitted_ns = monotonic_ns();
+    next_request_ += 1;
+    lane_->submitted.store(next_request_, std::memory_order_release);
+
+    // The worker sets `sleeping` before checking the doorbell one last time,
+    // so either it sees this increment or we see that it's sleeping
+    DaemonWorkerSignal& worker =
+        header_->workers[lane_idx_ % header_->num_workers];
+    worker.doorbell.fetch_add(1);
+    if (worker.sleeping.load()) {
+        futex_wake(worker.doorbell, 1);
+    }
+}
+
+DaemonRequest* DaemonClient::wait() {
+    if (next_wait_ == next_request_ || !wait_for_completion(next_wait_)) {
+        return nullptr;
+    }
+
+    DaemonRequest* request =
+        layout_.slot(lane_, next_wait_ % header_->slots_per_lane);
+    next_wait_ += 1;
+
+    return request;
+}
+
+bool DaemonClient::wait_for_completion(uint32_t index) {
+    for (int i = 0; i < client_spin_iterations; i++) {
+        if (is_after(lane_->completed.load(std::memory_order_acquire),
+                     index)) {
+            return true;
+        }
+    }
+
+    // Same protocol as the doorbell, but the other way around. The futex
+    // only sleeps if the counter still has the value we checked.
+    lane_->client_waiting.store(1);
+    bool done = false;
+    while (true) {
+        const uint32_t completed = lane_->completed.load();
+        done = is_after(completed, index);
+        if (done || !header_->running.load()) {
+            break;
+        }
+
+        futex_wait(lane_->completed, completed, client_wait_timeout_ns);
+    }
+    lane_->client_waiting.store(0);
+
+    return done;
+}
@@ -0,0 +1,121 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "protocol.h"
+
+/**
+ * A connection to a running `diopser-daemon`. This maps the daemon's shared
+ * memory segment and claims one of its lanes, so requests never go through a
+ * socket or any copies other than the caller writing its input and reading
+ * its output. Up to `num_slots()` requests can be in flight at the same time.
+ * A client must only be used from one thread at a time.
+ *
+ * ```cpp
+ * DaemonRequest* request = client.acquire();
+ * // Fill in the parameters and write the input to client.channel(*request, n)
+ * client.submit(*request);
+ * request = client.wait();
+ * // The output is now in client.channel(*request, n)
+ * ```
+ */
+class DaemonClient {
+   public:
+    DaemonClient() = default;
+    ~DaemonClient();
+
+    DaemonClient(const DaemonClient&) = delete;
+    DaemonClient& operator=(const DaemonClient&) = delete;
+
+    /**
+     * Connect to the daemon serving the shared memory segment `name`, which
+     * should start with a slash.
+     *
+     * @return False with a description in `error` if the daemon isn't
+     *   running or all of its lanes are in use.
+     */
+    bool connect(const std::string& name, std::string& error);
+
+    /**
+     * Release the lane and unmap the segment. Requests that are still in
+     * flight are finished by the daemon, but their results are lost.
+     */
+    void disconnect();
+
+    uint32_t max_channels() const { return header_->max_channels; }
+    uint32_t max_frames() const { return header_->max_frames; }
+    uint32_t max_stages() const { return header_->max_stages; }
+    uint32_t num_slots() const { return header_->slots_per_lane; }
+
+    /**
+     * Return the next free request slot, waiting for the daemon to finish
+     * with it if needed. The request's parameters and audio can be written
+     * until it gets passed to `submit()`.
+     *
+     * @return A null pointer if `num_slots()` requests are already in flight
+     *   without having been waited for, or if the daemon shut down.
+     */
+    DaemonRequest* acquire();
+
+    /**
+     * Hand the request returned by the last call to `acquire()` to the
+     * daemon.
+     */
+    void submit(DaemonRequest& request);
+
+    /**
+     * Wait for the oldest request in flight to finish. The request and its
+     * audio stay valid until the slot gets returned by `acquire()` again.
+     *
+     * @return A null pointer if no requests are in flight, or if the daemon
+     *   shut down.
+     */
+    DaemonRequest* wait();
+
+    /**
+     * One of the request's channels. There's room for `max_frames()`
+     * samples.
+     */
+    float* channel(DaemonRequest& request, uint32_t channel) {
+        return layout_.channel(&request, channel);
+    }
+
+   private:
+    /**
+     * Wait until the daemon has finished request number `index`.
+     *
+     * @return False if the daemon shut down.
+     */
+    bool wait_for_completion(uint32_t index);
+
+    DaemonHeader* header_ = nullptr;
+    size_t mapped_size_ = 0;
+    DaemonLayout layout_{};
+
+    DaemonLane* lane_ = nullptr;
+    uint32_t lane_idx_ = 0;
+    /**
+     * The index of the next request to submit, and of the oldest request
+     * that hasn't been waited for. These wrap around together with the lane's
+     * counters.
+     */
+    uint32_t next_request_ = 0;
+    uint32_t next_wait_ = 0;
+};
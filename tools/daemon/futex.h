@@ -0,0 +1,62 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Thin wrappers around the futex system call. These use the shared variants
+// since the futex words live in memory shared between processes.
+
+/**
+ * Sleep until `word` gets woken up, as long as it still contains `expected`.
+ * This may also return spuriously, so the caller should always check the
+ * condition it's waiting for again.
+ *
+ * @param timeout_ns Give up after this long, or wait indefinitely when zero.
+ */
+inline void futex_wait(std::atomic<uint32_t>& word,
+                       uint32_t expected,
+                       int64_t timeout_ns = 0) {
+    timespec timeout{static_cast<time_t>(timeout_ns / 1'000'000'000),
+                     static_cast<long>(timeout_ns % 1'000'000'000)};
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT,
+            expected, timeout_ns > 0 ? &timeout : nullptr, nullptr, 0);
+}
+
+/**
+ * Wake up to `count` threads waiting on `word`.
+ */
+inline void futex_wake(std::atomic<uint32_t>& word, int count) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, count,
+            nullptr, nullptr, 0);
+}
+
+/**
+ * `CLOCK_MONOTONIC` in nanoseconds, which is comparable between processes.
+ */
+inline uint64_t monotonic_ns() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1'000'000'000 +
+           static_cast<uint64_t>(now.tv_nsec);
+}
@@ -0,0 +1,149 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// `diopser-daemon` keeps a pool of prepared engines resident and processes
+// audio submitted by other processes through shared memory, see `protocol.h`
+// and `DaemonClient`. It runs until it receives SIGINT or SIGTERM. Run with
+// `--help` for the available options.
+
+#include <algorithm>
+#include <csignal>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include <pthread.h>
+
+#include "server.h"
+
+static void print_usage(const char* program_name) {
+    std::cerr << "Usage: " << program_name << " [options]\n"
+              << "\n"
+              << "Options:\n"
+              << "  --name <name>            Shared memory segment name "
+                 "(default: /diopser-daemon)\n"
+              << "  --mode <octal>           Segment permissions (default: "
+                 "0600)\n"
+              << "  --lanes <n>              Maximum number of connected "
+                 "clients (default: 16)\n"
+              << "  --slots <n>              Requests in flight per client "
+                 "(default: 4)\n"
+              << "  --channels <n>           Maximum channels per request "
+                 "(default: 2)\n"
+              << "  --frames <n>             Maximum samples per request "
+                 "(default: 8192)\n"
+              << "  --max-stages <n>         Up to 4096 (default: 512)\n"
+              << "  --workers <n>            Worker threads (default: one "
+                 "per core)\n"
+              << "  --spin-us <us>           Time to poll for new requests "
+                 "before sleeping (default: 50)\n"
+              << "  --sample-rate <hz>       Sample rate to prepare the "
+                 "engines for (default: 48000)\n"
+              << "  --stages <n>             Stage count to prepare the "
+                 "engines for (default: 0)\n"
+              << "  --smoothing-interval <n> Smoothing interval to prepare "
+                 "the engines for (default: 128)\n";
+}
+
+int main(int argc, char* argv[]) {
+    DaemonOptions options;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        const auto count = [&]() {
+            return static_cast<uint32_t>(std::max(0, std::atoi(argv[++i])));
+        };
+
+        if (arg == "--name" && has_value) {
+            options.name = argv[++i];
+        } else if (arg == "--mode" && has_value) {
+            options.mode =
+                static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 8));
+        } else if (arg == "--lanes" && has_value) {
+            options.num_lanes = count();
+        } else if (arg == "--slots" && has_value) {
+            options.slots_per_lane = count();
+        } else if (arg == "--channels" && has_value) {
+            options.max_channels = count();
+        } else if (arg == "--frames" && has_value) {
+            options.max_frames = count();
+        } else if (arg == "--max-stages" && has_value) {
+            options.max_stages = std::min(
+                count(), static_cast<uint32_t>(DiopserEngine::max_stages));
+        } else if (arg == "--workers" && has_value) {
+            options.num_workers = count();
+        } else if (arg == "--spin-us" && has_value) {
+            options.spin_us = static_cast<int>(count());
+        } else if (arg == "--sample-rate" && has_value) {
+            options.warm_sample_rate = std::atof(argv[++i]);
+        } else if (arg == "--stages" && has_value) {
+            options.warm_stages = count();
+        } else if (arg == "--smoothing-interval" && has_value) {
+            options.warm_smoothing_interval = static_cast<int>(count());
+        } else {
+            print_usage(argv[0]);
+            return arg == "--help" || arg == "-h" ? 0 : 1;
+        }
+    }
+
+    // The signals are handled synchronously on this thread. They're blocked
+    // before starting the workers so the workers inherit the mask.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    DaemonServer server;
+    std::string error;
+    if (!server.start(options, error)) {
+        std::cerr << error << '\n';
+        return 1;
+    }
+
+    std::cerr << "Serving '" << options.name << "' with " << options.num_lanes
+              << " lanes, press Ctrl+C to stop\n";
+
+    int signal;
+    sigwait(&signals, &signal);
+    server.stop();
+
+    const DaemonStats stats = server.stats();
+    std::cout << std::fixed << std::setprecision(3)
+              << "Processed " << stats.num_requests << " requests ("
+              << stats.num_invalid << " invalid) totaling "
+              << stats.audio_seconds << " seconds of audio\n"
+              << "Prepared " << stats.num_prepares
+              << " engines for new configurations\n"
+              << "Busy for " << static_cast<double>(stats.busy_ns) / 1e9
+              << " seconds over all workers\n";
+    if (stats.num_requests > 0) {
+        std::cout << "Queue time: mean "
+                  << static_cast<double>(stats.total_queue_ns) /
+                         static_cast<double>(stats.num_requests) / 1000.0
+                  << " us, max "
+                  << static_cast<double>(stats.max_queue_ns) / 1000.0
+                  << " us\n";
+    }
+    if (stats.num_lock_failures > 0) {
+        std::cout << stats.num_lock_failures
+                  << " filter allocations could not be locked into RAM, "
+                     "consider raising RLIMIT_MEMLOCK\n";
+    }
+
+    return 0;
+}
@@ -0,0 +1,223 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+// The layout of the shared memory segment used to talk to `diopser-daemon`.
+// The daemon creates the segment, and clients map it and claim one of its
+// lanes. A lane is a single producer single consumer ring of request slots:
+// the client writes audio directly into a slot and submits it, a daemon worker
+// processes the audio in place, and the client reads the result from the same
+// slot. Both sides use futexes to sleep while there's nothing to do, and they
+// only make a system call when the other side is actually asleep.
+//
+// ```
+// DaemonHeader
+// lane 0: DaemonLane, slot 0: DaemonRequest, audio, slot 1: ..., ...
+// lane 1: ...
+// ```
+//
+// Every struct and every slot's audio start on a cache line boundary. The
+// audio is stored planar, with channel `n` at `n * max_frames` floats from
+// the start of the slot's audio.
+
+constexpr uint32_t daemon_magic = 0x44535044;  // "DPSD"
+/**
+ * Increment this whenever the layout changes.
+ */
+constexpr uint32_t daemon_protocol_version = 1;
+constexpr size_t max_daemon_workers = 64;
+
+// These are shared between processes, so they need to be plain memory without
+// any hidden locks
+static_assert(std::atomic<uint32_t>::is_always_lock_free);
+static_assert(std::atomic<int32_t>::is_always_lock_free);
+
+/**
+ * A futex word per daemon worker. Clients increment `doorbell` after
+ * submitting a request to one of the worker's lanes, and they only wake the
+ * worker when `sleeping` is set.
+ */
+struct alignas(64) DaemonWorkerSignal {
+    std::atomic<uint32_t> doorbell;
+    std::atomic<uint32_t> sleeping;
+};
+
+struct alignas(64) DaemonHeader {
+    /**
+     * Written last when creating the segment, so a client that sees the magic
+     * value also sees the rest of the header.
+     */
+    std::atomic<uint32_t> magic;
+    uint32_t version;
+
+    uint32_t num_lanes;
+    uint32_t slots_per_lane;
+    uint32_t max_channels;
+    uint32_t max_frames;
+    uint32_t max_stages;
+    uint32_t num_workers;
+
+    int32_t daemon_pid;
+    /**
+     * Cleared when the daemon shuts down, after which clients stop waiting.
+     */
+    std::atomic<uint32_t> running;
+
+    /**
+     * Lane `n` is served by worker `n % num_workers`.
+     */
+    DaemonWorkerSignal workers[max_daemon_workers];
+};
+
+struct alignas(64) DaemonLane {
+    /**
+     * The process ID of the client using this lane, or zero if it's free.
+     * Clients claim lanes with a compare-and-swap, and they may take over
+     * lanes whose owner no longer exists.
+     */
+    std::atomic<int32_t> owner;
+    /**
+     * Incremented every time the lane changes owners. The daemon never
+     * continues a stream across owners.
+     */
+    std::atomic<uint32_t> generation;
+
+    /**
+     * The number of requests submitted to this lane. Only written by the
+     * client.
+     */
+    alignas(64) std::atomic<uint32_t> submitted;
+
+    /**
+     * The number of requests the daemon has finished. Only written by the
+     * daemon, and the client waits on this as a futex.
+     */
+    alignas(64) std::atomic<uint32_t> completed;
+    std::atomic<uint32_t> client_waiting;
+};
+
+enum DaemonRequestFlags : uint32_t {
+    daemon_request_spread_linear = 1 << 0,
+    daemon_request_safe_mode = 1 << 1,
+    /**
+     * Continue from where the lane's previous request left off instead of
+     * starting with a freshly prepared engine, for processing a stream in
+     * pieces. Ignored for the first request after the lane changes owners or
+     * when the sample rate, channel count, or smoothing interval changes.
+     */
+    daemon_request_continue = 1 << 2,
+};
+
+enum class DaemonStatus : int32_t {
+    ok = 0,
+    /**
+     * The channel count, frame count, stage count, sample rate, or smoothing
+     * interval is out of range. The audio is left untouched.
+     */
+    invalid_request = 1,
+};
+
+/**
+ * A request slot's header. The audio follows at the next cache line.
+ */
+struct alignas(64) DaemonRequest {
+    // Written by the client before submitting the request
+    double sample_rate;
+    uint32_t num_channels;
+    uint32_t num_frames;
+    uint32_t num_stages;
+    float frequency;
+    float resonance;
+    float spread;
+    int32_t smoothing_interval;
+    uint32_t flags;
+    /**
+     * `CLOCK_MONOTONIC` timestamps in nanoseconds. The clock is shared
+     * between processes, so the daemon's timestamps can be compared to this.
+     */
+    uint64_t submitted_ns;
+
+    // Written by the daemon before completing the request
+    DaemonStatus status;
+    uint64_t started_ns;
+    uint64_t finished_ns;
+};
+
+static_assert(std::is_standard_layout_v<DaemonHeader>);
+static_assert(std::is_standard_layout_v<DaemonLane>);
+static_assert(std::is_standard_layout_v<DaemonRequest>);
+
+/**
+ * The offsets of everything in a segment, derived from its dimensions. The
+ * daemon keeps its own copy instead of trusting the shared header.
+ */
+struct DaemonLayout {
+    uint32_t max_frames;
+    uint64_t lanes_offset;
+    uint64_t lane_stride;
+    uint64_t slot_stride;
+    uint64_t total_size;
+
+    static constexpr uint64_t round_up(uint64_t size) {
+        return (size + 63) & ~uint64_t(63);
+    }
+
+    static constexpr DaemonLayout compute(uint32_t num_lanes,
+                                          uint32_t slots_per_lane,
+                                          uint32_t max_channels,
+                                          uint32_t max_frames) {
+        DaemonLayout layout{};
+        layout.max_frames = max_frames;
+        layout.lanes_offset = round_up(sizeof(DaemonHeader));
+        layout.slot_stride =
+            round_up(sizeof(DaemonRequest)) +
+            round_up(uint64_t(max_channels) * max_frames * sizeof(float));
+        layout.lane_stride = round_up(sizeof(DaemonLane)) +
+                             uint64_t(slots_per_lane) * layout.slot_stride;
+        layout.total_size =
+            layout.lanes_offset + uint64_t(num_lanes) * layout.lane_stride;
+
+        return layout;
+    }
+
+    DaemonLane* lane(DaemonHeader* header, uint32_t lane_idx) const {
+        return reinterpret_cast<DaemonLane*>(
+            reinterpret_cast<std::byte*>(header) + lanes_offset +
+            lane_idx * lane_stride);
+    }
+
+    DaemonRequest* slot(DaemonLane* lane, uint32_t slot_idx) const {
+        return reinterpret_cast<DaemonRequest*>(
+            reinterpret_cast<std::byte*>(lane) +
+            round_up(sizeof(DaemonLane)) + slot_idx * slot_stride);
+    }
+
+    /**
+     * There's room for `max_frames` samples.
+     */
+    float* channel(DaemonRequest* request, uint32_t channel) const {
+        return reinterpret_cast<float*>(
+                   reinterpret_cast<std::byte*>(request) +
+                   round_up(sizeof(DaemonRequest))) +
+               static_cast<size_t>(channel) * max_frames;
+    }
+};
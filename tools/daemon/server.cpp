@@ -0,0 +1,401 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "server.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <csignal>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "core/denormals.h"
+#include "futex.h"
+
+static bool process_exists(int32_t pid) {
+    return pid > 0 && (kill(pid, 0) == 0 || errno != ESRCH);
+}
+
+/**
+ * Check whether an existing segment called `name` belongs to a daemon that's
+ * still running.
+ */
+static bool is_in_use(const std::string& name) {
+    const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd == -1) {
+        return false;
+    }
+
+    bool in_use = false;
+    void* mapping =
+        mmap(nullptr, sizeof(DaemonHeader), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping != MAP_FAILED) {
+        const auto* header = static_cast<const DaemonHeader*>(mapping);
+        in_use = header->magic.load() == daemon_magic &&
+                 header->running.load() && process_exists(header->daemon_pid);
+        munmap(mapping, sizeof(DaemonHeader));
+    }
+
+    return in_use;
+}
+
+void DaemonStats::add(const DaemonStats& other) {
+    num_requests += other.num_requests;
+    num_invalid += other.num_invalid;
+    num_prepares += other.num_prepares;
+    audio_seconds += other.audio_seconds;
+    busy_ns += other.busy_ns;
+    total_queue_ns += other.total_queue_ns;
+    max_queue_ns = std::max(max_queue_ns, other.max_queue_ns);
+    num_lock_failures += other.num_lock_failures;
+}
+
+DaemonServer::~DaemonServer() {
+    stop();
+}
+
+bool DaemonServer::start(const DaemonOptions& options, std::string& error) {
+    options_ = options;
+    if (options_.num_lanes == 0 || options_.slots_per_lane == 0 ||
+        options_.max_channels == 0 || options_.max_frames == 0 ||
+        options_.warm_sample_rate <= 0.0 ||
+        options_.warm_stages > options_.max_stages ||
+        options_.warm_smoothing_interval < 1) {
+        error =
+            "The lane, slot, channel, and frame counts must be positive, and "
+            "the warm configuration must be valid";
+        return false;
+    }
+    if (options_.num_workers == 0) {
+        options_.num_workers =
+            std::max(1u, std::thread::hardware_concurrency());
+    }
+    options_.num_workers =
+        std::min({options_.num_workers, options_.num_lanes,
+                  static_cast<uint32_t>(max_daemon_workers)});
+
+    layout_ = DaemonLayout::compute(options_.num_lanes, options_.slots_per_lane,
+                                    options_.max_channels, options_.max_frames);
+
+    int fd = shm_open(options_.name.c_str(), O_CREAT | O_EXCL | O_RDWR,
+                      static_cast<mode_t>(options_.mode));
+    if (fd == -1 && errno == EEXIST) {
+        if (is_in_use(options_.name)) {
+            error = "Another daemon is already serving '" + options_.name + "'";
+            return false;
+        }
+
+        // Left behind by a daemon that crashed
+        shm_unlink(options_.name.c_str());
+        fd = shm_open(options_.name.c_str(), O_CREAT | O_EXCL | O_RDWR,
+                      static_cast<mode_t>(options_.mode));
+    }
+    if (fd == -1) {
+        error = "Could not create '" + options_.name +
+                "': " + std::strerror(errno);
+        return false;
+    }
+
+    // The permissions passed to `shm_open()` are subject to the umask
+    fchmod(fd, static_cast<mode_t>(options_.mode));
+
+    // A new segment is zero filled, which is the initial state for every lane
+    void* mapping = MAP_FAILED;
+    if (ftruncate(fd, static_cast<off_t>(layout_.total_size)) == 0) {
+        mapping = mmap(nullptr, layout_.total_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd, 0);
+    }
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        error = "Could not allocate " + std::to_string(layout_.total_size) +
+                " bytes of shared memory for '" + options_.name +
+                "': " + std::strerror(errno);
+        shm_unlink(options_.name.c_str());
+        return false;
+    }
+
+    header_ = static_cast<DaemonHeader*>(mapping);
+
+    header_->version = daemon_protocol_version;
+    header_->num_lanes = options_.num_lanes;
+    header_->slots_per_lane = options_.slots_per_lane;
+    header_->max_channels = options_.max_channels;
+    header_->max_frames = options_.max_frames;
+    header_->max_stages = options_.max_stages;
+    header_->num_workers = options_.num_workers;
+    header_->daemon_pid = getpid();
+    header_->running.store(1);
+    running_ = true;
+
+    // All allocations happen here, so clients using the warm configuration
+    // never wait for one
+    workers_.resize(options_.num_workers);
+    for (uint32_t lane_idx = 0; lane_idx < options_.num_lanes; lane_idx++) {
+        auto lane = std::make_unique<LaneEngine>();
+        lane->lane_idx = lane_idx;
+        lane->channels.resize(options_.max_channels);
+
+        Worker& worker = workers_[lane_idx % options_.num_workers];
+        start_stream(*lane, options_.warm_sample_rate,
+                     options_.warm_smoothing_interval, options_.warm_stages,
+                     worker.stats);
+        lane->has_stream = false;
+        worker.lanes.push_back(std::move(lane));
+    }
+    // Failing to lock the warm engines' memory is still worth reporting
+    for (auto& worker : workers_) {
+        const uint64_t num_lock_failures = worker.stats.num_lock_failures;
+        worker.stats = DaemonStats{};
+        worker.stats.num_lock_failures = num_lock_failures;
+    }
+
+    header_->magic.store(daemon_magic, std::memory_order_release);
+
+    for (uint32_t worker_idx = 0; worker_idx < options_.num_workers;
+         worker_idx++) {
+        workers_[worker_idx].thread =
+            std::thread(&DaemonServer::run_worker, this, worker_idx);
+    }
+
+    return true;
+}
+
+void DaemonServer::stop() {
+    if (!header_) {
+        return;
+    }
+
+    // Workers finish everything that has already been submitted before they
+    // check this flag
+    running_ = false;
+    header_->running.store(0);
+    for (uint32_t worker_idx = 0; worker_idx < options_.num_workers;
+         worker_idx++) {
+        DaemonWorkerSignal& signal = header_->workers[worker_idx];
+        signal.doorbell.fetch_add(1);
+        futex_wake(signal.doorbell, INT_MAX);
+    }
+    for (auto& worker : workers_) {
+        if (worker.thread.joinable()) {
+            worker.thread.join();
+        }
+    }
+    for (uint32_t lane_idx = 0; lane_idx < options_.num_lanes; lane_idx++) {
+        futex_wake(layout_.lane(header_, lane_idx)->completed, INT_MAX);
+    }
+
+    // Connected clients keep their mappings, only the name goes away
+    shm_unlink(options_.name.c_str());
+    munmap(header_, layout_.total_size);
+    header_ = nullptr;
+}
+
+DaemonStats DaemonServer::stats() const {
+    DaemonStats stats;
+    for (const auto& worker : workers_) {
+        stats.add(worker.stats);
+    }
+
+    return stats;
+}
+
+void DaemonServer::run_worker(uint32_t worker_idx) {
+    const ScopedFlushDenormals flush_denormals;
+
+    Worker& worker = workers_[worker_idx];
+    DaemonWorkerSignal& signal = header_->workers[worker_idx];
+    const auto spin_duration = std::chrono::microseconds(options_.spin_us);
+
+    while (true) {
+        // Anything submitted after this load increments the doorbell again,
+        // so the futex won't go to sleep on a stale value
+        const uint32_t doorbell = signal.doorbell.load();
+
+        bool did_work = false;
+        for (auto& lane : worker.lanes) {
+            did_work |= serve_lane(*lane, worker.stats);
+        }
+
+        if (!running_) {
+            break;
+        }
+        if (did_work) {
+            continue;
+        }
+
+        const auto spin_until =
+            std::chrono::steady_clock::now() + spin_duration;
+        while (signal.doorbell.load(std::memory_order_relaxed) == doorbell &&
+               std::chrono::steady_clock::now() < spin_until) {
+        }
+
+        signal.sleeping.store(1);
+        futex_wait(signal.doorbell, doorbell);
+        signal.sleeping.store(0);
+    }
+}
+
+bool DaemonServer::serve_lane(LaneEngine& lane, DaemonStats& stats) {
+    DaemonLane* shared_lane = layout_.lane(header_, lane.lane_idx);
+    const uint32_t submitted =
+        shared_lane->submitted.load(std::memory_order_acquire);
+    if (submitted == lane.completed) {
+        return false;
+    }
+
+    const uint32_t generation = shared_lane->generation.load();
+    if (generation != lane.generation) {
+        lane.generation = generation;
+        lane.has_stream = false;
+    }
+
+    while (lane.completed != submitted) {
+        DaemonRequest& request = *layout_.slot(
+            shared_lane, lane.completed % options_.slots_per_lane);
+        process(lane, request, stats);
+
+        // The client sets `client_waiting` before checking the counter one
+        // last time, so either it sees this store or we see that it's waiting
+        lane.completed += 1;
+        shared_lane->completed.store(lane.completed);
+        if (shared_lane->client_waiting.load()) {
+            futex_wake(shared_lane->completed, INT_MAX);
+        }
+    }
+
+    return true;
+}
+
+void DaemonServer::process(LaneEngine& lane,
+                           DaemonRequest& request,
+                           DaemonStats& stats) {
+    // The client could still write to the shared request while we're
+    // processing it, so everything gets validated and used from a copy
+    const DaemonRequest config = request;
+
+    const uint64_t started_ns = monotonic_ns();
+    request.started_ns = started_ns;
+    if (started_ns > config.submitted_ns) {
+        const uint64_t queue_ns = started_ns - config.submitted_ns;
+        stats.total_queue_ns += queue_ns;
+        stats.max_queue_ns = std::max(stats.max_queue_ns, queue_ns);
+    }
+    stats.num_requests += 1;
+
+    if (!is_valid(config)) {
+        request.status = DaemonStatus::invalid_request;
+        request.finished_ns = monotonic_ns();
+        stats.num_invalid += 1;
+        return;
+    }
+
+    const bool can_continue =
+        (config.flags & daemon_request_continue) && lane.has_stream &&
+        config.sample_rate == lane.sample_rate &&
+        config.num_channels == lane.num_channels &&
+        config.smoothing_interval == lane.smoothing_interval;
+    if (!can_continue) {
+        start_stream(lane, config.sample_rate, config.smoothing_interval,
+                     config.num_stages, stats);
+    } else if (config.num_stages != lane.num_stages) {
+        // Just like in the plugin, this takes effect at the start of the
+        // next call to `process()`
+        lane.engine->set_num_stages(config.num_stages);
+        lane.num_stages = config.num_stages;
+        count_lock_failures(lane, stats);
+    }
+
+    DiopserEngine::Parameters parameters;
+    parameters.frequency = config.frequency;
+    parameters.resonance = config.resonance;
+    parameters.spread = config.spread;
+    parameters.spread_linear = config.flags & daemon_request_spread_linear;
+    parameters.smoothing_interval = config.smoothing_interval;
+    parameters.safe_mode = config.flags & daemon_request_safe_mode;
+
+    // The audio gets processed in place, right in the shared memory
+    for (uint32_t channel = 0; channel < config.num_channels; channel++) {
+        lane.channels[channel] = layout_.channel(&request, channel);
+    }
+    lane.engine->process(lane.channels.data(), config.num_channels,
+                         config.num_frames, parameters);
+    lane.has_stream = true;
+    lane.num_channels = config.num_channels;
+
+    const uint64_t finished_ns = monotonic_ns();
+    request.status = DaemonStatus::ok;
+    request.finished_ns = finished_ns;
+    stats.busy_ns += finished_ns - started_ns;
+    stats.audio_seconds +=
+        static_cast<double>(config.num_frames) / config.sample_rate;
+}
+
+void DaemonServer::start_stream(LaneEngine& lane,
+                                double sample_rate,
+                                int smoothing_interval,
+                                uint32_t num_stages,
+                                DaemonStats& stats) {
+    if (lane.engine && sample_rate == lane.sample_rate &&
+        smoothing_interval == lane.smoothing_interval &&
+        num_stages == lane.fresh_num_stages) {
+        lane.engine->restore_state(lane.fresh_state);
+    } else {
+        // The engine is always prepared for the maximum channel count, since
+        // channels the request doesn't use are simply skipped
+        lane.engine = std::make_unique<DiopserEngine>();
+        lane.engine->prepare(sample_rate, options_.max_frames,
+                             options_.max_channels, num_stages,
+                             smoothing_interval);
+        lane.engine->save_state(lane.fresh_state);
+        lane.lock_failures = 0;
+
+        lane.sample_rate = sample_rate;
+        lane.smoothing_interval = smoothing_interval;
+        lane.fresh_num_stages = num_stages;
+        stats.num_prepares += 1;
+    }
+
+    lane.num_stages = num_stages;
+    lane.has_stream = true;
+    count_lock_failures(lane, stats);
+}
+
+void DaemonServer::count_lock_failures(LaneEngine& lane, DaemonStats& stats) {
+    const uint64_t lock_failures = lane.engine->memory_stats().lock_failures;
+    stats.num_lock_failures += lock_failures - lane.lock_failures;
+    lane.lock_failures = lock_failures;
+}
+
+bool DaemonServer::is_valid(const DaemonRequest& request) const {
+    return request.num_channels >= 1 &&
+           request.num_channels <= options_.max_channels &&
+           request.num_frames <= options_.max_frames &&
+           request.num_stages <= options_.max_stages &&
+           request.sample_rate >= 1000.0 && request.sample_rate <= 768000.0 &&
+           request.smoothing_interval >= 1 &&
+           request.smoothing_interval <= 512 &&
+           std::isfinite(request.frequency) && request.frequency > 0.0f &&
+           std::isfinite(request.resonance) && request.resonance > 0.0f &&
+           std::isfinite(request.spread);
+}
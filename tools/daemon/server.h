@@ -0,0 +1,229 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "core/engine.h"
+#include "protocol.h"
+
+struct DaemonOptions {
+    /**
+     * The name of the shared memory segment, see `shm_open()`.
+     */
+    std::string name = "/diopser-daemon";
+    /**
+     * The segment's permissions. Only processes that can open the segment
+     * can connect.
+     */
+    uint32_t mode = 0600;
+
+    uint32_t num_lanes = 16;
+    uint32_t slots_per_lane = 4;
+    uint32_t max_channels = 2;
+    uint32_t max_frames = 8192;
+    uint32_t max_stages = 512;
+    /**
+     * Defaults to one per core, but never more than the number of lanes.
+     */
+    uint32_t num_workers = 0;
+    /**
+     * How long a worker keeps polling its lanes after its last request before
+     * it goes to sleep. Waking up a sleeping worker costs a system call and a
+     * context switch.
+     */
+    int spin_us = 50;
+
+    /**
+     * Every lane's engine is prepared for this configuration at startup, so
+     * the first requests don't have to wait for any allocations.
+     */
+    double warm_sample_rate = 48000.0;
+    uint32_t warm_stages = 0;
+    int warm_smoothing_interval = 128;
+};
+
+/**
+ * Totals over all requests processed by the daemon.
+ */
+struct DaemonStats {
+    uint64_t num_requests = 0;
+    uint64_t num_invalid = 0;
+    /**
+     * Requests that had to prepare a new engine because the lane's engine
+     * was prepared for a different sample rate, smoothing interval, or stage
+     * count.
+     */
+    uint64_t num_prepares = 0;
+    double audio_seconds = 0.0;
+    /**
+     * Time spent processing requests, summed over all workers.
+     */
+    uint64_t busy_ns = 0;
+    /**
+     * Time between a request being submitted and a worker picking it up.
+     */
+    uint64_t total_queue_ns = 0;
+    uint64_t max_queue_ns = 0;
+    /**
+     * Filter allocations that could not be locked into RAM, usually because
+     * of `RLIMIT_MEMLOCK`. Those filters may be swapped out under memory
+     * pressure, causing page faults while processing.
+     */
+    uint64_t num_lock_failures = 0;
+
+    void add(const DaemonStats& other);
+};
+
+/**
+ * The daemon side of the shared memory protocol from `protocol.h`. This
+ * creates the segment and runs a pool of workers that each serve a fixed set
+ * of lanes. Every lane keeps its own `DiopserEngine` resident, together with
+ * a snapshot of that engine's freshly prepared state. Starting a new stream
+ * restores that snapshot instead of preparing a new engine, so as long as a
+ * client keeps using the same sample rate, smoothing interval, and stage count
+ * requests never allocate. A request without `daemon_request_continue` is
+ * processed exactly like a freshly prepared engine would process it.
+ */
+class DaemonServer {
+   public:
+    DaemonServer() = default;
+    ~DaemonServer();
+
+    DaemonServer(const DaemonServer&) = delete;
+    DaemonServer& operator=(const DaemonServer&) = delete;
+
+    /**
+     * Create the shared memory segment and start the workers. A segment with
+     * the same name that was left behind by a daemon that no longer runs is
+     * replaced.
+     *
+     * @return False with a description in `error` if the options are out of
+     *   range, another daemon is using the name, or the segment could not be
+     *   created.
+     */
+    bool start(const DaemonOptions& options, std::string& error);
+
+    /**
+     * Finish all submitted requests, stop the workers, and remove the
+     * segment. Clients that are still waiting will see that the daemon shut
+     * down.
+     */
+    void stop();
+
+    /**
+     * Only accurate after `stop()`.
+     */
+    DaemonStats stats() const;
+
+   private:
+    /**
+     * The daemon's private state for a lane.
+     */
+    struct LaneEngine {
+        uint32_t lane_idx = 0;
+        /**
+         * Mirrors `DaemonLane::completed`.
+         */
+        uint32_t completed = 0;
+        uint32_t generation = 0;
+
+        /**
+         * Replaced by a new engine whenever the configuration changes, so the
+         * smoothers don't start out at the previous stream's targets.
+         */
+        std::unique_ptr<DiopserEngine> engine;
+        double sample_rate = 0.0;
+        int smoothing_interval = 0;
+        uint32_t fresh_num_stages = 0;
+        DiopserEngine::State fresh_state;
+
+        /**
+         * Whether the engine contains a stream that the next request may
+         * continue.
+         */
+        bool has_stream = false;
+        uint32_t num_stages = 0;
+        /**
+         * The channel count of the stream in the engine. The engine only has
+         * filter state for the channels it has processed, so a stream can't
+         * continue with a different number of channels.
+         */
+        uint32_t num_channels = 0;
+
+        /**
+         * The engine's lock failure count that has already been added to the
+         * worker's stats.
+         */
+        uint64_t lock_failures = 0;
+
+        std::vector<float*> channels;
+    };
+
+    struct Worker {
+        std::thread thread;
+        std::vector<std::unique_ptr<LaneEngine>> lanes;
+        DaemonStats stats;
+    };
+
+    void run_worker(uint32_t worker_idx);
+
+    /**
+     * Process all requests that have been submitted to the lane.
+     *
+     * @return Whether there were any.
+     */
+    bool serve_lane(LaneEngine& lane, DaemonStats& stats);
+    void process(LaneEngine& lane, DaemonRequest& request, DaemonStats& stats);
+
+    /**
+     * Bring the lane's engine to a freshly prepared state for this
+     * configuration.
+     */
+    void start_stream(LaneEngine& lane,
+                      double sample_rate,
+                      int smoothing_interval,
+                      uint32_t num_stages,
+                      DaemonStats& stats);
+
+    /**
+     * Add any new failures to lock the lane's filters into RAM to the stats.
+     * Called after anything that may have reallocated the filters.
+     */
+    void count_lock_failures(LaneEngine& lane, DaemonStats& stats);
+
+    bool is_valid(const DaemonRequest& request) const;
+
+    DaemonOptions options_;
+    /**
+     * Clients can write to the entire segment, so the daemon only ever uses
+     * its own copy of the segment's dimensions.
+     */
+    DaemonLayout layout_{};
+    DaemonHeader* header_ = nullptr;
+    /**
+     * `DaemonHeader::running` is only there to inform clients.
+     */
+    std::atomic_bool running_ = false;
+
+    std::vector<Worker> workers_;
+};
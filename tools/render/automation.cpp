@@ -0,0 +1,395 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "automation.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "parameter_ids.h"
+
+struct AutomatableParameter {
+    const char* parameter_id;
+    bool discrete;
+};
+
+/**
+ * The parameters that can be automated. Only the continuous parameters can
+ * ramp between breakpoints.
+ */
+constexpr AutomatableParameter automatable_parameters[] = {
+    {filter_stages_param_name, true},
+    {filter_frequency_param_name, false},
+    {filter_resonance_param_name, false},
+    {filter_spread_param_name, false},
+    {filter_spread_linear_param_name, true},
+    {extended_stages_param_name, true},
+    {extended_filter_stages_param_name, true},
+    {rotation_mode_param_name, true},
+    {rotation_angle_param_name, false},
+    {design_mode_param_name, true},
+    {smoothing_interval_param_name, true},
+    {safe_mode_param_name, true},
+};
+
+static bool is_number(const juce::String& text) {
+    return text.isNotEmpty() && text.containsOnly("0123456789.-+eE");
+}
+
+static bool is_number(const juce::var& value) {
+    return value.isInt() || value.isInt64() || value.isDouble() ||
+           value.isBool();
+}
+
+static juce::Result parse_shape(const juce::String& shape, bool& step) {
+    if (shape.isEmpty() || shape == "linear") {
+        step = false;
+    } else if (shape == "step") {
+        step = true;
+    } else {
+        return juce::Result::fail("Unknown shape '" + shape +
+                                  "', expected 'linear' or 'step'");
+    }
+
+    return juce::Result::ok();
+}
+
+juce::Result Automation::load(const juce::File& file) {
+    if (!file.existsAsFile()) {
+        return juce::Result::fail("Could not read '" + file.getFullPathName() +
+                                  "'");
+    }
+
+    lanes_.clear();
+
+    juce::Result result = juce::Result::ok();
+    if (file.hasFileExtension("csv")) {
+        result = load_csv(file);
+    } else if (file.hasFileExtension("json")) {
+        result = load_json(file);
+    } else {
+        result = juce::Result::fail("Automation must be a .csv or .json file");
+    }
+    if (result.failed()) {
+        lanes_.clear();
+        return result;
+    }
+
+    for (auto& lane : lanes_) {
+        std::stable_sort(lane.points.begin(), lane.points.end(),
+                         [](const Point& a, const Point& b) {
+                             return a.time < b.time;
+                         });
+    }
+
+    return juce::Result::ok();
+}
+
+juce::Result Automation::load_csv(const juce::File& file) {
+    juce::StringArray lines;
+    file.readLines(lines);
+
+    bool is_first_line = true;
+    for (int line_idx = 0; line_idx < lines.size(); line_idx++) {
+        const juce::String line = lines[line_idx].trim();
+        if (line.isEmpty() || line.startsWithChar('#')) {
+            continue;
+        }
+
+        const juce::String location = file.getFileName() + ":" +
+                                      juce::String(line_idx + 1) + ": ";
+
+        juce::StringArray fields =
+            juce::StringArray::fromTokens(line, ",", "\"");
+        fields.trim();
+
+        // The first line may be a header
+        const bool is_header = is_first_line && !is_number(fields[0]);
+        is_first_line = false;
+        if (is_header) {
+            continue;
+        }
+
+        if (fields.size() < 3 || fields.size() > 4 || !is_number(fields[0]) ||
+            !is_number(fields[2])) {
+            return juce::Result::fail(
+                location + "Expected 'time,parameter,value[,shape]'");
+        }
+
+        bool step;
+        juce::Result result = parse_shape(fields[3].unquoted(), step);
+        if (result.wasOk()) {
+            result = add_point(fields[1].unquoted(),
+                               Point{fields[0].getDoubleValue(),
+                                     fields[2].getFloatValue(), step});
+        }
+        if (result.failed()) {
+            return juce::Result::fail(location + result.getErrorMessage());
+        }
+    }
+
+    return juce::Result::ok();
+}
+
+juce::Result Automation::load_json(const juce::File& file) {
+    const juce::String location = file.getFileName() + ": ";
+
+    juce::var json;
+    const juce::Result parse_result =
+        juce::JSON::parse(file.loadFileAsString(), json);
+    if (parse_result.failed()) {
+        return juce::Result::fail(location + parse_result.getErrorMessage());
+    }
+
+    juce::DynamicObject* object = json.getDynamicObject();
+    if (!object) {
+        return juce::Result::fail(
+            location +
+            "Expected an object containing an array of breakpoints for every "
+            "parameter");
+    }
+
+    for (const auto& property : object->getProperties()) {
+        const juce::String parameter_id = property.name.toString();
+        const juce::Array<juce::var>* points = property.value.getArray();
+        if (!points) {
+            return juce::Result::fail(location + "Expected an array for '" +
+                                      parameter_id + "'");
+        }
+
+        for (const auto& point : *points) {
+            juce::var time;
+            juce::var value;
+            juce::var shape;
+            if (const juce::Array<juce::var>* fields = point.getArray()) {
+                if (fields->size() >= 2 && fields->size() <= 3) {
+                    time = (*fields)[0];
+                    value = (*fields)[1];
+                    shape = (*fields)[2];
+                }
+            } else if (point.isObject()) {
+                time = point.getProperty("time", {});
+                value = point.getProperty("value", {});
+                shape = point.getProperty("shape", {});
+            }
+
+            if (!is_number(time) || !is_number(value) ||
+                !(shape.isVoid() || shape.isString())) {
+                return juce::Result::fail(
+                    location + "Invalid breakpoint for '" + parameter_id +
+                    "', expected {\"time\": <seconds>, \"value\": <value>} or "
+                    "[<seconds>, <value>]");
+            }
+
+            bool step;
+            juce::Result result = parse_shape(shape.toString(), step);
+            if (result.wasOk()) {
+                const auto point_value =
+                    static_cast<float>(static_cast<double>(value));
+                result = add_point(
+                    parameter_id,
+                    Point{static_cast<double>(time), point_value, step});
+            }
+            if (result.failed()) {
+                return juce::Result::fail(location + result.getErrorMessage());
+            }
+        }
+    }
+
+    return juce::Result::ok();
+}
+
+juce::Result Automation::add_point(const juce::String& parameter_id,
+                                   Point point) {
+    if (!std::isfinite(point.time) || point.time < 0.0 ||
+        !std::isfinite(point.value)) {
+        return juce::Result::fail("Invalid breakpoint for '" + parameter_id +
+                                  "'");
+    }
+
+    const std::string_view id = parameter_id.toRawUTF8();
+    auto lane = std::find_if(
+        lanes_.begin(), lanes_.end(),
+        [&](const Lane& lane) { return lane.parameter_id == id; });
+    if (lane == lanes_.end()) {
+        const auto parameter = std::find_if(
+            std::begin(automatable_parameters),
+            std::end(automatable_parameters),
+            [&](const AutomatableParameter& parameter) {
+                return parameter.parameter_id == id;
+            });
+        if (parameter == std::end(automatable_parameters)) {
+            return juce::Result::fail("'" + parameter_id +
+                                      "' is not a parameter that can be "
+                                      "automated");
+        }
+
+        lane = lanes_.insert(
+            lanes_.end(),
+            Lane{parameter->parameter_id, parameter->discrete, {}});
+    }
+
+    lane->points.push_back(point);
+
+    return juce::Result::ok();
+}
+
+AutomationPlayer::AutomationPlayer(const RenderSettings& settings,
+                                   double sample_rate,
+                                   juce::int64 start_position)
+    : position_(start_position), settings_(settings) {
+    const std::vector<Automation::Lane> no_lanes;
+    const std::vector<Automation::Lane>& lanes =
+        settings.automation ? settings.automation->lanes() : no_lanes;
+
+    // Every breakpoint from every lane starts a new segment
+    std::vector<std::vector<juce::int64>> lane_positions;
+    std::vector<juce::int64> segment_positions{0};
+    for (const auto& lane : lanes) {
+        auto& positions = lane_positions.emplace_back();
+        for (const auto& point : lane.points) {
+            positions.push_back(static_cast<juce::int64>(
+                std::llround(point.time * sample_rate)));
+        }
+
+        segment_positions.insert(segment_positions.end(), positions.begin(),
+                                 positions.end());
+    }
+    std::sort(segment_positions.begin(), segment_positions.end());
+    segment_positions.erase(
+        std::unique(segment_positions.begin(), segment_positions.end()),
+        segment_positions.end());
+
+    for (const juce::int64 position : segment_positions) {
+        Segment& segment = segments_.emplace_back();
+        segment.position = position;
+        segment.is_ramp = false;
+
+        for (size_t lane_idx = 0; lane_idx < lanes.size(); lane_idx++) {
+            const Automation::Lane& lane = lanes[lane_idx];
+            const std::vector<juce::int64>& positions =
+                lane_positions[lane_idx];
+
+            // Before the first breakpoint and after the last breakpoint the
+            // value stays constant
+            LaneValue& value = segment.values.emplace_back(
+                LaneValue{lane.parameter_id, lane.points.front().value, 0.0f});
+            const auto next =
+                std::upper_bound(positions.begin(), positions.end(), position);
+            if (next == positions.begin()) {
+                continue;
+            }
+
+            const size_t point_idx =
+                static_cast<size_t>(next - positions.begin()) - 1;
+            value.value = lane.points[point_idx].value;
+            if (next == positions.end() || lane.discrete ||
+                lane.points[point_idx + 1].step) {
+                continue;
+            }
+
+            // The next breakpoint is always at a later sample, since
+            // `upper_bound()` skips breakpoints at the same position
+            const double slope =
+                static_cast<double>(lane.points[point_idx + 1].value -
+                                    lane.points[point_idx].value) /
+                static_cast<double>(*next - positions[point_idx]);
+            value.value = static_cast<float>(
+                lane.points[point_idx].value +
+                slope * static_cast<double>(position - positions[point_idx]));
+            value.slope = static_cast<float>(slope);
+            segment.is_ramp = segment.is_ramp || value.slope != 0.0f;
+        }
+    }
+
+    const auto segment = std::upper_bound(
+        segments_.begin(), segments_.end(), start_position,
+        [](juce::int64 position, const Segment& segment) {
+            return position < segment.position;
+        });
+    segment_idx_ = static_cast<size_t>(segment - segments_.begin()) - 1;
+
+    apply_segment();
+    engine_num_stages_ = settings_.num_stages;
+}
+
+void AutomationPlayer::process(DiopserEngine& engine,
+                               float* const* samples,
+                               size_t num_channels,
+                               size_t num_samples) {
+    channel_pointers_.resize(num_channels);
+
+    size_t offset = 0;
+    while (offset < num_samples) {
+        while (segment_idx_ + 1 < segments_.size() &&
+               segments_[segment_idx_ + 1].position <= position_) {
+            segment_idx_ += 1;
+        }
+
+        apply_segment();
+        if (settings_.num_stages != engine_num_stages_) {
+            engine.set_num_stages(settings_.num_stages);
+            engine_num_stages_ = settings_.num_stages;
+        }
+
+        // The block is split at the next breakpoint, and during ramps the
+        // targets are moved along with the ramp once per smoothing interval
+        juce::int64 length = static_cast<juce::int64>(num_samples - offset);
+        if (segment_idx_ + 1 < segments_.size()) {
+            length = std::min(length,
+                              segments_[segment_idx_ + 1].position - position_);
+        }
+        if (segments_[segment_idx_].is_ramp) {
+            const juce::int64 interval =
+                settings_.parameters.smoothing_interval;
+            const juce::int64 elapsed =
+                position_ - segments_[segment_idx_].position;
+            length = std::min(length, interval - (elapsed % interval));
+        }
+
+        for (size_t channel = 0; channel < num_channels; channel++) {
+            channel_pointers_[channel] = samples[channel] + offset;
+        }
+        engine.process(channel_pointers_.data(), num_channels,
+                       static_cast<size_t>(length), settings_.parameters);
+
+        offset += static_cast<size_t>(length);
+        position_ += length;
+    }
+}
+
+void AutomationPlayer::apply_segment() {
+    const Segment& segment = segments_[segment_idx_];
+    for (const auto& lane : segment.values) {
+        if (lane.slope == 0.0f) {
+            settings_.set_parameter(lane.parameter_id, lane.value);
+        }
+    }
+
+    // Ramps are only updated at multiples of the smoothing interval from the
+    // start of the segment. That way the output doesn't depend on where
+    // blocks start, so a render resumed from a checkpoint matches the
+    // original render exactly.
+    const juce::int64 interval = settings_.parameters.smoothing_interval;
+    const auto elapsed = static_cast<float>(
+        ((position_ - segment.position) / interval) * interval);
+    for (const auto& lane : segment.values) {
+        if (lane.slope != 0.0f) {
+            settings_.set_parameter(lane.parameter_id,
+                                    lane.value + (lane.slope * elapsed));
+        }
+    }
+}
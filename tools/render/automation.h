@@ -0,0 +1,167 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <string_view>
+#include <vector>
+
+#include <juce_core/juce_core.h>
+
+#include "core/engine.h"
+#include "render.h"
+
+/**
+ * Time-stamped automation for the plugin's parameters, loaded from a CSV or
+ * JSON file. Every parameter has its own lane of breakpoints. Continuous
+ * parameters ramp linearly between breakpoints unless a breakpoint is marked as
+ * a step. The other parameters, like the number of stages, always jump to the
+ * new value at the breakpoint. Before a lane's first breakpoint the parameter
+ * has that breakpoint's value, and after the last breakpoint it keeps the last
+ * value. Parameters without a lane keep the value from the other settings.
+ *
+ * CSV files contain one breakpoint per line in the form
+ * `time,parameter,value[,shape]`, optionally preceded by a header. JSON files
+ * contain an object with an array of breakpoints per parameter, where each
+ * breakpoint is either an object like
+ * `{"time": 1.5, "value": 800, "shape": "step"}` or an array like
+ * `[1.5, 800, "step"]`. Times are in seconds, values use the same units as
+ * the command line options, and the shape is either `linear` (the default) or
+ * `step`.
+ */
+class Automation {
+   public:
+    struct Point {
+        double time;
+        float value;
+        /**
+         * Whether the parameter should jump to this value at `time` instead of
+         * ramping towards it from the previous breakpoint.
+         */
+        bool step;
+    };
+
+    struct Lane {
+        std::string_view parameter_id;
+        /**
+         * Discrete parameters always jump to the next value.
+         */
+        bool discrete;
+        /**
+         * Sorted by time.
+         */
+        std::vector<Point> points;
+    };
+
+    /**
+     * Load automation from `file`. The format is chosen based on the file
+     * extension.
+     */
+    juce::Result load(const juce::File& file);
+
+    const std::vector<Lane>& lanes() const { return lanes_; }
+
+   private:
+    juce::Result load_csv(const juce::File& file);
+    juce::Result load_json(const juce::File& file);
+
+    juce::Result add_point(const juce::String& parameter_id, Point point);
+
+    std::vector<Lane> lanes_;
+};
+
+/**
+ * Replays the automation from a `RenderSettings` into a `DiopserEngine`. The
+ * entire future is known offline, so all breakpoints are converted to
+ * segments with a starting value and a per-sample slope for every lane up
+ * front. During processing blocks are split at segment boundaries so every
+ * breakpoint lands on the exact sample it was placed at. Within a ramp the
+ * targets are updated every `smoothing_interval` samples, which is as often
+ * as the engine recomputes its coefficients anyway. Without any automation
+ * the blocks are processed as is. The output never depends on the block
+ * boundaries.
+ */
+class AutomationPlayer {
+   public:
+    /**
+     * Precompute the segments for `settings`'s automation at `sample_rate`
+     * and seek to `start_position`. The engine should be prepared using the
+     * stage count and smoothing interval from `settings()` afterwards.
+     */
+    AutomationPlayer(const RenderSettings& settings,
+                     double sample_rate,
+                     juce::int64 start_position = 0);
+
+    /**
+     * The settings at the current position.
+     */
+    const RenderSettings& settings() const { return settings_; }
+
+    /**
+     * Should be called after restoring the engine's state from a checkpoint,
+     * since the engine then uses the checkpoint's number of stages instead of
+     * the one from `settings()`.
+     */
+    void set_engine_num_stages(size_t num_stages) {
+        engine_num_stages_ = num_stages;
+    }
+
+    /**
+     * Process the next `num_samples` samples, changing the engine's
+     * parameters and number of stages as needed.
+     */
+    void process(DiopserEngine& engine,
+                 float* const* samples,
+                 size_t num_channels,
+                 size_t num_samples);
+
+   private:
+    struct LaneValue {
+        std::string_view parameter_id;
+        float value;
+        /**
+         * The change in value per sample, 0 unless the lane is ramping.
+         */
+        float slope;
+    };
+
+    struct Segment {
+        juce::int64 position;
+        std::vector<LaneValue> values;
+        bool is_ramp;
+    };
+
+    /**
+     * Update `settings_` to the current segment's values at `position_`.
+     */
+    void apply_segment();
+
+    std::vector<Segment> segments_;
+    size_t segment_idx_ = 0;
+    juce::int64 position_ = 0;
+
+    RenderSettings settings_;
+    /**
+     * The stage count last passed to the engine, or the one from `settings()`
+     * that it was prepared with.
+     */
+    size_t engine_num_stages_ = 0;
+
+    /**
+     * Used to offset the channel pointers when splitting blocks.
+     */
+    std::vector<float*> channel_pointers_;
+};
@@ -0,0 +1,539 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "batch.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+
+#include "checkpoints.h"
+#include "core/denormals.h"
+#include "renderer.h"
+#include "work_stealing_queue.h"
+
+/**
+ * Chunks are at most this long regardless of the chunk length option, since
+ * they're kept in memory until they can be written.
+ */
+constexpr juce::int64 max_chunk_length = 1 << 28;
+
+/**
+ * A file from the batch together with everything needed to render it in
+ * chunks. The fields above the mutex are set before the workers start and are
+ * read-only after that.
+ */
+struct FileState {
+    /**
+     * A chunk either continues from a checkpoint, in which case its output is
+     * identical to rendering the file in one go, or it starts by processing
+     * the pre-roll leading up to it.
+     */
+    struct Chunk {
+        juce::int64 start;
+        juce::int64 end;
+        const Checkpoints::Checkpoint* checkpoint;
+    };
+
+    const BatchJob* job = nullptr;
+    juce::AudioFormat* input_format = nullptr;
+    double sample_rate = 0.0;
+    juce::int64 length = 0;
+    juce::int64 preroll_length = 0;
+    std::vector<Chunk> chunks;
+
+    /**
+     * The checkpoints loaded from the job's checkpoint file. Chunks only start
+     * at these checkpoints when the job has a checkpoint file.
+     */
+    Checkpoints checkpoints;
+    uint64_t fingerprint = 0;
+    /**
+     * Set when the job's checkpoint file is missing or was made with other
+     * settings. The file is then rendered as a single chunk, which writes new
+     * checkpoints so the next render can be split up again.
+     */
+    bool record_checkpoints = false;
+
+    std::mutex mutex;
+    /**
+     * Created by the worker that renders the first chunk. That worker writes
+     * its output directly to the file as it goes, since the first chunk is
+     * always next in line. The other chunks are kept in `finished_chunks` until
+     * all chunks before them have been written. `next_chunk` only gets
+     * incremented after the first chunk is done, so nothing else touches the
+     * writer until then.
+     */
+    std::unique_ptr<juce::AudioFormatWriter> writer;
+    /**
+     * Set once the writer has replaced the output file. An existing output
+     * file is only removed when the render fails after this point.
+     */
+    bool created_output = false;
+    std::map<size_t, juce::AudioBuffer<float>> finished_chunks;
+    size_t next_chunk = 0;
+    size_t chunks_remaining = 0;
+    /**
+     * The first error encountered while rendering any of this file's chunks.
+     * Once this is set the remaining chunks are skipped.
+     */
+    juce::Result result = juce::Result::ok();
+};
+
+struct ChunkTask {
+    FileState* file;
+    size_t chunk_idx;
+};
+
+juce::Result read_manifest(const juce::File& manifest,
+                           const RenderSettings& defaults,
+                           std::vector<BatchJob>& jobs) {
+    if (!manifest.existsAsFile()) {
+        return juce::Result::fail("Could not read '" +
+                                  manifest.getFullPathName() + "'");
+    }
+
+    juce::StringArray lines;
+    manifest.readLines(lines);
+
+    const juce::File directory = manifest.getParentDirectory();
+    for (int line_idx = 0; line_idx < lines.size(); line_idx++) {
+        const juce::String line = lines[line_idx].trim();
+        if (line.isEmpty() || line.startsWithChar('#')) {
+            continue;
+        }
+
+        const juce::String location = manifest.getFileName() + ":" +
+                                      juce::String(line_idx + 1) + ": ";
+
+        juce::StringArray tokens = juce::StringArray::fromTokens(line, true);
+        tokens.removeEmptyStrings();
+
+        juce::StringArray paths;
+        juce::StringArray options;
+        for (const auto& token : tokens) {
+            const juce::String argument = token.unquoted();
+            if (argument.startsWith("--state=") ||
+                argument.startsWith("--automation=") ||
+                argument.startsWith("--checkpoints=")) {
+                // Just like the input and output files, these are relative to
+                // the manifest instead of to the working directory
+                const juce::String path =
+                    argument.fromFirstOccurrenceOf("=", false, false)
+                        .unquoted();
+                options.add(argument.upToFirstOccurrenceOf("=", true, false) +
+                            directory.getChildFile(path).getFullPathName());
+            } else if (argument.startsWith("-")) {
+                options.add(argument);
+            } else {
+                paths.add(argument);
+            }
+        }
+
+        if (paths.size() != 2) {
+            return juce::Result::fail(location +
+                                      "Expected an input and an output file");
+        }
+
+        BatchJob job{directory.getChildFile(paths[0]),
+                     directory.getChildFile(paths[1]), defaults};
+        const juce::Result result = job.settings.apply_arguments(
+            juce::ArgumentList("diopser-render", options));
+        if (result.failed()) {
+            return juce::Result::fail(location + result.getErrorMessage());
+        }
+
+        jobs.push_back(std::move(job));
+    }
+
+    return juce::Result::ok();
+}
+
+double BatchStats::realtime_factor() const {
+    return seconds > 0.0 ? audio_seconds / seconds : 0.0;
+}
+
+/**
+ * Read `file.job`'s input file's header and divide it into chunks.
+ */
+static juce::Result plan_file(juce::AudioFormatManager& formats,
+                              const BatchOptions& options,
+                              FileState& file) {
+    const BatchJob& job = *file.job;
+    const RenderSettings& settings = job.settings;
+    if (job.input == job.output) {
+        return juce::Result::fail("The input and output files are the same");
+    }
+    if (settings.start_seconds > 0.0) {
+        return juce::Result::fail(
+            "--start is only supported when rendering a single file");
+    }
+
+    file.input_format =
+        formats.findFormatForFileExtension(job.input.getFileExtension());
+    if (!file.input_format) {
+        return juce::Result::fail("Unsupported input format for '" +
+                                  job.input.getFullPathName() + "'");
+    }
+    // The writer is only created once the first chunk gets rendered, but it's
+    // nicer to catch this before rendering anything
+    if (!formats.findFormatForFileExtension(job.output.getFileExtension())) {
+        return juce::Result::fail("Unsupported output format for '" +
+                                  job.output.getFullPathName() + "'");
+    }
+
+    // This only reads the header, nothing gets mapped yet
+    StreamingReader reader(*file.input_format, job.input, 0);
+    juce::AudioFormatReader* source = reader.get();
+    if (!source) {
+        return juce::Result::fail("Could not open '" +
+                                  job.input.getFullPathName() + "'");
+    }
+
+    const auto to_samples = [&](double seconds) {
+        return static_cast<juce::int64>(
+            std::ceil(seconds * source->sampleRate));
+    };
+
+    file.sample_rate = source->sampleRate;
+    file.length = source->lengthInSamples;
+    file.preroll_length = to_samples(options.preroll_seconds);
+
+    juce::int64 chunk_length = file.length;
+    if (options.chunk_seconds > 0.0) {
+        chunk_length = std::min(
+            chunk_length,
+            std::min(to_samples(options.chunk_seconds), max_chunk_length));
+    }
+
+    const bool use_checkpoints = settings.checkpoint_file != juce::File();
+    if (use_checkpoints) {
+        file.fingerprint = Checkpoints::fingerprint(
+            settings, file.sample_rate, static_cast<int>(source->numChannels));
+        file.record_checkpoints =
+            file.checkpoints.load(settings.checkpoint_file, file.fingerprint)
+                .failed();
+    }
+
+    const auto split_at = [&](juce::int64 position,
+                              const Checkpoints::Checkpoint* checkpoint) {
+        file.chunks.back().end = position;
+        file.chunks.push_back(
+            FileState::Chunk{position, file.length, checkpoint});
+    };
+
+    file.chunks.push_back(FileState::Chunk{0, file.length, nullptr});
+    if (file.record_checkpoints || chunk_length >= file.length) {
+        // A single chunk
+    } else if (use_checkpoints) {
+        // Chunks should still be at least `chunk_length` long, but they can
+        // only start at a checkpoint
+        for (const auto& checkpoint : file.checkpoints.checkpoints()) {
+            if (checkpoint.position < file.length &&
+                checkpoint.position - file.chunks.back().start >=
+                    chunk_length) {
+                split_at(checkpoint.position, &checkpoint);
+            }
+        }
+    } else {
+        for (juce::int64 position = chunk_length; position < file.length;
+             position += chunk_length) {
+            split_at(position, nullptr);
+        }
+    }
+    file.chunks_remaining = file.chunks.size();
+
+    return juce::Result::ok();
+}
+
+/**
+ * Render a single chunk of a file. The first chunk is written directly to the
+ * file, and the other chunks are rendered to `output`.
+ *
+ * @param preroll_samples Incremented with the number of samples that were
+ *   processed before the start of the chunk.
+ */
+static juce::Result process_chunk(juce::AudioFormatManager& formats,
+                                  FileState& file,
+                                  size_t chunk_idx,
+                                  juce::AudioBuffer<float>& output,
+                                  juce::int64& preroll_samples) {
+    const BatchJob& job = *file.job;
+    const RenderSettings& settings = job.settings;
+    const int block_size = static_cast<int>(settings.block_size);
+
+    StreamingReader reader(*file.input_format, job.input,
+                           mapped_window_blocks * block_size);
+    juce::AudioFormatReader* source = reader.get();
+    if (!source) {
+        return juce::Result::fail("Could not open '" +
+                                  job.input.getFullPathName() + "'");
+    }
+
+    if (chunk_idx == 0) {
+        std::lock_guard lock(file.mutex);
+        const juce::Result result =
+            create_writer(formats, job.output, *source,
+                          settings.bits_per_sample, file.writer);
+        if (result.failed()) {
+            return result;
+        }
+
+        file.created_output = true;
+    }
+
+    const FileState::Chunk& chunk = file.chunks[chunk_idx];
+    const int num_channels = static_cast<int>(source->numChannels);
+    Renderer renderer(
+        reader, settings,
+        chunk.checkpoint
+            ? chunk.start
+            : std::max<juce::int64>(0, chunk.start - file.preroll_length));
+    if (chunk.checkpoint) {
+        const juce::Result result = renderer.restore(*chunk.checkpoint);
+        if (result.failed()) {
+            return result;
+        }
+    }
+
+    Checkpoints recorded_checkpoints;
+    if (file.record_checkpoints) {
+        renderer.record_checkpoints(
+            recorded_checkpoints,
+            Checkpoints::interval(settings, file.sample_rate));
+    }
+
+    if (chunk_idx > 0) {
+        output.setSize(num_channels, static_cast<int>(chunk.end - chunk.start));
+    }
+
+    while (renderer.position() < chunk.end) {
+        const juce::int64 position = renderer.position();
+        const bool before_start = position < chunk.start;
+        int num_samples;
+        if (!renderer.process_block(before_start ? chunk.start : chunk.end,
+                                    num_samples)) {
+            return juce::Result::fail("Could not read from '" +
+                                      job.input.getFullPathName() + "'");
+        }
+
+        const juce::AudioBuffer<float>& buffer = renderer.buffer();
+        if (before_start) {
+            preroll_samples += num_samples;
+        } else if (chunk_idx == 0) {
+            if (!file.writer->writeFromAudioSampleBuffer(buffer, 0,
+                                                         num_samples)) {
+                return juce::Result::fail("Could not write to '" +
+                                          job.output.getFullPathName() + "'");
+            }
+        } else {
+            for (int channel = 0; channel < num_channels; channel++) {
+                output.copyFrom(channel,
+                                static_cast<int>(position - chunk.start),
+                                buffer, channel, 0, num_samples);
+            }
+        }
+    }
+
+    if (file.record_checkpoints) {
+        return recorded_checkpoints.save(settings.checkpoint_file,
+                                         file.fingerprint);
+    }
+
+    return juce::Result::ok();
+}
+
+/**
+ * Store a finished chunk and write all chunks that are next in line.
+ *
+ * @return Whether this was the file's last chunk.
+ */
+static bool finish_chunk(FileState& file,
+                         size_t chunk_idx,
+                         const juce::Result& chunk_result,
+                         juce::AudioBuffer<float> output) {
+    std::lock_guard lock(file.mutex);
+
+    if (chunk_result.failed() && file.result.wasOk()) {
+        file.result = chunk_result;
+    }
+
+    if (file.result.wasOk()) {
+        file.finished_chunks.emplace(chunk_idx, std::move(output));
+
+        auto next = file.finished_chunks.find(file.next_chunk);
+        while (next != file.finished_chunks.end()) {
+            const juce::AudioBuffer<float>& chunk = next->second;
+            if (chunk.getNumSamples() > 0 &&
+                !file.writer->writeFromAudioSampleBuffer(
+                    chunk, 0, chunk.getNumSamples())) {
+                file.result = juce::Result::fail(
+                    "Could not write to '" +
+                    file.job->output.getFullPathName() + "'");
+                break;
+            }
+
+            file.finished_chunks.erase(next);
+            file.next_chunk += 1;
+            next = file.finished_chunks.find(file.next_chunk);
+        }
+    }
+
+    file.chunks_remaining -= 1;
+    if (file.chunks_remaining > 0) {
+        return false;
+    }
+
+    // Destroying the writer finalizes the file's header
+    file.writer.reset();
+    file.finished_chunks.clear();
+    if (file.result.failed() && file.created_output) {
+        file.job->output.deleteFile();
+    }
+
+    return true;
+}
+
+void render_batch(
+    juce::AudioFormatManager& formats,
+    const std::vector<BatchJob>& jobs,
+    const BatchOptions& options,
+    BatchStats& stats,
+    std::function<void(const BatchJob&, const juce::Result&)> on_finished) {
+    const double start_time = juce::Time::getMillisecondCounterHiRes();
+
+    stats = BatchStats{};
+    stats.num_files = jobs.size();
+
+    // Protects `stats` and serializes the calls to `on_finished`
+    std::mutex report_mutex;
+    const auto report = [&](const FileState& file, const juce::Result& result,
+                            juce::int64 preroll_samples) {
+        std::lock_guard lock(report_mutex);
+        if (preroll_samples > 0) {
+            stats.preroll_seconds +=
+                static_cast<double>(preroll_samples) / file.sample_rate;
+        }
+        if (result.wasOk()) {
+            stats.audio_seconds +=
+                static_cast<double>(file.length) / file.sample_rate;
+        } else {
+            stats.num_failed += 1;
+        }
+
+        on_finished(*file.job, result);
+    };
+
+    std::vector<std::unique_ptr<FileState>> files;
+    // Two jobs writing to the same output or checkpoint file would overwrite
+    // each other's results
+    std::set<juce::File> outputs;
+    std::set<juce::File> checkpoint_files;
+    for (const auto& job : jobs) {
+        auto file = std::make_unique<FileState>();
+        file->job = &job;
+
+        juce::Result result = plan_file(formats, options, *file);
+        if (result.wasOk() && !outputs.insert(job.output).second) {
+            result = juce::Result::fail("'" + job.output.getFullPathName() +
+                                        "' is already used as an output");
+        }
+        const juce::File& checkpoint_file = job.settings.checkpoint_file;
+        if (result.wasOk() && checkpoint_file != juce::File() &&
+            !checkpoint_files.insert(checkpoint_file).second) {
+            result = juce::Result::fail("'" +
+                                        checkpoint_file.getFullPathName() +
+                                        "' is already used for checkpoints");
+        }
+
+        if (result.wasOk()) {
+            stats.num_chunks += file->chunks.size();
+            files.push_back(std::move(file));
+        } else {
+            report(*file, result, 0);
+        }
+    }
+
+    // The longest files go first, so they don't end up holding up the end of
+    // the batch
+    std::stable_sort(files.begin(), files.end(),
+                     [](const auto& a, const auto& b) {
+                         return static_cast<double>(a->length) /
+                                    a->sample_rate >
+                                static_cast<double>(b->length) / b->sample_rate;
+                     });
+
+    size_t num_threads =
+        options.num_threads > 0
+            ? options.num_threads
+            : std::max(1u, std::thread::hardware_concurrency());
+    num_threads = std::max<size_t>(1, std::min(num_threads, stats.num_chunks));
+    stats.num_threads = num_threads;
+
+    // A file's chunks all go to the same worker in order. Other workers steal
+    // them from the front once their own queue is empty.
+    WorkStealingQueue<ChunkTask> queue(num_threads);
+    for (size_t file_idx = 0; file_idx < files.size(); file_idx++) {
+        for (size_t chunk_idx = 0; chunk_idx < files[file_idx]->chunks.size();
+             chunk_idx++) {
+            queue.push(file_idx % num_threads,
+                       ChunkTask{files[file_idx].get(), chunk_idx});
+        }
+    }
+
+    std::vector<std::thread> workers;
+    for (size_t worker_idx = 0; worker_idx < num_threads; worker_idx++) {
+        workers.emplace_back([&, worker_idx]() {
+            const ScopedFlushDenormals flush_denormals;
+            while (const auto task = queue.pop(worker_idx)) {
+                FileState& file = *task->file;
+
+                bool skip;
+                {
+                    std::lock_guard lock(file.mutex);
+                    skip = file.result.failed();
+                }
+
+                juce::AudioBuffer<float> output;
+                juce::int64 preroll_samples = 0;
+                const juce::Result result =
+                    skip ? juce::Result::ok()
+                         : process_chunk(formats, file, task->chunk_idx,
+                                         output, preroll_samples);
+
+                if (finish_chunk(file, task->chunk_idx, result,
+                                 std::move(output))) {
+                    // No other worker touches this file anymore
+                    report(file, file.result, preroll_samples);
+                } else if (preroll_samples > 0) {
+                    std::lock_guard lock(report_mutex);
+                    stats.preroll_seconds +=
+                        static_cast<double>(preroll_samples) / file.sample_rate;
+                }
+            }
+        });
+    }
+
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    stats.seconds =
+        (juce::Time::getMillisecondCounterHiRes() - start_time) / 1000.0;
+}
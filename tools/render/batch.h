@@ -0,0 +1,124 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include <juce_audio_formats/juce_audio_formats.h>
+
+#include "render.h"
+
+/**
+ * A single file from a batch manifest.
+ */
+struct BatchJob {
+    juce::File input;
+    juce::File output;
+    RenderSettings settings;
+};
+
+/**
+ * Read a batch manifest. Every line contains an input file, an output file,
+ * and optionally any of the options from `RenderSettings::options_help()`,
+ * separated by whitespace. Paths containing spaces can be quoted, and
+ * relative paths are relative to the manifest's directory. Empty lines and
+ * lines starting with `#` are ignored. Every job starts out with `defaults`,
+ * and the line's options are applied on top of that.
+ */
+juce::Result read_manifest(const juce::File& manifest,
+                           const RenderSettings& defaults,
+                           std::vector<BatchJob>& jobs);
+
+struct BatchOptions {
+    /**
+     * The number of worker threads. Defaults to one per core.
+     */
+    size_t num_threads = 0;
+    /**
+     * Files longer than this are split into chunks of this length, so a
+     * single long file can be rendered by several workers at the same time.
+     * Set to 0 to never split files.
+     */
+    double chunk_seconds = 60.0;
+    /**
+     * Without checkpoints, every chunk other than a file's first chunk starts
+     * by processing this much of the audio leading up to the chunk and then
+     * throwing away the result. This brings the filters' state and the
+     * smoothed parameters to where they would have been if the file had been
+     * rendered in one go. The all-pass filters' impulse responses are
+     * infinite, so the output at chunk boundaries is only approximately the
+     * same as when rendering the file in one go. With very high resonance
+     * values and stage counts the impulse response can take seconds to decay,
+     * in which case this should be increased, chunking should be disabled, or
+     * the job should use a checkpoint file.
+     */
+    double preroll_seconds = 2.0;
+};
+
+/**
+ * Statistics for a call to `render_batch()`.
+ */
+struct BatchStats {
+    size_t num_threads = 0;
+    size_t num_files = 0;
+    size_t num_failed = 0;
+    size_t num_chunks = 0;
+    /**
+     * The length of all successfully rendered files combined.
+     */
+    double audio_seconds = 0.0;
+    /**
+     * The audio processed only to prime the filters before a chunk.
+     */
+    double preroll_seconds = 0.0;
+    /**
+     * The wall clock time for the entire batch.
+     */
+    double seconds = 0.0;
+
+    /**
+     * How many seconds of audio were rendered per second, over all workers
+     * combined.
+     */
+    double realtime_factor() const;
+};
+
+/**
+ * Render all of `jobs` using a pool of worker threads. Long files are split
+ * into chunks, and the chunks from all files are scheduled over the workers
+ * using a `WorkStealingQueue`, longest files first. For jobs with a checkpoint
+ * file, chunks start at the stored checkpoints so the output is bit for bit
+ * identical to a single render. If that file doesn't exist yet or doesn't
+ * match the job's settings, the job is rendered in one chunk that writes new
+ * checkpoints. `RenderSettings::start_seconds` is not supported here.
+ *
+ * A file's chunks are written in order by whichever worker finishes the chunk
+ * that's next in line, so outputs are written without any temporary files. A
+ * failing file doesn't stop the rest of the batch, and its incomplete output
+ * is removed.
+ *
+ * @param on_finished Called with the result for every file as soon as
+ *   it's done. This is called from the worker threads, but never from two
+ *   threads at the same time.
+ */
+void render_batch(
+    juce::AudioFormatManager& formats,
+    const std::vector<BatchJob>& jobs,
+    const BatchOptions& options,
+    BatchStats& stats,
+    std::function<void(const BatchJob&, const juce::Result&)> on_finished);
@@ -0,0 +1,380 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "checkpoints.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "automation.h"
+
+/**
+ * Build a four character tag the same way it's stored in the file, so it can
+ * be compared to values read with `InputStream::readInt()`.
+ */
+static constexpr int make_tag(const char (&tag)[5]) {
+    return static_cast<int>(static_cast<uint32_t>(tag[0]) |
+                            (static_cast<uint32_t>(tag[1]) << 8) |
+                            (static_cast<uint32_t>(tag[2]) << 16) |
+                            (static_cast<uint32_t>(tag[3]) << 24));
+}
+
+constexpr int checkpoints_magic = make_tag("DCKP");
+
+static bool has_bytes(juce::InputStream& stream, juce::int64 num_bytes) {
+    return stream.getNumBytesRemaining() >= num_bytes;
+}
+
+/**
+ * Used with `std::upper_bound()` to search checkpoints by position.
+ */
+static bool is_before(juce::int64 position,
+                      const Checkpoints::Checkpoint& checkpoint) {
+    return position < checkpoint.position;
+}
+
+static void write_smoother(juce::OutputStream& stream,
+                           const LinearSmoother::State& state) {
+    stream.writeFloat(state.current);
+    stream.writeFloat(state.target);
+    stream.writeFloat(state.step);
+    stream.writeInt(state.countdown);
+    stream.writeInt(state.steps_to_target);
+}
+
+static void read_smoother(juce::InputStream& stream,
+                          LinearSmoother::State& state) {
+    state.current = stream.readFloat();
+    state.target = stream.readFloat();
+    state.step = stream.readFloat();
+    state.countdown = stream.readInt();
+    state.steps_to_target = stream.readInt();
+}
+
+static void write_stages(
+    juce::OutputStream& stream,
+    const std::vector<DiopserEngine::State::Stage>& stages) {
+    stream.writeInt(static_cast<int>(stages.size()));
+    for (const auto& stage : stages) {
+        stream.writeFloat(stage.coefficients.b0);
+        stream.writeFloat(stage.coefficients.b1);
+        for (const auto& channel : stage.channels) {
+            stream.writeFloat(channel.s1);
+            stream.writeFloat(channel.s2);
+        }
+    }
+}
+
+/**
+ * The caller should make sure the stream contains all `num_stages` stages.
+ */
+static void read_stages(juce::InputStream& stream,
+                        uint32_t num_stages,
+                        uint32_t num_channels,
+                        std::vector<DiopserEngine::State::Stage>& stages) {
+    stages.resize(num_stages);
+    for (auto& stage : stages) {
+        stage.coefficients.b0 = stream.readFloat();
+        stage.coefficients.b1 = stream.readFloat();
+        stage.channels.resize(num_channels);
+        for (auto& channel : stage.channels) {
+            channel.s1 = stream.readFloat();
+            channel.s2 = stream.readFloat();
+        }
+    }
+}
+
+static void write_state(juce::OutputStream& stream,
+                        const DiopserEngine::State& state) {
+    stream.writeDouble(state.sample_rate);
+    stream.writeInt(static_cast<int>(state.num_channels));
+    stream.writeBool(state.filters_initialized);
+    write_stages(stream, state.stages);
+
+    write_smoother(stream, state.frequency);
+    write_smoother(stream, state.resonance);
+    write_smoother(stream, state.spread);
+    stream.writeInt(state.next_smooth_in);
+    stream.writeBool(state.old_spread_linear);
+
+    stream.writeBool(state.old_rotation_mode);
+    stream.writeInt(static_cast<int>(state.rotator.history.size()));
+    for (const float value : state.rotator.history) {
+        stream.writeFloat(value);
+    }
+    stream.writeBool(state.rotator.odd);
+    write_smoother(stream, state.rotator.angle);
+
+    stream.writeBool(state.old_design_mode);
+    stream.writeInt(static_cast<int>(state.design.size()));
+    for (const auto& stage : state.design) {
+        stream.writeFloat(stage.frequency);
+        stream.writeFloat(stage.resonance);
+    }
+    write_stages(stream, state.designed_stages);
+
+    stream.writeBool(state.old_safe_mode);
+    stream.writeFloat(state.limiter.envelope);
+}
+
+/**
+ * Returns false if the stream doesn't contain an entire engine state.
+ */
+static bool read_state(juce::InputStream& stream,
+                       DiopserEngine::State& state) {
+    constexpr juce::int64 header_size = 8 + 4 + 1 + 4;
+    constexpr juce::int64 smoother_size = 5 * 4;
+    constexpr juce::int64 smoothers_size = (3 * smoother_size) + 4 + 1;
+    // The rotator's history and the design have variable lengths
+    constexpr juce::int64 rotator_header_size = 1 + 4;
+    constexpr juce::int64 rotator_footer_size = 1 + smoother_size;
+    constexpr juce::int64 design_header_size = 1 + 4;
+    constexpr juce::int64 designed_stage_size = 2 * 4;
+    constexpr juce::int64 limiter_size = 1 + 4;
+
+    if (!has_bytes(stream, header_size)) {
+        return false;
+    }
+
+    state.sample_rate = stream.readDouble();
+    state.num_channels = static_cast<uint32_t>(stream.readInt());
+    state.filters_initialized = stream.readBool();
+    const auto num_stages = static_cast<uint32_t>(stream.readInt());
+
+    // This also keeps malformed files from causing huge allocations
+    const juce::int64 stage_size =
+        (2 * 4) + (static_cast<juce::int64>(state.num_channels) * 2 * 4);
+    if (!has_bytes(stream, (num_stages * stage_size) + smoothers_size +
+                               rotator_header_size + rotator_footer_size +
+                               design_header_size + 4 + limiter_size)) {
+        return false;
+    }
+
+    read_stages(stream, num_stages, state.num_channels, state.stages);
+
+    read_smoother(stream, state.frequency);
+    read_smoother(stream, state.resonance);
+    read_smoother(stream, state.spread);
+    state.next_smooth_in = stream.readInt();
+    state.old_spread_linear = stream.readBool();
+
+    state.old_rotation_mode = stream.readBool();
+    const auto history_size = static_cast<uint32_t>(stream.readInt());
+    if (!has_bytes(stream, (history_size * juce::int64(4)) +
+                               rotator_footer_size + design_header_size + 4 +
+                               limiter_size)) {
+        return false;
+    }
+
+    state.rotator.history.resize(history_size);
+    for (auto& value : state.rotator.history) {
+        value = stream.readFloat();
+    }
+    state.rotator.odd = stream.readBool();
+    read_smoother(stream, state.rotator.angle);
+
+    state.old_design_mode = stream.readBool();
+    const auto design_size = static_cast<uint32_t>(stream.readInt());
+    if (!has_bytes(stream,
+                   (design_size * designed_stage_size) + 4 + limiter_size)) {
+        return false;
+    }
+
+    state.design.resize(design_size);
+    for (auto& stage : state.design) {
+        stage.frequency = stream.readFloat();
+        stage.resonance = stream.readFloat();
+    }
+
+    const auto num_designed_stages = static_cast<uint32_t>(stream.readInt());
+    if (!has_bytes(stream,
+                   (num_designed_stages * stage_size) + limiter_size)) {
+        return false;
+    }
+
+    read_stages(stream, num_designed_stages, state.num_channels,
+                state.designed_stages);
+
+    state.old_safe_mode = stream.readBool();
+    state.limiter.envelope = stream.readFloat();
+
+    return true;
+}
+
+uint64_t Checkpoints::fingerprint(const RenderSettings& settings,
+                                  double sample_rate,
+                                  int num_channels) {
+    juce::MemoryOutputStream stream;
+    stream.writeDouble(sample_rate);
+    stream.writeInt(num_channels);
+
+    const DiopserEngine::Parameters& parameters = settings.parameters;
+    stream.writeInt64(static_cast<juce::int64>(settings.num_stages));
+    stream.writeFloat(parameters.frequency);
+    stream.writeFloat(parameters.resonance);
+    stream.writeFloat(parameters.spread);
+    stream.writeBool(parameters.spread_linear);
+    stream.writeInt(parameters.smoothing_interval);
+    stream.writeBool(parameters.safe_mode);
+    stream.writeBool(parameters.rotation_mode);
+    stream.writeFloat(parameters.rotation_angle);
+    stream.writeBool(parameters.design_mode);
+    stream.writeInt(static_cast<int>(settings.design.size()));
+    for (const auto& stage : settings.design) {
+        stream.writeFloat(stage.frequency);
+        stream.writeFloat(stage.resonance);
+    }
+
+    if (settings.automation) {
+        for (const auto& lane : settings.automation->lanes()) {
+            stream.writeInt(static_cast<int>(lane.parameter_id.size()));
+            stream.write(lane.parameter_id.data(), lane.parameter_id.size());
+            stream.writeInt(static_cast<int>(lane.points.size()));
+            for (const auto& point : lane.points) {
+                stream.writeDouble(point.time);
+                stream.writeFloat(point.value);
+                stream.writeBool(point.step);
+            }
+        }
+    }
+
+    // 64-bit FNV-1a
+    uint64_t hash = 0xcbf29ce484222325;
+    const auto* data = static_cast<const uint8_t*>(stream.getData());
+    for (size_t i = 0; i < stream.getDataSize(); i++) {
+        hash = (hash ^ data[i]) * 0x100000001b3;
+    }
+
+    return hash;
+}
+
+juce::int64 Checkpoints::interval(const RenderSettings& settings,
+                                  double sample_rate) {
+    return std::max<juce::int64>(
+        1, std::llround(settings.checkpoint_interval * sample_rate));
+}
+
+juce::Result Checkpoints::load(const juce::File& file,
+                               uint64_t expected_fingerprint) {
+    checkpoints_.clear();
+
+    juce::MemoryBlock data;
+    if (!file.loadFileAsData(data)) {
+        return juce::Result::fail("Could not read '" + file.getFullPathName() +
+                                  "'");
+    }
+
+    const juce::String malformed =
+        "'" + file.getFullPathName() + "' is not a valid checkpoint file";
+
+    juce::MemoryInputStream stream(data, false);
+    if (!has_bytes(stream, 4 + 4 + 8 + 4) ||
+        stream.readInt() != checkpoints_magic) {
+        return juce::Result::fail(malformed);
+    }
+    if (static_cast<uint32_t>(stream.readInt()) != version) {
+        return juce::Result::fail(
+            "'" + file.getFullPathName() +
+            "' was written by a different version of Diopser");
+    }
+    if (static_cast<uint64_t>(stream.readInt64()) != expected_fingerprint) {
+        return juce::Result::fail("'" + file.getFullPathName() +
+                                  "' was written using different settings");
+    }
+
+    std::vector<Checkpoint> checkpoints;
+    const auto count = static_cast<uint32_t>(stream.readInt());
+    for (uint32_t i = 0; i < count; i++) {
+        if (!has_bytes(stream, 8)) {
+            return juce::Result::fail(malformed);
+        }
+
+        Checkpoint checkpoint;
+        checkpoint.position = stream.readInt64();
+        if (!read_state(stream, checkpoint.state) ||
+            checkpoint.position <= 0 ||
+            (!checkpoints.empty() &&
+             checkpoint.position <= checkpoints.back().position)) {
+            return juce::Result::fail(malformed);
+        }
+
+        checkpoints.push_back(std::move(checkpoint));
+    }
+    if (!stream.isExhausted()) {
+        return juce::Result::fail(malformed);
+    }
+
+    checkpoints_ = std::move(checkpoints);
+
+    return juce::Result::ok();
+}
+
+juce::Result Checkpoints::save(const juce::File& file,
+                               uint64_t fingerprint) const {
+    const juce::String failed =
+        "Could not write '" + file.getFullPathName() + "'";
+
+    juce::TemporaryFile temporary_file(file);
+    {
+        juce::FileOutputStream stream(temporary_file.getFile());
+        if (stream.failedToOpen()) {
+            return juce::Result::fail(failed);
+        }
+
+        stream.writeInt(checkpoints_magic);
+        stream.writeInt(static_cast<int>(version));
+        stream.writeInt64(static_cast<juce::int64>(fingerprint));
+        stream.writeInt(static_cast<int>(checkpoints_.size()));
+        for (const auto& checkpoint : checkpoints_) {
+            stream.writeInt64(checkpoint.position);
+            write_state(stream, checkpoint.state);
+        }
+
+        stream.flush();
+        if (stream.getStatus().failed()) {
+            return juce::Result::fail(failed);
+        }
+    }
+
+    if (!temporary_file.overwriteTargetFileWithTemporary()) {
+        return juce::Result::fail(failed);
+    }
+
+    return juce::Result::ok();
+}
+
+void Checkpoints::add(juce::int64 position, DiopserEngine& engine) {
+    if (!checkpoints_.empty() && position <= checkpoints_.back().position) {
+        return;
+    }
+
+    Checkpoint& checkpoint = checkpoints_.emplace_back();
+    checkpoint.position = position;
+    engine.save_state(checkpoint.state);
+}
+
+void Checkpoints::remove_after(juce::int64 position) {
+    const auto first_after = std::upper_bound(
+        checkpoints_.begin(), checkpoints_.end(), position, is_before);
+    checkpoints_.erase(first_after, checkpoints_.end());
+}
+
+const Checkpoints::Checkpoint* Checkpoints::find(juce::int64 position) const {
+    const auto next = std::upper_bound(
+        checkpoints_.begin(), checkpoints_.end(), position, is_before);
+
+    return next == checkpoints_.begin() ? nullptr : &*std::prev(next);
+}
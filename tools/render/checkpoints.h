@@ -0,0 +1,117 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <juce_core/juce_core.h>
+
+#include "core/engine.h"
+#include "render.h"
+
+/**
+ * Snapshots of the engine's state at regular positions in a file, written
+ * while rendering. The filters' impulse responses can be very long, so
+ * starting a render in the middle of a file would otherwise require a long
+ * pre-roll that only approximates the original output. Restoring a checkpoint
+ * instead continues exactly where the original render was at that position,
+ * so partial re-renders and renders split over multiple threads match a full
+ * render bit for bit.
+ *
+ * A checkpoint only depends on the settings and on the input before its
+ * position. The settings are stored as a fingerprint, and checkpoints made
+ * with other settings are rejected. Changes to the input can't be detected,
+ * so after editing a file only the checkpoints before the edit are still
+ * valid.
+ *
+ * The file format uses little-endian byte order, like `BinaryState`:
+ *
+ * ```
+ * u32 magic ("DCKP")
+ * u32 version
+ * u64 fingerprint
+ * u32 count
+ * { i64 position, engine state }*
+ * ```
+ */
+class Checkpoints {
+   public:
+    struct Checkpoint {
+        juce::int64 position;
+        DiopserEngine::State state;
+    };
+
+    /**
+     * The current version of the format. Increment this whenever the layout
+     * or the meaning of the engine state changes.
+     */
+    static constexpr uint32_t version = 1;
+
+    /**
+     * A hash of everything other than the input audio that affects the
+     * output: the parameters, the design, the automation, the sample rate and
+     * the number of channels. The block size doesn't affect the output.
+     */
+    static uint64_t fingerprint(const RenderSettings& settings,
+                                double sample_rate,
+                                int num_channels);
+
+    /**
+     * `settings.checkpoint_interval` converted to samples.
+     */
+    static juce::int64 interval(const RenderSettings& settings,
+                                double sample_rate);
+
+    /**
+     * Load checkpoints from `file`, replacing the current checkpoints. Fails
+     * if the file is malformed or if it was made with a different fingerprint.
+     */
+    juce::Result load(const juce::File& file, uint64_t expected_fingerprint);
+
+    /**
+     * Write the checkpoints to `file`. The file is replaced atomically, so an
+     * interrupted render never leaves behind a broken file.
+     */
+    juce::Result save(const juce::File& file, uint64_t fingerprint) const;
+
+    /**
+     * Store the engine's current state as a checkpoint at `position`. This is
+     * ignored unless `position` comes after all existing checkpoints.
+     */
+    void add(juce::int64 position, DiopserEngine& engine);
+
+    /**
+     * Remove all checkpoints after `position`, for instance because they were
+     * made before the input was edited at that position.
+     */
+    void remove_after(juce::int64 position);
+
+    /**
+     * The last checkpoint at or before `position`, or `nullptr` if there are
+     * none.
+     */
+    const Checkpoint* find(juce::int64 position) const;
+
+    /**
+     * Sorted by position.
+     */
+    const std::vector<Checkpoint>& checkpoints() const { return checkpoints_; }
+
+   private:
+    std::vector<Checkpoint> checkpoints_;
+};
@@ -0,0 +1,185 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// `diopser-render` applies Diopser to audio files without needing a host. Run
+// with `--help` for the available options.
+
+#include <algorithm>
+#include <iostream>
+
+#include <juce_audio_formats/juce_audio_formats.h>
+
+#include "batch.h"
+#include "render.h"
+
+static void render_command(const juce::ArgumentList& args) {
+    juce::Array<juce::File> files;
+    for (const auto& arg : args.arguments) {
+        if (!arg.isOption()) {
+            files.add(arg.resolveAsFile());
+        }
+    }
+    if (files.size() != 2) {
+        juce::ConsoleApplication::fail(
+            "Expected an input and an output file, see --help");
+    }
+
+    RenderSettings settings;
+    const juce::Result result = settings.apply_arguments(args);
+    if (result.failed()) {
+        juce::ConsoleApplication::fail(result.getErrorMessage());
+    }
+
+    juce::AudioFormatManager formats;
+    formats.registerBasicFormats();
+    juce::TimeSliceThread writer_thread("diopser-render writer");
+    writer_thread.startThread();
+
+    RenderStats stats;
+    const juce::Result render_result = render_file(
+        formats, writer_thread, files[0], files[1], settings, stats);
+    writer_thread.stopThread(1000);
+    if (render_result.failed()) {
+        juce::ConsoleApplication::fail(render_result.getErrorMessage());
+    }
+
+    if (!args.containsOption("--quiet")) {
+        std::cout << "Rendered "
+                  << static_cast<double>(stats.num_samples) / stats.sample_rate
+                  << " seconds of audio in " << stats.seconds << " seconds ("
+                  << stats.realtime_factor() << "x real time)\n";
+    }
+}
+
+static void batch_command(const juce::ArgumentList& args) {
+    juce::Array<juce::File> files;
+    for (const auto& arg : args.arguments) {
+        if (!arg.isOption()) {
+            files.add(arg.resolveAsFile());
+        }
+    }
+    if (files.size() != 1) {
+        juce::ConsoleApplication::fail("Expected a manifest file, see --help");
+    }
+
+    // Options on the command line apply to every file in the manifest, unless
+    // the manifest overrides them
+    RenderSettings defaults;
+    const juce::Result result = defaults.apply_arguments(args);
+    if (result.failed()) {
+        juce::ConsoleApplication::fail(result.getErrorMessage());
+    }
+
+    std::vector<BatchJob> jobs;
+    const juce::Result manifest_result =
+        read_manifest(files[0], defaults, jobs);
+    if (manifest_result.failed()) {
+        juce::ConsoleApplication::fail(manifest_result.getErrorMessage());
+    }
+
+    BatchOptions options;
+    if (args.containsOption("--jobs")) {
+        options.num_threads = static_cast<size_t>(
+            std::max(1, args.getValueForOption("--jobs").getIntValue()));
+    }
+    if (args.containsOption("--chunk-seconds")) {
+        options.chunk_seconds = std::max(
+            0.0, args.getValueForOption("--chunk-seconds").getDoubleValue());
+    }
+    if (args.containsOption("--preroll-seconds")) {
+        options.preroll_seconds = std::max(
+            0.0, args.getValueForOption("--preroll-seconds").getDoubleValue());
+    }
+
+    juce::AudioFormatManager formats;
+    formats.registerBasicFormats();
+
+    const bool quiet = args.containsOption("--quiet");
+    size_t num_finished = 0;
+    BatchStats stats;
+    render_batch(formats, jobs, options, stats,
+                 [&](const BatchJob& job, const juce::Result& result) {
+                     num_finished += 1;
+                     if (result.failed()) {
+                         std::cerr << "[" << num_finished << "/" << jobs.size()
+                                   << "] Failed to render '"
+                                   << job.input.getFullPathName()
+                                   << "': " << result.getErrorMessage()
+                                   << "\n";
+                     } else if (!quiet) {
+                         std::cout << "[" << num_finished << "/" << jobs.size()
+                                   << "] " << job.output.getFullPathName()
+                                   << "\n";
+                     }
+                 });
+
+    if (!quiet) {
+        std::cout << "Rendered " << stats.num_files - stats.num_failed << " of "
+                  << stats.num_files << " files in " << stats.num_chunks
+                  << " chunks using " << stats.num_threads << " threads\n"
+                  << stats.audio_seconds << " seconds of audio in "
+                  << stats.seconds << " seconds (" << stats.realtime_factor()
+                  << "x real time), plus " << stats.preroll_seconds
+                  << " seconds of pre-roll\n";
+    }
+
+    if (stats.num_failed > 0) {
+        juce::ConsoleApplication::fail(juce::String(stats.num_failed) +
+                                       " files failed to render");
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const juce::String usage =
+        juce::String("Usage: diopser-render <input> <output> [options]\n"
+                     "\n"
+                     "Applies Diopser to an audio file. The output format is "
+                     "chosen based on the output's\nfile extension.\n"
+                     "\n"
+                     "Options:\n") +
+        RenderSettings::options_help() +
+        "  --quiet                  Don't print any statistics\n"
+        "\n"
+        "Usage: diopser-render --batch <manifest> [options]\n"
+        "\n"
+        "Renders every file from a manifest in parallel. Every line in the "
+        "manifest contains an\ninput file, an output file, and optionally any "
+        "of the options above. Relative paths\nare relative to the manifest. "
+        "Options passed on the command line apply to every\nfile unless the "
+        "manifest overrides them. Long files are split into chunks that are\n"
+        "rendered separately, with a short pre-roll to prime the filters. "
+        "Files with\n--checkpoints are split at their checkpoints instead, "
+        "without any pre-roll.\n"
+        "\n"
+        "Batch options:\n"
+        "  --jobs=<n>               Number of worker threads (default: one "
+        "per core)\n"
+        "  --chunk-seconds=<s>      Split files into chunks of this length, or "
+        "0 to never\n"
+        "                           split files (default: 60)\n"
+        "  --preroll-seconds=<s>    Audio to process before every chunk "
+        "(default: 2)\n";
+
+    juce::ConsoleApplication app;
+    app.addHelpCommand("--help|-h", usage, true);
+    app.addCommand({"--batch", "--batch <manifest> [options]",
+                    "Render all files from a manifest", usage,
+                    batch_command});
+    app.addDefaultCommand({"", "<input> <output> [options]",
+                           "Render a file", usage, render_command});
+
+    return app.findAndRunCommand(argc, argv);
+}
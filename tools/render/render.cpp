@@ -0,0 +1,497 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "render.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "automation.h"
+#include "checkpoints.h"
+#include "core/denormals.h"
+#include "design_target.h"
+#include "parameter_ids.h"
+#include "renderer.h"
+#include "state.h"
+
+/**
+ * The number of blocks the background writer can buffer before processing
+ * has to wait for it.
+ */
+constexpr int writer_buffer_blocks = 4;
+
+/**
+ * The default tolerance for `--design`, as a fraction of the target's peak
+ * group delay. This is the same tolerance the plugin uses.
+ */
+constexpr float default_design_relative_tolerance = 0.02f;
+
+StreamingReader::StreamingReader(juce::AudioFormat& format,
+                                 const juce::File& file,
+                                 juce::int64 window_size) {
+    mapped_reader_.reset(format.createMemoryMappedReader(file));
+    if (mapped_reader_) {
+        window_size_ = window_size;
+    } else if (auto stream = file.createInputStream()) {
+        reader_.reset(format.createReaderFor(stream.release(), true));
+    }
+}
+
+juce::AudioFormatReader* StreamingReader::get() {
+    return mapped_reader_ ? mapped_reader_.get() : reader_.get();
+}
+
+bool StreamingReader::read(float* const* samples,
+                           int num_channels,
+                           juce::int64 start_sample,
+                           int num_samples) {
+    if (mapped_reader_) {
+        const juce::Range<juce::int64> needed(start_sample,
+                                              start_sample + num_samples);
+        if (!mapped_reader_->getMappedSection().contains(needed)) {
+            // This replaces the previous mapping
+            const juce::int64 end = std::min(
+                mapped_reader_->lengthInSamples,
+                start_sample +
+                    std::max<juce::int64>(window_size_, num_samples));
+            if (!mapped_reader_->mapSectionOfFile({start_sample, end})) {
+                return false;
+            }
+        }
+
+        return mapped_reader_->read(samples, num_channels, start_sample,
+                                    num_samples);
+    } else {
+        return reader_->read(samples, num_channels, start_sample,
+                             num_samples);
+    }
+}
+
+bool RenderSettings::set_parameter(std::string_view id, float value) {
+    // These are the same ranges the plugin's parameters use
+    if (id == filter_stages_param_name) {
+        stages_parameter = juce::jlimit(0, 512, juce::roundToInt(value));
+    } else if (id == extended_stages_param_name) {
+        extended_stages = value >= 0.5f;
+    } else if (id == extended_filter_stages_param_name) {
+        extended_stages_parameter =
+            juce::jlimit(0, max_extended_stages, juce::roundToInt(value));
+    } else if (id == filter_frequency_param_name) {
+        parameters.frequency = juce::jlimit(5.0f, 20000.0f, value);
+    } else if (id == filter_resonance_param_name) {
+        parameters.resonance = juce::jlimit(0.01f, 30.0f, value);
+    } else if (id == filter_spread_param_name) {
+        parameters.spread = juce::jlimit(-5000.0f, 5000.0f, value);
+    } else if (id == filter_spread_linear_param_name) {
+        parameters.spread_linear = value >= 0.5f;
+    } else if (id == rotation_mode_param_name) {
+        parameters.rotation_mode = value >= 0.5f;
+    } else if (id == rotation_angle_param_name) {
+        parameters.rotation_angle = juce::jlimit(-180.0f, 180.0f, value);
+    } else if (id == design_mode_param_name) {
+        parameters.design_mode = value >= 0.5f;
+    } else if (id == smoothing_interval_param_name) {
+        parameters.smoothing_interval =
+            juce::jlimit(1, 512, juce::roundToInt(value));
+    } else if (id == safe_mode_param_name) {
+        parameters.safe_mode = value >= 0.5f;
+    } else {
+        return false;
+    }
+
+    num_stages = static_cast<size_t>(
+        extended_stages ? extended_stages_parameter : stages_parameter);
+
+    return true;
+}
+
+juce::Result RenderSettings::load_state(const juce::File& file) {
+    juce::MemoryBlock state;
+    if (!file.loadFileAsData(state)) {
+        return juce::Result::fail("Could not read '" + file.getFullPathName() +
+                                  "'");
+    }
+
+    if (!BinaryState::is_binary_state(state.getData(), state.getSize())) {
+        return juce::Result::fail(
+            "'" + file.getFullPathName() +
+            "' is not a state saved by this version of Diopser");
+    }
+
+    // Unknown parameters are ignored, just like the plugin does
+    std::vector<DesignedStage> loaded_design;
+    if (!BinaryState::read(
+            state.getData(), state.getSize(),
+            [this](std::string_view id, float value) {
+                set_parameter(id, value);
+            },
+            [&](const DesignedStage& stage) {
+                loaded_design.push_back(stage);
+            })) {
+        return juce::Result::fail("'" + file.getFullPathName() +
+                                  "' is not a valid state");
+    }
+
+    // Like in the plugin, a state without a valid design can't use the design
+    // mode
+    if (!loaded_design.empty()) {
+        design = std::move(loaded_design);
+    } else {
+        parameters.design_mode = false;
+    }
+
+    return juce::Result::ok();
+}
+
+/**
+ * Command line options that directly set one of the plugin's parameters.
+ */
+struct ParameterOption {
+    const char* option;
+    const char* parameter_id;
+};
+
+constexpr ParameterOption parameter_options[] = {
+    {"--stages", filter_stages_param_name},
+    {"--extended-stages", extended_filter_stages_param_name},
+    {"--frequency", filter_frequency_param_name},
+    {"--resonance", filter_resonance_param_name},
+    {"--spread", filter_spread_param_name},
+    {"--rotate", rotation_angle_param_name},
+    {"--smoothing-interval", smoothing_interval_param_name},
+};
+
+juce::Result RenderSettings::apply_arguments(const juce::ArgumentList& args) {
+    if (args.containsOption("--state")) {
+        const juce::Result result =
+            load_state(args.getFileForOption("--state"));
+        if (result.failed()) {
+            return result;
+        }
+    }
+
+    for (const auto& [option, parameter_id] : parameter_options) {
+        if (args.containsOption(option)) {
+            const juce::String value = args.getValueForOption(option);
+            if (!value.containsOnly("0123456789.-")) {
+                return juce::Result::fail("Invalid value '" + value +
+                                          "' for " + option);
+            }
+
+            set_parameter(parameter_id, value.getFloatValue());
+        }
+    }
+
+    if (args.containsOption("--automation")) {
+        auto loaded_automation = std::make_shared<Automation>();
+        const juce::Result result =
+            loaded_automation->load(args.getFileForOption("--automation"));
+        if (result.failed()) {
+            return result;
+        }
+
+        automation = std::move(loaded_automation);
+    }
+
+    // The design is stored as frequencies and resonances, so it doesn't
+    // depend on the input's sample rate
+    if (args.containsOption("--design")) {
+        GroupDelayDesigner::Settings design_settings;
+        const juce::Result result = load_design_target(
+            args.getFileForOption("--design"), design_settings.target);
+        if (result.failed()) {
+            return result;
+        }
+
+        float peak_group_delay_ms = 0.0f;
+        for (const auto& point : design_settings.target) {
+            peak_group_delay_ms =
+                std::max(peak_group_delay_ms, point.group_delay_ms);
+        }
+        design_settings.tolerance_ms =
+            args.containsOption("--design-tolerance")
+                ? std::max(0.0f, args.getValueForOption("--design-tolerance")
+                                     .getFloatValue())
+                : peak_group_delay_ms * default_design_relative_tolerance;
+        if (args.containsOption("--design-max-stages")) {
+            design_settings.max_stages = static_cast<size_t>(juce::jlimit(
+                0, 4096,
+                args.getValueForOption("--design-max-stages").getIntValue()));
+        }
+
+        const std::atomic_bool cancelled = false;
+        design =
+            GroupDelayDesigner::design(design_settings, cancelled).stages;
+        set_parameter(design_mode_param_name, 1.0f);
+    }
+
+    if (args.containsOption("--checkpoints")) {
+        checkpoint_file = args.getFileForOption("--checkpoints");
+    }
+    if (args.containsOption("--checkpoint-interval")) {
+        checkpoint_interval = std::max(
+            0.001,
+            args.getValueForOption("--checkpoint-interval").getDoubleValue());
+    }
+    if (args.containsOption("--start")) {
+        start_seconds =
+            std::max(0.0, args.getValueForOption("--start").getDoubleValue());
+    }
+
+    if (args.containsOption("--spread-linear")) {
+        parameters.spread_linear = true;
+    }
+    if (args.containsOption("--extended-stages")) {
+        set_parameter(extended_stages_param_name, 1.0f);
+    }
+    if (args.containsOption("--rotate")) {
+        set_parameter(rotation_mode_param_name, 1.0f);
+    }
+    if (args.containsOption("--no-safe-mode")) {
+        parameters.safe_mode = false;
+    }
+
+    if (args.containsOption("--block-size")) {
+        block_size = static_cast<size_t>(juce::jlimit(
+            1, 1 << 20, args.getValueForOption("--block-size").getIntValue()));
+    }
+    if (args.containsOption("--bits")) {
+        bits_per_sample = args.getValueForOption("--bits").getIntValue();
+    }
+
+    return juce::Result::ok();
+}
+
+const char* RenderSettings::options_help() {
+    return "  --state=<file>           Load the parameters from a state saved "
+           "by the plugin\n"
+           "  --stages=<n>             Number of filter stages, 0-512\n"
+           "  --extended-stages=<n>    Use the extended stage range with "
+           "this many stages\n"
+           "                           instead, 0-4096\n"
+           "  --frequency=<hz>         Filter frequency, 5-20000 Hz\n"
+           "  --resonance=<q>          Filter resonance, 0.01-30\n"
+           "  --spread=<hz>            Filter spread, -5000-5000 Hz\n"
+           "  --spread-linear          Use a linear instead of a logarithmic "
+           "spread\n"
+           "  --rotate=<degrees>       Rotate the phase by a fixed angle "
+           "instead of using the\n"
+           "                           filters, -180-180 degrees\n"
+           "  --smoothing-interval=<n> Samples between coefficient updates, "
+           "1-512\n"
+           "  --no-safe-mode           Disable the safety limiter\n"
+           "  --design=<file>          Replace the filters with the smallest "
+           "cascade matching the\n"
+           "                           group delay curve in this file, with "
+           "one 'frequency\n"
+           "                           group_delay_ms' pair per line\n"
+           "  --design-tolerance=<ms>  The design's allowed RMS error "
+           "(default: 2% of the peak)\n"
+           "  --design-max-stages=<n>  The design's maximum number of stages "
+           "(default: 512)\n"
+           "  --automation=<file>      Automate the parameters using "
+           "breakpoints from a CSV or\n"
+           "                           JSON file\n"
+           "  --checkpoints=<file>     Read and write checkpoints of the "
+           "filter state\n"
+           "  --checkpoint-interval=<s> Seconds between checkpoints (default: "
+           "10)\n"
+           "  --start=<s>              Only render the input after this point, "
+           "starting from the\n"
+           "                           last checkpoint before it\n"
+           "  --block-size=<n>         Samples per processing block (default: "
+           "8192)\n"
+           "  --bits=<n>               Output bit depth (default: the input's)"
+           "\n";
+}
+
+double RenderStats::realtime_factor() const {
+    return seconds > 0.0 ? (static_cast<double>(num_samples) / sample_rate) /
+                               seconds
+                         : 0.0;
+}
+
+juce::Result create_writer(juce::AudioFormatManager& formats,
+                           const juce::File& output,
+                           const juce::AudioFormatReader& source,
+                           int bits_per_sample,
+                           std::unique_ptr<juce::AudioFormatWriter>& writer) {
+    juce::AudioFormat* output_format =
+        formats.findFormatForFileExtension(output.getFileExtension());
+    if (!output_format) {
+        return juce::Result::fail("Unsupported output format for '" +
+                                  output.getFullPathName() + "'");
+    }
+
+    const int num_channels = static_cast<int>(source.numChannels);
+    const int requested_bits_per_sample = bits_per_sample;
+    if (bits_per_sample <= 0) {
+        bits_per_sample = static_cast<int>(source.bitsPerSample);
+    }
+    const juce::Array<int> possible_bit_depths =
+        output_format->getPossibleBitDepths();
+    if (!possible_bit_depths.contains(bits_per_sample)) {
+        if (requested_bits_per_sample > 0) {
+            return juce::Result::fail(
+                juce::String(bits_per_sample) +
+                "-bit output is not supported for this format");
+        }
+
+        bits_per_sample = possible_bit_depths.contains(24)
+                              ? 24
+                              : possible_bit_depths.getLast();
+    }
+
+    if (output.exists() && !output.deleteFile()) {
+        return juce::Result::fail("Could not replace '" +
+                                  output.getFullPathName() + "'");
+    }
+    auto output_stream = std::make_unique<juce::FileOutputStream>(output);
+    if (output_stream->failedToOpen()) {
+        return juce::Result::fail("Could not open '" +
+                                  output.getFullPathName() + "' for writing");
+    }
+
+    writer.reset(output_format->createWriterFor(
+        output_stream.get(), source.sampleRate,
+        static_cast<unsigned int>(num_channels), bits_per_sample,
+        source.metadataValues, 0));
+    if (!writer) {
+        return juce::Result::fail("Could not write " +
+                                  juce::String(num_channels) + " channels at " +
+                                  juce::String(source.sampleRate) +
+                                  " Hz to '" + output.getFullPathName() + "'");
+    }
+    // The writer now owns the stream
+    output_stream.release();
+
+    return juce::Result::ok();
+}
+
+juce::Result render_file(juce::AudioFormatManager& formats,
+                         juce::TimeSliceThread& writer_thread,
+                         const juce::File& input,
+                         const juce::File& output,
+                         const RenderSettings& settings,
+                         RenderStats& stats) {
+    const double start_time = juce::Time::getMillisecondCounterHiRes();
+
+    if (input == output) {
+        return juce::Result::fail("The input and output files are the same");
+    }
+
+    juce::AudioFormat* input_format =
+        formats.findFormatForFileExtension(input.getFileExtension());
+    if (!input_format) {
+        return juce::Result::fail("Unsupported input format for '" +
+                                  input.getFullPathName() + "'");
+    }
+
+    const int block_size = static_cast<int>(settings.block_size);
+    StreamingReader reader(*input_format, input,
+                           mapped_window_blocks * block_size);
+    juce::AudioFormatReader* source = reader.get();
+    if (!source) {
+        return juce::Result::fail("Could not open '" + input.getFullPathName() +
+                                  "'");
+    }
+
+    const int num_channels = static_cast<int>(source->numChannels);
+    const juce::int64 length = source->lengthInSamples;
+    const juce::int64 start = std::clamp<juce::int64>(
+        std::llround(settings.start_seconds * source->sampleRate), 0, length);
+
+    Checkpoints checkpoints;
+    const bool use_checkpoints = settings.checkpoint_file != juce::File();
+    const uint64_t fingerprint =
+        Checkpoints::fingerprint(settings, source->sampleRate, num_channels);
+    if (use_checkpoints && settings.checkpoint_file.existsAsFile()) {
+        const juce::Result result =
+            checkpoints.load(settings.checkpoint_file, fingerprint);
+
+        // Unusable checkpoints would get replaced anyway when rendering the
+        // entire file
+        if (result.failed() && start > 0) {
+            return result;
+        }
+    }
+    checkpoints.remove_after(start);
+
+    std::unique_ptr<juce::AudioFormatWriter> writer;
+    const juce::Result writer_result = create_writer(
+        formats, output, *source, settings.bits_per_sample, writer);
+    if (writer_result.failed()) {
+        return writer_result;
+    }
+
+    // The threaded writer takes ownership of the writer, and it writes any
+    // remaining buffered audio when it gets destroyed
+    auto threaded_writer =
+        std::make_unique<juce::AudioFormatWriter::ThreadedWriter>(
+            writer.release(), writer_thread,
+            block_size * writer_buffer_blocks);
+
+    const ScopedFlushDenormals flush_denormals;
+    Renderer renderer(reader, settings, 0);
+    if (const auto* checkpoint = checkpoints.find(start)) {
+        const juce::Result result = renderer.restore(*checkpoint);
+        if (result.failed()) {
+            return result;
+        }
+    }
+    if (use_checkpoints) {
+        renderer.record_checkpoints(
+            checkpoints,
+            Checkpoints::interval(settings, source->sampleRate));
+    }
+
+    // Everything between the checkpoint and the starting position is only
+    // processed to get the engine into the right state
+    while (renderer.position() < length) {
+        const bool before_start = renderer.position() < start;
+        int num_samples;
+        if (!renderer.process_block(before_start ? start : length,
+                                    num_samples)) {
+            return juce::Result::fail("Could not read from '" +
+                                      input.getFullPathName() + "'");
+        }
+
+        // This only fails when the writer's buffer is full, in which case
+        // we'll need to wait for the writer thread to catch up
+        while (!before_start &&
+               !threaded_writer->write(
+                   renderer.buffer().getArrayOfReadPointers(), num_samples)) {
+            juce::Thread::sleep(1);
+        }
+    }
+
+    threaded_writer.reset();
+
+    if (use_checkpoints) {
+        const juce::Result result =
+            checkpoints.save(settings.checkpoint_file, fingerprint);
+        if (result.failed()) {
+            return result;
+        }
+    }
+
+    stats.num_samples = length - start;
+    stats.sample_rate = source->sampleRate;
+    stats.seconds =
+        (juce::Time::getMillisecondCounterHiRes() - start_time) / 1000.0;
+
+    return juce::Result::ok();
+}
@@ -0,0 +1,196 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include <juce_audio_formats/juce_audio_formats.h>
+
+#include "core/engine.h"
+
+class Automation;
+
+/**
+ * Everything needed to render a file other than the file names. The defaults
+ * match the plugin's default parameter values.
+ */
+struct RenderSettings {
+    DiopserEngine::Parameters parameters;
+    /**
+     * The actual number of stages, taken from either the regular or the
+     * extended filter stages parameter depending on the extended stage range
+     * parameter.
+     */
+    size_t num_stages = 0;
+    int stages_parameter = 0;
+    int extended_stages_parameter = 0;
+    bool extended_stages = false;
+    /**
+     * The stages used in the design mode, either loaded from a state or
+     * designed with `--design`. The engine clamps the frequencies to the
+     * input's sample rate.
+     */
+    std::vector<DesignedStage> design;
+
+    /**
+     * Audio is processed in blocks of this many samples. There's no host
+     * waiting for the output, so these can be much larger than in the plugin.
+     */
+    size_t block_size = 8192;
+    /**
+     * The output's bit depth, or 0 to use the input's bit depth if the output
+     * format supports it.
+     */
+    int bits_per_sample = 0;
+
+    /**
+     * Optional automation for the parameters. The values above are used for
+     * parameters without automation. This is shared between copies of the
+     * settings since it never changes after loading.
+     */
+    std::shared_ptr<const Automation> automation;
+
+    /**
+     * If set, checkpoints of the engine's state are read from and written to
+     * this file. See `Checkpoints`.
+     */
+    juce::File checkpoint_file;
+    /**
+     * The time between two checkpoints, in seconds.
+     */
+    double checkpoint_interval = 10.0;
+    /**
+     * Only render the part of the input after this many seconds. Rendering
+     * starts from the last checkpoint before this point, or from the start
+     * of the file if there is none, so the output is identical to the same
+     * part of a full render.
+     */
+    double start_seconds = 0.0;
+
+    /**
+     * Set one of the plugin's parameters by its ID to a denormalized value,
+     * clamped to the parameter's range.
+     *
+     * @return False if `id` is not one of the plugin's parameters.
+     */
+    bool set_parameter(std::string_view id, float value);
+
+    /**
+     * Apply the parameters from a state saved by the plugin's
+     * `getStateInformation()`. Only the binary state format is supported.
+     * Parameters that aren't in the state keep their current values, and the
+     * design is only replaced if the state contains one.
+     */
+    juce::Result load_state(const juce::File& file);
+
+    /**
+     * Apply the settings from command line options like `--frequency=200`.
+     * If `--state=<file>` is used, that state is loaded first so the other
+     * options can override parameters from it. `--automation=<file>` loads
+     * automation using `Automation::load()`, and `--design=<file>` runs the
+     * group delay designer on a target read using `load_design_target()`.
+     * Arguments that aren't options are ignored.
+     */
+    juce::Result apply_arguments(const juce::ArgumentList& args);
+
+    /**
+     * A description of the options understood by `apply_arguments()`, for
+     * the help text.
+     */
+    static const char* options_help();
+};
+
+/**
+ * The number of blocks in the section of a memory mapped input file that's
+ * mapped at any given time.
+ */
+constexpr juce::int64 mapped_window_blocks = 64;
+
+/**
+ * Reads an input file block by block. WAV and AIFF files are memory mapped,
+ * but only a window around the current position is mapped at any time so
+ * multi-hour files don't use more address space or page cache than short
+ * ones. Other formats are read using their regular readers.
+ */
+class StreamingReader {
+   public:
+    StreamingReader(juce::AudioFormat& format,
+                    const juce::File& file,
+                    juce::int64 window_size);
+
+    /**
+     * Returns `nullptr` if the file could not be opened.
+     */
+    juce::AudioFormatReader* get();
+
+    bool read(float* const* samples,
+              int num_channels,
+              juce::int64 start_sample,
+              int num_samples);
+
+   private:
+    std::unique_ptr<juce::MemoryMappedAudioFormatReader> mapped_reader_;
+    std::unique_ptr<juce::AudioFormatReader> reader_;
+    juce::int64 window_size_ = 0;
+};
+
+/**
+ * Statistics for a single call to `render_file()`.
+ */
+struct RenderStats {
+    juce::int64 num_samples = 0;
+    double sample_rate = 0.0;
+    double seconds = 0.0;
+
+    /**
+     * How many seconds of audio were rendered per second.
+     */
+    double realtime_factor() const;
+};
+
+/**
+ * Create a writer for `output` with the same sample rate, channel count and
+ * metadata as `source`, replacing `output` if it already exists. The format is
+ * chosen based on the file extension. If `bits_per_sample` is 0, then
+ * `source`'s bit depth is used if the format supports it.
+ */
+juce::Result create_writer(juce::AudioFormatManager& formats,
+                           const juce::File& output,
+                           const juce::AudioFormatReader& source,
+                           int bits_per_sample,
+                           std::unique_ptr<juce::AudioFormatWriter>& writer);
+
+/**
+ * Apply Diopser to `input` and write the result to `output`, replacing it if
+ * it already exists. The output format is chosen based on `output`'s file
+ * extension. WAV and AIFF inputs are read through a memory mapped window that
+ * slides along the file, and the output is written from `writer_thread`, so
+ * memory usage does not depend on the length of the file. `writer_thread`
+ * must already be running, and it can be shared between renders.
+ *
+ * With `settings.checkpoint_file` set, checkpoints after the starting position
+ * are replaced by new ones while rendering. With `settings.start_seconds` set,
+ * only the part after that point is written to `output`.
+ */
+juce::Result render_file(juce::AudioFormatManager& formats,
+                         juce::TimeSliceThread& writer_thread,
+                         const juce::File& input,
+                         const juce::File& output,
+                         const RenderSettings& settings,
+                         RenderStats& stats);
@@ -0,0 +1,81 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "renderer.h"
+
+#include <algorithm>
+
+Renderer::Renderer(StreamingReader& reader,
+                   const RenderSettings& settings,
+                   juce::int64 start_position)
+    : reader_(reader),
+      settings_(settings),
+      sample_rate_(reader.get()->sampleRate),
+      num_channels_(static_cast<int>(reader.get()->numChannels)),
+      position_(start_position),
+      automation_(settings, sample_rate_, start_position),
+      buffer_(num_channels_, static_cast<int>(settings.block_size)) {
+    engine_.prepare(sample_rate_, settings.block_size,
+                    static_cast<size_t>(num_channels_),
+                    automation_.settings().num_stages,
+                    automation_.settings().parameters.smoothing_interval);
+    engine_.set_design(settings.design);
+}
+
+juce::Result Renderer::restore(const Checkpoints::Checkpoint& checkpoint) {
+    if (!engine_.restore_state(checkpoint.state)) {
+        return juce::Result::fail(
+            "The checkpoint doesn't match the input file's format");
+    }
+
+    position_ = checkpoint.position;
+    automation_ = AutomationPlayer(settings_, sample_rate_, position_);
+    automation_.set_engine_num_stages(checkpoint.state.stages.size());
+
+    return juce::Result::ok();
+}
+
+void Renderer::record_checkpoints(Checkpoints& checkpoints,
+                                  juce::int64 interval) {
+    recorded_checkpoints_ = &checkpoints;
+    checkpoint_interval_ = std::max<juce::int64>(1, interval);
+}
+
+bool Renderer::process_block(juce::int64 end, int& num_samples) {
+    juce::int64 length =
+        std::min<juce::int64>(buffer_.getNumSamples(), end - position_);
+    if (recorded_checkpoints_) {
+        if (position_ > 0 && position_ % checkpoint_interval_ == 0) {
+            recorded_checkpoints_->add(position_, engine_);
+        }
+
+        length = std::min(length, checkpoint_interval_ -
+                                      (position_ % checkpoint_interval_));
+    }
+
+    num_samples = static_cast<int>(length);
+    if (!reader_.read(buffer_.getArrayOfWritePointers(), num_channels_,
+                      position_, num_samples)) {
+        return false;
+    }
+
+    automation_.process(engine_, buffer_.getArrayOfWritePointers(),
+                        static_cast<size_t>(num_channels_),
+                        static_cast<size_t>(num_samples));
+    position_ += length;
+
+    return true;
+}
@@ -0,0 +1,78 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <juce_audio_formats/juce_audio_formats.h>
+
+#include "automation.h"
+#include "checkpoints.h"
+#include "core/engine.h"
+#include "render.h"
+
+/**
+ * Processes an input file block by block from some starting position. This
+ * ties together the reader, the engine, automation and checkpoints, so single
+ * file renders and batch renders process audio in exactly the same way. The
+ * caller is responsible for disabling denormals.
+ */
+class Renderer {
+   public:
+    /**
+     * Prepare an engine to start processing at `start_position` with a clean
+     * state. The reader and the settings must outlive this object.
+     */
+    Renderer(StreamingReader& reader,
+             const RenderSettings& settings,
+             juce::int64 start_position);
+
+    /**
+     * Continue from a checkpoint's position and state instead.
+     */
+    juce::Result restore(const Checkpoints::Checkpoint& checkpoint);
+
+    /**
+     * Add a checkpoint to `checkpoints` whenever the position reaches a
+     * multiple of `interval` samples. Blocks are split at those positions.
+     */
+    void record_checkpoints(Checkpoints& checkpoints, juce::int64 interval);
+
+    /**
+     * Process the next block, which is at most the block size long and never
+     * extends past `end`. The processed audio can then be read from
+     * `buffer()`.
+     *
+     * @return False if the input file could not be read.
+     */
+    bool process_block(juce::int64 end, int& num_samples);
+
+    juce::int64 position() const { return position_; }
+    const juce::AudioBuffer<float>& buffer() const { return buffer_; }
+
+   private:
+    StreamingReader& reader_;
+    const RenderSettings& settings_;
+    const double sample_rate_;
+    const int num_channels_;
+
+    juce::int64 position_;
+    AutomationPlayer automation_;
+    DiopserEngine engine_;
+    juce::AudioBuffer<float> buffer_;
+
+    Checkpoints* recorded_checkpoints_ = nullptr;
+    juce::int64 checkpoint_interval_ = 0;
+};
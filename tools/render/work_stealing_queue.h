@@ -0,0 +1,84 @@
+// Diopser: a phase rotation plugin
+// Copyright (C) 2021-2022 Robbert van der Helm
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+/**
+ * A set of task queues, one per worker thread. Workers take tasks from their
+ * own queue, and when that runs out they steal from the other workers' queues
+ * instead of going idle. Tasks are always taken from the front, including when
+ * stealing. The batch renderer queues a file's chunks in order, so this way a
+ * file's chunks finish roughly in order regardless of which worker renders
+ * them, and only a few finished chunks need to be kept around until they can
+ * be written.
+ *
+ * The queues are only accessed once per task, and a task takes at least
+ * milliseconds to complete, so a mutex per queue is plenty.
+ */
+template <typename T>
+class WorkStealingQueue {
+   public:
+    explicit WorkStealingQueue(size_t num_workers) : queues_(num_workers) {}
+
+    size_t num_workers() const { return queues_.size(); }
+
+    /**
+     * Add a task to the back of `worker`'s queue.
+     */
+    void push(size_t worker, T task) {
+        Queue& queue = queues_[worker];
+        std::lock_guard lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+
+    /**
+     * Take the next task from `worker`'s own queue, or steal one from another
+     * worker's queue if that's empty. Returns `std::nullopt` when there are no
+     * tasks left anywhere. Tasks are never added while the workers are
+     * running, so at that point the worker can stop.
+     */
+    std::optional<T> pop(size_t worker) {
+        for (size_t offset = 0; offset < queues_.size(); offset++) {
+            Queue& queue = queues_[(worker + offset) % queues_.size()];
+            std::lock_guard lock(queue.mutex);
+            if (!queue.tasks.empty()) {
+                T task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+
+                return task;
+            }
+        }
+
+        return std::nullopt;
+    }
+
+   private:
+    /**
+     * Aligned to a cache line so workers polling neighbouring queues don't
+     * contend on the same cache line.
+     */
+    struct alignas(64) Queue {
+        std::mutex mutex;
+        std::deque<T> tasks;
+    };
+
+    std::vector<Queue> queues_;
+};